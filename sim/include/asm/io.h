@@ -0,0 +1,7 @@
+#ifndef _SPECTR_IO_SIM_ASM_IO_H
+#define _SPECTR_IO_SIM_ASM_IO_H
+
+// Register access goes through the dma.h backend, there is no bus to read or write directly
+#include <linux/types.h>
+
+#endif // _SPECTR_IO_SIM_ASM_IO_H
@@ -0,0 +1,14 @@
+#ifndef _SPECTR_IO_SIM_LINUX_BITOPS_H
+#define _SPECTR_IO_SIM_LINUX_BITOPS_H
+
+#include <linux/types.h>
+
+#define BIT( n )	( 1UL << ( n ) )
+#define GENMASK_ULL( h, l )	( ( ~0ULL >> ( 63 - ( h ) ) ) & ( ~0ULL << ( l ) ) )
+
+#define __ffs( x )	( ( unsigned long ) __builtin_ctzl( x ) )
+#define fls( x )	( ( x ) ? 32 - __builtin_clz( x ) : 0 )
+#define fls64( x )	( ( x ) ? 64 - __builtin_clzll( x ) : 0 )
+#define hweight32( x )	__builtin_popcount( x )
+
+#endif // _SPECTR_IO_SIM_LINUX_BITOPS_H
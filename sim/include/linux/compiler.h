@@ -0,0 +1,20 @@
+#ifndef _SPECTR_IO_SIM_LINUX_COMPILER_H
+#define _SPECTR_IO_SIM_LINUX_COMPILER_H
+
+#define __iomem
+#define __user
+#define __percpu
+#define __init
+#define __exit
+#define __aligned( x )	__attribute__( ( aligned( x ) ) )
+#define __packed	__attribute__( ( packed ) )
+
+#define likely( x )	__builtin_expect( !!( x ), 1 )
+#define unlikely( x )	__builtin_expect( !!( x ), 0 )
+
+#define READ_ONCE( x )		( *( volatile __typeof__( x )* ) &( x ) )
+#define WRITE_ONCE( x, v )	( *( volatile __typeof__( x )* ) &( x ) = ( v ) )
+
+#define barrier()	__asm__ __volatile__( "" ::: "memory" )
+
+#endif // _SPECTR_IO_SIM_LINUX_COMPILER_H
@@ -0,0 +1,14 @@
+#ifndef _SPECTR_IO_SIM_LINUX_COMPLETION_H
+#define _SPECTR_IO_SIM_LINUX_COMPLETION_H
+
+struct completion {
+	unsigned int done;
+};
+
+void init_completion( struct completion* x );
+void reinit_completion( struct completion* x );
+void complete( struct completion* x );
+void wait_for_completion( struct completion* x );
+unsigned long wait_for_completion_timeout( struct completion* x, unsigned long timeout );
+
+#endif // _SPECTR_IO_SIM_LINUX_COMPLETION_H
@@ -0,0 +1,7 @@
+#ifndef _SPECTR_IO_SIM_LINUX_CPUMASK_H
+#define _SPECTR_IO_SIM_LINUX_CPUMASK_H
+
+#define nr_cpu_ids		1
+#define cpu_online( cpu )	( ( cpu ) == 0 )
+
+#endif // _SPECTR_IO_SIM_LINUX_CPUMASK_H
@@ -0,0 +1,14 @@
+#ifndef _SPECTR_IO_SIM_LINUX_DEBUGFS_H
+#define _SPECTR_IO_SIM_LINUX_DEBUGFS_H
+
+#include <linux/fs.h>
+
+struct dentry;
+
+// There is no debugfs to create files in, creation succeeds without doing anything
+struct dentry* debugfs_create_dir( const char* name, struct dentry* parent );
+struct dentry* debugfs_create_file( const char* name, unsigned short mode, struct dentry* parent,
+	void* data, const struct file_operations* fops );
+void debugfs_remove_recursive( struct dentry* dentry );
+
+#endif // _SPECTR_IO_SIM_LINUX_DEBUGFS_H
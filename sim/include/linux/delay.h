@@ -0,0 +1,10 @@
+#ifndef _SPECTR_IO_SIM_LINUX_DELAY_H
+#define _SPECTR_IO_SIM_LINUX_DELAY_H
+
+// Sleeps let the simulated time pass by the minimum, as a timer with no slack would
+void usleep_range( unsigned long min, unsigned long max );
+
+// Busy waits let the simulated time pass by the delay
+void udelay( unsigned long us );
+
+#endif // _SPECTR_IO_SIM_LINUX_DELAY_H
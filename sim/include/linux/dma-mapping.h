@@ -0,0 +1,14 @@
+#ifndef _SPECTR_IO_SIM_LINUX_DMA_MAPPING_H
+#define _SPECTR_IO_SIM_LINUX_DMA_MAPPING_H
+
+#include <linux/gfp.h>
+#include <linux/platform_device.h>
+#include <linux/types.h>
+
+#define DMA_BIT_MASK( n )	( ( ( n ) == 64 ) ? ~0ULL : ( ( 1ULL << ( n ) ) - 1 ) )
+
+int dma_coerce_mask_and_coherent( struct device* dev, u64 mask );
+void* dma_alloc_coherent( struct device* dev, size_t size, dma_addr_t* handle, int gfp );
+void dma_free_coherent( struct device* dev, size_t size, void* mem, dma_addr_t handle );
+
+#endif // _SPECTR_IO_SIM_LINUX_DMA_MAPPING_H
@@ -0,0 +1,7 @@
+#ifndef _SPECTR_IO_SIM_LINUX_ERR_H
+#define _SPECTR_IO_SIM_LINUX_ERR_H
+
+// The error pointer helpers live in kernel.h
+#include <linux/kernel.h>
+
+#endif // _SPECTR_IO_SIM_LINUX_ERR_H
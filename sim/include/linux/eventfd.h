@@ -0,0 +1,15 @@
+#ifndef _SPECTR_IO_SIM_LINUX_EVENTFD_H
+#define _SPECTR_IO_SIM_LINUX_EVENTFD_H
+
+#include <linux/types.h>
+
+// An eventfd is only a counter, the simulator has no file descriptors to look them up by
+struct eventfd_ctx {
+	u64 count;
+};
+
+struct eventfd_ctx* eventfd_ctx_fdget( int fd );
+void eventfd_signal( struct eventfd_ctx* ctx );
+void eventfd_ctx_put( struct eventfd_ctx* ctx );
+
+#endif // _SPECTR_IO_SIM_LINUX_EVENTFD_H
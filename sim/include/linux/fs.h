@@ -0,0 +1,40 @@
+#ifndef _SPECTR_IO_SIM_LINUX_FS_H
+#define _SPECTR_IO_SIM_LINUX_FS_H
+
+#include <fcntl.h>
+
+#include <linux/types.h>
+
+struct module;
+struct poll_table_struct;
+struct vm_area_struct;
+
+struct inode {
+	void* i_private;
+};
+
+struct file {
+	const struct file_operations* f_op;
+	unsigned int f_flags;
+	void* private_data;
+};
+
+struct file_operations {
+	struct module* owner;
+	int ( *open )( struct inode* inode, struct file* file );
+	ssize_t ( *read )( struct file* file, char __user* buf, size_t len, loff_t* pos );
+	ssize_t ( *write )( struct file* file, const char __user* buf, size_t len, loff_t* pos );
+	loff_t ( *llseek )( struct file* file, loff_t off, int whence );
+	int ( *release )( struct inode* inode, struct file* file );
+	long ( *unlocked_ioctl )( struct file* file, unsigned int cmd, unsigned long arg );
+	long ( *compat_ioctl )( struct file* file, unsigned int cmd, unsigned long arg );
+	int ( *mmap )( struct file* file, struct vm_area_struct* vma );
+	unsigned int ( *poll )( struct file* file, struct poll_table_struct* wait );
+};
+
+#define THIS_MODULE	( ( struct module* ) 0 )
+
+loff_t noop_llseek( struct file* file, loff_t off, int whence );
+long compat_ptr_ioctl( struct file* file, unsigned int cmd, unsigned long arg );
+
+#endif // _SPECTR_IO_SIM_LINUX_FS_H
@@ -0,0 +1,7 @@
+#ifndef _SPECTR_IO_SIM_LINUX_GFP_H
+#define _SPECTR_IO_SIM_LINUX_GFP_H
+
+#define GFP_KERNEL	0
+#define GFP_ATOMIC	1
+
+#endif // _SPECTR_IO_SIM_LINUX_GFP_H
@@ -0,0 +1,9 @@
+#ifndef _SPECTR_IO_SIM_LINUX_HARDIRQ_H
+#define _SPECTR_IO_SIM_LINUX_HARDIRQ_H
+
+// Everything runs in process context except the handlers sim_raise_irq() calls
+int sim_in_interrupt( void );
+
+#define in_interrupt()	sim_in_interrupt()
+
+#endif // _SPECTR_IO_SIM_LINUX_HARDIRQ_H
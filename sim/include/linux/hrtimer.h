@@ -0,0 +1,41 @@
+#ifndef _SPECTR_IO_SIM_LINUX_HRTIMER_H
+#define _SPECTR_IO_SIM_LINUX_HRTIMER_H
+
+#include <time.h>
+
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+};
+
+// Timers only fire when the simulator is told to run them, see sim_hrtimer_fire_next()
+struct hrtimer {
+	ktime_t expires;
+	enum hrtimer_restart ( *function )( struct hrtimer* timer );
+	int active;
+};
+
+void hrtimer_init( struct hrtimer* timer, clockid_t clock, enum hrtimer_mode mode );
+void hrtimer_start( struct hrtimer* timer, ktime_t time, enum hrtimer_mode mode );
+int hrtimer_cancel( struct hrtimer* timer );
+
+// Sleeps by advancing the simulated time to the expiry
+int schedule_hrtimeout_range( ktime_t* expires, u64 delta, const enum hrtimer_mode mode );
+
+static inline void hrtimer_add_expires_ns( struct hrtimer* timer, u64 ns ) {
+	timer->expires += ns;
+}
+
+static inline s64 hrtimer_get_expires_ns( const struct hrtimer* timer ) {
+	return timer->expires;
+}
+
+#endif // _SPECTR_IO_SIM_LINUX_HRTIMER_H
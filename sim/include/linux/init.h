@@ -0,0 +1,6 @@
+#ifndef _SPECTR_IO_SIM_LINUX_INIT_H
+#define _SPECTR_IO_SIM_LINUX_INIT_H
+
+#include <linux/compiler.h>
+
+#endif // _SPECTR_IO_SIM_LINUX_INIT_H
@@ -0,0 +1,23 @@
+#ifndef _SPECTR_IO_SIM_LINUX_INTERRUPT_H
+#define _SPECTR_IO_SIM_LINUX_INTERRUPT_H
+
+typedef int irqreturn_t;
+
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+#define IRQ_WAKE_THREAD	2
+
+#define IRQF_SHARED	0x00000080
+#define IRQF_ONESHOT	0x00002000
+
+typedef irqreturn_t ( *irq_handler_t )( int irq, void* dev );
+
+// Handlers are only kept in a table, the simulated peripherals raise them through sim_raise_irq()
+int request_irq( unsigned int irq, irq_handler_t handler, unsigned long flags, const char* name,
+	void* dev );
+void free_irq( unsigned int irq, void* dev );
+
+static inline void synchronize_irq( unsigned int irq ) {
+}
+
+#endif // _SPECTR_IO_SIM_LINUX_INTERRUPT_H
@@ -0,0 +1,22 @@
+#ifndef _SPECTR_IO_SIM_LINUX_IOCTL_H
+#define _SPECTR_IO_SIM_LINUX_IOCTL_H
+
+// The asm-generic command encoding
+#define _IOC_NRSHIFT	0
+#define _IOC_TYPESHIFT	8
+#define _IOC_SIZESHIFT	16
+#define _IOC_DIRSHIFT	30
+
+#define _IOC_NONE	0U
+#define _IOC_WRITE	1U
+#define _IOC_READ	2U
+
+#define _IOC( dir, type, nr, size )	( ( ( dir ) << _IOC_DIRSHIFT ) | ( ( type ) << _IOC_TYPESHIFT ) \
+					| ( ( nr ) << _IOC_NRSHIFT ) | ( ( size ) << _IOC_SIZESHIFT ) )
+
+#define _IO( type, nr )			_IOC( _IOC_NONE, ( type ), ( nr ), 0 )
+#define _IOR( type, nr, t )		_IOC( _IOC_READ, ( type ), ( nr ), sizeof( t ) )
+#define _IOW( type, nr, t )		_IOC( _IOC_WRITE, ( type ), ( nr ), sizeof( t ) )
+#define _IOWR( type, nr, t )		_IOC( _IOC_READ | _IOC_WRITE, ( type ), ( nr ), sizeof( t ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_IOCTL_H
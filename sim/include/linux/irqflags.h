@@ -0,0 +1,6 @@
+#ifndef _SPECTR_IO_SIM_LINUX_IRQFLAGS_H
+#define _SPECTR_IO_SIM_LINUX_IRQFLAGS_H
+
+#define irqs_disabled()	0
+
+#endif // _SPECTR_IO_SIM_LINUX_IRQFLAGS_H
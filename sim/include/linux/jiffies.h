@@ -0,0 +1,19 @@
+#ifndef _SPECTR_IO_SIM_LINUX_JIFFIES_H
+#define _SPECTR_IO_SIM_LINUX_JIFFIES_H
+
+#include <linux/types.h>
+
+#define HZ	100
+
+// Jiffies follow the simulated clock so driver timeouts expire in simulated time
+#define jiffies	sim_jiffies()
+
+unsigned long sim_jiffies( void );
+
+#define time_after( a, b )	( ( long ) ( ( b ) - ( a ) ) < 0 )
+#define time_before( a, b )	time_after( b, a )
+
+unsigned long msecs_to_jiffies( unsigned int ms );
+unsigned long usecs_to_jiffies( unsigned int us );
+
+#endif // _SPECTR_IO_SIM_LINUX_JIFFIES_H
@@ -0,0 +1,46 @@
+#ifndef _SPECTR_IO_SIM_LINUX_KERNEL_H
+#define _SPECTR_IO_SIM_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <limits.h>
+
+#include <linux/types.h>
+
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+#define U32_MAX		( ( u32 ) ~0U )
+
+#define ARRAY_SIZE( a )	( sizeof( a ) / sizeof( ( a )[0] ) )
+
+#define min( a, b )		( ( a ) < ( b ) ? ( a ) : ( b ) )
+#define max( a, b )		( ( a ) > ( b ) ? ( a ) : ( b ) )
+#define min_t( t, a, b )	( ( t ) ( a ) < ( t ) ( b ) ? ( t ) ( a ) : ( t ) ( b ) )
+#define max_t( t, a, b )	( ( t ) ( a ) > ( t ) ( b ) ? ( t ) ( a ) : ( t ) ( b ) )
+
+#define clamp_t( t, v, lo, hi )	min_t( t, max_t( t, v, lo ), hi )
+
+#define DIV_ROUND_UP( n, d )	( ( ( n ) + ( d ) - 1 ) / ( d ) )
+#define round_up( x, y )	( ( ( ( x ) - 1 ) | ( ( y ) - 1 ) ) + 1 )
+
+#define MAX_ERRNO	4095
+
+// Kernel internal codes the host errno.h does not have
+#define ERESTARTSYS	512
+
+#define ERR_PTR( err )		( ( void* ) ( long ) ( err ) )
+#define PTR_ERR( ptr )		( ( long ) ( ptr ) )
+#define IS_ERR( ptr )		( ( unsigned long ) ( ptr ) >= ( unsigned long ) -MAX_ERRNO )
+#define IS_ERR_OR_NULL( ptr )	( !( ptr ) || IS_ERR( ptr ) )
+
+#define u64_to_user_ptr( x )	( ( void __user* ) ( uintptr_t ) ( x ) )
+
+#define container_of( ptr, type, member )	( ( type* ) ( ( char* ) ( ptr ) - offsetof( type, member ) ) )
+
+// Spinning takes time in the simulator as well, or loops waiting on the clock would never end
+void sim_cpu_relax( void );
+#define cpu_relax()	sim_cpu_relax()
+
+#endif // _SPECTR_IO_SIM_LINUX_KERNEL_H
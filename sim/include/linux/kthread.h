@@ -0,0 +1,12 @@
+#ifndef _SPECTR_IO_SIM_LINUX_KTHREAD_H
+#define _SPECTR_IO_SIM_LINUX_KTHREAD_H
+
+#include <linux/sched.h>
+
+// The simulator has no threads, creation fails so drivers fall back to running work inline
+struct task_struct* kthread_create( int ( *fn )( void* data ), void* data, const char* name, ... );
+void kthread_bind( struct task_struct* task, unsigned int cpu );
+int kthread_stop( struct task_struct* task );
+bool kthread_should_stop( void );
+
+#endif // _SPECTR_IO_SIM_LINUX_KTHREAD_H
@@ -0,0 +1,23 @@
+#ifndef _SPECTR_IO_SIM_LINUX_KTIME_H
+#define _SPECTR_IO_SIM_LINUX_KTIME_H
+
+#include <linux/types.h>
+
+#define NSEC_PER_USEC	1000L
+#define NSEC_PER_MSEC	1000000L
+#define NSEC_PER_SEC	1000000000L
+#define USEC_PER_SEC	1000000L
+
+typedef s64 ktime_t;
+
+#define ktime_sub( a, b )	( ( a ) - ( b ) )
+#define ktime_add_ns( a, ns )	( ( a ) + ( ns ) )
+#define ktime_to_ns( a )	( ( s64 ) ( a ) )
+#define ns_to_ktime( ns )	( ( ktime_t ) ( ns ) )
+#define ktime_before( a, b )	( ( a ) < ( b ) )
+#define ktime_after( a, b )	( ( a ) > ( b ) )
+
+ktime_t ktime_get( void );
+u64 ktime_get_ns( void );
+
+#endif // _SPECTR_IO_SIM_LINUX_KTIME_H
@@ -0,0 +1,60 @@
+#ifndef _SPECTR_IO_SIM_LINUX_LIST_H
+#define _SPECTR_IO_SIM_LINUX_LIST_H
+
+#include <linux/kernel.h>
+
+struct list_head {
+	struct list_head* next;
+	struct list_head* prev;
+};
+
+#define LIST_HEAD_INIT( name )	{ &( name ), &( name ) }
+#define LIST_HEAD( name )	struct list_head name = LIST_HEAD_INIT( name )
+
+static inline void INIT_LIST_HEAD( struct list_head* list ) {
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add( struct list_head* entry, struct list_head* prev, struct list_head* next ) {
+	next->prev = entry;
+	entry->next = next;
+	entry->prev = prev;
+	prev->next = entry;
+}
+
+static inline void list_add( struct list_head* entry, struct list_head* head ) {
+	__list_add( entry, head, head->next );
+}
+
+static inline void list_add_tail( struct list_head* entry, struct list_head* head ) {
+	__list_add( entry, head->prev, head );
+}
+
+static inline void list_del_init( struct list_head* entry ) {
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD( entry );
+}
+
+#define list_del( entry )	list_del_init( entry )
+
+static inline int list_empty( const struct list_head* head ) {
+	return head->next == head;
+}
+
+#define list_entry( ptr, type, member )	container_of( ptr, type, member )
+#define list_first_entry( head, type, member )	list_entry( ( head )->next, type, member )
+
+#define list_for_each_entry( pos, head, member )						\
+	for ( pos = list_entry( ( head )->next, __typeof__( *pos ), member );			\
+	      &pos->member != ( head );								\
+	      pos = list_entry( pos->member.next, __typeof__( *pos ), member ) )
+
+#define list_for_each_entry_safe( pos, n, head, member )					\
+	for ( pos = list_entry( ( head )->next, __typeof__( *pos ), member ),			\
+	      n = list_entry( pos->member.next, __typeof__( *pos ), member );			\
+	      &pos->member != ( head );								\
+	      pos = n, n = list_entry( n->member.next, __typeof__( *n ), member ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_LIST_H
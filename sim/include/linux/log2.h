@@ -0,0 +1,6 @@
+#ifndef _SPECTR_IO_SIM_LINUX_LOG2_H
+#define _SPECTR_IO_SIM_LINUX_LOG2_H
+
+#define is_power_of_2( n )	( ( n ) != 0 && ( ( ( n ) & ( ( n ) - 1 ) ) == 0 ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_LOG2_H
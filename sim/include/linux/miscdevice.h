@@ -0,0 +1,18 @@
+#ifndef _SPECTR_IO_SIM_LINUX_MISCDEVICE_H
+#define _SPECTR_IO_SIM_LINUX_MISCDEVICE_H
+
+#include <linux/fs.h>
+
+#define MISC_DYNAMIC_MINOR	255
+
+struct miscdevice {
+	int minor;
+	const char* name;
+	const struct file_operations* fops;
+};
+
+// Registered devices are only kept in a table, find them with sim_misc_find()
+int misc_register( struct miscdevice* misc );
+void misc_deregister( struct miscdevice* misc );
+
+#endif // _SPECTR_IO_SIM_LINUX_MISCDEVICE_H
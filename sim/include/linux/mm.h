@@ -0,0 +1,19 @@
+#ifndef _SPECTR_IO_SIM_LINUX_MM_H
+#define _SPECTR_IO_SIM_LINUX_MM_H
+
+#include <linux/types.h>
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	( 1UL << PAGE_SHIFT )
+#define PAGE_ALIGN( x )	( ( ( x ) + PAGE_SIZE - 1 ) & ~( PAGE_SIZE - 1 ) )
+
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_pgoff;
+};
+
+// Nothing is mapped, the area only learns where the memory is
+int remap_vmalloc_range( struct vm_area_struct* vma, void* addr, unsigned long pgoff );
+
+#endif // _SPECTR_IO_SIM_LINUX_MM_H
@@ -0,0 +1,18 @@
+#ifndef _SPECTR_IO_SIM_LINUX_MODULE_H
+#define _SPECTR_IO_SIM_LINUX_MODULE_H
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+
+// There is no insmod to set module parameters, a test reaches them through SIM_MODULE_PARAM()
+#define module_param( name, type, perm )	\
+	void* sim_module_param_##name( void ) { return &name; } extern int sim_module_param_unused
+#define MODULE_PARM_DESC( name, desc )		extern int sim_module_param_unused
+
+#define EXPORT_SYMBOL( sym )	extern int sim_export_symbol_unused
+#define MODULE_LICENSE( lic )	extern int sim_module_info_unused
+
+#define module_init( fn )	extern int sim_module_info_unused
+#define module_exit( fn )	extern int sim_module_info_unused
+
+#endif // _SPECTR_IO_SIM_LINUX_MODULE_H
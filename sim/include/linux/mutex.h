@@ -0,0 +1,19 @@
+#ifndef _SPECTR_IO_SIM_LINUX_MUTEX_H
+#define _SPECTR_IO_SIM_LINUX_MUTEX_H
+
+// The simulator runs the driver on a single thread, mutexes are no-ops
+struct mutex {
+	int unused;
+};
+
+#define DEFINE_MUTEX( name )	struct mutex name = { 0 }
+
+#define mutex_init( lock )		( ( void ) ( lock ) )
+#define mutex_lock( lock )		( ( void ) ( lock ) )
+#define mutex_lock_interruptible( lock )	( ( void ) ( lock ), 0 )
+#define mutex_trylock( lock )		( ( void ) ( lock ), 1 )
+#define mutex_unlock( lock )		( ( void ) ( lock ) )
+
+#define lockdep_assert_held( lock )	( ( void ) ( lock ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_MUTEX_H
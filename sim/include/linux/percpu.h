@@ -0,0 +1,25 @@
+#ifndef _SPECTR_IO_SIM_LINUX_PERCPU_H
+#define _SPECTR_IO_SIM_LINUX_PERCPU_H
+
+#include <stdlib.h>
+
+#include <linux/compiler.h>
+
+// The simulator runs on a single CPU, per-CPU variables are plain variables
+#define DECLARE_PER_CPU( type, name )	extern __typeof__( type ) name
+#define DEFINE_PER_CPU( type, name )	__typeof__( type ) name
+
+#define per_cpu( var, cpu )	( *( ( void ) ( cpu ), &( var ) ) )
+#define per_cpu_ptr( ptr, cpu )	( ( void ) ( cpu ), ( ptr ) )
+#define this_cpu_ptr( ptr )	( ptr )
+#define this_cpu_add( var, n )	( ( var ) += ( n ) )
+#define this_cpu_inc( var )	( ( var )++ )
+#define this_cpu_read( var )	( var )
+
+#define alloc_percpu( type )	( ( type* ) calloc( 1, sizeof( type ) ) )
+#define free_percpu( ptr )	free( ( void* ) ( ptr ) )
+
+#define for_each_possible_cpu( cpu )	for ( ( cpu ) = 0; ( cpu ) < 1; ( cpu )++ )
+#define for_each_online_cpu( cpu )	for_each_possible_cpu( cpu )
+
+#endif // _SPECTR_IO_SIM_LINUX_PERCPU_H
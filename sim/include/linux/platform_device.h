@@ -0,0 +1,16 @@
+#ifndef _SPECTR_IO_SIM_LINUX_PLATFORM_DEVICE_H
+#define _SPECTR_IO_SIM_LINUX_PLATFORM_DEVICE_H
+
+struct device {
+	const char* name;
+};
+
+struct platform_device {
+	struct device dev;
+};
+
+struct platform_device* platform_device_register_simple( const char* name, int id, const void* res,
+	unsigned int num );
+void platform_device_unregister( struct platform_device* pdev );
+
+#endif // _SPECTR_IO_SIM_LINUX_PLATFORM_DEVICE_H
@@ -0,0 +1,22 @@
+#ifndef _SPECTR_IO_SIM_LINUX_POLL_H
+#define _SPECTR_IO_SIM_LINUX_POLL_H
+
+#include <linux/fs.h>
+#include <linux/wait.h>
+
+typedef unsigned int __poll_t;
+
+#define EPOLLIN		0x0001
+#define EPOLLPRI	0x0002
+#define EPOLLOUT	0x0004
+#define EPOLLERR	0x0008
+#define EPOLLRDNORM	0x0040
+#define EPOLLWRNORM	0x0100
+
+typedef struct poll_table_struct {
+	int unused;
+} poll_table;
+
+#define poll_wait( file, wq, pt )	( ( void ) ( file ), ( void ) ( wq ), ( void ) ( pt ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_POLL_H
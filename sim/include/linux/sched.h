@@ -0,0 +1,30 @@
+#ifndef _SPECTR_IO_SIM_LINUX_SCHED_H
+#define _SPECTR_IO_SIM_LINUX_SCHED_H
+
+#define SCHED_NORMAL	0
+#define SCHED_FIFO	1
+
+#define MAX_RT_PRIO	100
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+
+struct task_struct;
+
+// The simulator only ever runs the current task
+#define set_current_state( state )	do { } while ( 0 )
+#define __set_current_state( state )	do { } while ( 0 )
+
+struct sched_param {
+	int sched_priority;
+};
+
+int sched_setscheduler_nocheck( struct task_struct* task, int policy, const struct sched_param* param );
+int wake_up_process( struct task_struct* task );
+
+// The simulator never has anything else to run
+static inline int cond_resched( void ) {
+	return 0;
+}
+
+#endif // _SPECTR_IO_SIM_LINUX_SCHED_H
@@ -0,0 +1,19 @@
+#ifndef _SPECTR_IO_SIM_LINUX_SEQ_FILE_H
+#define _SPECTR_IO_SIM_LINUX_SEQ_FILE_H
+
+#include <linux/fs.h>
+
+// Shown files are printed to stdout, there is nothing to read them through
+struct seq_file {
+	void* private;
+};
+
+void seq_printf( struct seq_file* m, const char* fmt, ... ) __attribute__( ( format( printf, 2, 3 ) ) );
+void seq_puts( struct seq_file* m, const char* s );
+
+int single_open( struct file* file, int ( *show )( struct seq_file* m, void* v ), void* data );
+int single_release( struct inode* inode, struct file* file );
+ssize_t seq_read( struct file* file, char __user* buf, size_t len, loff_t* pos );
+loff_t seq_lseek( struct file* file, loff_t off, int whence );
+
+#endif // _SPECTR_IO_SIM_LINUX_SEQ_FILE_H
@@ -0,0 +1,17 @@
+#ifndef _SPECTR_IO_SIM_LINUX_SLAB_H
+#define _SPECTR_IO_SIM_LINUX_SLAB_H
+
+#include <stdlib.h>
+
+#include <linux/gfp.h>
+#include <linux/types.h>
+
+#define kmalloc( size, gfp )	( ( void ) ( gfp ), malloc( size ) )
+#define kzalloc( size, gfp )	( ( void ) ( gfp ), calloc( 1, size ) )
+#define kmalloc_array( n, size, gfp )	( ( void ) ( gfp ), reallocarray( NULL, n, size ) )
+#define kfree( ptr )		free( ( void* ) ( ptr ) )
+
+void* kmemdup( const void* src, size_t len, int gfp );
+void* memdup_user( const void __user* src, size_t len );
+
+#endif // _SPECTR_IO_SIM_LINUX_SLAB_H
@@ -0,0 +1,10 @@
+#ifndef _SPECTR_IO_SIM_LINUX_SORT_H
+#define _SPECTR_IO_SIM_LINUX_SORT_H
+
+#include <stddef.h>
+
+typedef void ( *swap_func_t )( void* a, void* b, int size );
+
+void sort( void* base, size_t num, size_t size, int ( *cmp )( const void* a, const void* b ), swap_func_t swap );
+
+#endif // _SPECTR_IO_SIM_LINUX_SORT_H
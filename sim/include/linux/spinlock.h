@@ -0,0 +1,18 @@
+#ifndef _SPECTR_IO_SIM_LINUX_SPINLOCK_H
+#define _SPECTR_IO_SIM_LINUX_SPINLOCK_H
+
+// The simulator runs the driver on a single thread and handlers only while it waits, so locks are
+// no-ops
+typedef struct {
+	int unused;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK( name )	spinlock_t name = { 0 }
+
+#define spin_lock_init( lock )			( ( void ) ( lock ) )
+#define spin_lock( lock )			( ( void ) ( lock ) )
+#define spin_unlock( lock )			( ( void ) ( lock ) )
+#define spin_lock_irqsave( lock, flags )	( ( void ) ( lock ), ( flags ) = 0 )
+#define spin_unlock_irqrestore( lock, flags )	( ( void ) ( lock ), ( void ) ( flags ) )
+
+#endif // _SPECTR_IO_SIM_LINUX_SPINLOCK_H
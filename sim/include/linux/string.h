@@ -0,0 +1,6 @@
+#ifndef _SPECTR_IO_SIM_LINUX_STRING_H
+#define _SPECTR_IO_SIM_LINUX_STRING_H
+
+#include <string.h>
+
+#endif // _SPECTR_IO_SIM_LINUX_STRING_H
@@ -0,0 +1,23 @@
+#ifndef _SPECTR_IO_SIM_LINUX_TRACEPOINT_H
+#define _SPECTR_IO_SIM_LINUX_TRACEPOINT_H
+
+// There is no tracer to record events with, tracepoints compile to nothing and stay disabled
+#define TP_PROTO( ... )		__VA_ARGS__
+#define TP_ARGS( ... )		__VA_ARGS__
+#define TP_STRUCT__entry( ... )
+#define TP_fast_assign( ... )
+#define TP_printk( ... )
+#define PARAMS( ... )		__VA_ARGS__
+
+#define TRACE_EVENT( name, proto, args, tstruct, assign, print )		\
+	static inline void trace_##name( proto ) {				\
+	}									\
+	static inline bool trace_##name##_enabled( void ) {			\
+		return false;							\
+	}
+
+#define DECLARE_EVENT_CLASS( name, proto, args, tstruct, assign, print )
+#define DEFINE_EVENT( template, name, proto, args )				\
+	TRACE_EVENT( name, PARAMS( proto ), PARAMS( args ), , , )
+
+#endif // _SPECTR_IO_SIM_LINUX_TRACEPOINT_H
@@ -0,0 +1,12 @@
+#ifndef _SPECTR_IO_SIM_LINUX_UACCESS_H
+#define _SPECTR_IO_SIM_LINUX_UACCESS_H
+
+#include <string.h>
+
+#include <linux/types.h>
+
+// The simulator shares one address space with its callers, copies never fault
+#define copy_from_user( to, from, n )	( memcpy( ( to ), ( from ), ( n ) ), 0UL )
+#define copy_to_user( to, from, n )	( memcpy( ( to ), ( from ), ( n ) ), 0UL )
+
+#endif // _SPECTR_IO_SIM_LINUX_UACCESS_H
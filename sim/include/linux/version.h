@@ -0,0 +1,9 @@
+#ifndef _SPECTR_IO_SIM_LINUX_VERSION_H
+#define _SPECTR_IO_SIM_LINUX_VERSION_H
+
+#define KERNEL_VERSION( a, b, c )	( ( ( a ) << 16 ) + ( ( b ) << 8 ) + ( c ) )
+
+// The simulator follows the newest interfaces the drivers know
+#define LINUX_VERSION_CODE	KERNEL_VERSION( 6, 8, 0 )
+
+#endif // _SPECTR_IO_SIM_LINUX_VERSION_H
@@ -0,0 +1,9 @@
+#ifndef _SPECTR_IO_SIM_LINUX_VMALLOC_H
+#define _SPECTR_IO_SIM_LINUX_VMALLOC_H
+
+#include <linux/types.h>
+
+void* vmalloc_user( unsigned long size );
+void vfree( const void* addr );
+
+#endif // _SPECTR_IO_SIM_LINUX_VMALLOC_H
@@ -0,0 +1,17 @@
+#ifndef _SPECTR_IO_SIM_LINUX_WAIT_H
+#define _SPECTR_IO_SIM_LINUX_WAIT_H
+
+#include <linux/sched.h>
+
+// Nothing else runs while the driver waits, so a wait can only return once its condition holds
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+#define init_waitqueue_head( wq )	( ( void ) ( wq ) )
+#define wake_up( wq )			( ( void ) ( wq ) )
+#define wake_up_interruptible( wq )	( ( void ) ( wq ) )
+
+#define wait_event_interruptible( wq, condition )	( ( void ) ( wq ), ( condition ) ? 0 : -ERESTARTSYS )
+
+#endif // _SPECTR_IO_SIM_LINUX_WAIT_H
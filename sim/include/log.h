@@ -0,0 +1,10 @@
+#ifndef _SPECTR_IO_SIM_LOG_H
+#define _SPECTR_IO_SIM_LOG_H
+
+#include <stdio.h>
+
+#include <linux/kernel.h>
+
+#define LOG( level, fmt, ... )	fprintf( stderr, level "spectr-io: " fmt "\n", ##__VA_ARGS__ )
+
+#endif // _SPECTR_IO_SIM_LOG_H
@@ -0,0 +1 @@
+// Tracepoints are only declared in the simulator, there is nothing to define
@@ -0,0 +1,501 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/eventfd.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/platform_device.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+
+#include "sim.h"
+
+// The simulated time a sleeping waiter lets pass before checking again
+#define SIM_WAIT_STEP_NS	1000
+#define SIM_RELAX_NS		10
+
+#define SIM_DMA_ALLOCS	16
+
+// Handed out as DMA bus addresses, the DMA controller model finds the memory behind them again
+static u32 sim_dma_next = 0x00100000;
+
+static struct {
+	void* mem;
+	u32 bus;
+	size_t size;
+} sim_dma_allocs[SIM_DMA_ALLOCS];
+
+static struct platform_device sim_pdev;
+
+// -----------------------------------------------------------------------------
+// Time
+// -----------------------------------------------------------------------------
+
+unsigned long sim_jiffies( void ) {
+	return sim_time_ns() / ( NSEC_PER_SEC / HZ );
+}
+
+unsigned long msecs_to_jiffies( unsigned int ms ) {
+	return ( ( unsigned long ) ms * HZ + 999 ) / 1000;
+}
+
+unsigned long usecs_to_jiffies( unsigned int us ) {
+	return ( ( unsigned long ) us * HZ + 999999 ) / 1000000;
+}
+
+ktime_t ktime_get( void ) {
+	return ( ktime_t ) sim_time_ns();
+}
+
+u64 ktime_get_ns( void ) {
+	return sim_time_ns();
+}
+
+void usleep_range( unsigned long min, unsigned long max ) {
+	sim_advance_ns( ( u64 ) min * 1000 );
+}
+
+void udelay( unsigned long us ) {
+	sim_advance_ns( ( u64 ) us * 1000 );
+}
+
+void sim_cpu_relax( void ) {
+	sim_advance_ns( SIM_RELAX_NS );
+}
+
+// -----------------------------------------------------------------------------
+// Completions
+// -----------------------------------------------------------------------------
+
+void init_completion( struct completion* x ) {
+	x->done = 0;
+}
+
+void reinit_completion( struct completion* x ) {
+	x->done = 0;
+}
+
+void complete( struct completion* x ) {
+	x->done++;
+}
+
+void wait_for_completion( struct completion* x ) {
+	while ( !x->done ) {
+		sim_advance_ns( SIM_WAIT_STEP_NS );
+	}
+	x->done--;
+}
+
+unsigned long wait_for_completion_timeout( struct completion* x, unsigned long timeout ) {
+	const unsigned long end = jiffies + timeout;
+
+	while ( !x->done ) {
+		if ( time_after( jiffies, end ) ) {
+			return 0;
+		}
+		sim_advance_ns( SIM_WAIT_STEP_NS );
+	}
+	x->done--;
+
+	return time_after( end, jiffies ) ? end - jiffies : 1;
+}
+
+// -----------------------------------------------------------------------------
+// Interrupts
+// -----------------------------------------------------------------------------
+
+#define SIM_IRQ_HANDLERS	16
+
+static struct {
+	unsigned int irq;
+	irq_handler_t handler;
+	void* dev;
+} sim_irq_handlers[SIM_IRQ_HANDLERS];
+
+static int sim_irq_depth;
+
+int request_irq( unsigned int irq, irq_handler_t handler, unsigned long flags, const char* name,
+	void* dev ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_IRQ_HANDLERS; i++ ) {
+		if ( !sim_irq_handlers[i].handler ) {
+			sim_irq_handlers[i].irq = irq;
+			sim_irq_handlers[i].handler = handler;
+			sim_irq_handlers[i].dev = dev;
+			return 0;
+		}
+	}
+
+	return -EBUSY;
+}
+
+void free_irq( unsigned int irq, void* dev ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_IRQ_HANDLERS; i++ ) {
+		if ( sim_irq_handlers[i].handler && sim_irq_handlers[i].irq == irq && sim_irq_handlers[i].dev == dev ) {
+			memset( &sim_irq_handlers[i], 0, sizeof( sim_irq_handlers[i] ) );
+		}
+	}
+}
+
+int sim_raise_irq( unsigned int irq ) {
+	int handled = 0;
+	size_t i;
+
+	// Every handler sharing the line gets a look, like on a shared interrupt
+	sim_irq_depth++;
+	for ( i = 0; i < SIM_IRQ_HANDLERS; i++ ) {
+		if ( sim_irq_handlers[i].handler && sim_irq_handlers[i].irq == irq
+		  && sim_irq_handlers[i].handler( irq, sim_irq_handlers[i].dev ) != IRQ_NONE ) {
+			handled = 1;
+		}
+	}
+	sim_irq_depth--;
+
+	return handled;
+}
+
+int sim_in_interrupt( void ) {
+	return sim_irq_depth > 0;
+}
+
+// -----------------------------------------------------------------------------
+// High resolution timers
+// -----------------------------------------------------------------------------
+
+#define SIM_HRTIMERS	8
+
+static struct hrtimer* sim_hrtimers[SIM_HRTIMERS];
+
+void hrtimer_init( struct hrtimer* timer, clockid_t clock, enum hrtimer_mode mode ) {
+	timer->active = 0;
+}
+
+void hrtimer_start( struct hrtimer* timer, ktime_t time, enum hrtimer_mode mode ) {
+	size_t i;
+
+	timer->expires = mode == HRTIMER_MODE_REL ? ktime_add_ns( ktime_get(), time ) : time;
+	timer->active = 1;
+
+	for ( i = 0; i < SIM_HRTIMERS; i++ ) {
+		if ( sim_hrtimers[i] == timer ) {
+			return;
+		}
+	}
+	for ( i = 0; i < SIM_HRTIMERS; i++ ) {
+		if ( !sim_hrtimers[i] ) {
+			sim_hrtimers[i] = timer;
+			return;
+		}
+	}
+	fprintf( stderr, "sim: too many high resolution timers\n" );
+	abort();
+}
+
+int hrtimer_cancel( struct hrtimer* timer ) {
+	const int active = timer->active;
+
+	timer->active = 0;
+
+	return active;
+}
+
+int schedule_hrtimeout_range( ktime_t* expires, u64 delta, const enum hrtimer_mode mode ) {
+	const ktime_t end = mode == HRTIMER_MODE_ABS ? *expires : ktime_get() + *expires;
+
+	if ( end > ktime_get() ) {
+		sim_advance_ns( end - ktime_get() );
+	}
+
+	return 0;
+}
+
+int sim_hrtimer_fire_next( void ) {
+	struct hrtimer* next = ( struct hrtimer* ) 0;
+	size_t i;
+
+	for ( i = 0; i < SIM_HRTIMERS; i++ ) {
+		if ( sim_hrtimers[i] && sim_hrtimers[i]->active && ( !next || sim_hrtimers[i]->expires < next->expires ) ) {
+			next = sim_hrtimers[i];
+		}
+	}
+	if ( !next ) {
+		return 0;
+	}
+
+	if ( next->expires > ktime_get() ) {
+		sim_advance_ns( next->expires - ktime_get() );
+	}
+
+	// Like the kernel, a timer is inactive while its callback runs and restarted by its result
+	next->active = 0;
+	if ( next->function( next ) == HRTIMER_RESTART ) {
+		next->active = 1;
+	}
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Sorting
+// -----------------------------------------------------------------------------
+
+void sort( void* base, size_t num, size_t size, int ( *cmp )( const void* a, const void* b ), swap_func_t swap ) {
+	qsort( base, num, size, cmp );
+}
+
+// -----------------------------------------------------------------------------
+// Threads
+// -----------------------------------------------------------------------------
+
+struct task_struct* kthread_create( int ( *fn )( void* data ), void* data, const char* name, ... ) {
+	return ERR_PTR( -ENOSYS );
+}
+
+void kthread_bind( struct task_struct* task, unsigned int cpu ) {
+}
+
+int kthread_stop( struct task_struct* task ) {
+	return 0;
+}
+
+bool kthread_should_stop( void ) {
+	return true;
+}
+
+int sched_setscheduler_nocheck( struct task_struct* task, int policy, const struct sched_param* param ) {
+	return 0;
+}
+
+int wake_up_process( struct task_struct* task ) {
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Devices and DMA memory
+// -----------------------------------------------------------------------------
+
+struct platform_device* platform_device_register_simple( const char* name, int id, const void* res,
+	unsigned int num ) {
+	sim_pdev.dev.name = name;
+	return &sim_pdev;
+}
+
+void platform_device_unregister( struct platform_device* pdev ) {
+}
+
+int dma_coerce_mask_and_coherent( struct device* dev, u64 mask ) {
+	return 0;
+}
+
+void* dma_alloc_coherent( struct device* dev, size_t size, dma_addr_t* handle, int gfp ) {
+	size_t i;
+
+	const size_t aligned = ( size + 4095 ) & ~( size_t ) 4095;
+
+	void* const mem = aligned_alloc( 4096, aligned );
+	if ( !mem ) {
+		return ( void* ) 0;
+	}
+	memset( mem, 0, aligned );
+
+	*handle = sim_dma_next;
+	sim_dma_next += aligned;
+
+	for ( i = 0; i < SIM_DMA_ALLOCS; i++ ) {
+		if ( !sim_dma_allocs[i].mem ) {
+			sim_dma_allocs[i].mem = mem;
+			sim_dma_allocs[i].bus = *handle;
+			sim_dma_allocs[i].size = aligned;
+			break;
+		}
+	}
+
+	return mem;
+}
+
+void dma_free_coherent( struct device* dev, size_t size, void* mem, dma_addr_t handle ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_DMA_ALLOCS; i++ ) {
+		if ( sim_dma_allocs[i].mem == mem ) {
+			memset( &sim_dma_allocs[i], 0, sizeof( sim_dma_allocs[i] ) );
+		}
+	}
+	free( mem );
+}
+
+void* sim_dma_mem( u32 bus, size_t len ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_DMA_ALLOCS; i++ ) {
+		if ( sim_dma_allocs[i].mem && bus >= sim_dma_allocs[i].bus
+		  && bus + len <= sim_dma_allocs[i].bus + sim_dma_allocs[i].size ) {
+			return ( u8* ) sim_dma_allocs[i].mem + ( bus - sim_dma_allocs[i].bus );
+		}
+	}
+
+	return ( void* ) 0;
+}
+
+void* vmalloc_user( unsigned long size ) {
+	const size_t aligned = PAGE_ALIGN( size );
+
+	void* const mem = aligned_alloc( PAGE_SIZE, aligned );
+	if ( mem ) {
+		memset( mem, 0, aligned );
+	}
+
+	return mem;
+}
+
+void vfree( const void* addr ) {
+	free( ( void* ) addr );
+}
+
+int remap_vmalloc_range( struct vm_area_struct* vma, void* addr, unsigned long pgoff ) {
+	vma->vm_start = ( unsigned long ) addr + ( pgoff << PAGE_SHIFT );
+	return 0;
+}
+
+void* kmemdup( const void* src, size_t len, int gfp ) {
+	void* const dst = malloc( len );
+	if ( dst ) {
+		memcpy( dst, src, len );
+	}
+
+	return dst;
+}
+
+void* memdup_user( const void __user* src, size_t len ) {
+	void* const dst = kmemdup( src, len, GFP_KERNEL );
+	return dst ? dst : ERR_PTR( -ENOMEM );
+}
+
+// -----------------------------------------------------------------------------
+// Files
+// -----------------------------------------------------------------------------
+
+// Any non-NULL pointer will do, callers never dereference a dentry
+static int sim_dentry;
+
+struct dentry* debugfs_create_dir( const char* name, struct dentry* parent ) {
+	return ( struct dentry* ) &sim_dentry;
+}
+
+struct dentry* debugfs_create_file( const char* name, unsigned short mode, struct dentry* parent,
+	void* data, const struct file_operations* fops ) {
+	return ( struct dentry* ) &sim_dentry;
+}
+
+void debugfs_remove_recursive( struct dentry* dentry ) {
+}
+
+void seq_printf( struct seq_file* m, const char* fmt, ... ) {
+	va_list args;
+
+	va_start( args, fmt );
+	vprintf( fmt, args );
+	va_end( args );
+}
+
+void seq_puts( struct seq_file* m, const char* s ) {
+	fputs( s, stdout );
+}
+
+int single_open( struct file* file, int ( *show )( struct seq_file* m, void* v ), void* data ) {
+	struct seq_file m = { .private = data };
+
+	// Opening a file shows it right away
+	return show( &m, ( void* ) 0 );
+}
+
+int single_release( struct inode* inode, struct file* file ) {
+	return 0;
+}
+
+ssize_t seq_read( struct file* file, char __user* buf, size_t len, loff_t* pos ) {
+	return 0;
+}
+
+loff_t seq_lseek( struct file* file, loff_t off, int whence ) {
+	return 0;
+}
+
+loff_t noop_llseek( struct file* file, loff_t off, int whence ) {
+	return off;
+}
+
+long compat_ptr_ioctl( struct file* file, unsigned int cmd, unsigned long arg ) {
+	return file->f_op->unlocked_ioctl( file, cmd, arg );
+}
+
+struct eventfd_ctx* eventfd_ctx_fdget( int fd ) {
+	return ERR_PTR( -EBADF );
+}
+
+void eventfd_signal( struct eventfd_ctx* ctx ) {
+	ctx->count++;
+}
+
+void eventfd_ctx_put( struct eventfd_ctx* ctx ) {
+}
+
+#define SIM_MISC_DEVICES	8
+
+static struct miscdevice* sim_misc[SIM_MISC_DEVICES];
+
+int misc_register( struct miscdevice* misc ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_MISC_DEVICES; i++ ) {
+		if ( !sim_misc[i] ) {
+			sim_misc[i] = misc;
+			return 0;
+		}
+	}
+
+	return -EBUSY;
+}
+
+void misc_deregister( struct miscdevice* misc ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_MISC_DEVICES; i++ ) {
+		if ( sim_misc[i] == misc ) {
+			sim_misc[i] = ( struct miscdevice* ) 0;
+		}
+	}
+}
+
+int sim_misc_open( const char* name, struct file* file ) {
+	size_t i;
+
+	for ( i = 0; i < SIM_MISC_DEVICES; i++ ) {
+		if ( sim_misc[i] && !strcmp( sim_misc[i]->name, name ) ) {
+			// As the misc device layer does, the driver finds its device in the private data
+			file->private_data = sim_misc[i];
+			file->f_op = sim_misc[i]->fops;
+			return file->f_op->open ? file->f_op->open( ( struct inode* ) 0, file ) : 0;
+		}
+	}
+
+	return -ENODEV;
+}
@@ -0,0 +1,1375 @@
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+
+#include <dma.h>
+
+#define SIM_GPIO_BASE	( BCM2836_IO_MEM_START + 0x00200000 )
+#define SIM_SPI0_BASE	( BCM2836_IO_MEM_START + 0x00204000 )
+#define SIM_BSC1_BASE	( BCM2836_IO_MEM_START + 0x00804000 )
+#define SIM_AUX_BASE	( BCM2836_IO_MEM_START + 0x00215000 )
+#define SIM_DMAC_BASE	( BCM2836_IO_MEM_START + 0x00007000 )
+
+#define SIM_REGIONS	16
+
+#define SIM_SPI_FIFO_SIZE	64
+#define SIM_BSC_FIFO_SIZE	16
+#define SIM_BSC_DEVICES		8
+#define SIM_AUX_SPIS		2
+#define SIM_AUX_FIFO_SIZE	4
+
+// SPI0 CS bits that hold configuration rather than status or one-shot actions
+#define SIM_SPI_CS_CONFIG	0x03E03FCF
+#define SIM_SPI_CS_CLEAR_TX	BIT(  4 )
+#define SIM_SPI_CS_CLEAR_RX	BIT(  5 )
+#define SIM_SPI_CS_TA		BIT(  7 )
+#define SIM_SPI_CS_DMAEN	BIT(  8 )
+#define SIM_SPI_CS_DONE		BIT( 16 )
+#define SIM_SPI_CS_RXD		BIT( 17 )
+#define SIM_SPI_CS_TXD		BIT( 18 )
+#define SIM_SPI_CS_RXR		BIT( 19 )
+#define SIM_SPI_CS_RXF		BIT( 20 )
+
+#define SIM_BSC_C_READ		BIT(  0 )
+#define SIM_BSC_C_CLEAR		( BIT( 4 ) | BIT( 5 ) )
+#define SIM_BSC_C_ST		BIT(  7 )
+#define SIM_BSC_C_INTD		BIT(  8 )
+#define SIM_BSC_C_INTT		BIT(  9 )
+#define SIM_BSC_C_INTR		BIT( 10 )
+#define SIM_BSC_C_EN		BIT( 15 )
+#define SIM_BSC_S_TA		BIT(  0 )
+#define SIM_BSC_S_DONE		BIT(  1 )
+#define SIM_BSC_S_TXW		BIT(  2 )
+#define SIM_BSC_S_RXR		BIT(  3 )
+#define SIM_BSC_S_TXD		BIT(  4 )
+#define SIM_BSC_S_RXD		BIT(  5 )
+#define SIM_BSC_S_TXE		BIT(  6 )
+#define SIM_BSC_S_RXF		BIT(  7 )
+#define SIM_BSC_S_ERR		BIT(  8 )
+#define SIM_BSC_S_CLKT		BIT(  9 )
+#define SIM_BSC_S_STICKY	( SIM_BSC_S_DONE | SIM_BSC_S_ERR | SIM_BSC_S_CLKT )
+
+#define SIM_AUX_ENABLES		0x04
+#define SIM_AUX_SPI1		0x80
+#define SIM_AUX_SPI_SIZE	0x40
+#define SIM_AUX_CNTL0_CLEAR	BIT(  9 )
+#define SIM_AUX_CNTL0_ENABLE	BIT( 11 )
+#define SIM_AUX_STAT_BUSY	BIT(  6 )
+#define SIM_AUX_STAT_RX_EMPTY	BIT(  7 )
+#define SIM_AUX_STAT_RX_FULL	BIT(  8 )
+#define SIM_AUX_STAT_TX_EMPTY	BIT(  9 )
+#define SIM_AUX_STAT_TX_FULL	BIT( 10 )
+
+#define SIM_DMAC_CHANNELS	15
+#define SIM_DMAC_CHAN_SIZE	0x100
+#define SIM_DMAC_CS_ACTIVE	BIT(  0 )
+#define SIM_DMAC_CS_END		BIT(  1 )
+#define SIM_DMAC_CS_INT		BIT(  2 )
+#define SIM_DMAC_CS_ERROR	BIT(  8 )
+#define SIM_DMAC_CS_ABORT	BIT( 30 )
+#define SIM_DMAC_CS_RESET	BIT( 31 )
+#define SIM_DMAC_TI_INTEN	BIT(  0 )
+#define SIM_DMAC_TI_DEST_INC	BIT(  4 )
+#define SIM_DMAC_TI_SRC_INC	BIT(  8 )
+
+// The bus address of the SPI0 FIFO, the only peripheral register the DMA model moves data to and from
+#define SIM_DMAC_SPI_FIFO	0x7E204004
+
+// Strips the cache alias off a bus address of SDRAM
+#define SIM_DMAC_RAM_MASK	0x3FFFFFFF
+
+struct sim_region {
+	u8* mem;
+	unsigned long phys;
+	unsigned long size;
+	unsigned int block;
+};
+
+struct sim_fifo {
+	u8 data[SIM_SPI_FIFO_SIZE];
+	unsigned int head;
+	unsigned int count;
+};
+
+// A mini SPI FIFO of variable width words.
+struct sim_word_fifo {
+	u32 data[SIM_AUX_FIFO_SIZE];
+	unsigned int head;
+	unsigned int count;
+};
+
+struct sim_i2c_device {
+	unsigned char addr;
+	u8* regs;
+	size_t size;
+	unsigned int addr_bytes;
+	unsigned int addr_count;
+	size_t ptr;
+};
+
+struct sim_dmac_chan {
+	u32 cs;
+	u32 conblk_ad;
+	u32 ti;
+	u32 source_ad;
+	u32 dest_ad;
+	u32 txfr_len;
+	u32 nextconbk;
+
+	unsigned int fault;	// The SIM_DMAC_FAULT_* fault injected.
+};
+
+static struct sim_region sim_regions[SIM_REGIONS];
+
+static u64 sim_now = 0;
+
+static unsigned int sim_mmio_cost = SIM_MMIO_COST_NS;
+
+static unsigned int sim_barrier_cost = SIM_BARRIER_COST_NS;
+
+static struct sim_counters sim_counters[SIM_BLOCKS];
+
+static u64 sim_barriers;
+
+static int sim_irq_delivering;
+
+static struct {
+	u32 fsel[6];
+	u32 out[2];
+	u32 in[2];
+	u32 eds[2];
+	u32 ren[2];
+	u32 fen[2];
+	u32 aren[2];
+	u32 afen[2];
+} sim_gpio;
+
+static struct {
+	u32 cs;
+	u32 clk;
+	u32 dlen;
+	u32 ltoh;
+	u32 dc;
+
+	struct sim_fifo tx;
+	struct sim_fifo rx;
+
+	int shifting;
+	u64 shift_end;
+
+	u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi );
+	void* ctx;
+} sim_spi;
+
+static struct {
+	u32 c;
+	u32 s;
+	u32 dlen;
+	u32 a;
+	u32 div;
+	u32 del;
+	u32 clkt;
+
+	struct sim_fifo fifo;
+	u8 shift;
+
+	int active;
+	int read;
+	int addressed;
+	int waiting;
+	u32 remaining;
+	unsigned int addr;
+	u64 event_end;
+	struct sim_i2c_device* dev;
+
+	int pending;
+	int pending_read;
+	u32 pending_len;
+	unsigned int pending_addr;
+	unsigned int repeated_starts;
+
+	struct sim_i2c_device devices[SIM_BSC_DEVICES];
+
+	unsigned int sda_hold;	// The SCL pulses left before a stuck peripheral lets go of SDA.
+} sim_bsc;
+
+static struct {
+	u32 enables;
+
+	struct {
+		u32 cntl0;
+		u32 cntl1;
+
+		struct sim_word_fifo tx;
+		struct sim_word_fifo rx;
+
+		int shifting;
+		u64 shift_end;
+
+		u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi );
+		void* ctx;
+	} spi[SIM_AUX_SPIS];
+} sim_aux;
+
+static struct {
+	struct sim_dmac_chan chan[SIM_DMAC_CHANNELS];
+
+	u32 irqs;			// The channels with an interrupt waiting to be delivered.
+} sim_dmac;
+
+// -----------------------------------------------------------------------------
+// FIFOs
+// -----------------------------------------------------------------------------
+
+static inline void sim_fifo_clear( struct sim_fifo* fifo ) {
+	fifo->head = 0;
+	fifo->count = 0;
+}
+
+static inline void sim_fifo_push( struct sim_fifo* fifo, unsigned int size, u8 byte ) {
+	if ( fifo->count < size ) {
+		fifo->data[( fifo->head + fifo->count ) % size] = byte;
+		fifo->count++;
+	}
+}
+
+static inline u8 sim_fifo_pop( struct sim_fifo* fifo, unsigned int size ) {
+	if ( !fifo->count ) {
+		return 0x00;
+	}
+
+	const u8 byte = fifo->data[fifo->head];
+	fifo->head = ( fifo->head + 1 ) % size;
+	fifo->count--;
+
+	return byte;
+}
+
+// -----------------------------------------------------------------------------
+// GPIO
+// -----------------------------------------------------------------------------
+
+// SDA and SCL of BSC0 and BSC1, pulled up and only ever driven low
+#define SIM_BSC_LINES	( BIT( 0 ) | BIT( 1 ) | BIT( 2 ) | BIT( 3 ) )
+#define SIM_BSC1_SDA	BIT( 2 )
+#define SIM_BSC1_SCL	BIT( 3 )
+
+static u32 sim_gpio_level( unsigned int bank ) {
+	u32 outputs = 0;
+	unsigned int i;
+
+	for ( i = 0; i < 32 && bank * 32 + i < 54; i++ ) {
+		const unsigned int pin = bank * 32 + i;
+		if ( ( ( sim_gpio.fsel[pin / 10] >> ( ( pin % 10 ) * 3 ) ) & 0x07 ) == 0x01 ) {
+			outputs |= BIT( i );
+		}
+	}
+
+	if ( bank ) {
+		return ( sim_gpio.out[1] & outputs ) | ( sim_gpio.in[1] & ~outputs );
+	}
+
+	// The bus lines read high unless a pin or a stuck peripheral pulls them low
+	u32 lines = SIM_BSC_LINES & ~( outputs & ~sim_gpio.out[0] );
+	if ( sim_bsc.sda_hold ) {
+		lines &= ~SIM_BSC1_SDA;
+	}
+
+	return ( ( ( sim_gpio.out[0] & outputs ) | ( sim_gpio.in[0] & ~outputs ) ) & ~SIM_BSC_LINES ) | lines;
+}
+
+static u32 sim_gpio_read( unsigned long off ) {
+	if ( off <= 0x14 ) {
+		return sim_gpio.fsel[off >> 2];
+	}
+	if ( off == 0x34 || off == 0x38 ) {
+		return sim_gpio_level( ( off - 0x34 ) >> 2 );
+	}
+	if ( off == 0x40 || off == 0x44 ) {
+		return sim_gpio.eds[( off - 0x40 ) >> 2];
+	}
+	if ( off == 0x4C || off == 0x50 ) {
+		return sim_gpio.ren[( off - 0x4C ) >> 2];
+	}
+	if ( off == 0x58 || off == 0x5C ) {
+		return sim_gpio.fen[( off - 0x58 ) >> 2];
+	}
+	if ( off == 0x7C || off == 0x80 ) {
+		return sim_gpio.aren[( off - 0x7C ) >> 2];
+	}
+	if ( off == 0x88 || off == 0x8C ) {
+		return sim_gpio.afen[( off - 0x88 ) >> 2];
+	}
+	return 0;
+}
+
+static void sim_gpio_store( unsigned long off, u32 value ) {
+	if ( off <= 0x14 ) {
+		sim_gpio.fsel[off >> 2] = value;
+	} else if ( off == 0x1C || off == 0x20 ) {
+		sim_gpio.out[( off - 0x1C ) >> 2] |= value;
+	} else if ( off == 0x28 || off == 0x2C ) {
+		sim_gpio.out[( off - 0x28 ) >> 2] &= ~value;
+	} else if ( off == 0x40 || off == 0x44 ) {
+		sim_gpio.eds[( off - 0x40 ) >> 2] &= ~value;
+	} else if ( off == 0x4C || off == 0x50 ) {
+		sim_gpio.ren[( off - 0x4C ) >> 2] = value;
+	} else if ( off == 0x58 || off == 0x5C ) {
+		sim_gpio.fen[( off - 0x58 ) >> 2] = value;
+	} else if ( off == 0x7C || off == 0x80 ) {
+		sim_gpio.aren[( off - 0x7C ) >> 2] = value;
+	} else if ( off == 0x88 || off == 0x8C ) {
+		sim_gpio.afen[( off - 0x88 ) >> 2] = value;
+	}
+}
+
+static void sim_gpio_write( unsigned long off, u32 value ) {
+	const u32 before = sim_gpio_level( 0 );
+
+	sim_gpio_store( off, value );
+
+	// A stuck peripheral counts the SCL pulses bit banged at it
+	if ( !( before & SIM_BSC1_SCL ) && ( sim_gpio_level( 0 ) & SIM_BSC1_SCL ) && sim_bsc.sda_hold ) {
+		sim_bsc.sda_hold--;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// SPI0
+// -----------------------------------------------------------------------------
+
+static u64 sim_spi_byte_ns( void ) {
+	u32 div = sim_spi.clk & 0xFFFE;
+	if ( !div ) {
+		div = 65536;
+	}
+
+	return 8ULL * div * 1000000000ULL / SIM_CORE_CLK_HZ;
+}
+
+static int sim_spi_can_shift( void ) {
+	return ( sim_spi.cs & SIM_SPI_CS_TA ) && sim_spi.tx.count
+		&& sim_spi.rx.count < SIM_SPI_FIFO_SIZE;
+}
+
+static void sim_spi_advance( void ) {
+	while ( sim_spi.shifting && sim_spi.shift_end <= sim_now ) {
+		const u8 mosi = sim_fifo_pop( &sim_spi.tx, SIM_SPI_FIFO_SIZE );
+		const u8 miso = sim_spi.xfer ? sim_spi.xfer( sim_spi.ctx, sim_spi.cs & 0x03, mosi ) : mosi;
+		sim_fifo_push( &sim_spi.rx, SIM_SPI_FIFO_SIZE, miso );
+
+		// Bytes follow each other back to back as long as the FIFOs allow
+		if ( sim_spi_can_shift() ) {
+			sim_spi.shift_end += sim_spi_byte_ns();
+		} else {
+			sim_spi.shifting = 0;
+		}
+	}
+}
+
+static void sim_spi_kick( void ) {
+	if ( !sim_spi.shifting && sim_spi_can_shift() ) {
+		sim_spi.shifting = 1;
+		sim_spi.shift_end = sim_now + sim_spi_byte_ns();
+	}
+}
+
+static u32 sim_spi_read( unsigned long off ) {
+	u32 value = 0;
+
+	switch ( off ) {
+	case 0x00:
+		value = sim_spi.cs;
+		if ( ( sim_spi.cs & SIM_SPI_CS_TA ) && !sim_spi.tx.count && !sim_spi.shifting ) {
+			value |= SIM_SPI_CS_DONE;
+		}
+		if ( sim_spi.rx.count ) {
+			value |= SIM_SPI_CS_RXD;
+		}
+		if ( sim_spi.tx.count < SIM_SPI_FIFO_SIZE ) {
+			value |= SIM_SPI_CS_TXD;
+		}
+		if ( sim_spi.rx.count >= SIM_SPI_FIFO_SIZE * 3 / 4 ) {
+			value |= SIM_SPI_CS_RXR;
+		}
+		if ( sim_spi.rx.count == SIM_SPI_FIFO_SIZE ) {
+			value |= SIM_SPI_CS_RXF;
+		}
+		break;
+	case 0x04:
+		value = sim_fifo_pop( &sim_spi.rx, SIM_SPI_FIFO_SIZE );
+		break;
+	case 0x08:
+		value = sim_spi.clk;
+		break;
+	case 0x0C:
+		value = sim_spi.dlen;
+		break;
+	case 0x10:
+		value = sim_spi.ltoh;
+		break;
+	case 0x14:
+		value = sim_spi.dc;
+		break;
+	}
+
+	return value;
+}
+
+static void sim_spi_write( unsigned long off, u32 value ) {
+	switch ( off ) {
+	case 0x00:
+		if ( value & SIM_SPI_CS_CLEAR_TX ) {
+			sim_fifo_clear( &sim_spi.tx );
+			sim_spi.shifting = 0;
+		}
+		if ( value & SIM_SPI_CS_CLEAR_RX ) {
+			sim_fifo_clear( &sim_spi.rx );
+		}
+		sim_spi.cs = value & SIM_SPI_CS_CONFIG;
+		if ( !( sim_spi.cs & SIM_SPI_CS_TA ) ) {
+			sim_spi.shifting = 0;
+		}
+		break;
+	case 0x04:
+		sim_fifo_push( &sim_spi.tx, SIM_SPI_FIFO_SIZE, value & 0xFF );
+		break;
+	case 0x08:
+		sim_spi.clk = value & 0xFFFF;
+		break;
+	case 0x0C:
+		sim_spi.dlen = value & 0xFFFF;
+		break;
+	case 0x10:
+		sim_spi.ltoh = value & 0x0F;
+		break;
+	case 0x14:
+		sim_spi.dc = value;
+		break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BSC1
+// -----------------------------------------------------------------------------
+
+static u64 sim_bsc_bit_ns( void ) {
+	u32 div = sim_bsc.div & 0xFFFE;
+	if ( !div ) {
+		div = 32768;
+	}
+
+	return ( u64 ) div * 1000000000ULL / SIM_CORE_CLK_HZ;
+}
+
+static struct sim_i2c_device* sim_bsc_find( unsigned int addr ) {
+	unsigned int i;
+
+	for ( i = 0; i < SIM_BSC_DEVICES; i++ ) {
+		if ( sim_bsc.devices[i].regs && sim_bsc.devices[i].addr == addr ) {
+			return &sim_bsc.devices[i];
+		}
+	}
+
+	return ( struct sim_i2c_device* ) 0;
+}
+
+static void sim_bsc_start( u64 t, int read, u32 len, unsigned int addr ) {
+	sim_bsc.active = 1;
+	sim_bsc.read = read;
+	sim_bsc.remaining = len;
+	sim_bsc.addr = addr;
+	sim_bsc.addressed = 0;
+	sim_bsc.waiting = 0;
+
+	// A start condition plus the address and R/W bit and its acknowledge
+	sim_bsc.event_end = t + 10 * sim_bsc_bit_ns();
+}
+
+static void sim_bsc_schedule( u64 t ) {
+	if ( !sim_bsc.remaining ) {
+		if ( sim_bsc.pending ) {
+			// The next transfer was queued while this one ran, it follows with a repeated start
+			sim_bsc.pending = 0;
+			sim_bsc.repeated_starts++;
+			sim_bsc_start( t, sim_bsc.pending_read, sim_bsc.pending_len, sim_bsc.pending_addr );
+		} else {
+			sim_bsc.active = 0;
+			sim_bsc.s |= SIM_BSC_S_DONE;
+		}
+		return;
+	}
+
+	// The master holds the clock low while the FIFO has nothing to send or no room to receive
+	const int ready = sim_bsc.read ? sim_bsc.fifo.count < SIM_BSC_FIFO_SIZE : sim_bsc.fifo.count > 0;
+	if ( ready ) {
+		// A byte to send leaves the FIFO for the shift register as soon as it starts going out
+		if ( !sim_bsc.read ) {
+			sim_bsc.shift = sim_fifo_pop( &sim_bsc.fifo, SIM_BSC_FIFO_SIZE );
+		}
+		sim_bsc.waiting = 0;
+		sim_bsc.event_end = t + 9 * sim_bsc_bit_ns();
+	} else {
+		sim_bsc.waiting = 1;
+	}
+}
+
+static void sim_bsc_advance( void ) {
+	while ( sim_bsc.active && !sim_bsc.waiting && sim_bsc.event_end <= sim_now ) {
+		const u64 t = sim_bsc.event_end;
+		struct sim_i2c_device* const dev = sim_bsc.dev;
+
+		if ( !sim_bsc.addressed ) {
+			sim_bsc.dev = sim_bsc_find( sim_bsc.addr );
+			if ( !sim_bsc.dev ) {
+				// Nobody acknowledged the address, the transfer ends with a stop
+				sim_bsc.active = 0;
+				sim_bsc.pending = 0;
+				sim_bsc.s |= SIM_BSC_S_ERR | SIM_BSC_S_DONE;
+				return;
+			}
+			sim_bsc.addressed = 1;
+			if ( !sim_bsc.read ) {
+				sim_bsc.dev->addr_count = 0;
+			}
+		} else if ( sim_bsc.read ) {
+			sim_fifo_push( &sim_bsc.fifo, SIM_BSC_FIFO_SIZE, dev->regs[dev->ptr % dev->size] );
+			dev->ptr++;
+			sim_bsc.remaining--;
+		} else {
+			const u8 byte = sim_bsc.shift;
+			if ( dev->addr_count < dev->addr_bytes ) {
+				dev->ptr = ( dev->addr_count ? dev->ptr << 8 : 0 ) | byte;
+				dev->addr_count++;
+			} else {
+				dev->regs[dev->ptr % dev->size] = byte;
+				dev->ptr++;
+			}
+			sim_bsc.remaining--;
+		}
+
+		sim_bsc_schedule( t );
+	}
+}
+
+static void sim_bsc_kick( void ) {
+	if ( sim_bsc.active && sim_bsc.waiting ) {
+		sim_bsc_schedule( sim_now );
+	}
+}
+
+static u32 sim_bsc_read( unsigned long off ) {
+	u32 value = 0;
+
+	switch ( off ) {
+	case 0x00:
+		value = sim_bsc.c;
+		break;
+	case 0x04:
+		value = sim_bsc.s & SIM_BSC_S_STICKY;
+		if ( sim_bsc.active ) {
+			value |= SIM_BSC_S_TA;
+			if ( !sim_bsc.read && sim_bsc.fifo.count < SIM_BSC_FIFO_SIZE / 4
+			  && sim_bsc.remaining > sim_bsc.fifo.count ) {
+				value |= SIM_BSC_S_TXW;
+			}
+			if ( sim_bsc.read && sim_bsc.fifo.count >= SIM_BSC_FIFO_SIZE * 3 / 4 ) {
+				value |= SIM_BSC_S_RXR;
+			}
+		}
+		if ( sim_bsc.fifo.count < SIM_BSC_FIFO_SIZE ) {
+			value |= SIM_BSC_S_TXD;
+		}
+		if ( sim_bsc.fifo.count ) {
+			value |= SIM_BSC_S_RXD;
+		} else {
+			value |= SIM_BSC_S_TXE;
+		}
+		if ( sim_bsc.fifo.count == SIM_BSC_FIFO_SIZE ) {
+			value |= SIM_BSC_S_RXF;
+		}
+		break;
+	case 0x08:
+		value = sim_bsc.active ? sim_bsc.remaining : sim_bsc.dlen;
+		break;
+	case 0x0C:
+		value = sim_bsc.a;
+		break;
+	case 0x10:
+		value = sim_fifo_pop( &sim_bsc.fifo, SIM_BSC_FIFO_SIZE );
+		break;
+	case 0x14:
+		value = sim_bsc.div;
+		break;
+	case 0x18:
+		value = sim_bsc.del;
+		break;
+	case 0x1C:
+		value = sim_bsc.clkt;
+		break;
+	}
+
+	return value;
+}
+
+static int sim_bsc_irq_asserted( void ) {
+	const u32 status = sim_bsc_read( 0x04 );
+
+	// The interrupt is a level, asserted for as long as an enabled condition holds
+	return ( ( sim_bsc.c & SIM_BSC_C_INTD ) && ( status & SIM_BSC_S_DONE ) )
+	    || ( ( sim_bsc.c & SIM_BSC_C_INTT ) && ( status & SIM_BSC_S_TXW ) )
+	    || ( ( sim_bsc.c & SIM_BSC_C_INTR ) && ( status & SIM_BSC_S_RXR ) );
+}
+
+static void sim_bsc_write( unsigned long off, u32 value ) {
+	switch ( off ) {
+	case 0x00:
+		if ( value & SIM_BSC_C_CLEAR ) {
+			sim_fifo_clear( &sim_bsc.fifo );
+		}
+		sim_bsc.c = value & ~( SIM_BSC_C_CLEAR | SIM_BSC_C_ST );
+		if ( !( value & SIM_BSC_C_EN ) ) {
+			sim_bsc.active = 0;
+			sim_bsc.pending = 0;
+		} else if ( value & SIM_BSC_C_ST ) {
+			if ( sim_bsc.active ) {
+				sim_bsc.pending = 1;
+				sim_bsc.pending_read = ( value & SIM_BSC_C_READ ) != 0;
+				sim_bsc.pending_len = sim_bsc.dlen;
+				sim_bsc.pending_addr = sim_bsc.a;
+			} else {
+				sim_bsc_start( sim_now, ( value & SIM_BSC_C_READ ) != 0, sim_bsc.dlen, sim_bsc.a );
+			}
+		}
+		break;
+	case 0x04:
+		sim_bsc.s &= ~( value & SIM_BSC_S_STICKY );
+		break;
+	case 0x08:
+		sim_bsc.dlen = value & 0xFFFF;
+		break;
+	case 0x0C:
+		sim_bsc.a = value & 0x7F;
+		break;
+	case 0x10:
+		sim_fifo_push( &sim_bsc.fifo, SIM_BSC_FIFO_SIZE, value & 0xFF );
+		break;
+	case 0x14:
+		sim_bsc.div = value & 0xFFFF;
+		break;
+	case 0x18:
+		sim_bsc.del = value;
+		break;
+	case 0x1C:
+		sim_bsc.clkt = value & 0xFFFF;
+		break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// AUX mini SPI
+// -----------------------------------------------------------------------------
+
+static inline void sim_word_fifo_push( struct sim_word_fifo* fifo, u32 word ) {
+	if ( fifo->count < SIM_AUX_FIFO_SIZE ) {
+		fifo->data[( fifo->head + fifo->count ) % SIM_AUX_FIFO_SIZE] = word;
+		fifo->count++;
+	}
+}
+
+static inline u32 sim_word_fifo_peek( const struct sim_word_fifo* fifo ) {
+	return fifo->count ? fifo->data[fifo->head] : 0;
+}
+
+static inline u32 sim_word_fifo_pop( struct sim_word_fifo* fifo ) {
+	const u32 word = sim_word_fifo_peek( fifo );
+	if ( fifo->count ) {
+		fifo->head = ( fifo->head + 1 ) % SIM_AUX_FIFO_SIZE;
+		fifo->count--;
+	}
+
+	return word;
+}
+
+static u64 sim_aux_word_ns( unsigned int n ) {
+	const u64 speed = ( sim_aux.spi[n].cntl0 >> 20 ) & 0xFFF;
+	const u64 bits = ( sim_word_fifo_peek( &sim_aux.spi[n].tx ) >> 24 ) & 0x1F;
+
+	return bits * 2 * ( speed + 1 ) * 1000000000ULL / SIM_CORE_CLK_HZ;
+}
+
+static int sim_aux_can_shift( unsigned int n ) {
+	return ( sim_aux.enables & BIT( n + 1 ) ) && ( sim_aux.spi[n].cntl0 & SIM_AUX_CNTL0_ENABLE )
+		&& sim_aux.spi[n].tx.count && sim_aux.spi[n].rx.count < SIM_AUX_FIFO_SIZE;
+}
+
+static unsigned int sim_aux_chip( unsigned int n ) {
+	const u32 cs = ( sim_aux.spi[n].cntl0 >> 17 ) & 0x7;
+	unsigned int chip;
+
+	// The selected chip is the one line driven low
+	for ( chip = 0; chip < 3; chip++ ) {
+		if ( !( cs & BIT( chip ) ) ) {
+			break;
+		}
+	}
+
+	return chip;
+}
+
+static void sim_aux_advance( void ) {
+	unsigned int n;
+
+	for ( n = 0; n < SIM_AUX_SPIS; n++ ) {
+		while ( sim_aux.spi[n].shifting && sim_aux.spi[n].shift_end <= sim_now ) {
+			const u32 word = sim_word_fifo_pop( &sim_aux.spi[n].tx );
+			const unsigned int bytes = ( ( word >> 24 ) & 0x1F ) / 8;
+			u32 in = 0;
+			unsigned int i;
+
+			// Bytes go out from bit 23 down and come in from bit 0 up
+			for ( i = 0; i < bytes; i++ ) {
+				const u8 mosi = ( word >> ( 16 - 8 * i ) ) & 0xFF;
+				const u8 miso = sim_aux.spi[n].xfer
+					? sim_aux.spi[n].xfer( sim_aux.spi[n].ctx, sim_aux_chip( n ), mosi ) : mosi;
+				in = ( in << 8 ) | miso;
+			}
+			sim_word_fifo_push( &sim_aux.spi[n].rx, in );
+
+			if ( sim_aux_can_shift( n ) ) {
+				sim_aux.spi[n].shift_end += sim_aux_word_ns( n );
+			} else {
+				sim_aux.spi[n].shifting = 0;
+			}
+		}
+	}
+}
+
+static void sim_aux_kick( void ) {
+	unsigned int n;
+
+	for ( n = 0; n < SIM_AUX_SPIS; n++ ) {
+		if ( !sim_aux.spi[n].shifting && sim_aux_can_shift( n ) ) {
+			sim_aux.spi[n].shifting = 1;
+			sim_aux.spi[n].shift_end = sim_now + sim_aux_word_ns( n );
+		}
+	}
+}
+
+static u32 sim_aux_read( u8* mem, unsigned long off ) {
+	u32 value = 0;
+
+	if ( off == SIM_AUX_ENABLES ) {
+		return sim_aux.enables;
+	}
+	if ( off < SIM_AUX_SPI1 || off >= SIM_AUX_SPI1 + SIM_AUX_SPIS * SIM_AUX_SPI_SIZE ) {
+		memcpy( &value, mem + off, sizeof( value ) );
+		return value;
+	}
+
+	const unsigned int n = ( off - SIM_AUX_SPI1 ) / SIM_AUX_SPI_SIZE;
+	off = ( off - SIM_AUX_SPI1 ) % SIM_AUX_SPI_SIZE;
+	switch ( off ) {
+	case 0x00:
+		value = sim_aux.spi[n].cntl0;
+		break;
+	case 0x04:
+		value = sim_aux.spi[n].cntl1;
+		break;
+	case 0x08:
+		if ( sim_aux.spi[n].shifting ) {
+			value |= SIM_AUX_STAT_BUSY;
+		}
+		if ( !sim_aux.spi[n].rx.count ) {
+			value |= SIM_AUX_STAT_RX_EMPTY;
+		}
+		if ( sim_aux.spi[n].rx.count == SIM_AUX_FIFO_SIZE ) {
+			value |= SIM_AUX_STAT_RX_FULL;
+		}
+		if ( !sim_aux.spi[n].tx.count ) {
+			value |= SIM_AUX_STAT_TX_EMPTY;
+		}
+		if ( sim_aux.spi[n].tx.count == SIM_AUX_FIFO_SIZE ) {
+			value |= SIM_AUX_STAT_TX_FULL;
+		}
+		value |= sim_aux.spi[n].rx.count << 16;
+		value |= sim_aux.spi[n].tx.count << 24;
+		break;
+	case 0x0C:
+		value = sim_word_fifo_peek( &sim_aux.spi[n].rx );
+		break;
+	case 0x20:
+	case 0x24:
+	case 0x28:
+	case 0x2C:
+		value = sim_word_fifo_pop( &sim_aux.spi[n].rx );
+		break;
+	}
+
+	return value;
+}
+
+static void sim_aux_write( u8* mem, unsigned long off, u32 value ) {
+	if ( off == SIM_AUX_ENABLES ) {
+		sim_aux.enables = value & 0x07;
+		return;
+	}
+	if ( off < SIM_AUX_SPI1 || off >= SIM_AUX_SPI1 + SIM_AUX_SPIS * SIM_AUX_SPI_SIZE ) {
+		memcpy( mem + off, &value, sizeof( value ) );
+		return;
+	}
+
+	// IO and TXHOLD only differ in the chip select behind the word, which is not modeled
+	const unsigned int n = ( off - SIM_AUX_SPI1 ) / SIM_AUX_SPI_SIZE;
+	off = ( off - SIM_AUX_SPI1 ) % SIM_AUX_SPI_SIZE;
+	switch ( off ) {
+	case 0x00:
+		if ( value & SIM_AUX_CNTL0_CLEAR ) {
+			memset( &sim_aux.spi[n].tx, 0, sizeof( sim_aux.spi[n].tx ) );
+			memset( &sim_aux.spi[n].rx, 0, sizeof( sim_aux.spi[n].rx ) );
+			sim_aux.spi[n].shifting = 0;
+		}
+		sim_aux.spi[n].cntl0 = value & ~SIM_AUX_CNTL0_CLEAR;
+		if ( !( value & SIM_AUX_CNTL0_ENABLE ) ) {
+			sim_aux.spi[n].shifting = 0;
+		}
+		break;
+	case 0x04:
+		sim_aux.spi[n].cntl1 = value & 0x7FF;
+		break;
+	case 0x20:
+	case 0x24:
+	case 0x28:
+	case 0x2C:
+	case 0x30:
+	case 0x34:
+	case 0x38:
+	case 0x3C:
+		sim_word_fifo_push( &sim_aux.spi[n].tx, value );
+		break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// DMA controller
+// -----------------------------------------------------------------------------
+
+static void sim_dmac_fail( unsigned int n ) {
+	// The channel stops where it is and interrupts, whatever its control block asked for
+	sim_dmac.chan[n].cs = ( sim_dmac.chan[n].cs & ~SIM_DMAC_CS_ACTIVE ) | SIM_DMAC_CS_ERROR | SIM_DMAC_CS_INT;
+	sim_dmac.irqs |= BIT( n );
+}
+
+static void sim_dmac_load( unsigned int n ) {
+	struct sim_dmac_chan* const ch = &sim_dmac.chan[n];
+
+	// TI, SOURCE_AD, DEST_AD, TXFR_LEN, STRIDE, NEXTCONBK, and two reserved words
+	const u32* const cb = sim_dma_mem( ch->conblk_ad & SIM_DMAC_RAM_MASK, 8 * sizeof( u32 ) );
+	if ( !cb ) {
+		sim_dmac_fail( n );
+		return;
+	}
+
+	ch->ti = cb[0];
+	ch->source_ad = cb[1];
+	ch->dest_ad = cb[2];
+	ch->txfr_len = cb[3] & 0x3FFFFFFF;
+	ch->nextconbk = cb[5];
+}
+
+static int sim_dmac_ready( unsigned int n ) {
+	const struct sim_dmac_chan* const ch = &sim_dmac.chan[n];
+
+	// The SPI DREQs only pace the channels while the SPI has DMA enabled
+	if ( ch->source_ad == SIM_DMAC_SPI_FIFO
+	  && ( !( sim_spi.cs & SIM_SPI_CS_DMAEN ) || !sim_spi.rx.count ) ) {
+		return 0;
+	}
+	if ( ch->dest_ad == SIM_DMAC_SPI_FIFO
+	  && ( !( sim_spi.cs & SIM_SPI_CS_DMAEN ) || sim_spi.tx.count >= SIM_SPI_FIFO_SIZE ) ) {
+		return 0;
+	}
+
+	return 1;
+}
+
+static int sim_dmac_move( unsigned int n ) {
+	struct sim_dmac_chan* const ch = &sim_dmac.chan[n];
+	u8 byte;
+
+	if ( ch->source_ad == SIM_DMAC_SPI_FIFO ) {
+		byte = sim_fifo_pop( &sim_spi.rx, SIM_SPI_FIFO_SIZE );
+	} else {
+		const u8* const src = sim_dma_mem( ch->source_ad & SIM_DMAC_RAM_MASK, 1 );
+		if ( !src ) {
+			return -1;
+		}
+		byte = *src;
+		if ( ch->ti & SIM_DMAC_TI_SRC_INC ) {
+			ch->source_ad++;
+		}
+	}
+
+	if ( ch->dest_ad == SIM_DMAC_SPI_FIFO ) {
+		sim_fifo_push( &sim_spi.tx, SIM_SPI_FIFO_SIZE, byte );
+	} else {
+		u8* const dst = sim_dma_mem( ch->dest_ad & SIM_DMAC_RAM_MASK, 1 );
+		if ( !dst ) {
+			return -1;
+		}
+		*dst = byte;
+		if ( ch->ti & SIM_DMAC_TI_DEST_INC ) {
+			ch->dest_ad++;
+		}
+	}
+
+	ch->txfr_len--;
+	return 0;
+}
+
+static void sim_dmac_advance( void ) {
+	unsigned int n;
+
+	// The channels move data as fast as the peripherals let them, only the bus takes time
+	for ( n = 0; n < SIM_DMAC_CHANNELS; n++ ) {
+		struct sim_dmac_chan* const ch = &sim_dmac.chan[n];
+
+		while ( ( ch->cs & SIM_DMAC_CS_ACTIVE ) && ch->fault != SIM_DMAC_FAULT_STALL ) {
+			if ( ch->fault == SIM_DMAC_FAULT_ERROR ) {
+				sim_dmac_fail( n );
+				break;
+			}
+
+			if ( ch->txfr_len ) {
+				if ( !sim_dmac_ready( n ) ) {
+					break;
+				}
+				if ( sim_dmac_move( n ) ) {
+					sim_dmac_fail( n );
+					break;
+				}
+				continue;
+			}
+
+			// The control block is done, the channel follows the chain or ends
+			if ( ch->ti & SIM_DMAC_TI_INTEN ) {
+				ch->cs |= SIM_DMAC_CS_INT;
+				sim_dmac.irqs |= BIT( n );
+			}
+			ch->conblk_ad = ch->nextconbk;
+			if ( !ch->conblk_ad ) {
+				ch->cs = ( ch->cs & ~SIM_DMAC_CS_ACTIVE ) | SIM_DMAC_CS_END;
+				break;
+			}
+			sim_dmac_load( n );
+		}
+	}
+
+	sim_spi_kick();
+}
+
+static void sim_dmac_deliver( void ) {
+	unsigned int n;
+
+	while ( sim_dmac.irqs ) {
+		for ( n = 0; n < SIM_DMAC_CHANNELS; n++ ) {
+			if ( sim_dmac.irqs & BIT( n ) ) {
+				sim_dmac.irqs &= ~BIT( n );
+				sim_raise_irq( SIM_IRQ_DMA( n ) );
+			}
+		}
+	}
+}
+
+static u32 sim_dmac_read( u8* mem, unsigned long off ) {
+	u32 value = 0;
+
+	if ( off >= SIM_DMAC_CHANNELS * SIM_DMAC_CHAN_SIZE ) {
+		memcpy( &value, mem + off, sizeof( value ) );
+		return value;
+	}
+
+	const struct sim_dmac_chan* const ch = &sim_dmac.chan[off / SIM_DMAC_CHAN_SIZE];
+	switch ( off % SIM_DMAC_CHAN_SIZE ) {
+	case 0x00:
+		value = ch->cs;
+		break;
+	case 0x04:
+		value = ch->conblk_ad;
+		break;
+	case 0x08:
+		value = ch->ti;
+		break;
+	case 0x0C:
+		value = ch->source_ad;
+		break;
+	case 0x10:
+		value = ch->dest_ad;
+		break;
+	case 0x14:
+		value = ch->txfr_len;
+		break;
+	case 0x1C:
+		value = ch->nextconbk;
+		break;
+	}
+
+	return value;
+}
+
+static void sim_dmac_write( u8* mem, unsigned long off, u32 value ) {
+	if ( off >= SIM_DMAC_CHANNELS * SIM_DMAC_CHAN_SIZE ) {
+		memcpy( mem + off, &value, sizeof( value ) );
+		return;
+	}
+
+	const unsigned int n = off / SIM_DMAC_CHAN_SIZE;
+	struct sim_dmac_chan* const ch = &sim_dmac.chan[n];
+	switch ( off % SIM_DMAC_CHAN_SIZE ) {
+	case 0x00:
+		if ( value & SIM_DMAC_CS_RESET ) {
+			const unsigned int fault = ch->fault;
+			memset( ch, 0, sizeof( *ch ) );
+			ch->fault = fault;
+			sim_dmac.irqs &= ~BIT( n );
+			break;
+		}
+		if ( value & SIM_DMAC_CS_ABORT ) {
+			ch->cs &= ~SIM_DMAC_CS_ACTIVE;
+			ch->txfr_len = 0;
+		}
+
+		// END and INT are write 1 to clear, ACTIVE starts the channel on CONBLK_AD or pauses it
+		ch->cs &= ~( value & ( SIM_DMAC_CS_END | SIM_DMAC_CS_INT ) );
+		if ( !( value & SIM_DMAC_CS_ACTIVE ) ) {
+			ch->cs &= ~SIM_DMAC_CS_ACTIVE;
+		} else if ( !( ch->cs & SIM_DMAC_CS_ACTIVE ) ) {
+			ch->cs |= SIM_DMAC_CS_ACTIVE;
+			sim_dmac_load( n );
+		}
+		break;
+	case 0x04:
+		ch->conblk_ad = value;
+		break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Backend
+// -----------------------------------------------------------------------------
+
+static void sim_advance_buses( void ) {
+	sim_spi_advance();
+	sim_dmac_advance();
+	sim_bsc_advance();
+	sim_aux_advance();
+}
+
+static struct sim_region* sim_find_region( void __iomem* addr, unsigned long* off ) {
+	unsigned int i;
+
+	for ( i = 0; i < SIM_REGIONS; i++ ) {
+		struct sim_region* const region = &sim_regions[i];
+		if ( region->mem && ( u8* ) addr >= region->mem
+		  && ( u8* ) addr < region->mem + region->size ) {
+			*off = ( u8* ) addr - region->mem;
+			return region;
+		}
+	}
+
+	return ( struct sim_region* ) 0;
+}
+
+static u32 sim_read( void __iomem* addr, unsigned int width ) {
+	unsigned long off;
+	u32 value = 0;
+
+	struct sim_region* const region = sim_find_region( addr, &off );
+	if ( !region ) {
+		return 0;
+	}
+
+	sim_now += sim_mmio_cost;
+	sim_advance_buses();
+	sim_counters[region->block].reads++;
+
+	switch ( region->block ) {
+	case SIM_BLOCK_GPIO:
+		value = sim_gpio_read( off );
+		break;
+	case SIM_BLOCK_SPI0:
+		value = sim_spi_read( off );
+		sim_spi_kick();
+		break;
+	case SIM_BLOCK_BSC1:
+		value = sim_bsc_read( off );
+		sim_bsc_kick();
+		break;
+	case SIM_BLOCK_AUX:
+		value = sim_aux_read( region->mem, off );
+		sim_aux_kick();
+		break;
+	case SIM_BLOCK_DMAC:
+		value = sim_dmac_read( region->mem, off );
+		break;
+	default:
+		memcpy( &value, region->mem + off, width );
+		break;
+	}
+
+	return value;
+}
+
+static void sim_write( void __iomem* addr, u32 value, unsigned int width ) {
+	unsigned long off;
+
+	struct sim_region* const region = sim_find_region( addr, &off );
+	if ( !region ) {
+		return;
+	}
+
+	sim_now += sim_mmio_cost;
+	sim_advance_buses();
+	sim_counters[region->block].writes++;
+
+	// Narrow writes reach the peripherals as zero extended 32-bit writes
+	switch ( region->block ) {
+	case SIM_BLOCK_GPIO:
+		sim_gpio_write( off, value );
+		break;
+	case SIM_BLOCK_SPI0:
+		sim_spi_write( off, value );
+		sim_spi_kick();
+		break;
+	case SIM_BLOCK_BSC1:
+		sim_bsc_write( off, value );
+		sim_bsc_kick();
+		break;
+	case SIM_BLOCK_AUX:
+		sim_aux_write( region->mem, off, value );
+		sim_aux_kick();
+		break;
+	case SIM_BLOCK_DMAC:
+		sim_dmac_write( region->mem, off, value );
+		sim_dmac_advance();
+		break;
+	default:
+		memcpy( region->mem + off, &value, width );
+		break;
+	}
+}
+
+static void __iomem* sim_map( unsigned long phys, unsigned long size ) {
+	unsigned int i;
+
+	for ( i = 0; i < SIM_REGIONS; i++ ) {
+		struct sim_region* const region = &sim_regions[i];
+		if ( region->mem ) {
+			continue;
+		}
+
+		region->mem = calloc( 1, size + sizeof( u32 ) );
+		if ( !region->mem ) {
+			return ( void __iomem* ) 0;
+		}
+		region->phys = phys;
+		region->size = size;
+		if ( phys == SIM_GPIO_BASE ) {
+			region->block = SIM_BLOCK_GPIO;
+		} else if ( phys == SIM_SPI0_BASE ) {
+			region->block = SIM_BLOCK_SPI0;
+		} else if ( phys == SIM_BSC1_BASE ) {
+			region->block = SIM_BLOCK_BSC1;
+		} else if ( phys == SIM_AUX_BASE ) {
+			region->block = SIM_BLOCK_AUX;
+		} else if ( phys == SIM_DMAC_BASE ) {
+			region->block = SIM_BLOCK_DMAC;
+		} else {
+			region->block = SIM_BLOCK_OTHER;
+		}
+
+		return region->mem;
+	}
+
+	return ( void __iomem* ) 0;
+}
+
+static void sim_unmap( void __iomem* addr ) {
+	unsigned int i;
+
+	for ( i = 0; i < SIM_REGIONS; i++ ) {
+		if ( sim_regions[i].mem == addr ) {
+			free( sim_regions[i].mem );
+			memset( &sim_regions[i], 0, sizeof( sim_regions[i] ) );
+		}
+	}
+}
+
+static u8 sim_read8( void __iomem* addr ) {
+	return sim_read( addr, 1 );
+}
+
+static u16 sim_read16( void __iomem* addr ) {
+	return sim_read( addr, 2 );
+}
+
+static u32 sim_read32( void __iomem* addr ) {
+	return sim_read( addr, 4 );
+}
+
+static void sim_write8( void __iomem* addr, u8 value ) {
+	sim_write( addr, value, 1 );
+}
+
+static void sim_write16( void __iomem* addr, u16 value ) {
+	sim_write( addr, value, 2 );
+}
+
+static void sim_write32( void __iomem* addr, u32 value ) {
+	sim_write( addr, value, 4 );
+}
+
+static void sim_fence( void ) {
+	sim_now += sim_barrier_cost;
+	sim_advance_buses();
+	sim_barriers++;
+}
+
+static const struct dma_backend sim_backend = {
+	.map = sim_map,
+	.unmap = sim_unmap,
+	.read8 = sim_read8,
+	.read16 = sim_read16,
+	.read32 = sim_read32,
+	.write8 = sim_write8,
+	.write16 = sim_write16,
+	.write32 = sim_write32,
+	.fence = sim_fence,
+};
+
+const struct dma_backend* dma_backend = &sim_backend;
+
+// -----------------------------------------------------------------------------
+// Control
+// -----------------------------------------------------------------------------
+
+void sim_reset( void ) {
+	sim_now = 0;
+	sim_mmio_cost = SIM_MMIO_COST_NS;
+	sim_barrier_cost = SIM_BARRIER_COST_NS;
+	memset( &sim_gpio, 0, sizeof( sim_gpio ) );
+	memset( &sim_spi, 0, sizeof( sim_spi ) );
+	memset( &sim_bsc, 0, sizeof( sim_bsc ) );
+	memset( &sim_aux, 0, sizeof( sim_aux ) );
+	memset( &sim_dmac, 0, sizeof( sim_dmac ) );
+	sim_reset_counters();
+}
+
+u64 sim_time_ns( void ) {
+	return sim_now;
+}
+
+void sim_advance_ns( u64 ns ) {
+	sim_now += ns;
+	sim_advance_buses();
+	sim_spi_kick();
+	sim_bsc_kick();
+	sim_aux_kick();
+
+	// Handlers access registers and wait, which must not deliver again
+	if ( !sim_irq_delivering ) {
+		sim_irq_delivering = 1;
+		sim_dmac_deliver();
+		// A level the handler leaves asserted is delivered again on the next step
+		if ( sim_bsc_irq_asserted() ) {
+			sim_raise_irq( SIM_IRQ_BSC );
+		}
+		sim_irq_delivering = 0;
+	}
+}
+
+void sim_set_mmio_cost_ns( unsigned int ns ) {
+	sim_mmio_cost = ns;
+}
+
+void sim_set_barrier_cost_ns( unsigned int ns ) {
+	sim_barrier_cost = ns;
+}
+
+void sim_dmac_fault( unsigned int chan, unsigned int fault ) {
+	sim_dmac.chan[chan % SIM_DMAC_CHANNELS].fault = fault;
+}
+
+void sim_get_counters( unsigned int block, struct sim_counters* counters ) {
+	*counters = sim_counters[block % SIM_BLOCKS];
+}
+
+void sim_reset_counters( void ) {
+	memset( sim_counters, 0, sizeof( sim_counters ) );
+	sim_barriers = 0;
+}
+
+u64 sim_get_barriers( void ) {
+	return sim_barriers;
+}
+
+void sim_gpio_set_inputs( unsigned int bank, u32 levels ) {
+	const u32 before = sim_gpio_level( bank & 1 );
+
+	sim_gpio.in[bank & 1] = levels;
+
+	// Edges on the pins latch their events, the synchronous and asynchronous detectors alike
+	const u32 after = sim_gpio_level( bank & 1 );
+	sim_gpio.eds[bank & 1] |= ( ~before & after & ( sim_gpio.ren[bank & 1] | sim_gpio.aren[bank & 1] ) )
+		| ( before & ~after & ( sim_gpio.fen[bank & 1] | sim_gpio.afen[bank & 1] ) );
+}
+
+void sim_spi_set_device( u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi ), void* ctx ) {
+	sim_spi.xfer = xfer;
+	sim_spi.ctx = ctx;
+}
+
+void sim_spi_aux_set_device( unsigned int n, u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi ),
+		void* ctx ) {
+	sim_aux.spi[n % SIM_AUX_SPIS].xfer = xfer;
+	sim_aux.spi[n % SIM_AUX_SPIS].ctx = ctx;
+}
+
+int sim_i2c_attach( unsigned char addr, u8* regs, size_t size, unsigned int addr_bytes ) {
+	unsigned int i;
+
+	sim_i2c_detach( addr );
+	for ( i = 0; i < SIM_BSC_DEVICES; i++ ) {
+		struct sim_i2c_device* const dev = &sim_bsc.devices[i];
+		if ( !dev->regs ) {
+			dev->addr = addr & 0x7F;
+			dev->regs = regs;
+			dev->size = size;
+			dev->addr_bytes = addr_bytes;
+			dev->addr_count = 0;
+			dev->ptr = 0;
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+void sim_i2c_detach( unsigned char addr ) {
+	struct sim_i2c_device* const dev = sim_bsc_find( addr & 0x7F );
+	if ( dev ) {
+		memset( dev, 0, sizeof( *dev ) );
+	}
+}
+
+void sim_i2c_hold_sda( unsigned int pulses ) {
+	sim_bsc.sda_hold = pulses;
+}
+
+unsigned int sim_i2c_repeated_starts( void ) {
+	return sim_bsc.repeated_starts;
+}
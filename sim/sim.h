@@ -0,0 +1,236 @@
+#ifndef _SPECTR_IO_SIM_H
+#define _SPECTR_IO_SIM_H
+
+#include <linux/types.h>
+
+// The core clock the SPI and BSC dividers are applied to.
+#define SIM_CORE_CLK_HZ	250000000
+
+// The default cost of a single register access in nanoseconds.
+#define SIM_MMIO_COST_NS	50
+
+// The default cost of a barrier around a register access in nanoseconds.
+#define SIM_BARRIER_COST_NS	20
+
+// Register access counters, per simulated block.
+struct sim_counters {
+	u64 reads;
+	u64 writes;
+};
+
+#define SIM_BLOCK_GPIO	0
+#define SIM_BLOCK_SPI0	1
+#define SIM_BLOCK_BSC1	2
+#define SIM_BLOCK_AUX	3
+#define SIM_BLOCK_DMAC	4
+#define SIM_BLOCK_OTHER	5
+#define SIM_BLOCKS	6
+
+// The interrupt a DMA controller channel raises, numbered as on the BCM2836.
+#define SIM_IRQ_DMA( chan )	( 16 + ( chan ) )
+
+// The interrupt the BSC controllers share, numbered as on the BCM2836.
+#define SIM_IRQ_BSC		53
+
+#define SIM_DMAC_FAULT_NONE	0	// The channel works.
+#define SIM_DMAC_FAULT_ERROR	1	// The channel stops with ERROR set and interrupts.
+#define SIM_DMAC_FAULT_STALL	2	// The channel stays active without moving any data.
+
+// Declares the accessor of a driver module parameter, see sim_module_param().
+#define SIM_MODULE_PARAM( name )	void* sim_module_param_##name( void )
+
+// A driver module parameter, set it before the driver is initialized like insmod would.
+#define sim_module_param( name )	( *( int* ) sim_module_param_##name() )
+
+/**
+ * Resets the simulated clock, the register blocks, the attached devices, and the counters.
+ *
+ */
+void sim_reset( void );
+
+/**
+ * Gets the simulated time.
+ *
+ * @returns The time in nanoseconds since the last reset.
+ *
+ */
+u64 sim_time_ns( void );
+
+/**
+ * Advances the simulated time, letting the buses make progress.
+ *
+ * @param ns The time to advance by in nanoseconds.
+ *
+ */
+void sim_advance_ns( u64 ns );
+
+/**
+ * Sets the simulated cost of a single register access.
+ *
+ * @param ns The cost in nanoseconds.
+ *
+ */
+void sim_set_mmio_cost_ns( unsigned int ns );
+
+/**
+ * Sets the simulated cost of a barrier, paid by every plain register access and every fence.
+ *
+ * @param ns The cost in nanoseconds.
+ *
+ */
+void sim_set_barrier_cost_ns( unsigned int ns );
+
+/**
+ * Gets the register access counters of a simulated block.
+ *
+ * @param block The SIM_BLOCK_* block.
+ * @param counters The location to store the counters at.
+ *
+ */
+void sim_get_counters( unsigned int block, struct sim_counters* counters );
+
+/**
+ * Resets the register access counters of all simulated blocks.
+ *
+ */
+void sim_reset_counters( void );
+
+/**
+ * Gets the number of barriers issued, counted alongside the register accesses.
+ *
+ * @returns The number of barriers since the counters were last reset.
+ *
+ */
+u64 sim_get_barriers( void );
+
+/**
+ * Sets the levels driven onto GPIO pins configured as inputs.
+ *
+ * Edges on pins with edge detection enabled latch their events in GPEDS.
+ *
+ * @param bank The bank.
+ * @param levels The pin levels, one bit per pin.
+ *
+ */
+void sim_gpio_set_inputs( unsigned int bank, u32 levels );
+
+/**
+ * Sets the SPI0 peripheral model, called once for every byte shifted on the bus.
+ *
+ * @param xfer The model returning the MISO byte for a MOSI byte, or NULL to loop MOSI back.
+ * @param ctx The context passed to the model.
+ *
+ */
+void sim_spi_set_device( u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi ), void* ctx );
+
+/**
+ * Sets the peripheral model of an AUX mini SPI bus, called once for every byte shifted on it.
+ *
+ * @param n The bus, 0 for SPI1 and 1 for SPI2.
+ * @param xfer The model returning the MISO byte for a MOSI byte, or NULL to loop MOSI back.
+ * @param ctx The context passed to the model.
+ *
+ */
+void sim_spi_aux_set_device( unsigned int n, u8 ( *xfer )( void* ctx, unsigned int cs, u8 mosi ),
+	void* ctx );
+
+/**
+ * Attaches a register file peripheral to the BSC1 bus.
+ *
+ * The first bytes of every write select the register, further bytes are written to it and reads
+ * return from it, auto-incrementing the register either way.
+ *
+ * @param addr The 7-bit peripheral address.
+ * @param regs The register file.
+ * @param size The size of the register file in bytes.
+ * @param addr_bytes The number of register address bytes, 1 or 2.
+ *
+ * @returns Zero on success; a negative error code if no slot is free.
+ *
+ */
+int sim_i2c_attach( unsigned char addr, u8* regs, size_t size, unsigned int addr_bytes );
+
+/**
+ * Detaches a peripheral from the BSC1 bus.
+ *
+ * @param addr The 7-bit peripheral address.
+ *
+ */
+void sim_i2c_detach( unsigned char addr );
+
+/**
+ * Makes a peripheral on the BSC1 bus hold SDA low, as one left mid-byte by a glitch would.
+ *
+ * The peripheral lets go once it has seen a number of SCL pulses bit banged on GPIO 3.
+ *
+ * @param pulses The number of pulses, zero to let go right away.
+ *
+ */
+void sim_i2c_hold_sda( unsigned int pulses );
+
+/**
+ * Gets the number of transfers on the BSC1 bus that followed the previous one with a repeated
+ * start instead of a stop.
+ *
+ * @returns The number of repeated starts since the last reset.
+ *
+ */
+unsigned int sim_i2c_repeated_starts( void );
+
+/**
+ * Makes a DMA controller channel misbehave from its next control block on.
+ *
+ * @param chan The channel.
+ * @param fault The SIM_DMAC_FAULT_* fault.
+ *
+ */
+void sim_dmac_fault( unsigned int chan, unsigned int fault );
+
+/**
+ * Runs the handlers registered for an interrupt, as the interrupt controller would.
+ *
+ * Interrupts raised by the simulated peripherals are delivered whenever the simulated time is
+ * advanced, not from within a register access.
+ *
+ * @param irq The interrupt.
+ *
+ * @returns Nonzero if a handler handled it; zero otherwise.
+ *
+ */
+int sim_raise_irq( unsigned int irq );
+
+/**
+ * Finds the memory behind a DMA bus address handed out by dma_alloc_coherent().
+ *
+ * @param bus The bus address, without the cache alias bits.
+ * @param len The length of the memory in bytes.
+ *
+ * @returns The memory; NULL if the range is not allocated.
+ *
+ */
+void* sim_dma_mem( u32 bus, size_t len );
+
+struct file;
+
+/**
+ * Opens a registered misc device, as opening its /dev node would.
+ *
+ * Call the file operations through file->f_op from there on, release included.
+ *
+ * @param name The device name.
+ * @param file The file to open.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int sim_misc_open( const char* name, struct file* file );
+
+/**
+ * Runs the high resolution timer due first, advancing the simulated time to its expiry.
+ *
+ * @returns Nonzero if a timer ran; zero if none is active.
+ *
+ */
+int sim_hrtimer_fire_next( void );
+
+#endif // _SPECTR_IO_SIM_H
@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "check.h"
+#include "gpio.h"
+#include "i2c.h"
+#include "sim.h"
+#include "spi.h"
+#include "stats.h"
+
+static u8 spi_invert( void* ctx, unsigned int cs, u8 mosi ) {
+	return ~mosi;
+}
+
+static void spi_transaction( void ) {
+	u8 tx[32];
+	u8 rx[32];
+	size_t i;
+
+	for ( i = 0; i < sizeof( tx ); i++ ) {
+		tx[i] = i * 3;
+	}
+	sim_spi_set_device( spi_invert, ( void* ) 0 );
+
+	spi_set_clk_div( 16 );
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, sizeof( tx ) ), sizeof( tx ) );
+	spi_end_transfer();
+
+	for ( i = 0; i < sizeof( tx ); i++ ) {
+		CHECK_EQ( rx[i], ( u8 ) ~tx[i] );
+	}
+	CHECK_EQ( stats_read( STATS_BUS_SPI0, STATS_BYTES ), sizeof( tx ) );
+
+	// There are only three chip select lines, a fourth would set CSPOL past them
+	const struct spi_device_profile profile = { SPI_CHIP2 + 1, SPI_MODE0, 1, 0, 16 };
+	CHECK_EQ( spi_register_device( &profile ), SPI_ERR_BAD_CHIP );
+
+	sim_spi_set_device( ( void* ) 0, ( void* ) 0 );
+}
+
+static void i2c_transaction( void ) {
+	u8 regs[256];
+	u8 data[8];
+	const u8 write[4] = { 0x40, 0xA1, 0xB2, 0xC3 };
+
+	memset( regs, 0, sizeof( regs ) );
+	CHECK_EQ( sim_i2c_attach( 0x48, regs, sizeof( regs ), 1 ), 0 );
+
+	i2c_bus_set_addr( I2C_BUS1, 0x48 );
+	CHECK_EQ( i2c_bus_write( I2C_BUS1, sizeof( write ), write ), sizeof( write ) );
+	CHECK( regs[0x40] == 0xA1 && regs[0x41] == 0xB2 && regs[0x42] == 0xC3 );
+
+	CHECK_EQ( i2c_bus_read_register( I2C_BUS1, 0x40, 3, data ), 3 );
+	CHECK( !memcmp( data, write + 1, 3 ) );
+
+	// Nobody answers at this address
+	i2c_bus_set_addr( I2C_BUS1, 0x49 );
+	CHECK_EQ( ( ssize_t ) i2c_bus_read_register( I2C_BUS1, 0x00, 1, data ), I2C_ERR_NO_RESPONSE );
+	CHECK_EQ( stats_read( STATS_BUS_I2C1, STATS_NACKS ), 1 );
+
+	sim_i2c_detach( 0x48 );
+}
+
+int main( void ) {
+	sim_reset();
+	CHECK_EQ( stats_init(), 0 );
+	CHECK_EQ( gpio_init(), 0 );
+	CHECK_EQ( spi_init(), 0 );
+	CHECK_EQ( i2c_init(), 0 );
+
+	spi_transaction();
+	i2c_transaction();
+
+	// Pins claimed by a bus only change mode through their owner
+	CHECK_EQ( gpio_set_pin_mode( 9, GPIO_PIN_MODE_OUTPUT ), GPIO_ERR_PIN_CONFLICT );
+	CHECK_EQ( gpio_set_pins_mode( GPIO_BANK0, BIT( 2 ) | BIT( 17 ), GPIO_PIN_MODE_OUTPUT ), GPIO_ERR_PIN_CONFLICT );
+	CHECK_EQ( gpio_set_pin_mode( 17, GPIO_PIN_MODE_OUTPUT ), 0 );
+
+	i2c_exit();
+	spi_exit();
+	gpio_exit();
+	stats_exit();
+
+	return check_done( "bus" );
+}
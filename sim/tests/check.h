@@ -0,0 +1,39 @@
+#ifndef _SPECTR_IO_SIM_CHECK_H
+#define _SPECTR_IO_SIM_CHECK_H
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+// Records a failed check and carries on, so one run reports every failure
+#define CHECK( cond ) do { \
+	if ( !( cond ) ) { \
+		fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); \
+		check_failures++; \
+	} \
+} while ( 0 )
+
+#define CHECK_EQ( actual, expected ) do { \
+	const long long check_actual = ( long long ) ( actual ); \
+	const long long check_expected = ( long long ) ( expected ); \
+	if ( check_actual != check_expected ) { \
+		fprintf( stderr, "%s:%d: check failed: %s is %lld, expected %lld\n", __FILE__, __LINE__, \
+			#actual, check_actual, check_expected ); \
+		check_failures++; \
+	} \
+} while ( 0 )
+
+/**
+ * Reports the outcome of a test.
+ *
+ * @param name The test name.
+ *
+ * @returns The process exit status, zero if every check passed.
+ *
+ */
+static inline int check_done( const char* name ) {
+	printf( "%s: %s\n", name, check_failures ? "FAILED" : "ok" );
+	return check_failures ? 1 : 0;
+}
+
+#endif // _SPECTR_IO_SIM_CHECK_H
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "check.h"
+#include "gpio.h"
+#include "i2c.h"
+#include "sim.h"
+#include "spi.h"
+#include "stats.h"
+
+#define SPI_TEST_LEN	4096
+#define I2C_TEST_LEN	200
+#define I2C_TEST_ADDR	0x48
+
+// Register accesses slow enough for the bus to keep ahead, so every status read finds the FIFO
+// ready and the count only depends on how many bytes each status read moves
+#define BURST_TEST_MMIO_NS	1000
+#define BURST_TEST_SPI_DIV	8
+#define BURST_TEST_I2C_DIV	16
+
+static u8 spi_echo( void* ctx, unsigned int cs, u8 mosi ) {
+	return mosi;
+}
+
+static void check_spi_burst( void ) {
+	static u8 tx[SPI_TEST_LEN];
+	static u8 rx[SPI_TEST_LEN];
+	struct sim_counters counters;
+
+	sim_spi_set_device( spi_echo, ( void* ) 0 );
+	spi_set_clk_div( BURST_TEST_SPI_DIV );
+
+	spi_begin_transfer();
+	sim_reset_counters();
+	CHECK_EQ( spi_transfer( tx, rx, SPI_TEST_LEN ), SPI_TEST_LEN );
+	sim_get_counters( SIM_BLOCK_SPI0, &counters );
+	spi_end_transfer();
+
+	// One FIFO access per byte each way, the status is read once per burst instead of per byte
+	const u64 status_reads = counters.reads - SPI_TEST_LEN;
+	printf( "fifo_burst: spi %d bytes, %llu status reads\n", SPI_TEST_LEN, ( unsigned long long ) status_reads );
+	CHECK_EQ( counters.writes, SPI_TEST_LEN );
+	CHECK( status_reads <= SPI_TEST_LEN / 32 );
+
+	sim_spi_set_device( ( void* ) 0, ( void* ) 0 );
+}
+
+static void check_i2c_burst( void ) {
+	u8 regs[256];
+	u8 data[I2C_TEST_LEN];
+	struct sim_counters counters;
+
+	memset( regs, 0, sizeof( regs ) );
+	CHECK_EQ( sim_i2c_attach( I2C_TEST_ADDR, regs, sizeof( regs ), 1 ), 0 );
+	i2c_bus_set_addr( I2C_BUS1, I2C_TEST_ADDR );
+	i2c_bus_set_clk_div( I2C_BUS1, BURST_TEST_I2C_DIV );
+
+	sim_reset_counters();
+	CHECK_EQ( i2c_bus_read( I2C_BUS1, I2C_TEST_LEN, data ), I2C_TEST_LEN );
+	sim_get_counters( SIM_BLOCK_BSC1, &counters );
+	const u64 read_status = counters.reads - I2C_TEST_LEN;
+
+	sim_reset_counters();
+	CHECK_EQ( i2c_bus_write( I2C_BUS1, I2C_TEST_LEN, data ), I2C_TEST_LEN );
+	sim_get_counters( SIM_BLOCK_BSC1, &counters );
+	const u64 write_status = counters.reads;
+
+	// The 16 byte FIFO is drained and filled several bytes per status read
+	printf( "fifo_burst: i2c %d bytes, %llu status reads reading, %llu writing\n", I2C_TEST_LEN,
+		( unsigned long long ) read_status, ( unsigned long long ) write_status );
+	CHECK( read_status <= I2C_TEST_LEN / 4 );
+	CHECK( write_status <= I2C_TEST_LEN / 4 );
+
+	sim_i2c_detach( I2C_TEST_ADDR );
+}
+
+int main( void ) {
+	sim_reset();
+	CHECK_EQ( stats_init(), 0 );
+	CHECK_EQ( gpio_init(), 0 );
+	CHECK_EQ( spi_init(), 0 );
+	CHECK_EQ( i2c_init(), 0 );
+
+	sim_set_mmio_cost_ns( BURST_TEST_MMIO_NS );
+	check_spi_burst();
+	check_i2c_burst();
+
+	i2c_exit();
+	spi_exit();
+	gpio_exit();
+	stats_exit();
+
+	return check_done( "fifo_burst" );
+}
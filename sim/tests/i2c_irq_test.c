@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "check.h"
+#include "gpio.h"
+#include "i2c.h"
+#include "sim.h"
+#include "stats.h"
+
+#define I2C_TEST_ADDR	0x48
+#define I2C_TEST_LEN	40
+
+SIM_MODULE_PARAM( i2c1_irq );
+
+static u8 regs[256];
+
+static void check_register_read( void ) {
+	u8 data[4];
+
+	// The register address is written and read back behind a repeated start, not a stop
+	const unsigned int starts = sim_i2c_repeated_starts();
+	CHECK_EQ( i2c_bus_read_register( I2C_BUS1, 0x10, sizeof( data ), data ), sizeof( data ) );
+	CHECK( !memcmp( data, regs + 0x10, sizeof( data ) ) );
+	CHECK_EQ( sim_i2c_repeated_starts() - starts, 1 );
+}
+
+static void check_long_write_then_read( void ) {
+	u8 out[1 + I2C_TEST_LEN];
+	u8 in[I2C_TEST_LEN];
+	size_t i;
+
+	// Longer than the FIFO, so the handler refills it before starting the read behind the last bytes
+	out[0] = 0x80;
+	for ( i = 1; i < sizeof( out ); i++ ) {
+		out[i] = i * 11;
+	}
+	struct i2c1_msg msgs[] = {
+		{ .addr = I2C_TEST_ADDR, .flags = 0, .len = sizeof( out ), .buf = out },
+		{ .addr = I2C_TEST_ADDR, .flags = I2C1_M_RD, .len = sizeof( in ), .buf = in },
+	};
+
+	const unsigned int starts = sim_i2c_repeated_starts();
+	CHECK_EQ( i2c_bus_transfer( I2C_BUS1, msgs, ARRAY_SIZE( msgs ) ), 0 );
+	CHECK( !memcmp( regs + 0x80, out + 1, I2C_TEST_LEN ) );
+	CHECK( !memcmp( in, regs + 0x80 + I2C_TEST_LEN, I2C_TEST_LEN ) );
+	CHECK_EQ( sim_i2c_repeated_starts() - starts, 1 );
+}
+
+int main( void ) {
+	size_t i;
+
+	sim_reset();
+	sim_module_param( i2c1_irq ) = SIM_IRQ_BSC;
+	CHECK_EQ( stats_init(), 0 );
+	CHECK_EQ( gpio_init(), 0 );
+	CHECK_EQ( i2c_init(), 0 );
+
+	for ( i = 0; i < sizeof( regs ); i++ ) {
+		regs[i] = i ^ 0x5A;
+	}
+	CHECK_EQ( sim_i2c_attach( I2C_TEST_ADDR, regs, sizeof( regs ), 1 ), 0 );
+	i2c_bus_set_addr( I2C_BUS1, I2C_TEST_ADDR );
+
+	check_register_read();
+	check_long_write_then_read();
+
+	sim_i2c_detach( I2C_TEST_ADDR );
+	i2c_exit();
+	gpio_exit();
+	stats_exit();
+
+	return check_done( "i2c_irq" );
+}
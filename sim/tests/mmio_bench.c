@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio.h"
+#include "i2c.h"
+#include "sim.h"
+#include "spi.h"
+#include "stats.h"
+
+#define BENCH_SPI_LEN		4096
+#define BENCH_SPI_WRITE_LEN	16
+#define BENCH_I2C_LEN		200
+#define BENCH_I2C_ADDR		0x50
+#define BENCH_GPIO_CALLS	1000
+
+// Counts the register accesses and barriers of the hot paths, run with make bench
+static u8 tx[BENCH_SPI_LEN];
+static u8 rx[BENCH_SPI_LEN];
+static u8 regs[256];
+static u8 data[256];
+
+static u64 bench_begin( void ) {
+	sim_reset_counters();
+	return sim_time_ns();
+}
+
+static void bench_report( const char* name, unsigned int block, u64 begin ) {
+	struct sim_counters counters;
+
+	sim_get_counters( block, &counters );
+	printf( "%-12s %10llu ns %8llu reads %8llu writes %8llu barriers\n", name,
+		( unsigned long long ) ( sim_time_ns() - begin ), ( unsigned long long ) counters.reads,
+		( unsigned long long ) counters.writes, ( unsigned long long ) sim_get_barriers() );
+}
+
+int main( void ) {
+	const struct spi_device_profile profile = { SPI_CHIP0, SPI_MODE0, 0, 0, 8 };
+	u64 begin;
+	size_t i;
+
+	for ( i = 0; i < BENCH_SPI_LEN; i++ ) {
+		tx[i] = i * 7;
+	}
+	for ( i = 0; i < sizeof( regs ); i++ ) {
+		regs[i] = i;
+	}
+
+	sim_reset();
+	if ( stats_init() || gpio_init() || spi_init() || i2c_init() ) {
+		fprintf( stderr, "mmio_bench: init failed\n" );
+		return 1;
+	}
+	sim_i2c_attach( BENCH_I2C_ADDR, regs, sizeof( regs ), 1 );
+
+	spi_lock_bus();
+	spi_use_device( spi_register_device( &profile ) );
+	spi_unlock_bus();
+
+	begin = bench_begin();
+	spi_begin_transfer();
+	spi_transfer( tx, rx, BENCH_SPI_LEN );
+	spi_end_transfer();
+	bench_report( "spi_transfer", SIM_BLOCK_SPI0, begin );
+
+	begin = bench_begin();
+	spi_begin_transfer();
+	spi_write( BENCH_SPI_WRITE_LEN, tx );
+	spi_end_transfer();
+	bench_report( "spi_write", SIM_BLOCK_SPI0, begin );
+
+	i2c_bus_set_addr( I2C_BUS1, BENCH_I2C_ADDR );
+	begin = bench_begin();
+	i2c_bus_read_register( I2C_BUS1, 0x00, BENCH_I2C_LEN, data );
+	bench_report( "i2c_read", SIM_BLOCK_BSC1, begin );
+
+	begin = bench_begin();
+	for ( i = 0; i < BENCH_GPIO_CALLS; i++ ) {
+		gpio_write_mask( GPIO_BANK0, BIT( i & 7 ), 0xF0 );
+	}
+	bench_report( "gpio_mask", SIM_BLOCK_GPIO, begin );
+
+	begin = bench_begin();
+	for ( i = 0; i < BENCH_GPIO_CALLS; i++ ) {
+		gpio_read_levels();
+	}
+	bench_report( "gpio_levels", SIM_BLOCK_GPIO, begin );
+
+	sim_i2c_detach( BENCH_I2C_ADDR );
+	i2c_exit();
+	spi_exit();
+	gpio_exit();
+	stats_exit();
+
+	return 0;
+}
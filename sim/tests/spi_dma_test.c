@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "check.h"
+#include "dmac.h"
+#include "gpio.h"
+#include "sim.h"
+#include "spi.h"
+#include "stats.h"
+
+// Three full bounce buffers and a bit, the driver splits DMA transfers into 16384 byte chunks
+#define SPI_TEST_LEN	( 3 * 16384 + 100 )
+#define SPI_TEST_DIV	8
+#define SPI_TEST_RX_CHAN	5
+
+SIM_MODULE_PARAM( spi_dma_irq );
+
+// Records the bytes as they go out on MOSI and answers with a running count on MISO
+struct spi_recorder {
+	u8 mosi[SPI_TEST_LEN];
+	size_t count;
+};
+
+static u8 spi_record( void* ctx, unsigned int cs, u8 mosi ) {
+	struct spi_recorder* const rec = ctx;
+	const size_t n = rec->count++;
+
+	if ( n < SPI_TEST_LEN ) {
+		rec->mosi[n] = mosi;
+	}
+	return n * 3 + ( n >> 10 );
+}
+
+static struct spi_recorder rec;
+static u8 tx[SPI_TEST_LEN];
+static u8 rx[SPI_TEST_LEN];
+
+static void check_chunks( size_t len ) {
+	size_t i;
+
+	memset( &rec, 0, sizeof( rec ) );
+	memset( rx, 0, sizeof( rx ) );
+
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, len ), len );
+	spi_end_transfer();
+
+	// Every chunk lands where it belongs, nothing is lost or repeated at the chunk boundaries
+	CHECK_EQ( rec.count, len );
+	for ( i = 0; i < len; i++ ) {
+		if ( rec.mosi[i] != tx[i] || rx[i] != ( u8 ) ( i * 3 + ( i >> 10 ) ) ) {
+			fprintf( stderr, "%zu byte DMA transfer out of order at byte %zu\n", len, i );
+			check_failures++;
+			break;
+		}
+	}
+}
+
+int main( void ) {
+	static const size_t lens[] = { 128, 16383, 16384, 16385, 2 * 16384, SPI_TEST_LEN };
+	size_t i;
+
+	sim_reset();
+	sim_module_param( spi_dma_irq ) = SIM_IRQ_DMA( SPI_TEST_RX_CHAN );
+	CHECK_EQ( stats_init(), 0 );
+	CHECK_EQ( gpio_init(), 0 );
+	CHECK_EQ( dmac_init(), 0 );
+	CHECK_EQ( spi_init(), 0 );
+
+	for ( i = 0; i < SPI_TEST_LEN; i++ ) {
+		tx[i] = i * 7 + ( i >> 8 );
+	}
+	sim_spi_set_device( spi_record, &rec );
+	spi_set_clk_div( SPI_TEST_DIV );
+
+	for ( i = 0; i < ARRAY_SIZE( lens ); i++ ) {
+		check_chunks( lens[i] );
+	}
+
+	// Every DMA transfer wakes its caller once, the handlers account for their time
+	CHECK_EQ( stats_read( STATS_BUS_SPI0, STATS_WAKES ), ARRAY_SIZE( lens ) );
+	CHECK( stats_read( STATS_BUS_SPI0, STATS_CPU_NS ) > 0 );
+
+	// A channel error ends the transfer with an error, the next transfer starts from a clean channel
+	sim_dmac_fault( SPI_TEST_RX_CHAN, SIM_DMAC_FAULT_ERROR );
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, 1000 ), SPI_ERR_DMA_FAIL );
+	spi_end_transfer();
+	sim_dmac_fault( SPI_TEST_RX_CHAN, SIM_DMAC_FAULT_NONE );
+	sim_advance_ns( 1000000 );
+	check_chunks( 20000 );
+
+	// A channel that never finishes runs into the timeout and is reset by the abort
+	spi_hw_timeout = 10;
+	sim_dmac_fault( SPI_TEST_RX_CHAN, SIM_DMAC_FAULT_STALL );
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, 1000 ), SPI_ERR_HW_TIMEOUT );
+	spi_end_transfer();
+	CHECK_EQ( stats_read( STATS_BUS_SPI0, STATS_TIMEOUTS ), 1 );
+	sim_dmac_fault( SPI_TEST_RX_CHAN, SIM_DMAC_FAULT_NONE );
+	sim_advance_ns( 1000000 );
+	check_chunks( 20000 );
+
+	sim_spi_set_device( ( void* ) 0, ( void* ) 0 );
+	spi_exit();
+	dmac_exit();
+	gpio_exit();
+	stats_exit();
+
+	return check_done( "spi_dma" );
+}
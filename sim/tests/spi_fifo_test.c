@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "check.h"
+#include "gpio.h"
+#include "sim.h"
+#include "spi.h"
+#include "stats.h"
+
+#define SPI_TEST_LEN	4096
+#define SPI_TEST_DIV	8
+
+// Records the bytes as they go out on MOSI and answers with a running count on MISO
+struct spi_recorder {
+	u8 mosi[SPI_TEST_LEN];
+	size_t count;
+};
+
+static u8 spi_record( void* ctx, unsigned int cs, u8 mosi ) {
+	struct spi_recorder* const rec = ctx;
+
+	if ( rec->count < SPI_TEST_LEN ) {
+		rec->mosi[rec->count] = mosi;
+	}
+	return rec->count++ * 5 + 1;
+}
+
+static struct spi_recorder rec;
+static u8 tx[SPI_TEST_LEN];
+static u8 rx[SPI_TEST_LEN];
+
+static void check_order( size_t len ) {
+	size_t i;
+
+	memset( &rec, 0, sizeof( rec ) );
+	memset( rx, 0, sizeof( rx ) );
+
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, len ), len );
+	spi_end_transfer();
+
+	// Both directions keep the order of the buffers, whatever the FIFO fill level was
+	CHECK_EQ( rec.count, len );
+	for ( i = 0; i < len; i++ ) {
+		if ( rec.mosi[i] != tx[i] || rx[i] != ( u8 ) ( i * 5 + 1 ) ) {
+			fprintf( stderr, "%zu byte transfer out of order at byte %zu\n", len, i );
+			check_failures++;
+			break;
+		}
+	}
+}
+
+int main( void ) {
+	static const size_t lens[] = { 1, 2, 47, 48, 63, 64, 65, 127, 128, 129, 1000, SPI_TEST_LEN };
+	size_t i;
+
+	sim_reset();
+	CHECK_EQ( stats_init(), 0 );
+	CHECK_EQ( gpio_init(), 0 );
+	CHECK_EQ( spi_init(), 0 );
+
+	for ( i = 0; i < SPI_TEST_LEN; i++ ) {
+		tx[i] = i * 7 + ( i >> 8 );
+	}
+	sim_spi_set_device( spi_record, &rec );
+	spi_set_clk_div( SPI_TEST_DIV );
+
+	for ( i = 0; i < ARRAY_SIZE( lens ); i++ ) {
+		check_order( lens[i] );
+	}
+
+	// A NULL transmit buffer clocks out zeros
+	memset( &rec, 0, sizeof( rec ) );
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( ( const u8* ) 0, rx, 100 ), 100 );
+	spi_end_transfer();
+	CHECK_EQ( rec.mosi[0] | rec.mosi[50] | rec.mosi[99], 0 );
+
+	// Keeping the FIFO full should get close to the rate the clock allows
+	memset( &rec, 0, sizeof( rec ) );
+	const u64 begin = sim_time_ns();
+	spi_begin_transfer();
+	CHECK_EQ( spi_transfer( tx, rx, SPI_TEST_LEN ), SPI_TEST_LEN );
+	spi_end_transfer();
+	const u64 ns = sim_time_ns() - begin;
+	const u64 rate = SPI_TEST_LEN * 1000000000ULL / ns;
+	const u64 wire = SIM_CORE_CLK_HZ / SPI_TEST_DIV / 8;
+	printf( "spi_fifo: %d bytes in %llu ns, %llu bytes/s of %llu bytes/s on the wire\n", SPI_TEST_LEN,
+		( unsigned long long ) ns, ( unsigned long long ) rate, ( unsigned long long ) wire );
+	CHECK( rate * 100 >= wire * 95 );
+
+	sim_spi_set_device( ( void* ) 0, ( void* ) 0 );
+	spi_exit();
+	gpio_exit();
+	stats_exit();
+
+	return check_done( "spi_fifo" );
+}
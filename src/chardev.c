@@ -0,0 +1,1000 @@
+#include "chardev.h"
+
+#include <linux/bitops.h>
+#include <linux/err.h>
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include <asm/barrier.h>
+
+#include <log.h>
+
+#include "gpio.h"
+#include "gpio_event.h"
+#include "gpio_pattern.h"
+#include "gpio_sampler.h"
+#include "gpio_trigger.h"
+#include "i2c.h"
+#include "i2c_poll.h"
+#include "spi.h"
+#include "spi_stream.h"
+#include "uapi/spectr_io.h"
+
+#define CHARDEV_KIND_SPI	0
+#define CHARDEV_KIND_I2C	1
+#define CHARDEV_KIND_GPIO	2
+#define CHARDEV_KIND_SAMPLE	3
+#define CHARDEV_KIND_PATTERN	4
+#define CHARDEV_KIND_TRIGGER	5
+
+struct chardev {
+	unsigned int kind;
+	unsigned int bus;
+	struct miscdevice misc;
+	int registered;
+};
+
+// The state of an open file. Batches on the same file are serialized, batches on different files
+// only contend for the bus.
+struct chardev_file {
+	const struct chardev* dev;
+	struct mutex lock;		// Held for the whole of every ioctl.
+	unsigned long spi_devices;	// The SPI device handles registered through the file.
+	struct spi_stream* stream;	// The capture stream of the file, created on its first start.
+	int stream_device;		// The device handle the running stream uses.
+	struct gpio_sampler* sampler;	// The GPIO sampler of the file, created on its first start.
+	struct i2c_poller* poller;	// The I2C poller of the file, created on its first start.
+
+	u8* data;			// The bounce buffer of the batch data, only ever grown.
+	size_t data_size;
+
+	// The batch being run, kept here as it is too large for the stack
+	union {
+		struct spectr_io_spi_xfer spi[SPECTR_IO_BATCH_MAX];
+		struct {
+			struct spectr_io_i2c_xfer xfers[SPECTR_IO_BATCH_MAX];
+			struct spectr_io_i2c_msg msgs[SPECTR_IO_I2C_MSGS_MAX];
+			struct i2c1_msg kmsgs[SPECTR_IO_I2C_MSGS_MAX];
+		} i2c;
+	};
+};
+
+static const struct file_operations chardev_fops;
+
+static struct chardev chardevs[] = {
+	{
+		.kind = CHARDEV_KIND_SPI,
+		.bus = 0,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-spi0",
+			.fops = &chardev_fops,
+		},
+	},
+	{
+		.kind = CHARDEV_KIND_I2C,
+		.bus = I2C_BUS1,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-i2c1",
+			.fops = &chardev_fops,
+		},
+	},
+	{
+		.kind = CHARDEV_KIND_GPIO,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-gpio",
+			.fops = &chardev_fops,
+		},
+	},
+	{
+		.kind = CHARDEV_KIND_SAMPLE,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-gpio-sample",
+			.fops = &chardev_fops,
+		},
+	},
+	{
+		.kind = CHARDEV_KIND_PATTERN,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-gpio-pattern",
+			.fops = &chardev_fops,
+		},
+	},
+	{
+		.kind = CHARDEV_KIND_TRIGGER,
+		.misc = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "spectr-gpio-trigger",
+			.fops = &chardev_fops,
+		},
+	},
+};
+
+static int chardev_reserve( struct chardev_file* cf, size_t size ) {
+	if ( size <= cf->data_size ) {
+		return 0;
+	}
+
+	kfree( cf->data );
+	cf->data = kmalloc( size, GFP_KERNEL );
+	if ( !cf->data ) {
+		cf->data_size = 0;
+		return -ENOMEM;
+	}
+	cf->data_size = size;
+
+	return 0;
+}
+
+static int chardev_get_batch( struct spectr_io_batch* batch, void __user* arg ) {
+	if ( copy_from_user( batch, arg, sizeof( *batch ) ) ) {
+		return -EFAULT;
+	}
+	if ( batch->reserved ) {
+		return -EINVAL;
+	}
+	if ( batch->count > SPECTR_IO_BATCH_MAX ) {
+		return -E2BIG;
+	}
+
+	return 0;
+}
+
+static long chardev_spi_add_device( struct chardev_file* cf, struct spectr_io_spi_device __user* arg ) {
+	struct spectr_io_spi_device udev;
+
+	if ( copy_from_user( &udev, arg, sizeof( udev ) ) ) {
+		return -EFAULT;
+	}
+	if ( udev.reserved || udev.chip > SPI_CHIP2 ) {
+		return -EINVAL;
+	}
+
+	const struct spi_device_profile profile = {
+		.chip = udev.chip,
+		.mode = udev.mode,
+		.cs_high = udev.cs_high,
+		.reads = udev.reads,
+		.clk_div = udev.clk_div,
+	};
+	const int handle = spi_register_device( &profile );
+	if ( handle < 0 ) {
+		return -ENOSPC;
+	}
+
+	udev.handle = handle;
+	if ( copy_to_user( arg, &udev, sizeof( udev ) ) ) {
+		spi_unregister_device( handle );
+		return -EFAULT;
+	}
+	cf->spi_devices |= BIT( handle );
+
+	return 0;
+}
+
+static long chardev_spi_remove_device( struct chardev_file* cf, unsigned long handle ) {
+	if ( handle >= SPI_DEVICES || !( cf->spi_devices & BIT( handle ) ) ) {
+		return -EINVAL;
+	}
+	if ( cf->stream && spi_stream_running( cf->stream ) && cf->stream_device == handle ) {
+		return -EBUSY;
+	}
+
+	spi_unregister_device( handle );
+	cf->spi_devices &= ~BIT( handle );
+
+	return 0;
+}
+
+static u32 chardev_spi_run( struct chardev_file* cf, u32 count ) {
+	u8* data = cf->data;
+	int selected = 0;
+	u32 done;
+
+	spi_lock_bus();
+	for ( done = 0; done < count; done++ ) {
+		struct spectr_io_spi_xfer* const x = &cf->spi[done];
+		const u8* const tx = x->tx ? data : ( u8* ) 0;
+		data += x->tx ? x->len : 0;
+		u8* const rx = x->rx ? data : ( u8* ) 0;
+		data += x->rx ? x->len : 0;
+
+		if ( x->device != SPECTR_IO_SPI_KEEP_DEVICE ) {
+			if ( selected ) {
+				spi_end_transfer();
+				selected = 0;
+			}
+			x->result = spi_use_device( x->device );
+			if ( x->result ) {
+				break;
+			}
+		}
+
+		if ( !selected ) {
+			spi_begin_transfer();
+			selected = 1;
+		}
+		x->result = spi_transfer( tx, rx, x->len );
+		if ( x->result < 0 ) {
+			break;
+		}
+
+		if ( !( x->flags & SPECTR_IO_SPI_CS_KEEP ) ) {
+			spi_end_transfer();
+			selected = 0;
+		}
+	}
+
+	// The bus is not kept across calls, so a chip the last transfer held is released here
+	if ( selected ) {
+		spi_end_transfer();
+	}
+	spi_unlock_bus();
+
+	return done;
+}
+
+static long chardev_spi_batch( struct chardev_file* cf, void __user* arg ) {
+	struct spectr_io_batch batch;
+	size_t total = 0;
+	u8* data;
+	u32 done;
+	u32 i;
+	int err;
+
+	err = chardev_get_batch( &batch, arg );
+	if ( err ) {
+		return err;
+	}
+
+	struct spectr_io_spi_xfer __user* const uxfers = u64_to_user_ptr( batch.xfers );
+	if ( copy_from_user( cf->spi, uxfers, batch.count * sizeof( cf->spi[0] ) ) ) {
+		return -EFAULT;
+	}
+
+	// Each direction gets its own room in the bounce buffer, DMA transfers need them apart
+	for ( i = 0; i < batch.count; i++ ) {
+		const struct spectr_io_spi_xfer* const x = &cf->spi[i];
+		if ( x->flags & ~SPECTR_IO_SPI_CS_KEEP ) {
+			return -EINVAL;
+		}
+		if ( x->device != SPECTR_IO_SPI_KEEP_DEVICE && ( x->device < 0 || x->device >= SPI_DEVICES
+				|| !( cf->spi_devices & BIT( x->device ) ) ) ) {
+			return -EINVAL;
+		}
+		if ( x->len > SPECTR_IO_BATCH_DATA_MAX ) {
+			return -E2BIG;
+		}
+
+		total += ( x->tx ? x->len : 0 ) + ( x->rx ? x->len : 0 );
+		if ( total > SPECTR_IO_BATCH_DATA_MAX ) {
+			return -E2BIG;
+		}
+	}
+
+	err = chardev_reserve( cf, total );
+	if ( err ) {
+		return err;
+	}
+
+	data = cf->data;
+	for ( i = 0; i < batch.count; i++ ) {
+		const struct spectr_io_spi_xfer* const x = &cf->spi[i];
+		if ( x->tx ) {
+			if ( copy_from_user( data, u64_to_user_ptr( x->tx ), x->len ) ) {
+				return -EFAULT;
+			}
+			data += x->len;
+		}
+		data += x->rx ? x->len : 0;
+	}
+
+	done = chardev_spi_run( cf, batch.count );
+
+	data = cf->data;
+	for ( i = 0; i < done; i++ ) {
+		const struct spectr_io_spi_xfer* const x = &cf->spi[i];
+		data += x->tx ? x->len : 0;
+		if ( x->rx ) {
+			if ( copy_to_user( u64_to_user_ptr( x->rx ), data, x->len ) ) {
+				return -EFAULT;
+			}
+			data += x->len;
+		}
+	}
+
+	// The results go back for the transfers that ran, the failed one included
+	if ( copy_to_user( uxfers, cf->spi, min( done + 1, batch.count ) * sizeof( cf->spi[0] ) ) ) {
+		return -EFAULT;
+	}
+
+	return done;
+}
+
+static long chardev_spi_stream_start( struct chardev_file* cf, struct spectr_io_stream_config __user* arg ) {
+	struct spectr_io_stream_config uconfig;
+	struct spi_stream_config config;
+	u8* tx = ( u8* ) 0;
+	long err;
+
+	if ( copy_from_user( &uconfig, arg, sizeof( uconfig ) ) ) {
+		return -EFAULT;
+	}
+	if ( uconfig.device != SPECTR_IO_SPI_KEEP_DEVICE && ( uconfig.device < 0 || uconfig.device >= SPI_DEVICES
+			|| !( cf->spi_devices & BIT( uconfig.device ) ) ) ) {
+		return -EINVAL;
+	}
+
+	// The ring may already be mapped, so it keeps the geometry it was created with
+	if ( !cf->stream ) {
+		struct spi_stream* const stream = spi_stream_create( uconfig.frame_len, uconfig.frames );
+		if ( IS_ERR( stream ) ) {
+			return PTR_ERR( stream );
+		}
+		smp_store_release( &cf->stream, stream );
+	} else if ( !spi_stream_fits( cf->stream, uconfig.frame_len, uconfig.frames ) ) {
+		return -EBUSY;
+	}
+	if ( spi_stream_running( cf->stream ) ) {
+		return -EBUSY;
+	}
+
+	if ( uconfig.tx ) {
+		tx = memdup_user( u64_to_user_ptr( uconfig.tx ), uconfig.frame_len );
+		if ( IS_ERR( tx ) ) {
+			return PTR_ERR( tx );
+		}
+	}
+
+	config = ( struct spi_stream_config ) {
+		.tx = tx,
+		.device = uconfig.device,
+		.period_us = uconfig.period_us,
+		.notify = uconfig.notify,
+		.eventfd = ( struct eventfd_ctx* ) 0,
+	};
+	if ( uconfig.eventfd >= 0 ) {
+		config.eventfd = eventfd_ctx_fdget( uconfig.eventfd );
+		if ( IS_ERR( config.eventfd ) ) {
+			kfree( tx );
+			return PTR_ERR( config.eventfd );
+		}
+	}
+
+	err = spi_stream_start( cf->stream, &config );
+	kfree( tx );
+	if ( !err ) {
+		cf->stream_device = uconfig.device;
+	}
+
+	return err;
+}
+
+static long chardev_spi_stream_stop( struct chardev_file* cf ) {
+	if ( !cf->stream ) {
+		return -EINVAL;
+	}
+
+	spi_stream_stop( cf->stream );
+
+	return 0;
+}
+
+static long chardev_spi_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_SPI_IOC_ADD_DEVICE:
+		return chardev_spi_add_device( cf, ( struct spectr_io_spi_device __user* ) arg );
+	case SPECTR_IO_SPI_IOC_REMOVE_DEVICE:
+		return chardev_spi_remove_device( cf, arg );
+	case SPECTR_IO_SPI_IOC_BATCH:
+		return chardev_spi_batch( cf, ( void __user* ) arg );
+	case SPECTR_IO_SPI_IOC_STREAM_START:
+		return chardev_spi_stream_start( cf, ( struct spectr_io_stream_config __user* ) arg );
+	case SPECTR_IO_SPI_IOC_STREAM_STOP:
+		return chardev_spi_stream_stop( cf );
+	}
+
+	return -ENOTTY;
+}
+
+static long chardev_i2c_add_device( struct chardev_file* cf, struct spectr_io_i2c_device __user* arg ) {
+	struct spectr_io_i2c_device udev;
+
+	if ( copy_from_user( &udev, arg, sizeof( udev ) ) ) {
+		return -EFAULT;
+	}
+	if ( udev.addr > 0x7F ) {
+		return -EINVAL;
+	}
+
+	const struct i2c_device_profile profile = {
+		.addr = udev.addr,
+		.max_hz = udev.max_hz,
+		.clkt = udev.clkt,
+		.fedl = udev.fedl,
+		.redl = udev.redl,
+	};
+
+	return i2c_bus_add_device( cf->dev->bus, &profile ) ? -EINVAL : 0;
+}
+
+static long chardev_i2c_remove_device( struct chardev_file* cf, unsigned long addr ) {
+	if ( addr > 0x7F ) {
+		return -EINVAL;
+	}
+
+	i2c_bus_remove_device( cf->dev->bus, addr );
+
+	return 0;
+}
+
+static long chardev_i2c_batch( struct chardev_file* cf, void __user* arg ) {
+	struct spectr_io_batch batch;
+	size_t total = 0;
+	size_t msgs = 0;
+	size_t k;
+	u8* data;
+	u32 done;
+	u32 i;
+	int err;
+
+	err = chardev_get_batch( &batch, arg );
+	if ( err ) {
+		return err;
+	}
+
+	struct spectr_io_i2c_xfer __user* const uxfers = u64_to_user_ptr( batch.xfers );
+	if ( copy_from_user( cf->i2c.xfers, uxfers, batch.count * sizeof( cf->i2c.xfers[0] ) ) ) {
+		return -EFAULT;
+	}
+
+	// The messages of all the transfers are gathered back to back
+	for ( i = 0; i < batch.count; i++ ) {
+		const struct spectr_io_i2c_xfer* const x = &cf->i2c.xfers[i];
+		if ( !x->count ) {
+			return -EINVAL;
+		}
+		if ( x->count > SPECTR_IO_I2C_MSGS_MAX - msgs ) {
+			return -E2BIG;
+		}
+		if ( copy_from_user( &cf->i2c.msgs[msgs], u64_to_user_ptr( x->msgs ),
+				x->count * sizeof( cf->i2c.msgs[0] ) ) ) {
+			return -EFAULT;
+		}
+
+		for ( k = msgs; k < msgs + x->count; k++ ) {
+			const struct spectr_io_i2c_msg* const m = &cf->i2c.msgs[k];
+			if ( m->addr > 0x7F || m->flags & ~( SPECTR_IO_I2C_M_RD | SPECTR_IO_I2C_M_NOSTART ) ) {
+				return -EINVAL;
+			}
+			// A continued message is moved as part of the one before it, in its direction and to
+			// its address. Read buffers are never copied in, a read moved as a write would send
+			// whatever the bounce buffer held
+			if ( m->flags & SPECTR_IO_I2C_M_NOSTART && ( k == msgs
+					|| ( m->flags ^ m[-1].flags ) & SPECTR_IO_I2C_M_RD || m->addr != m[-1].addr ) ) {
+				return -EINVAL;
+			}
+			if ( m->len > SPECTR_IO_BATCH_DATA_MAX - total ) {
+				return -E2BIG;
+			}
+			total += m->len;
+		}
+		msgs += x->count;
+	}
+
+	err = chardev_reserve( cf, total );
+	if ( err ) {
+		return err;
+	}
+
+	data = cf->data;
+	for ( k = 0; k < msgs; k++ ) {
+		const struct spectr_io_i2c_msg* const m = &cf->i2c.msgs[k];
+		if ( !( m->flags & SPECTR_IO_I2C_M_RD ) && copy_from_user( data, u64_to_user_ptr( m->buf ), m->len ) ) {
+			return -EFAULT;
+		}
+
+		cf->i2c.kmsgs[k] = ( struct i2c1_msg ) {
+			.addr = m->addr,
+			.flags = ( m->flags & SPECTR_IO_I2C_M_RD ? I2C1_M_RD : 0 )
+				| ( m->flags & SPECTR_IO_I2C_M_NOSTART ? I2C1_M_NOSTART : 0 ),
+			.len = m->len,
+			.buf = data,
+		};
+		data += m->len;
+	}
+
+	msgs = 0;
+	for ( done = 0; done < batch.count; done++ ) {
+		struct spectr_io_i2c_xfer* const x = &cf->i2c.xfers[done];
+		x->result = i2c_bus_transfer( cf->dev->bus, &cf->i2c.kmsgs[msgs], x->count );
+		if ( x->result ) {
+			break;
+		}
+		msgs += x->count;
+	}
+
+	for ( k = 0; k < msgs; k++ ) {
+		const struct spectr_io_i2c_msg* const m = &cf->i2c.msgs[k];
+		if ( m->flags & SPECTR_IO_I2C_M_RD
+				&& copy_to_user( u64_to_user_ptr( m->buf ), cf->i2c.kmsgs[k].buf, m->len ) ) {
+			return -EFAULT;
+		}
+	}
+
+	// The results go back for the transfers that ran, the failed one included
+	if ( copy_to_user( uxfers, cf->i2c.xfers, min( done + 1, batch.count ) * sizeof( cf->i2c.xfers[0] ) ) ) {
+		return -EFAULT;
+	}
+
+	return done;
+}
+
+static long chardev_i2c_poll_start( struct chardev_file* cf, struct spectr_io_i2c_poll_table __user* arg ) {
+	struct spectr_io_i2c_poll_table table;
+	int err;
+
+	if ( copy_from_user( &table, arg, sizeof( table ) ) ) {
+		return -EFAULT;
+	}
+	if ( table.reserved || !table.count || table.count > SPECTR_IO_I2C_POLL_JOBS_MAX ) {
+		return -EINVAL;
+	}
+
+	err = chardev_reserve( cf, table.count * sizeof( struct spectr_io_i2c_poll_job ) );
+	if ( err ) {
+		return err;
+	}
+	if ( copy_from_user( cf->data, u64_to_user_ptr( table.jobs ), table.count * sizeof( struct spectr_io_i2c_poll_job ) ) ) {
+		return -EFAULT;
+	}
+
+	// The snapshot may already be mapped, so it is kept over restarts
+	if ( !cf->poller ) {
+		struct i2c_poller* const poller = i2c_poller_create( cf->dev->bus );
+		if ( IS_ERR( poller ) ) {
+			return PTR_ERR( poller );
+		}
+		cf->poller = poller;
+	}
+
+	return i2c_poller_start( cf->poller, ( const struct spectr_io_i2c_poll_job* ) cf->data, table.count );
+}
+
+static long chardev_i2c_poll_stop( struct chardev_file* cf ) {
+	if ( !cf->poller ) {
+		return -EINVAL;
+	}
+
+	i2c_poller_stop( cf->poller );
+
+	return 0;
+}
+
+static long chardev_i2c_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_I2C_IOC_ADD_DEVICE:
+		return chardev_i2c_add_device( cf, ( struct spectr_io_i2c_device __user* ) arg );
+	case SPECTR_IO_I2C_IOC_REMOVE_DEVICE:
+		return chardev_i2c_remove_device( cf, arg );
+	case SPECTR_IO_I2C_IOC_BATCH:
+		return chardev_i2c_batch( cf, ( void __user* ) arg );
+	case SPECTR_IO_I2C_IOC_POLL_START:
+		return chardev_i2c_poll_start( cf, ( struct spectr_io_i2c_poll_table __user* ) arg );
+	case SPECTR_IO_I2C_IOC_POLL_STOP:
+		return chardev_i2c_poll_stop( cf );
+	}
+
+	return -ENOTTY;
+}
+
+static int chardev_gpio_edges( u32 edges, unsigned int* gpio_edges ) {
+	if ( edges & ~( SPECTR_IO_GPIO_EDGE_RISING | SPECTR_IO_GPIO_EDGE_FALLING | SPECTR_IO_GPIO_EDGE_ASYNC ) ) {
+		return -EINVAL;
+	}
+
+	*gpio_edges = ( edges & SPECTR_IO_GPIO_EDGE_RISING ? GPIO_EDGE_RISING : 0 )
+		| ( edges & SPECTR_IO_GPIO_EDGE_FALLING ? GPIO_EDGE_FALLING : 0 )
+		| ( edges & SPECTR_IO_GPIO_EDGE_ASYNC ? GPIO_EDGE_ASYNC : 0 );
+
+	return 0;
+}
+
+static long chardev_gpio_watch( struct spectr_io_gpio_watch __user* arg ) {
+	struct spectr_io_gpio_watch watch;
+	unsigned int edges;
+
+	if ( copy_from_user( &watch, arg, sizeof( watch ) ) ) {
+		return -EFAULT;
+	}
+	if ( chardev_gpio_edges( watch.edges, &edges ) ) {
+		return -EINVAL;
+	}
+
+	return gpio_event_watch( watch.pin, edges );
+}
+
+static long chardev_gpio_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_GPIO_IOC_WATCH:
+		return chardev_gpio_watch( ( struct spectr_io_gpio_watch __user* ) arg );
+	}
+
+	return -ENOTTY;
+}
+
+static long chardev_sample_start( struct chardev_file* cf, struct spectr_io_gpio_sample_config __user* arg ) {
+	struct spectr_io_gpio_sample_config uconfig;
+	struct gpio_sampler_config config;
+
+	if ( copy_from_user( &uconfig, arg, sizeof( uconfig ) ) ) {
+		return -EFAULT;
+	}
+	if ( uconfig.flags & ~SPECTR_IO_GPIO_SAMPLE_RLE || uconfig.reserved ) {
+		return -EINVAL;
+	}
+
+	// The ring may already be mapped, so it keeps the size it was created with
+	if ( !cf->sampler ) {
+		struct gpio_sampler* const sampler = gpio_sampler_create( uconfig.words );
+		if ( IS_ERR( sampler ) ) {
+			return PTR_ERR( sampler );
+		}
+		smp_store_release( &cf->sampler, sampler );
+	} else if ( !gpio_sampler_fits( cf->sampler, uconfig.words ) ) {
+		return -EBUSY;
+	}
+	if ( gpio_sampler_running( cf->sampler ) ) {
+		return -EBUSY;
+	}
+
+	config = ( struct gpio_sampler_config ) {
+		.period_ns = uconfig.period_ns,
+		.rle = uconfig.flags & SPECTR_IO_GPIO_SAMPLE_RLE,
+		.notify = uconfig.notify,
+		.eventfd = ( struct eventfd_ctx* ) 0,
+	};
+	if ( uconfig.eventfd >= 0 ) {
+		config.eventfd = eventfd_ctx_fdget( uconfig.eventfd );
+		if ( IS_ERR( config.eventfd ) ) {
+			return PTR_ERR( config.eventfd );
+		}
+	}
+
+	return gpio_sampler_start( cf->sampler, &config );
+}
+
+static long chardev_sample_stop( struct chardev_file* cf ) {
+	if ( !cf->sampler ) {
+		return -EINVAL;
+	}
+
+	gpio_sampler_stop( cf->sampler );
+
+	return 0;
+}
+
+static long chardev_sample_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_GPIO_IOC_SAMPLE_START:
+		return chardev_sample_start( cf, ( struct spectr_io_gpio_sample_config __user* ) arg );
+	case SPECTR_IO_GPIO_IOC_SAMPLE_STOP:
+		return chardev_sample_stop( cf );
+	}
+
+	return -ENOTTY;
+}
+
+static long chardev_pattern_load( struct spectr_io_gpio_pattern __user* arg ) {
+	struct spectr_io_gpio_pattern pattern;
+
+	if ( copy_from_user( &pattern, arg, sizeof( pattern ) ) ) {
+		return -EFAULT;
+	}
+
+	return gpio_pattern_load( u64_to_user_ptr( pattern.steps ), pattern.count, pattern.loops );
+}
+
+static long chardev_pattern_status( struct spectr_io_gpio_pattern_status __user* arg ) {
+	struct spectr_io_gpio_pattern_status status;
+
+	gpio_pattern_status( &status );
+
+	return copy_to_user( arg, &status, sizeof( status ) ) ? -EFAULT : 0;
+}
+
+static long chardev_pattern_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_GPIO_IOC_PATTERN_LOAD:
+		return chardev_pattern_load( ( struct spectr_io_gpio_pattern __user* ) arg );
+	case SPECTR_IO_GPIO_IOC_PATTERN_START:
+		return gpio_pattern_start();
+	case SPECTR_IO_GPIO_IOC_PATTERN_STOP:
+		gpio_pattern_stop();
+		return 0;
+	case SPECTR_IO_GPIO_IOC_PATTERN_STATUS:
+		return chardev_pattern_status( ( struct spectr_io_gpio_pattern_status __user* ) arg );
+	}
+
+	return -ENOTTY;
+}
+
+static long chardev_trigger_add( struct spectr_io_trigger __user* arg ) {
+	struct spectr_io_trigger utrigger;
+	struct gpio_trigger_config config;
+	unsigned int edges;
+
+	if ( copy_from_user( &utrigger, arg, sizeof( utrigger ) ) ) {
+		return -EFAULT;
+	}
+	if ( utrigger.reserved0 || utrigger.reserved1 || utrigger.spi.reserved
+			|| ( utrigger.kind == SPECTR_IO_TRIGGER_SPI && utrigger.spi.chip > SPI_CHIP2 )
+			|| ( utrigger.kind != SPECTR_IO_TRIGGER_SPI && utrigger.kind != SPECTR_IO_TRIGGER_I2C )
+			|| chardev_gpio_edges( utrigger.edges, &edges ) ) {
+		return -EINVAL;
+	}
+
+	config = ( struct gpio_trigger_config ) {
+		.pin = utrigger.pin,
+		.edges = edges,
+		.kind = utrigger.kind == SPECTR_IO_TRIGGER_I2C ? GPIO_TRIGGER_I2C : GPIO_TRIGGER_SPI,
+		.len = utrigger.len,
+		.spi = {
+			.chip = utrigger.spi.chip,
+			.mode = utrigger.spi.mode,
+			.cs_high = utrigger.spi.cs_high,
+			.reads = utrigger.spi.reads,
+			.clk_div = utrigger.spi.clk_div,
+		},
+		.tx = utrigger.tx,
+		.i2c_bus = utrigger.i2c_bus,
+		.i2c_addr = utrigger.i2c_addr,
+		.i2c_reg = utrigger.i2c_reg,
+	};
+	const int handle = gpio_trigger_add( &config );
+	if ( handle < 0 ) {
+		return handle;
+	}
+
+	utrigger.handle = handle;
+	if ( copy_to_user( arg, &utrigger, sizeof( utrigger ) ) ) {
+		gpio_trigger_remove( handle );
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static long chardev_trigger_ioctl( struct chardev_file* cf, unsigned int cmd, unsigned long arg ) {
+	switch ( cmd ) {
+	case SPECTR_IO_TRIGGER_IOC_ADD:
+		return chardev_trigger_add( ( struct spectr_io_trigger __user* ) arg );
+	case SPECTR_IO_TRIGGER_IOC_REMOVE:
+		return arg > INT_MAX ? -EINVAL : gpio_trigger_remove( arg );
+	}
+
+	return -ENOTTY;
+}
+
+static long chardev_ioctl( struct file* file, unsigned int cmd, unsigned long arg ) {
+	struct chardev_file* const cf = file->private_data;
+	long ret;
+
+	if ( mutex_lock_interruptible( &cf->lock ) ) {
+		return -ERESTARTSYS;
+	}
+	switch ( cf->dev->kind ) {
+	case CHARDEV_KIND_SPI:
+		ret = chardev_spi_ioctl( cf, cmd, arg );
+		break;
+	case CHARDEV_KIND_I2C:
+		ret = chardev_i2c_ioctl( cf, cmd, arg );
+		break;
+	case CHARDEV_KIND_GPIO:
+		ret = chardev_gpio_ioctl( cf, cmd, arg );
+		break;
+	case CHARDEV_KIND_SAMPLE:
+		ret = chardev_sample_ioctl( cf, cmd, arg );
+		break;
+	case CHARDEV_KIND_PATTERN:
+		ret = chardev_pattern_ioctl( cf, cmd, arg );
+		break;
+	default:
+		ret = chardev_trigger_ioctl( cf, cmd, arg );
+		break;
+	}
+	mutex_unlock( &cf->lock );
+
+	return ret;
+}
+
+static int chardev_mmap( struct file* file, struct vm_area_struct* vma ) {
+	struct chardev_file* const cf = file->private_data;
+	int err;
+
+	mutex_lock( &cf->lock );
+	if ( cf->dev->kind == CHARDEV_KIND_SAMPLE ) {
+		err = cf->sampler ? gpio_sampler_mmap( cf->sampler, vma ) : -ENODEV;
+	} else if ( cf->dev->kind == CHARDEV_KIND_I2C ) {
+		err = cf->poller ? i2c_poller_mmap( cf->poller, vma ) : -ENODEV;
+	} else {
+		err = cf->stream ? spi_stream_mmap( cf->stream, vma ) : -ENODEV;
+	}
+	mutex_unlock( &cf->lock );
+
+	return err;
+}
+
+static ssize_t chardev_read( struct file* file, char __user* buf, size_t len, loff_t* pos ) {
+	struct chardev_file* const cf = file->private_data;
+
+	if ( cf->dev->kind == CHARDEV_KIND_TRIGGER ) {
+		return gpio_trigger_read( buf, len, file->f_flags & O_NONBLOCK );
+	}
+	if ( cf->dev->kind != CHARDEV_KIND_GPIO ) {
+		return -EINVAL;
+	}
+
+	return gpio_event_read( buf, len, file->f_flags & O_NONBLOCK );
+}
+
+static __poll_t chardev_poll( struct file* file, poll_table* wait ) {
+	struct chardev_file* const cf = file->private_data;
+
+	if ( cf->dev->kind == CHARDEV_KIND_GPIO ) {
+		return gpio_event_poll( file, wait );
+	}
+	if ( cf->dev->kind == CHARDEV_KIND_PATTERN ) {
+		return gpio_pattern_poll( file, wait );
+	}
+	if ( cf->dev->kind == CHARDEV_KIND_TRIGGER ) {
+		return gpio_trigger_poll( file, wait );
+	}
+
+	// The stream and the sampler are never freed before the file, only created, so no lock is
+	// needed once they are seen
+	if ( cf->dev->kind == CHARDEV_KIND_SAMPLE ) {
+		struct gpio_sampler* const sampler = smp_load_acquire( &cf->sampler );
+		return sampler ? gpio_sampler_poll( sampler, file, wait ) : EPOLLERR;
+	}
+
+	struct spi_stream* const stream = smp_load_acquire( &cf->stream );
+	if ( !stream ) {
+		return EPOLLERR;
+	}
+
+	return spi_stream_poll( stream, file, wait );
+}
+
+static int chardev_open( struct inode* inode, struct file* file ) {
+	// The misc device layer leaves the device in the private data
+	struct miscdevice* const misc = file->private_data;
+
+	const struct chardev* const dev = container_of( misc, struct chardev, misc );
+	int err;
+
+	// The event and sample rings have a single reader and there is a single pattern engine, so
+	// only one file can be open on each at a time
+	if ( dev->kind == CHARDEV_KIND_GPIO ) {
+		err = gpio_event_open();
+		if ( err ) {
+			return err;
+		}
+	} else if ( dev->kind == CHARDEV_KIND_PATTERN ) {
+		err = gpio_pattern_open();
+		if ( err ) {
+			return err;
+		}
+	} else if ( dev->kind == CHARDEV_KIND_TRIGGER ) {
+		err = gpio_trigger_open();
+		if ( err ) {
+			return err;
+		}
+	}
+
+	struct chardev_file* const cf = kzalloc( sizeof( *cf ), GFP_KERNEL );
+	if ( !cf ) {
+		if ( dev->kind == CHARDEV_KIND_GPIO ) {
+			gpio_event_release();
+		} else if ( dev->kind == CHARDEV_KIND_PATTERN ) {
+			gpio_pattern_release();
+		} else if ( dev->kind == CHARDEV_KIND_TRIGGER ) {
+			gpio_trigger_release();
+		}
+		return -ENOMEM;
+	}
+
+	cf->dev = dev;
+	mutex_init( &cf->lock );
+	file->private_data = cf;
+
+	return 0;
+}
+
+static int chardev_release( struct inode* inode, struct file* file ) {
+	struct chardev_file* const cf = file->private_data;
+	unsigned long handle;
+
+	if ( cf->dev->kind == CHARDEV_KIND_GPIO ) {
+		gpio_event_release();
+	} else if ( cf->dev->kind == CHARDEV_KIND_PATTERN ) {
+		gpio_pattern_release();
+	} else if ( cf->dev->kind == CHARDEV_KIND_TRIGGER ) {
+		gpio_trigger_release();
+	}
+
+	// The stream goes first, it may be using one of the devices
+	if ( cf->stream ) {
+		spi_stream_destroy( cf->stream );
+	}
+	if ( cf->sampler ) {
+		gpio_sampler_destroy( cf->sampler );
+	}
+	if ( cf->poller ) {
+		i2c_poller_destroy( cf->poller );
+	}
+
+	// SPI device slots are few, the ones a process registered go away with it
+	for ( handle = 0; handle < SPI_DEVICES; handle++ ) {
+		if ( cf->spi_devices & BIT( handle ) ) {
+			spi_unregister_device( handle );
+		}
+	}
+
+	kfree( cf->data );
+	kfree( cf );
+
+	return 0;
+}
+
+static const struct file_operations chardev_fops = {
+	.owner = THIS_MODULE,
+	.open = chardev_open,
+	.release = chardev_release,
+	.read = chardev_read,
+	.unlocked_ioctl = chardev_ioctl,
+	.mmap = chardev_mmap,
+	.poll = chardev_poll,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
+};
+
+int __init chardev_init( void ) {
+	size_t i;
+	int err;
+
+	for ( i = 0; i < ARRAY_SIZE( chardevs ); i++ ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "Chardev registering /dev/%s.", chardevs[i].misc.name );
+#endif // DEBUG
+		err = misc_register( &chardevs[i].misc );
+		if ( err ) {
+			// Not fatal, the kernel interface works without the devices
+			LOG( KERN_ERR, "Chardev failed to register /dev/%s.", chardevs[i].misc.name );
+			continue;
+		}
+		chardevs[i].registered = 1;
+	}
+
+	return 0;
+}
+
+void chardev_exit( void ) {
+	size_t i;
+
+	for ( i = 0; i < ARRAY_SIZE( chardevs ); i++ ) {
+		if ( chardevs[i].registered ) {
+			misc_deregister( &chardevs[i].misc );
+			chardevs[i].registered = 0;
+		}
+	}
+}
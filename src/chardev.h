@@ -0,0 +1,23 @@
+#ifndef _SPECTR_IO_CHARDEV_H
+#define _SPECTR_IO_CHARDEV_H
+
+#include <linux/init.h>
+
+/**
+ * Creates the /dev/spectr-spi0 and /dev/spectr-i2c1 character devices.
+ *
+ * Both take batches of transfers with an ioctl, see uapi/spectr_io.h, so a userspace driver runs
+ * many small transfers for the cost of a single system call.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init chardev_init( void );
+
+/**
+ * Removes the character devices.
+ *
+ */
+void chardev_exit( void );
+
+#endif // _SPECTR_IO_CHARDEV_H
@@ -1,9 +1,131 @@
 #ifndef _SPECTR_IO_DMA_H
 #define _SPECTR_IO_DMA_H
 
+#include <asm/barrier.h>
 #include <asm/io.h>
 
 #define BCM2836_IO_MEM_START	0x3F000000
+#define BCM2836_IO_BUS_START	0x7E000000
+
+// The core clock the SPI and BSC dividers are applied to.
+#define BCM2836_CORE_CLK_HZ	250000000
+
+// -----------------------------------------------------------------------------
+// Backend
+// -----------------------------------------------------------------------------
+
+#if defined( SPECTR_IO_SIM )
+
+// The register access backend, host builds plug a simulator in here in place of the bus.
+struct dma_backend {
+	void __iomem* ( *map )( unsigned long phys, unsigned long size );
+	void ( *unmap )( void __iomem* addr );
+	u8 ( *read8 )( void __iomem* addr );
+	u16 ( *read16 )( void __iomem* addr );
+	u32 ( *read32 )( void __iomem* addr );
+	void ( *write8 )( void __iomem* addr, u8 value );
+	void ( *write16 )( void __iomem* addr, u16 value );
+	void ( *write32 )( void __iomem* addr, u32 value );
+	void ( *fence )( void );
+};
+
+extern const struct dma_backend* dma_backend;
+
+// Plain accessors are relaxed ones plus a fence, after reads and before writes like on the bus
+static inline u32 dma_io_fenced( u32 value ) {
+	dma_backend->fence();
+	return value;
+}
+
+#define dma_io_map( phys, size )	dma_backend->map( phys, size )
+#define dma_io_unmap( addr )		dma_backend->unmap( addr )
+#define dma_io_read8( addr )		( u8 ) dma_io_fenced( dma_backend->read8( addr ) )
+#define dma_io_read16( addr )		( u16 ) dma_io_fenced( dma_backend->read16( addr ) )
+#define dma_io_read32( addr )		dma_io_fenced( dma_backend->read32( addr ) )
+#define dma_io_write8( addr, value )	( dma_backend->fence(), dma_backend->write8( addr, value ) )
+#define dma_io_write16( addr, value )	( dma_backend->fence(), dma_backend->write16( addr, value ) )
+#define dma_io_write32( addr, value )	( dma_backend->fence(), dma_backend->write32( addr, value ) )
+#define dma_io_read8_relaxed( addr )		dma_backend->read8( addr )
+#define dma_io_read16_relaxed( addr )		dma_backend->read16( addr )
+#define dma_io_read32_relaxed( addr )		dma_backend->read32( addr )
+#define dma_io_write8_relaxed( addr, value )	dma_backend->write8( addr, value )
+#define dma_io_write16_relaxed( addr, value )	dma_backend->write16( addr, value )
+#define dma_io_write32_relaxed( addr, value )	dma_backend->write32( addr, value )
+#define dma_io_rmb()			dma_backend->fence()
+#define dma_io_wmb()			dma_backend->fence()
+
+#else
+
+#define dma_io_map( phys, size )	ioremap( phys, size )
+#define dma_io_unmap( addr )		iounmap( addr )
+#define dma_io_read8( addr )		ioread8( addr )
+#define dma_io_read16( addr )		ioread16( addr )
+#define dma_io_read32( addr )		ioread32( addr )
+#define dma_io_write8( addr, value )	iowrite8( value, addr )
+#define dma_io_write16( addr, value )	iowrite16( value, addr )
+#define dma_io_write32( addr, value )	iowrite32( value, addr )
+#define dma_io_read8_relaxed( addr )		readb_relaxed( addr )
+#define dma_io_read16_relaxed( addr )		readw_relaxed( addr )
+#define dma_io_read32_relaxed( addr )		readl_relaxed( addr )
+#define dma_io_write8_relaxed( addr, value )	writeb_relaxed( value, addr )
+#define dma_io_write16_relaxed( addr, value )	writew_relaxed( value, addr )
+#define dma_io_write32_relaxed( addr, value )	writel_relaxed( value, addr )
+#define dma_io_rmb()			rmb()
+#define dma_io_wmb()			wmb()
+
+#endif // SPECTR_IO_SIM
+
+// -----------------------------------------------------------------------------
+// Mapping
+// -----------------------------------------------------------------------------
+
+/**
+ * Maps IO memory into kernel virtual address space.
+ *
+ * @param phys The physical address of the IO memory.
+ * @param size The size of the IO memory in bytes.
+ *
+ * @returns The mapped address; NULL on failure.
+ *
+ */
+static inline void __iomem* dma_ioremap( unsigned long phys, unsigned long size ) {
+	return dma_io_map( phys, size );
+}
+
+/**
+ * Unmaps IO memory mapped with dma_ioremap().
+ *
+ * @param addr The mapped address.
+ *
+ */
+static inline void dma_iounmap( void __iomem* addr ) {
+	dma_io_unmap( addr );
+}
+
+// -----------------------------------------------------------------------------
+// Barriers
+// -----------------------------------------------------------------------------
+//
+// The plain accessors below carry a barrier each, ordering them against ordinary memory accesses
+// like the DMA buffers. The _relaxed ones do not; accesses to the same peripheral still reach it in
+// program order, so a burst of them only needs a fence at the point it meets memory: before the
+// first write of a FIFO fill, and after the last read of a FIFO drain
+
+/**
+ * Orders the memory and IO reads before the fence before the reads after it.
+ *
+ */
+static inline void dma_read_fence( void ) {
+	dma_io_rmb();
+}
+
+/**
+ * Orders the memory and IO writes before the fence before the writes after it.
+ *
+ */
+static inline void dma_write_fence( void ) {
+	dma_io_wmb();
+}
 
 // -----------------------------------------------------------------------------
 // 8-bit IO
@@ -18,7 +140,7 @@
  *
  */
 static inline u8 dma_read8( void __iomem* addr ) {
-	return ioread8( addr );
+	return dma_io_read8( addr );
 }
 
 /**
@@ -29,7 +151,30 @@ static inline u8 dma_read8( void __iomem* addr ) {
  *
  */
 static inline void dma_write8( void __iomem* addr, u8 value ) {
-	iowrite8( value, addr );
+	dma_io_write8( addr, value );
+}
+
+/**
+ * Reads a 8-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ *
+ * @returns The value.
+ *
+ */
+static inline u8 dma_read8_relaxed( void __iomem* addr ) {
+	return dma_io_read8_relaxed( addr );
+}
+
+/**
+ * Writes a 8-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ * @param value The value.
+ *
+ */
+static inline void dma_write8_relaxed( void __iomem* addr, u8 value ) {
+	dma_io_write8_relaxed( addr, value );
 }
 
 /**
@@ -42,7 +187,7 @@ static inline void dma_write8( void __iomem* addr, u8 value ) {
  *
  */
 static inline u8 dma_get_flags8( void __iomem* addr, u8 bit, u8 mask ) {
-	return ioread8( addr ) & mask;
+	return dma_io_read8( addr ) & mask;
 }
 
 /**
@@ -53,7 +198,7 @@ static inline u8 dma_get_flags8( void __iomem* addr, u8 bit, u8 mask ) {
  *
  */
 static inline void dma_clr_flags8( void __iomem* addr, u8 flags ) {
-	iowrite8( ioread8( addr ) & ~flags, addr );
+	dma_io_write8( addr, dma_io_read8( addr ) & ~flags );
 }
 
 /**
@@ -64,7 +209,7 @@ static inline void dma_clr_flags8( void __iomem* addr, u8 flags ) {
  *
  */
 static inline void dma_set_flags8( void __iomem* addr, u8 flags ) {
-	iowrite8( ioread8( addr ) | flags, addr );
+	dma_io_write8( addr, dma_io_read8( addr ) | flags );
 }
 
 // -----------------------------------------------------------------------------
@@ -80,7 +225,7 @@ static inline void dma_set_flags8( void __iomem* addr, u8 flags ) {
  *
  */
 static inline u16 dma_read16( void __iomem* addr ) {
-	return ioread16( addr );
+	return dma_io_read16( addr );
 }
 
 /**
@@ -91,7 +236,30 @@ static inline u16 dma_read16( void __iomem* addr ) {
  *
  */
 static inline void dma_write16( void __iomem* addr, u16 value ) {
-	iowrite16( value, addr );
+	dma_io_write16( addr, value );
+}
+
+/**
+ * Reads a 16-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ *
+ * @returns The value.
+ *
+ */
+static inline u16 dma_read16_relaxed( void __iomem* addr ) {
+	return dma_io_read16_relaxed( addr );
+}
+
+/**
+ * Writes a 16-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ * @param value The value.
+ *
+ */
+static inline void dma_write16_relaxed( void __iomem* addr, u16 value ) {
+	dma_io_write16_relaxed( addr, value );
 }
 
 /**
@@ -104,7 +272,7 @@ static inline void dma_write16( void __iomem* addr, u16 value ) {
  *
  */
 static inline u16 dma_get_flags16( void __iomem* addr, u16 flags ) {
-	return ioread16( addr ) & flags;
+	return dma_io_read16( addr ) & flags;
 }
 
 /**
@@ -115,7 +283,7 @@ static inline u16 dma_get_flags16( void __iomem* addr, u16 flags ) {
  *
  */
 static inline void dma_clr_flags16( void __iomem* addr, u16 flags ) {
-	iowrite16( ioread16( addr ) & ~flags, addr );
+	dma_io_write16( addr, dma_io_read16( addr ) & ~flags );
 }
 
 /**
@@ -126,7 +294,7 @@ static inline void dma_clr_flags16( void __iomem* addr, u16 flags ) {
  *
  */
 static inline void dma_set_flags16( void __iomem* addr, u16 flags ) {
-	iowrite16( ioread16( addr ) | flags, addr );
+	dma_io_write16( addr, dma_io_read16( addr ) | flags );
 }
 
 // -----------------------------------------------------------------------------
@@ -142,7 +310,7 @@ static inline void dma_set_flags16( void __iomem* addr, u16 flags ) {
  *
  */
 static inline u32 dma_read32( void __iomem* addr ) {
-	return ioread32( addr );
+	return dma_io_read32( addr );
 }
 
 /**
@@ -153,7 +321,30 @@ static inline u32 dma_read32( void __iomem* addr ) {
  *
  */
 static inline void dma_write32( void __iomem* addr, u32 value ) {
-	iowrite32( value, addr );
+	dma_io_write32( addr, value );
+}
+
+/**
+ * Reads a 32-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ *
+ * @returns The value.
+ *
+ */
+static inline u32 dma_read32_relaxed( void __iomem* addr ) {
+	return dma_io_read32_relaxed( addr );
+}
+
+/**
+ * Writes a 32-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ * @param value The value.
+ *
+ */
+static inline void dma_write32_relaxed( void __iomem* addr, u32 value ) {
+	dma_io_write32_relaxed( addr, value );
 }
 
 /**
@@ -166,7 +357,7 @@ static inline void dma_write32( void __iomem* addr, u32 value ) {
  *
  */
 static inline u32 dma_get_flags32( void __iomem* addr, u32 flags ) {
-	return ioread32( addr ) & flags;
+	return dma_io_read32( addr ) & flags;
 }
 
 /**
@@ -177,7 +368,7 @@ static inline u32 dma_get_flags32( void __iomem* addr, u32 flags ) {
  *
  */
 static inline void dma_clr_flags32( void __iomem* addr, u32 flags ) {
-	iowrite32( ioread32( addr ) & ~flags, addr );
+	dma_io_write32( addr, dma_io_read32( addr ) & ~flags );
 }
 
 /**
@@ -188,7 +379,53 @@ static inline void dma_clr_flags32( void __iomem* addr, u32 flags ) {
  *
  */
 static inline void dma_set_flags32( void __iomem* addr, u32 flags ) {
-	iowrite32( ioread32( addr ) | flags, addr );
+	dma_io_write32( addr, dma_io_read32( addr ) | flags );
+}
+
+/**
+ * Sets flags in a write 1 to set 32-bit IO register, which ignores the zero bits written so there
+ * is nothing to read back.
+ *
+ * @param addr The IO register address.
+ * @param flags The flags to set.
+ *
+ */
+static inline void dma_w1s32( void __iomem* addr, u32 flags ) {
+	dma_io_write32( addr, flags );
+}
+
+/**
+ * Sets flags in a write 1 to set 32-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ * @param flags The flags to set.
+ *
+ */
+static inline void dma_w1s32_relaxed( void __iomem* addr, u32 flags ) {
+	dma_io_write32_relaxed( addr, flags );
+}
+
+/**
+ * Clears flags in a write 1 to clear 32-bit IO register, which ignores the zero bits written so
+ * there is nothing to read back.
+ *
+ * @param addr The IO register address.
+ * @param flags The flags to clear.
+ *
+ */
+static inline void dma_w1c32( void __iomem* addr, u32 flags ) {
+	dma_io_write32( addr, flags );
+}
+
+/**
+ * Clears flags in a write 1 to clear 32-bit IO register without a barrier.
+ *
+ * @param addr The IO register address.
+ * @param flags The flags to clear.
+ *
+ */
+static inline void dma_w1c32_relaxed( void __iomem* addr, u32 flags ) {
+	dma_io_write32_relaxed( addr, flags );
 }
 
 #endif // _SPECTR_IO_DMA_H
@@ -0,0 +1,144 @@
+#include "dmac.h"
+
+#include <asm/io.h>
+#include <linux/dma-mapping.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+
+#include <dma.h>
+#include <log.h>
+
+#define DMAC_OFFSET	0x00007000
+#define DMAC_SIZE	0x1000
+
+#define DMAC_CHAN_SIZE	0x100
+#define DMAC_ENABLE	0xFF0
+
+#define DMAC_CS		0x00
+#define DMAC_CONBLK_AD	0x04
+#define DMAC_DEBUG	0x20
+
+#define DMAC_CS_ACTIVE		BIT(  0 )
+#define DMAC_CS_END		BIT(  1 )
+#define DMAC_CS_INT		BIT(  2 )
+#define DMAC_CS_ERROR		BIT(  8 )
+#define DMAC_CS_WAIT_WRITES	BIT( 28 )
+#define DMAC_CS_ABORT		BIT( 30 )
+#define DMAC_CS_RESET		BIT( 31 )
+
+#define DMAC_CS_PRIORITY( p )		( ( ( u32 ) ( p ) & 0x0F ) << 16 )
+#define DMAC_CS_PANIC_PRIORITY( p )	( ( ( u32 ) ( p ) & 0x0F ) << 20 )
+
+// Clears the read error, FIFO error, and read last not set error flags.
+#define DMAC_DEBUG_CLEAR_ERRORS	0x00000007
+
+// The alias through which the DMA controller sees SDRAM without going through the L2 cache.
+#define DMAC_BUS_RAM_ALIAS	0xC0000000
+
+static u8* dmac_mem = ( u8* ) 0;
+
+static struct platform_device* dmac_pdev = ( struct platform_device* ) 0;
+
+static inline u8* dmac_chan_mem( unsigned int chan ) {
+	return dmac_mem + chan * DMAC_CHAN_SIZE;
+}
+
+int __init dmac_init( void ) {
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "DMAC registering device for DMA allocations." );
+#endif // DEBUG
+	dmac_pdev = platform_device_register_simple( "spectr-io-dma", -1, NULL, 0 );
+	if ( IS_ERR( dmac_pdev ) ) {
+		LOG( KERN_ERR, "DMAC failed to register device." );
+		dmac_pdev = ( struct platform_device* ) 0;
+		return DMAC_ERR_DEVICE_FAIL;
+	}
+	dma_coerce_mask_and_coherent( &dmac_pdev->dev, DMA_BIT_MASK( 32 ) );
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "DMAC mapping IO memory into kernel virtual address space." );
+#endif // DEBUG
+	dmac_mem = ( u8* ) dma_ioremap( BCM2836_IO_MEM_START + DMAC_OFFSET, DMAC_SIZE );
+	if ( !dmac_mem ) {
+		LOG( KERN_ERR, "DMAC failed to map IO memory." );
+		platform_device_unregister( dmac_pdev );
+		dmac_pdev = ( struct platform_device* ) 0;
+		return DMAC_ERR_IO_MAP_FAIL;
+	}
+
+	return 0;
+}
+
+void dmac_exit( void ) {
+	if ( dmac_mem ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "DMAC unmapping IO memory from kernel virtual address space." );
+#endif // DEBUG
+		dma_iounmap( dmac_mem );
+		dmac_mem = ( u8* ) 0;
+	}
+
+	if ( dmac_pdev ) {
+		platform_device_unregister( dmac_pdev );
+		dmac_pdev = ( struct platform_device* ) 0;
+	}
+}
+
+void* dmac_alloc( size_t size, u32* bus ) {
+	dma_addr_t handle;
+
+	void* const mem = dma_alloc_coherent( &dmac_pdev->dev, size, &handle, GFP_KERNEL );
+	if ( !mem ) {
+		return NULL;
+	}
+
+	*bus = ( u32 ) handle | DMAC_BUS_RAM_ALIAS;
+
+	return mem;
+}
+
+void dmac_free( size_t size, void* mem, u32 bus ) {
+	dma_free_coherent( &dmac_pdev->dev, size, mem, bus & ~DMAC_BUS_RAM_ALIAS );
+}
+
+u32 dmac_io_bus_addr( u32 offset ) {
+	return BCM2836_IO_BUS_START + offset;
+}
+
+void dmac_reset( unsigned int chan ) {
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "DMAC resetting channel %d.", chan );
+#endif // DEBUG
+	dma_set_flags32( dmac_mem + DMAC_ENABLE, BIT( chan ) );
+	dma_write32( dmac_chan_mem( chan ) + DMAC_CS, DMAC_CS_ABORT );
+	dma_write32( dmac_chan_mem( chan ) + DMAC_CS, DMAC_CS_RESET );
+	dma_write32( dmac_chan_mem( chan ) + DMAC_DEBUG, DMAC_DEBUG_CLEAR_ERRORS );
+}
+
+void dmac_start( unsigned int chan, u32 cb ) {
+	u8* const mem = dmac_chan_mem( chan );
+
+	// Clear any stale completion state before loading the control block chain
+	dma_write32( mem + DMAC_CS, DMAC_CS_END | DMAC_CS_INT );
+	dma_write32( mem + DMAC_CONBLK_AD, cb );
+	dma_write32( mem + DMAC_CS, DMAC_CS_ACTIVE | DMAC_CS_WAIT_WRITES
+		| DMAC_CS_PRIORITY( 8 ) | DMAC_CS_PANIC_PRIORITY( 15 ) );
+}
+
+int dmac_is_active( unsigned int chan ) {
+	return dma_get_flags32( dmac_chan_mem( chan ) + DMAC_CS, DMAC_CS_ACTIVE ) != 0;
+}
+
+int dmac_ack_irq( unsigned int chan ) {
+	u8* const mem = dmac_chan_mem( chan );
+
+	const u32 cs = dma_read32( mem + DMAC_CS );
+	if ( !( cs & DMAC_CS_INT ) ) {
+		return 0;
+	}
+
+	// INT and END are write 1 to clear
+	dma_write32( mem + DMAC_CS, DMAC_CS_INT | DMAC_CS_END );
+
+	return ( cs & DMAC_CS_ERROR ) ? DMAC_IRQ_ERROR : DMAC_IRQ_DONE;
+}
@@ -0,0 +1,130 @@
+#ifndef _SPECTR_IO_DMAC_H
+#define _SPECTR_IO_DMAC_H
+
+#include <linux/bitops.h>
+#include <linux/init.h>
+#include <linux/types.h>
+
+#define DMAC_ERR_IO_MAP_FAIL	-1	// Mapping IO memory into kernel virtual memory failed.
+#define DMAC_ERR_DEVICE_FAIL	-2	// Registering the device used for DMA allocations failed.
+
+#define DMAC_CHANNELS	15
+
+#define DMAC_TI_INTEN		BIT(  0 )
+#define DMAC_TI_TDMODE		BIT(  1 )
+#define DMAC_TI_WAIT_RESP	BIT(  3 )
+#define DMAC_TI_DEST_INC	BIT(  4 )
+#define DMAC_TI_DEST_WIDTH	BIT(  5 )
+#define DMAC_TI_DEST_DREQ	BIT(  6 )
+#define DMAC_TI_DEST_IGNORE	BIT(  7 )
+#define DMAC_TI_SRC_INC		BIT(  8 )
+#define DMAC_TI_SRC_WIDTH	BIT(  9 )
+#define DMAC_TI_SRC_DREQ	BIT( 10 )
+#define DMAC_TI_SRC_IGNORE	BIT( 11 )
+#define DMAC_TI_NO_WIDE_BURSTS	BIT( 26 )
+
+#define DMAC_TI_PERMAP( p )	( ( ( u32 ) ( p ) & 0x1F ) << 16 )
+
+#define DMAC_PERMAP_NONE	0
+#define DMAC_PERMAP_PWM		5
+#define DMAC_PERMAP_SPI_TX	6
+#define DMAC_PERMAP_SPI_RX	7
+
+#define DMAC_IRQ_DONE	BIT( 0 )
+#define DMAC_IRQ_ERROR	BIT( 1 )
+
+// A DMA control block, must be 32 byte aligned in memory visible to the DMA controller.
+struct dmac_cb {
+	u32 ti;
+	u32 source_ad;
+	u32 dest_ad;
+	u32 txfr_len;
+	u32 stride;
+	u32 nextconbk;
+	u32 reserved[2];
+} __aligned( 32 );
+
+/**
+ * Initializes the DMA controller subsystem.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init dmac_init( void );
+
+/**
+ * Destroys the DMA controller subsystem.
+ *
+ */
+void dmac_exit( void );
+
+/**
+ * Allocates memory visible to the DMA controller.
+ *
+ * @param size The size of the memory in bytes.
+ * @param bus The location to store the bus address of the memory at.
+ *
+ * @returns The kernel virtual address of the memory; NULL on failure.
+ *
+ */
+void* dmac_alloc( size_t size, u32* bus );
+
+/**
+ * Frees memory allocated with dmac_alloc().
+ *
+ * @param size The size of the memory in bytes.
+ * @param mem The kernel virtual address of the memory.
+ * @param bus The bus address of the memory.
+ *
+ */
+void dmac_free( size_t size, void* mem, u32 bus );
+
+/**
+ * Gets the bus address of a peripheral register as seen by the DMA controller.
+ *
+ * @param offset The offset of the register from the start of peripheral IO memory.
+ *
+ * @returns The bus address.
+ *
+ */
+u32 dmac_io_bus_addr( u32 offset );
+
+/**
+ * Resets a DMA channel, aborting any active transfer.
+ *
+ * @param chan The channel.
+ *
+ */
+void dmac_reset( unsigned int chan );
+
+/**
+ * Starts a DMA channel on a chain of control blocks.
+ *
+ * @param chan The channel.
+ * @param cb The bus address of the first control block.
+ *
+ */
+void dmac_start( unsigned int chan, u32 cb );
+
+/**
+ * Checks whether a DMA channel is still active.
+ *
+ * @param chan The channel.
+ *
+ * @returns Non-zero if the channel is active.
+ *
+ */
+int dmac_is_active( unsigned int chan );
+
+/**
+ * Acknowledges the interrupt of a DMA channel.
+ *
+ * @param chan The channel.
+ *
+ * @returns Zero if the channel had no interrupt pending; DMAC_IRQ_ERROR set if the channel
+ * reported an error, DMAC_IRQ_DONE set otherwise.
+ *
+ */
+int dmac_ack_irq( unsigned int chan );
+
+#endif // _SPECTR_IO_DMAC_H
@@ -3,12 +3,16 @@
 #include <asm/io.h>
 #include <linux/bitops.h>
 #include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 
 #include <dma.h>
 #include <log.h>
 
+#include "io_trace.h"
+
 #define GPIO_OFFSET	0x00200000
-#define GPIO_SIZE	0x3C
+#define GPIO_SIZE	0xB4
 
 #define GPIO_GPFSEL0	0x00
 #define GPIO_GPFSEL1	0x04
@@ -22,67 +26,303 @@
 #define GPIO_GPCLR1	0x2C
 #define GPIO_GPLEV0	0x34
 #define GPIO_GPLEV1	0x38
+#define GPIO_GPEDS0	0x40
+#define GPIO_GPREN0	0x4C
+#define GPIO_GPFEN0	0x58
+#define GPIO_GPHEN0	0x64
+#define GPIO_GPLEN0	0x70
+#define GPIO_GPAREN0	0x7C
+#define GPIO_GPAFEN0	0x88
+
+#define GPIO_GPFSEL_COUNT	6
 
 static u8* gpio_mem = ( u8* ) 0;
 
+// The GPFSEL registers are only ever written from their shadow, so mode changes cost one write
+// and never a read. Changes made to them by other drivers are not seen.
+static u32 gpio_fsel[GPIO_GPFSEL_COUNT];
+
+static const char* gpio_owner[GPIO_PINS];
+
+static DEFINE_SPINLOCK( gpio_fsel_lock );
+
+// The edge detect enables are shadowed the same way, indexed by bank
+static u32 gpio_ren[2];
+static u32 gpio_fen[2];
+static u32 gpio_aren[2];
+static u32 gpio_afen[2];
+
+static DEFINE_SPINLOCK( gpio_edge_lock );
+
+static void gpio_fsel_commit( const u32* clr, const u32* set ) {
+	unsigned int i;
+
+	for ( i = 0; i < GPIO_GPFSEL_COUNT; i++ ) {
+		const u32 value = ( gpio_fsel[i] & ~clr[i] ) | set[i];
+		if ( value != gpio_fsel[i] ) {
+			dma_write32( gpio_mem + GPIO_GPFSEL0 + ( i << 2 ), value );
+			gpio_fsel[i] = value;
+		}
+	}
+}
+
 int __init gpio_init( void ) {
+	unsigned int i;
+
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "GPIO mapping IO memory into kernel virtual address space." );
 #endif // DEBUG
-	gpio_mem = ( u8* ) ioremap( BCM2836_IO_MEM_START + GPIO_OFFSET, GPIO_SIZE );
+	gpio_mem = ( u8* ) dma_ioremap( BCM2836_IO_MEM_START + GPIO_OFFSET, GPIO_SIZE );
 	if ( !gpio_mem ) {
 		LOG( KERN_ERR, "GPIO failed to map IO memory." );
 		return GPIO_ERR_IO_MAP_FAIL;
 	}
 
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "GPIO loading pin function shadow registers." );
+#endif // DEBUG
+	for ( i = 0; i < GPIO_GPFSEL_COUNT; i++ ) {
+		gpio_fsel[i] = dma_read32( gpio_mem + GPIO_GPFSEL0 + ( i << 2 ) );
+	}
+	for ( i = 0; i < 2; i++ ) {
+		gpio_ren[i] = dma_read32( gpio_mem + GPIO_GPREN0 + ( i << 2 ) );
+		gpio_fen[i] = dma_read32( gpio_mem + GPIO_GPFEN0 + ( i << 2 ) );
+		gpio_aren[i] = dma_read32( gpio_mem + GPIO_GPAREN0 + ( i << 2 ) );
+		gpio_afen[i] = dma_read32( gpio_mem + GPIO_GPAFEN0 + ( i << 2 ) );
+	}
+
 	return 0;
 }
 
-void __exit gpio_exit( void ) {
+void gpio_exit( void ) {
 	if ( gpio_mem ) {
 #if defined( DEBUG )
 		LOG( KERN_DEBUG, "GPIO unmapping IO memory from kernel virtual address space." );
 #endif // DEBUG
-		iounmap( gpio_mem );
+		dma_iounmap( gpio_mem );
 		gpio_mem = ( u8* ) 0;
 	}
 }
 
-void gpio_set_pin_mode( unsigned int pin, unsigned int mode ) {
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "GPIO setting mode for pin %d to 0x%02X.", pin, mode );
-#endif // DEBUG
-	void __iomem* const addr = gpio_mem + GPIO_GPFSEL0
-		+ ( ( ( unsigned int ) ( ( pin % 53 ) / 10 ) ) << 2 );
+int gpio_set_pin_mode( unsigned int pin, unsigned int mode ) {
+	u32 clr[GPIO_GPFSEL_COUNT] = { 0 };
+	u32 set[GPIO_GPFSEL_COUNT] = { 0 };
+	unsigned long flags;
+
+	trace_spectr_io_gpio_mode( ( pin % 53 ) >> 5, BIT( pin & 0x1F ), mode );
+	const unsigned int reg = ( pin % 53 ) / 10;
 	const int bit = ( pin % 10 ) * 3;
-	dma_clr_flags32( addr, 0x07 << bit );
-	dma_set_flags32( addr, mode << bit );
+	clr[reg] = 0x07 << bit;
+	set[reg] = ( mode & 0x07 ) << bit;
+
+	spin_lock_irqsave( &gpio_fsel_lock, flags );
+	// Claimed pins are only changed by their owner, through gpio_configure_pins()
+	if ( gpio_owner[pin % 53] ) {
+		const char* const holder = gpio_owner[pin % 53];
+		spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+		LOG( KERN_ERR, "GPIO pin %d is owned by %s, its mode was not changed.", pin % 53, holder );
+		return GPIO_ERR_PIN_CONFLICT;
+	}
+	gpio_fsel_commit( clr, set );
+	spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+
+	return 0;
 }
 
 void gpio_set_pin_low( unsigned int pin ) {
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "GPIO setting level for pin %d to low.", pin );
-#endif // DEBUG
-	dma_set_flags32( gpio_mem + GPIO_GPCLR0 + ( ( ( pin % 53 ) >> 5 ) << 2 ), BIT( pin & 0x1F ) );
+	trace_spectr_io_gpio_write( ( pin % 53 ) >> 5, 0, BIT( pin & 0x1F ) );
+
+	// GPCLR is write 1 to clear, the other bits are ignored so there is nothing to read back
+	dma_w1c32( gpio_mem + GPIO_GPCLR0 + ( ( ( pin % 53 ) >> 5 ) << 2 ), BIT( pin & 0x1F ) );
 }
 
 void gpio_set_pin_high( unsigned int pin ) {
+	trace_spectr_io_gpio_write( ( pin % 53 ) >> 5, BIT( pin & 0x1F ), 0 );
+
+	// GPSET is write 1 to set, the other bits are ignored so there is nothing to read back
+	dma_w1s32( gpio_mem + GPIO_GPSET0 + ( ( ( pin % 53 ) >> 5 ) << 2 ), BIT( pin & 0x1F ) );
+}
+
+unsigned int gpio_get_pin_level( unsigned int pin ) {
+	const unsigned int bank = ( pin % 53 ) >> 5;
+
+	const u32 levels = dma_read32( gpio_mem + GPIO_GPLEV0 + ( bank << 2 ) );
+	trace_spectr_io_gpio_read( bank, levels );
+
+	return ( levels & BIT( pin & 0x1F ) ) > 0;
+}
+
+int gpio_set_pins_mode( unsigned int bank, u32 pins, unsigned int mode ) {
+	u32 clr[GPIO_GPFSEL_COUNT] = { 0 };
+	u32 set[GPIO_GPFSEL_COUNT] = { 0 };
+	unsigned long flags;
+
+	trace_spectr_io_gpio_mode( bank & 1, pins, mode );
+
+	spin_lock_irqsave( &gpio_fsel_lock, flags );
+
+	// Gather the field updates per GPFSEL register, a claimed pin fails the whole call
+	while ( pins ) {
+		const unsigned int pin = ( bank & 1 ) * 32 + __ffs( pins );
+		pins &= pins - 1;
+		if ( pin >= GPIO_PINS ) {
+			break;
+		}
+		if ( gpio_owner[pin] ) {
+			const char* const holder = gpio_owner[pin];
+			spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+			LOG( KERN_ERR, "GPIO pin %d is owned by %s, no mode was changed.", pin, holder );
+			return GPIO_ERR_PIN_CONFLICT;
+		}
+
+		const int bit = ( pin % 10 ) * 3;
+		clr[pin / 10] |= 0x07 << bit;
+		set[pin / 10] |= ( mode & 0x07 ) << bit;
+	}
+
+	// Replace the fields in one write so no pin passes through an intermediate mode
+	gpio_fsel_commit( clr, set );
+	spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+
+	return 0;
+}
+
+static int gpio_claim_pins( const char* owner, const struct gpio_pin_config* pins, size_t count,
+		int release ) {
+	u32 clr[GPIO_GPFSEL_COUNT] = { 0 };
+	u32 set[GPIO_GPFSEL_COUNT] = { 0 };
+	unsigned long flags;
+	size_t i;
+
+	spin_lock_irqsave( &gpio_fsel_lock, flags );
+
+	// Check every pin before touching any so a conflict leaves the configuration untouched
+	for ( i = 0; i < count; i++ ) {
+		const unsigned int pin = pins[i].pin;
+		if ( pin >= GPIO_PINS ) {
+			spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+			LOG( KERN_ERR, "GPIO pin %d requested by %s does not exist.", pin, owner );
+			return GPIO_ERR_INVALID_PIN;
+		}
+		if ( gpio_owner[pin] && strcmp( gpio_owner[pin], owner ) ) {
+			const char* const holder = gpio_owner[pin];
+			spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+			LOG( KERN_ERR, "GPIO pin %d requested by %s is owned by %s.", pin, owner, holder );
+			return GPIO_ERR_PIN_CONFLICT;
+		}
+
+		const int bit = ( pin % 10 ) * 3;
+		clr[pin / 10] |= 0x07 << bit;
+		set[pin / 10] |= ( pins[i].mode & 0x07 ) << bit;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		gpio_owner[pins[i].pin] = release ? ( const char* ) 0 : owner;
+	}
+
+	// Pins sharing a GPFSEL register are committed together in one write
+	gpio_fsel_commit( clr, set );
+
+	spin_unlock_irqrestore( &gpio_fsel_lock, flags );
+
+	return 0;
+}
+
+int gpio_configure_pins( const char* owner, const struct gpio_pin_config* pins, size_t count ) {
 #if defined( DEBUG )
-	LOG( KERN_DEBUG, "GPIO setting level for pin %d to high.", pin );
+	LOG( KERN_DEBUG, "GPIO configuring %d pins for %s.", count, owner );
 #endif // DEBUG
-	dma_set_flags32( gpio_mem + GPIO_GPSET0 + ( ( ( pin % 53 ) >> 5 ) << 2 ), BIT( pin & 0x1F ) );
+	return gpio_claim_pins( owner, pins, count, 0 );
 }
 
-unsigned int gpio_get_pin_level( unsigned int pin ) {
+int gpio_release_pins( const char* owner, const struct gpio_pin_config* pins, size_t count ) {
 #if defined( DEBUG )
-	LOG( KERN_DEBUG, "GPIO getting level for pin %d.", pin );
+	LOG( KERN_DEBUG, "GPIO releasing %d pins from %s.", count, owner );
 #endif // DEBUG
-	return dma_get_flags32( gpio_mem + GPIO_GPLEV0 + ( ( ( pin % 53 ) >> 5 ) << 2 ),
-		BIT( pin & 0x1F ) ) > 0;
+	return gpio_claim_pins( owner, pins, count, 1 );
+}
+
+void gpio_write_mask( unsigned int bank, u32 set_mask, u32 clr_mask ) {
+	const unsigned int off = ( bank & 1 ) << 2;
+
+	trace_spectr_io_gpio_write( bank & 1, set_mask, clr_mask );
+
+	// The GPIO block takes the writes in order, a single fence orders the pair against memory
+	dma_write_fence();
+	if ( set_mask ) {
+		dma_w1s32_relaxed( gpio_mem + GPIO_GPSET0 + off, set_mask );
+	}
+	if ( clr_mask ) {
+		dma_w1c32_relaxed( gpio_mem + GPIO_GPCLR0 + off, clr_mask );
+	}
+}
+
+u32 gpio_read_bank( unsigned int bank ) {
+	const u32 levels = dma_read32( gpio_mem + GPIO_GPLEV0 + ( ( bank & 1 ) << 2 ) );
+	trace_spectr_io_gpio_read( bank & 1, levels );
+
+	return levels;
+}
+
+u64 gpio_read_levels( void ) {
+	const u32 low = dma_read32_relaxed( gpio_mem + GPIO_GPLEV0 );
+	const u32 high = dma_read32_relaxed( gpio_mem + GPIO_GPLEV1 );
+	dma_read_fence();
+
+	return ( ( u64 ) high << 32 | low ) & GENMASK_ULL( GPIO_PINS - 1, 0 );
+}
+
+static inline void gpio_edge_commit( u32* shadow, unsigned long reg, unsigned int bank, u32 pin,
+		int enable ) {
+	const u32 value = enable ? shadow[bank] | pin : shadow[bank] & ~pin;
+	if ( value != shadow[bank] ) {
+		dma_write32( gpio_mem + reg + ( bank << 2 ), value );
+		shadow[bank] = value;
+	}
+}
+
+void gpio_set_pin_edges( unsigned int pin, unsigned int edges ) {
+	const unsigned int bank = ( pin % 53 ) >> 5;
+	const u32 bit = BIT( pin & 0x1F );
+	const int async = edges & GPIO_EDGE_ASYNC;
+	unsigned long flags;
+
+	spin_lock_irqsave( &gpio_edge_lock, flags );
+	gpio_edge_commit( gpio_ren, GPIO_GPREN0, bank, bit, !async && ( edges & GPIO_EDGE_RISING ) );
+	gpio_edge_commit( gpio_fen, GPIO_GPFEN0, bank, bit, !async && ( edges & GPIO_EDGE_FALLING ) );
+	gpio_edge_commit( gpio_aren, GPIO_GPAREN0, bank, bit, async && ( edges & GPIO_EDGE_RISING ) );
+	gpio_edge_commit( gpio_afen, GPIO_GPAFEN0, bank, bit, async && ( edges & GPIO_EDGE_FALLING ) );
+	spin_unlock_irqrestore( &gpio_edge_lock, flags );
+
+	// An edge latched before the pin was watched would show up as a stale event
+	dma_w1c32( gpio_mem + GPIO_GPEDS0 + ( bank << 2 ), bit );
+}
+
+u32 gpio_ack_events( unsigned int bank, u32 mask, u32* levels ) {
+	const unsigned int off = ( bank & 1 ) << 2;
+
+	const u32 events = dma_read32( gpio_mem + GPIO_GPEDS0 + off ) & mask;
+	if ( !events ) {
+		return 0;
+	}
+
+	// GPEDS is write 1 to clear, the events of pins outside the mask are left to their owners
+	dma_w1c32( gpio_mem + GPIO_GPEDS0 + off, events );
+	*levels = dma_read32( gpio_mem + GPIO_GPLEV0 + off );
+
+	return events;
 }
 
 EXPORT_SYMBOL( gpio_set_pin_mode );
 EXPORT_SYMBOL( gpio_set_pin_low );
 EXPORT_SYMBOL( gpio_set_pin_high );
 EXPORT_SYMBOL( gpio_get_pin_level );
+EXPORT_SYMBOL( gpio_set_pins_mode );
+EXPORT_SYMBOL( gpio_write_mask );
+EXPORT_SYMBOL( gpio_read_bank );
+EXPORT_SYMBOL( gpio_read_levels );
+EXPORT_SYMBOL( gpio_configure_pins );
+EXPORT_SYMBOL( gpio_release_pins );
+EXPORT_SYMBOL( gpio_set_pin_edges );
+EXPORT_SYMBOL( gpio_ack_events );
 
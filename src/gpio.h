@@ -1,9 +1,13 @@
 #ifndef _SPECTR_IO_GPIO_H
 #define _SPECTR_IO_GPIO_H
 
+#include <linux/bitops.h>
 #include <linux/init.h>
+#include <linux/types.h>
 
-#define GPIO_ERR_IO_MAP_FAIL -1
+#define GPIO_ERR_IO_MAP_FAIL	-1
+#define GPIO_ERR_PIN_CONFLICT	-2
+#define GPIO_ERR_INVALID_PIN	-3
 
 #define GPIO_PIN_MODE_INPUT	0x00
 #define GPIO_PIN_MODE_OUTPUT	0x01
@@ -17,6 +21,22 @@
 #define GPIO_PIN_LEVEL_LOW	0
 #define GPIO_PIN_LEVEL_HIGH	1
 
+#define GPIO_EDGE_RISING	BIT( 0 )
+#define GPIO_EDGE_FALLING	BIT( 1 )
+#define GPIO_EDGE_ASYNC		BIT( 2 )	// Detects edges without sampling them on the system
+						// clock, so pulses shorter than a cycle are caught too.
+
+#define GPIO_PINS	54
+
+#define GPIO_BANK0	0	// Pins 0-31.
+#define GPIO_BANK1	1	// Pins 32-53.
+
+// The mode of a GPIO bus pin in a batched configuration.
+struct gpio_pin_config {
+	unsigned int pin;
+	unsigned int mode;
+};
+
 /**
  * Initializes the GPIO subsystem.
  *
@@ -29,16 +49,20 @@ int __init gpio_init( void );
  * Destroys the GPIO subsystem.
  *
  */
-void __exit gpio_exit( void );
+void gpio_exit( void );
 
 /**
  * Sets the mode of a GPIO bus pin.
  *
+ * Pins claimed with gpio_configure_pins() are left alone, their owner changes them through it.
+ *
  * @param pin The pin.
  * @param pinmode The mode.
  *
+ * @returns Zero on success; a negative error code if the pin is owned.
+ *
  */
-void gpio_set_pin_mode( unsigned int pin, unsigned int mode );
+int gpio_set_pin_mode( unsigned int pin, unsigned int mode );
 
 /**
  * Sets the output of a GPIO bus pin to low.
@@ -66,5 +90,101 @@ void gpio_set_pin_high( unsigned int pin );
  */
 unsigned int gpio_get_pin_level( unsigned int pin );
 
+/**
+ * Sets the mode of several GPIO bus pins in the same bank.
+ *
+ * Each GPFSEL register covering the pins is updated with a single write. Nothing is changed if any
+ * of the pins is claimed with gpio_configure_pins().
+ *
+ * @param bank The bank.
+ * @param pins The mask of pins within the bank.
+ * @param mode The mode.
+ *
+ * @returns Zero on success; a negative error code if a pin is owned.
+ *
+ */
+int gpio_set_pins_mode( unsigned int bank, u32 pins, unsigned int mode );
+
+/**
+ * Sets the modes of a list of GPIO bus pins and claims them for an owner.
+ *
+ * Pins sharing a GPFSEL register are committed with a single write. Nothing is changed if any of
+ * the pins is owned by another owner.
+ *
+ * @param owner The name of the owning subsystem.
+ * @param pins The pins and their modes.
+ * @param count The number of pins.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_configure_pins( const char* owner, const struct gpio_pin_config* pins, size_t count );
+
+/**
+ * Sets the modes of a list of GPIO bus pins and releases them from their owner.
+ *
+ * @param owner The name of the owning subsystem.
+ * @param pins The pins and the modes to leave them in.
+ * @param count The number of pins.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_release_pins( const char* owner, const struct gpio_pin_config* pins, size_t count );
+
+/**
+ * Sets and clears the outputs of several GPIO bus pins in the same bank.
+ *
+ * @param bank The bank.
+ * @param set_mask The mask of pins within the bank to set high.
+ * @param clr_mask The mask of pins within the bank to set low.
+ *
+ */
+void gpio_write_mask( unsigned int bank, u32 set_mask, u32 clr_mask );
+
+/**
+ * Gets the levels of all GPIO bus pins in a bank.
+ *
+ * @param bank The bank.
+ *
+ * @returns The pin levels, one bit per pin.
+ *
+ */
+u32 gpio_read_bank( unsigned int bank );
+
+/**
+ * Gets the levels of all GPIO bus pins of both banks at once.
+ *
+ * The reads are not traced, this is meant to be called at sampling rates.
+ *
+ * @returns The pin levels, one bit per pin, bit n for pin n.
+ *
+ */
+u64 gpio_read_levels( void );
+
+/**
+ * Sets the edges that raise events on a GPIO bus pin.
+ *
+ * The enable registers are shadowed, so only the ones that change are written. Any event
+ * already latched for the pin is cleared.
+ *
+ * @param pin The pin.
+ * @param edges The GPIO_EDGE* edges, zero to raise no events.
+ *
+ */
+void gpio_set_pin_edges( unsigned int pin, unsigned int edges );
+
+/**
+ * Gets and clears the latched events of GPIO bus pins in a bank.
+ *
+ * @param bank The bank.
+ * @param mask The mask of pins within the bank to acknowledge, the others are left latched.
+ * @param levels The location to store the pin levels at, only if there were events.
+ *
+ * @returns The mask of pins with an event.
+ *
+ */
+u32 gpio_ack_events( unsigned int bank, u32 mask, u32* levels );
+
 #endif // _SPECTR_IO_GPIO_H
 
@@ -0,0 +1,310 @@
+#include "gpio_event.h"
+
+#include <asm/barrier.h>
+#include <linux/bitops.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "gpio.h"
+#include "uapi/spectr_io.h"
+
+// The number of events the ring holds, a power of two.
+#define GPIO_EVENT_RING	1024
+
+// A single producer, single consumer ring. The interrupt handler is the only one to write the
+// head and the reader under the lock is the only one to write the tail, so neither side takes a
+// lock the other one could hold.
+struct gpio_event_state {
+	struct spectr_io_gpio_event ring[GPIO_EVENT_RING];
+	u32 head;
+	u32 tail;
+	u32 seqno;		// The sequence number of the next event, owned by the handler.
+
+	u32 watched[2];		// The pins raising events, per bank.
+	u8 edges[GPIO_PINS];	// The GPIO_EDGE* edges of every pin.
+
+	// Pins bound to a handler of their own, which gets their events instead of the ring
+	u32 bound[2];
+	struct {
+		gpio_event_fn fn;
+		void* ctx;
+	} binds[GPIO_PINS];
+
+	struct mutex lock;	// Held by the reader and around watch changes.
+	wait_queue_head_t wait;
+	int open;
+	int irq_ready;
+};
+
+static int gpio_event_irq = -1;
+module_param( gpio_event_irq, int, 0444 );
+MODULE_PARM_DESC( gpio_event_irq, "IRQ raised by GPIO events on either bank, events are disabled if negative" );
+
+static struct gpio_event_state gpio_events;
+
+static inline u8 gpio_event_edge( unsigned int pin, u32 level ) {
+	const u8 edges = gpio_events.edges[pin] & ( GPIO_EDGE_RISING | GPIO_EDGE_FALLING );
+
+	// Only a pin watching both edges needs the level to tell them apart, a pulse shorter than the
+	// handler latency is reported with the edge it ended on
+	if ( edges == GPIO_EDGE_RISING || edges == GPIO_EDGE_FALLING ) {
+		return edges;
+	}
+
+	return level ? SPECTR_IO_GPIO_EDGE_RISING : SPECTR_IO_GPIO_EDGE_FALLING;
+}
+
+static irqreturn_t gpio_event_irq_handler( int irq, void* dev ) {
+	const u64 now = ktime_get_ns();
+	const u32 tail = smp_load_acquire( &gpio_events.tail );
+	u32 head = gpio_events.head;
+	int handled = 0;
+	unsigned int bank;
+
+	for ( bank = 0; bank < 2; bank++ ) {
+		// The handler of a bound pin is set before the pin is let through
+		const u32 bound = smp_load_acquire( &gpio_events.bound[bank] );
+		u32 levels;
+		u32 pending = gpio_ack_events( bank, READ_ONCE( gpio_events.watched[bank] ) | bound, &levels );
+		u32 fired = pending & bound;
+		handled |= pending != 0;
+		pending &= ~fired;
+
+		while ( fired ) {
+			const unsigned int pin = bank * 32 + __ffs( fired );
+			fired &= fired - 1;
+			gpio_events.binds[pin].fn( pin, now, gpio_events.binds[pin].ctx );
+		}
+
+		while ( pending ) {
+			const unsigned int bit = __ffs( pending );
+			pending &= pending - 1;
+
+			// A full ring drops the event, the sequence number still counts it
+			const u32 seqno = gpio_events.seqno++;
+			if ( head - tail >= GPIO_EVENT_RING ) {
+				continue;
+			}
+
+			struct spectr_io_gpio_event* const event = &gpio_events.ring[head & ( GPIO_EVENT_RING - 1 )];
+			event->timestamp_ns = now;
+			event->seqno = seqno;
+			event->pin = bank * 32 + bit;
+			event->edge = gpio_event_edge( event->pin, levels & BIT( bit ) );
+			event->reserved = 0;
+			head++;
+		}
+	}
+
+	// Other users of a shared line get their turn when none of the watched pins fired
+	if ( !handled ) {
+		return IRQ_NONE;
+	}
+
+	smp_store_release( &gpio_events.head, head );
+	wake_up_interruptible( &gpio_events.wait );
+
+	return IRQ_HANDLED;
+}
+
+int __init gpio_event_init( void ) {
+	mutex_init( &gpio_events.lock );
+	init_waitqueue_head( &gpio_events.wait );
+
+	if ( gpio_event_irq < 0 ) {
+		return 0;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "GPIO requesting event interrupt %d.", gpio_event_irq );
+#endif // DEBUG
+	// Not fatal, the pins can still be polled without events
+	if ( request_irq( gpio_event_irq, gpio_event_irq_handler, IRQF_SHARED, "spectr-io-gpio", &gpio_events ) ) {
+		LOG( KERN_ERR, "GPIO failed to request event interrupt %d, events are disabled.", gpio_event_irq );
+		return 0;
+	}
+	gpio_events.irq_ready = 1;
+
+	return 0;
+}
+
+void gpio_event_exit( void ) {
+	if ( gpio_events.irq_ready ) {
+		free_irq( gpio_event_irq, &gpio_events );
+		gpio_events.irq_ready = 0;
+	}
+}
+
+int gpio_event_open( void ) {
+	int err = 0;
+
+	mutex_lock( &gpio_events.lock );
+	if ( gpio_events.open ) {
+		err = -EBUSY;
+	} else {
+		gpio_events.open = 1;
+		smp_store_release( &gpio_events.tail, smp_load_acquire( &gpio_events.head ) );
+	}
+	mutex_unlock( &gpio_events.lock );
+
+	return err;
+}
+
+void gpio_event_release( void ) {
+	unsigned int pin;
+
+	mutex_lock( &gpio_events.lock );
+	for ( pin = 0; pin < GPIO_PINS; pin++ ) {
+		if ( gpio_events.edges[pin] ) {
+			gpio_set_pin_edges( pin, 0 );
+			gpio_events.edges[pin] = 0;
+		}
+	}
+	WRITE_ONCE( gpio_events.watched[0], 0 );
+	WRITE_ONCE( gpio_events.watched[1], 0 );
+	gpio_events.open = 0;
+	mutex_unlock( &gpio_events.lock );
+}
+
+int gpio_event_watch( unsigned int pin, unsigned int edges ) {
+	const unsigned int bank = pin >> 5;
+	const u32 bit = BIT( pin & 0x1F );
+
+	if ( pin >= GPIO_PINS || edges & ~( GPIO_EDGE_RISING | GPIO_EDGE_FALLING | GPIO_EDGE_ASYNC ) ) {
+		return -EINVAL;
+	}
+	if ( !gpio_events.irq_ready ) {
+		return -ENODEV;
+	}
+	if ( READ_ONCE( gpio_events.bound[bank] ) & bit ) {
+		return -EBUSY;
+	}
+
+	// An edge type has to be picked for the pin to raise anything
+	if ( !( edges & ( GPIO_EDGE_RISING | GPIO_EDGE_FALLING ) ) ) {
+		edges = 0;
+	}
+
+	mutex_lock( &gpio_events.lock );
+	gpio_events.edges[pin] = edges;
+
+	// The pin is only let through the handler once its events are enabled, and disabled before
+	// it is masked, so no event of it is ever left latched
+	if ( edges ) {
+		gpio_set_pin_edges( pin, edges );
+		WRITE_ONCE( gpio_events.watched[bank], gpio_events.watched[bank] | bit );
+	} else {
+		gpio_set_pin_edges( pin, 0 );
+		WRITE_ONCE( gpio_events.watched[bank], gpio_events.watched[bank] & ~bit );
+	}
+	mutex_unlock( &gpio_events.lock );
+
+	return 0;
+}
+
+int gpio_event_bind( unsigned int pin, unsigned int edges, gpio_event_fn fn, void* ctx ) {
+	const unsigned int bank = pin >> 5;
+	const u32 bit = BIT( pin & 0x1F );
+	int err = 0;
+
+	if ( pin >= GPIO_PINS || !( edges & ( GPIO_EDGE_RISING | GPIO_EDGE_FALLING ) )
+			|| edges & ~( GPIO_EDGE_RISING | GPIO_EDGE_FALLING | GPIO_EDGE_ASYNC ) ) {
+		return -EINVAL;
+	}
+	if ( !gpio_events.irq_ready ) {
+		return -ENODEV;
+	}
+
+	mutex_lock( &gpio_events.lock );
+	if ( ( gpio_events.watched[bank] | gpio_events.bound[bank] ) & bit ) {
+		err = -EBUSY;
+	} else {
+		gpio_events.binds[pin].fn = fn;
+		gpio_events.binds[pin].ctx = ctx;
+		smp_store_release( &gpio_events.bound[bank], gpio_events.bound[bank] | bit );
+		gpio_set_pin_edges( pin, edges );
+	}
+	mutex_unlock( &gpio_events.lock );
+
+	return err;
+}
+
+void gpio_event_unbind( unsigned int pin ) {
+	const unsigned int bank = pin >> 5;
+	const u32 bit = BIT( pin & 0x1F );
+
+	if ( pin >= GPIO_PINS ) {
+		return;
+	}
+
+	mutex_lock( &gpio_events.lock );
+	if ( gpio_events.bound[bank] & bit ) {
+		gpio_set_pin_edges( pin, 0 );
+		WRITE_ONCE( gpio_events.bound[bank], gpio_events.bound[bank] & ~bit );
+
+		// A handler already running on another CPU is waited for
+		synchronize_irq( gpio_event_irq );
+	}
+	mutex_unlock( &gpio_events.lock );
+}
+
+static inline int gpio_event_pending( void ) {
+	return smp_load_acquire( &gpio_events.head ) != READ_ONCE( gpio_events.tail );
+}
+
+ssize_t gpio_event_read( char __user* buf, size_t len, int nonblock ) {
+	const size_t size = sizeof( struct spectr_io_gpio_event );
+	const size_t max = len / size;
+	u32 head;
+	u32 tail;
+
+	if ( !max ) {
+		return -EINVAL;
+	}
+
+	if ( mutex_lock_interruptible( &gpio_events.lock ) ) {
+		return -ERESTARTSYS;
+	}
+	while ( !gpio_event_pending() ) {
+		mutex_unlock( &gpio_events.lock );
+		if ( nonblock ) {
+			return -EAGAIN;
+		}
+		if ( wait_event_interruptible( gpio_events.wait, gpio_event_pending() ) ) {
+			return -ERESTARTSYS;
+		}
+		if ( mutex_lock_interruptible( &gpio_events.lock ) ) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	head = smp_load_acquire( &gpio_events.head );
+	tail = gpio_events.tail;
+	const size_t count = min_t( size_t, head - tail, max );
+
+	// The events read wrap around the end of the ring at most once
+	const size_t first = min_t( size_t, count, GPIO_EVENT_RING - ( tail & ( GPIO_EVENT_RING - 1 ) ) );
+	if ( copy_to_user( buf, &gpio_events.ring[tail & ( GPIO_EVENT_RING - 1 )], first * size )
+			|| copy_to_user( buf + first * size, gpio_events.ring, ( count - first ) * size ) ) {
+		mutex_unlock( &gpio_events.lock );
+		return -EFAULT;
+	}
+
+	// The slots are only handed back once the events are copied out of them
+	smp_store_release( &gpio_events.tail, tail + count );
+	mutex_unlock( &gpio_events.lock );
+
+	return count * size;
+}
+
+__poll_t gpio_event_poll( struct file* file, poll_table* wait ) {
+	poll_wait( file, &gpio_events.wait, wait );
+
+	return gpio_event_pending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
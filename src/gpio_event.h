@@ -0,0 +1,106 @@
+#ifndef _SPECTR_IO_GPIO_EVENT_H
+#define _SPECTR_IO_GPIO_EVENT_H
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+
+/**
+ * Called from the GPIO interrupt for every edge of a pin bound with gpio_event_bind().
+ *
+ * @param pin The pin.
+ * @param timestamp_ns The time the interrupt was taken at.
+ * @param ctx The context given to gpio_event_bind().
+ *
+ */
+typedef void ( *gpio_event_fn )( unsigned int pin, u64 timestamp_ns, void* ctx );
+
+/**
+ * Initializes GPIO edge events, taking the GPIO interrupt given by the gpio_event_irq parameter.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init gpio_event_init( void );
+
+/**
+ * Destroys GPIO edge events.
+ *
+ */
+void gpio_event_exit( void );
+
+/**
+ * Takes the reading end of the event ring, there is only one.
+ *
+ * Events left over from a previous reader are dropped.
+ *
+ * @returns Zero on success; -EBUSY if the ring already has a reader.
+ *
+ */
+int gpio_event_open( void );
+
+/**
+ * Gives back the reading end of the event ring and stops watching every pin.
+ *
+ */
+void gpio_event_release( void );
+
+/**
+ * Sets the edges a GPIO pin raises events on.
+ *
+ * @param pin The pin.
+ * @param edges The GPIO_EDGE* edges, zero to stop watching the pin.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_event_watch( unsigned int pin, unsigned int edges );
+
+/**
+ * Binds a GPIO pin to a handler, which gets its edges straight from the interrupt instead of
+ * the event ring. Bound pins stay bound across readers of the ring.
+ *
+ * @param pin The pin, neither watched nor bound.
+ * @param edges The GPIO_EDGE* edges.
+ * @param fn The handler, called in interrupt context.
+ * @param ctx The context passed to the handler.
+ *
+ * @returns Zero on success; -EBUSY if the pin is watched or bound; a negative error code on
+ * other failures.
+ *
+ */
+int gpio_event_bind( unsigned int pin, unsigned int edges, gpio_event_fn fn, void* ctx );
+
+/**
+ * Unbinds a GPIO pin from its handler, waiting for a call of it in progress to return.
+ *
+ * @param pin The pin.
+ *
+ */
+void gpio_event_unbind( unsigned int pin );
+
+/**
+ * Reads whole struct spectr_io_gpio_event events from the ring, as many as are there and fit.
+ *
+ * @param buf The userspace buffer to read to.
+ * @param len The length of the buffer in bytes.
+ * @param nonblock Whether to fail with -EAGAIN instead of waiting for an event.
+ *
+ * @returns The number of bytes read; a negative error code on failure.
+ *
+ */
+ssize_t gpio_event_read( char __user* buf, size_t len, int nonblock );
+
+/**
+ * Polls the event ring for events.
+ *
+ * @param file The file polled.
+ * @param wait The poll table.
+ *
+ * @returns EPOLLIN if events wait to be read.
+ *
+ */
+__poll_t gpio_event_poll( struct file* file, poll_table* wait );
+
+#endif // _SPECTR_IO_GPIO_EVENT_H
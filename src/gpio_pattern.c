@@ -0,0 +1,336 @@
+#include "gpio_pattern.h"
+
+#include <linux/bitops.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "gpio.h"
+
+#define GPIO_PATTERN_OWNER	"gpio-pattern"
+
+struct gpio_pattern_table {
+	struct spectr_io_gpio_step* steps;
+	u32 count;
+	u32 loops;
+};
+
+// The timer only ever reads the front table, and the back one only once it is flagged to be
+// swapped in, so a table is loaded into the back without holding the lock.
+struct gpio_pattern_state {
+	struct gpio_pattern_table tables[2];
+	unsigned int front;	// The table played.
+	int swap;		// Whether the back table is swapped in at the end of the pass.
+
+	u32 step;		// The next step of the front table.
+	u32 passes;
+	u32 swaps;
+	u32 late;
+	int running;
+
+	u32 claimed;		// The pins of bank 0 claimed as outputs.
+
+	struct hrtimer timer;
+	spinlock_t lock;	// Held by the timer and around changes of the table state.
+	struct mutex mutex;	// Held by the caller taking the engine and around loads, starts and stops.
+	wait_queue_head_t wait;
+	int open;
+};
+
+static struct gpio_pattern_state gpio_pattern;
+
+// Moves on to the next step, returning zero once the last pass is done
+static int gpio_pattern_advance( void ) {
+	const struct gpio_pattern_table* const table = &gpio_pattern.tables[gpio_pattern.front];
+
+	if ( ++gpio_pattern.step < table->count ) {
+		return 1;
+	}
+
+	gpio_pattern.step = 0;
+	gpio_pattern.passes++;
+	if ( gpio_pattern.swap ) {
+		gpio_pattern.front ^= 1;
+		gpio_pattern.swap = 0;
+		gpio_pattern.passes = 0;
+		gpio_pattern.swaps++;
+		wake_up_interruptible( &gpio_pattern.wait );
+		return 1;
+	}
+
+	return !table->loops || gpio_pattern.passes < table->loops;
+}
+
+static enum hrtimer_restart gpio_pattern_tick( struct hrtimer* timer ) {
+	u32 delay;
+
+	spin_lock( &gpio_pattern.lock );
+
+	// Steps with no delay are run back to back, a table is never all of them
+	do {
+		const struct spectr_io_gpio_step* const step
+			= &gpio_pattern.tables[gpio_pattern.front].steps[gpio_pattern.step];
+		gpio_write_mask( GPIO_BANK0, step->set_mask, step->clr_mask );
+		delay = step->delay_ns;
+
+		if ( !gpio_pattern_advance() ) {
+			gpio_pattern.running = 0;
+			spin_unlock( &gpio_pattern.lock );
+			wake_up_interruptible( &gpio_pattern.wait );
+			return HRTIMER_NORESTART;
+		}
+	} while ( !delay );
+
+	// The schedule is kept from the expiry, not from now, so lateness does not build up
+	hrtimer_add_expires_ns( timer, delay );
+	if ( hrtimer_get_expires_ns( timer ) < ( s64 ) ktime_get_ns() ) {
+		gpio_pattern.late++;
+	}
+
+	spin_unlock( &gpio_pattern.lock );
+
+	return HRTIMER_RESTART;
+}
+
+int __init gpio_pattern_init( void ) {
+	spin_lock_init( &gpio_pattern.lock );
+	mutex_init( &gpio_pattern.mutex );
+	init_waitqueue_head( &gpio_pattern.wait );
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 13, 0 )
+	hrtimer_setup( &gpio_pattern.timer, gpio_pattern_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL );
+#else
+	hrtimer_init( &gpio_pattern.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL );
+	gpio_pattern.timer.function = gpio_pattern_tick;
+#endif
+
+	return 0;
+}
+
+void gpio_pattern_exit( void ) {
+	hrtimer_cancel( &gpio_pattern.timer );
+}
+
+int gpio_pattern_open( void ) {
+	unsigned int i;
+
+	mutex_lock( &gpio_pattern.mutex );
+	if ( gpio_pattern.open ) {
+		mutex_unlock( &gpio_pattern.mutex );
+		return -EBUSY;
+	}
+
+	for ( i = 0; i < 2; i++ ) {
+		gpio_pattern.tables[i].steps = kmalloc_array( SPECTR_IO_GPIO_PATTERN_STEPS_MAX,
+			sizeof( struct spectr_io_gpio_step ), GFP_KERNEL );
+		gpio_pattern.tables[i].count = 0;
+		if ( !gpio_pattern.tables[i].steps ) {
+			kfree( gpio_pattern.tables[0].steps );
+			gpio_pattern.tables[0].steps = ( struct spectr_io_gpio_step* ) 0;
+			mutex_unlock( &gpio_pattern.mutex );
+			return -ENOMEM;
+		}
+	}
+
+	gpio_pattern.front = 0;
+	gpio_pattern.swap = 0;
+	gpio_pattern.step = 0;
+	gpio_pattern.passes = 0;
+	gpio_pattern.swaps = 0;
+	gpio_pattern.late = 0;
+	gpio_pattern.open = 1;
+	mutex_unlock( &gpio_pattern.mutex );
+
+	return 0;
+}
+
+static void gpio_pattern_release_pins( void ) {
+	struct gpio_pin_config pins[32];
+	size_t count = 0;
+	u32 claimed = gpio_pattern.claimed;
+
+	while ( claimed ) {
+		pins[count].pin = __ffs( claimed );
+		pins[count].mode = GPIO_PIN_MODE_INPUT;
+		count++;
+		claimed &= claimed - 1;
+	}
+	if ( count ) {
+		gpio_release_pins( GPIO_PATTERN_OWNER, pins, count );
+	}
+	gpio_pattern.claimed = 0;
+}
+
+void gpio_pattern_release( void ) {
+	unsigned int i;
+
+	gpio_pattern_stop();
+
+	mutex_lock( &gpio_pattern.mutex );
+	gpio_pattern_release_pins();
+	for ( i = 0; i < 2; i++ ) {
+		kfree( gpio_pattern.tables[i].steps );
+		gpio_pattern.tables[i].steps = ( struct spectr_io_gpio_step* ) 0;
+		gpio_pattern.tables[i].count = 0;
+	}
+	gpio_pattern.open = 0;
+	mutex_unlock( &gpio_pattern.mutex );
+}
+
+static int gpio_pattern_claim( u32 pins ) {
+	struct gpio_pin_config config[32];
+	size_t count = 0;
+	u32 left = pins & ~gpio_pattern.claimed;
+
+	while ( left ) {
+		config[count].pin = __ffs( left );
+		config[count].mode = GPIO_PIN_MODE_OUTPUT;
+		count++;
+		left &= left - 1;
+	}
+	if ( !count ) {
+		return 0;
+	}
+
+	if ( gpio_configure_pins( GPIO_PATTERN_OWNER, config, count ) ) {
+		return -EBUSY;
+	}
+	gpio_pattern.claimed |= pins;
+
+	return 0;
+}
+
+int gpio_pattern_load( const struct spectr_io_gpio_step __user* steps, u32 count, u32 loops ) {
+	unsigned long flags;
+	u32 pins = 0;
+	u32 delay = 0;
+	u32 i;
+	int err;
+
+	if ( !count || count > SPECTR_IO_GPIO_PATTERN_STEPS_MAX ) {
+		return -EINVAL;
+	}
+
+	mutex_lock( &gpio_pattern.mutex );
+
+	// A table waiting to be swapped in is taken back before it is overwritten
+	spin_lock_irqsave( &gpio_pattern.lock, flags );
+	gpio_pattern.swap = 0;
+	spin_unlock_irqrestore( &gpio_pattern.lock, flags );
+
+	struct gpio_pattern_table* const back = &gpio_pattern.tables[gpio_pattern.front ^ 1];
+	if ( copy_from_user( back->steps, steps, count * sizeof( back->steps[0] ) ) ) {
+		err = -EFAULT;
+		goto gpio_pattern_load_done;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		const struct spectr_io_gpio_step* const step = &back->steps[i];
+		if ( step->reserved || ( step->delay_ns && step->delay_ns < SPECTR_IO_GPIO_PATTERN_DELAY_MIN ) ) {
+			err = -EINVAL;
+			goto gpio_pattern_load_done;
+		}
+		pins |= step->set_mask | step->clr_mask;
+		delay |= step->delay_ns;
+	}
+
+	// A table without any delay would never give the timer interrupt back
+	if ( !delay ) {
+		err = -EINVAL;
+		goto gpio_pattern_load_done;
+	}
+
+	err = gpio_pattern_claim( pins );
+	if ( err ) {
+		goto gpio_pattern_load_done;
+	}
+
+	back->count = count;
+	back->loops = loops;
+	spin_lock_irqsave( &gpio_pattern.lock, flags );
+	gpio_pattern.swap = 1;
+	spin_unlock_irqrestore( &gpio_pattern.lock, flags );
+
+gpio_pattern_load_done:
+	mutex_unlock( &gpio_pattern.mutex );
+
+	return err;
+}
+
+int gpio_pattern_start( void ) {
+	unsigned long flags;
+	int err = 0;
+
+	mutex_lock( &gpio_pattern.mutex );
+	spin_lock_irqsave( &gpio_pattern.lock, flags );
+	if ( gpio_pattern.running ) {
+		err = -EBUSY;
+	} else {
+		// A stopped engine has no pass to finish, a loaded table is swapped in right away
+		if ( gpio_pattern.swap ) {
+			gpio_pattern.front ^= 1;
+			gpio_pattern.swap = 0;
+		}
+		if ( !gpio_pattern.tables[gpio_pattern.front].count ) {
+			err = -EINVAL;
+		} else {
+			gpio_pattern.step = 0;
+			gpio_pattern.passes = 0;
+			gpio_pattern.running = 1;
+		}
+	}
+	spin_unlock_irqrestore( &gpio_pattern.lock, flags );
+
+	if ( !err ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "GPIO starting pattern of %u steps.", gpio_pattern.tables[gpio_pattern.front].count );
+#endif // DEBUG
+		hrtimer_start( &gpio_pattern.timer, ns_to_ktime( 0 ), HRTIMER_MODE_REL );
+	}
+	wake_up_interruptible( &gpio_pattern.wait );
+	mutex_unlock( &gpio_pattern.mutex );
+
+	return err;
+}
+
+void gpio_pattern_stop( void ) {
+	unsigned long flags;
+
+	mutex_lock( &gpio_pattern.mutex );
+	hrtimer_cancel( &gpio_pattern.timer );
+	spin_lock_irqsave( &gpio_pattern.lock, flags );
+	gpio_pattern.running = 0;
+	spin_unlock_irqrestore( &gpio_pattern.lock, flags );
+	mutex_unlock( &gpio_pattern.mutex );
+
+	wake_up_interruptible( &gpio_pattern.wait );
+}
+
+void gpio_pattern_status( struct spectr_io_gpio_pattern_status* status ) {
+	unsigned long flags;
+
+	spin_lock_irqsave( &gpio_pattern.lock, flags );
+	*status = ( struct spectr_io_gpio_pattern_status ) {
+		.running = gpio_pattern.running,
+		.step = gpio_pattern.step,
+		.passes = gpio_pattern.passes,
+		.pending = gpio_pattern.swap,
+		.swaps = gpio_pattern.swaps,
+		.late = gpio_pattern.late,
+	};
+	spin_unlock_irqrestore( &gpio_pattern.lock, flags );
+}
+
+__poll_t gpio_pattern_poll( struct file* file, poll_table* wait ) {
+	poll_wait( file, &gpio_pattern.wait, wait );
+
+	return READ_ONCE( gpio_pattern.swap ) ? 0 : EPOLLOUT | EPOLLWRNORM;
+}
@@ -0,0 +1,92 @@
+#ifndef _SPECTR_IO_GPIO_PATTERN_H
+#define _SPECTR_IO_GPIO_PATTERN_H
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+
+#include "uapi/spectr_io.h"
+
+/**
+ * Initializes the GPIO pattern engine.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init gpio_pattern_init( void );
+
+/**
+ * Destroys the GPIO pattern engine.
+ *
+ */
+void gpio_pattern_exit( void );
+
+/**
+ * Takes the pattern engine, there is only one, and allocates its tables.
+ *
+ * @returns Zero on success; -EBUSY if the engine is already taken; -ENOMEM on failure.
+ *
+ */
+int gpio_pattern_open( void );
+
+/**
+ * Stops the pattern engine, gives it back and returns the pins it drove to inputs.
+ *
+ */
+void gpio_pattern_release( void );
+
+/**
+ * Loads a table of steps into the pattern engine.
+ *
+ * The pins the steps drive are claimed as outputs, on bank 0. A stopped engine plays the table
+ * from the next start, a running one swaps it in at the end of the pass of the table playing. A
+ * table still waiting to be swapped in is replaced, or dropped if the load fails.
+ *
+ * @param steps The userspace array of steps.
+ * @param count The number of steps.
+ * @param loops The number of passes before the engine stops, zero to play until stopped.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_pattern_load( const struct spectr_io_gpio_step __user* steps, u32 count, u32 loops );
+
+/**
+ * Starts playing the loaded table from its first step.
+ *
+ * Steps are run from a high resolution timer on a fixed schedule, a step that runs late does not
+ * push back the ones after it. Steps with no delay run in the same timer interrupt as the step
+ * before them.
+ *
+ * @returns Zero on success; -EBUSY if a table plays; -EINVAL if none is loaded.
+ *
+ */
+int gpio_pattern_start( void );
+
+/**
+ * Stops playing, waiting for a step in progress to finish. The pins keep their levels.
+ *
+ */
+void gpio_pattern_stop( void );
+
+/**
+ * Gets the state of the pattern engine.
+ *
+ * @param status The location to store the state at.
+ *
+ */
+void gpio_pattern_status( struct spectr_io_gpio_pattern_status* status );
+
+/**
+ * Polls the pattern engine for room to load a table.
+ *
+ * @param file The file polled.
+ * @param wait The poll table.
+ *
+ * @returns EPOLLOUT if no loaded table waits to be swapped in.
+ *
+ */
+__poll_t gpio_pattern_poll( struct file* file, poll_table* wait );
+
+#endif // _SPECTR_IO_GPIO_PATTERN_H
@@ -0,0 +1,322 @@
+#include "gpio_sampler.h"
+
+#include <asm/barrier.h>
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/eventfd.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "gpio.h"
+#include "uapi/spectr_io.h"
+
+// The shortest period, two GPLEV reads and a store have to fit in it with room to spare.
+#define GPIO_SAMPLER_MIN_PERIOD_NS	500
+
+// Samples due within this many ns are spun for instead of slept for.
+#define GPIO_SAMPLER_SPIN_NS		20000
+
+#define GPIO_SAMPLER_RUN_SHIFT		54
+
+struct gpio_sampler {
+	struct spectr_io_gpio_sample_header* header;	// The start of the ring, shared with userspace.
+	u64* data;					// The first sample word.
+	size_t size;					// The size of the ring in bytes, page aligned.
+	u32 words;
+
+	// Owned by the worker while the sampler runs, the header only gets copies of these so
+	// nothing userspace writes to it can throw the driver off
+	u32 head;
+	u32 notified;		// The head at the last wake-up.
+	u32 overruns;
+	u32 missed;
+
+	u64 levels;		// The levels of the word being counted.
+	u32 run;		// The periods after its first the word being counted stands for.
+	int pending;		// Whether a word is being counted.
+
+	u32 period_ns;
+	int rle;
+	unsigned int notify;
+	struct eventfd_ctx* eventfd;
+
+	struct task_struct* worker;
+	wait_queue_head_t wait;
+};
+
+static int gpio_sampler_cpu = -1;
+module_param( gpio_sampler_cpu, int, 0444 );
+MODULE_PARM_DESC( gpio_sampler_cpu, "CPU the GPIO sampler threads are bound to, unbound if negative" );
+
+static int gpio_sampler_prio = 0;
+module_param( gpio_sampler_prio, int, 0444 );
+MODULE_PARM_DESC( gpio_sampler_prio, "SCHED_FIFO priority of the GPIO sampler threads, SCHED_NORMAL if zero" );
+
+static void gpio_sampler_wake( struct gpio_sampler* sampler ) {
+	sampler->notified = sampler->head;
+	wake_up_interruptible( &sampler->wait );
+	if ( sampler->eventfd ) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 8, 0 )
+		eventfd_signal( sampler->eventfd );
+#else
+		eventfd_signal( sampler->eventfd, 1 );
+#endif
+	}
+}
+
+static void gpio_sampler_push( struct gpio_sampler* sampler, u64 word ) {
+	struct spectr_io_gpio_sample_header* const header = sampler->header;
+
+	if ( sampler->head - smp_load_acquire( &header->tail ) >= sampler->words ) {
+		WRITE_ONCE( header->overruns, ++sampler->overruns );
+		return;
+	}
+
+	// The word has to be visible before the head that publishes it
+	sampler->data[sampler->head & ( sampler->words - 1 )] = word;
+	smp_store_release( &header->head, ++sampler->head );
+	if ( sampler->head - sampler->notified >= sampler->notify ) {
+		gpio_sampler_wake( sampler );
+	}
+}
+
+static void gpio_sampler_flush( struct gpio_sampler* sampler ) {
+	if ( !sampler->pending ) {
+		return;
+	}
+
+	gpio_sampler_push( sampler, sampler->levels | ( u64 ) sampler->run << GPIO_SAMPLER_RUN_SHIFT );
+	sampler->pending = 0;
+}
+
+static void gpio_sampler_record( struct gpio_sampler* sampler, u64 levels, u32 periods ) {
+	if ( !sampler->pending || levels != sampler->levels ) {
+		gpio_sampler_flush( sampler );
+		sampler->levels = levels;
+		sampler->run = 0;
+		sampler->pending = 1;
+		periods--;
+	}
+
+	// Runs too long for a word carry on in words of their own
+	while ( periods > SPECTR_IO_GPIO_SAMPLE_RUN_MAX - sampler->run ) {
+		periods -= SPECTR_IO_GPIO_SAMPLE_RUN_MAX - sampler->run + 1;
+		sampler->run = SPECTR_IO_GPIO_SAMPLE_RUN_MAX;
+		gpio_sampler_flush( sampler );
+		sampler->run = 0;
+		sampler->pending = 1;
+	}
+	sampler->run += periods;
+
+	if ( !sampler->rle ) {
+		gpio_sampler_flush( sampler );
+	}
+}
+
+static u32 gpio_sampler_pace( struct gpio_sampler* sampler, u64* next ) {
+	const u64 period = sampler->period_ns;
+
+	*next += period;
+	u64 now = ktime_get_ns();
+
+	// A sampler that fell a whole period behind skips ahead instead of sampling in a burst, the
+	// periods it skipped get the levels of the sample it takes now
+	if ( now >= *next + period ) {
+		const u64 late = min_t( u64, div64_u64( now - *next, period ), U32_MAX - 1 );
+		*next += late * period;
+		sampler->missed += late;
+		WRITE_ONCE( sampler->header->missed, sampler->missed );
+		return late + 1;
+	}
+
+	if ( *next > now + GPIO_SAMPLER_SPIN_NS ) {
+		const unsigned long us = div_u64( *next - now - GPIO_SAMPLER_SPIN_NS, NSEC_PER_USEC );
+		usleep_range( us, us + GPIO_SAMPLER_SPIN_NS / ( 2 * NSEC_PER_USEC ) );
+	} else {
+		// Nothing else gets the CPU otherwise on kernels without preemption
+		cond_resched();
+	}
+
+	while ( now < *next ) {
+		cpu_relax();
+		now = ktime_get_ns();
+	}
+
+	return 1;
+}
+
+static int gpio_sampler_worker( void* data ) {
+	struct gpio_sampler* const sampler = data;
+	u64 next = ktime_get_ns();
+	u32 periods = 1;
+
+	WRITE_ONCE( sampler->header->start_ns, next );
+	while ( !kthread_should_stop() ) {
+		gpio_sampler_record( sampler, gpio_read_levels(), periods );
+		periods = gpio_sampler_pace( sampler, &next );
+	}
+
+	// The run being counted is cut short by the stop
+	gpio_sampler_flush( sampler );
+
+	return 0;
+}
+
+struct gpio_sampler* gpio_sampler_create( u32 words ) {
+	if ( !is_power_of_2( words ) || words > SPECTR_IO_GPIO_SAMPLE_WORDS_MAX ) {
+		return ERR_PTR( -EINVAL );
+	}
+
+	struct gpio_sampler* const sampler = kzalloc( sizeof( *sampler ), GFP_KERNEL );
+	if ( !sampler ) {
+		return ERR_PTR( -ENOMEM );
+	}
+
+	// vmalloc_user() zeroes the pages and marks them for remap_vmalloc_range()
+	sampler->size = PAGE_ALIGN( PAGE_SIZE + ( size_t ) words * sizeof( u64 ) );
+	sampler->header = vmalloc_user( sampler->size );
+	if ( !sampler->header ) {
+		kfree( sampler );
+		return ERR_PTR( -ENOMEM );
+	}
+
+	sampler->data = ( u64* ) ( ( u8* ) sampler->header + PAGE_SIZE );
+	sampler->words = words;
+	init_waitqueue_head( &sampler->wait );
+
+	sampler->header->words = words;
+	sampler->header->data_offset = PAGE_SIZE;
+
+	return sampler;
+}
+
+void gpio_sampler_destroy( struct gpio_sampler* sampler ) {
+	gpio_sampler_stop( sampler );
+	vfree( sampler->header );
+	kfree( sampler );
+}
+
+int gpio_sampler_fits( const struct gpio_sampler* sampler, u32 words ) {
+	return sampler->words == words;
+}
+
+static void gpio_sampler_release_config( struct gpio_sampler* sampler ) {
+	if ( sampler->eventfd ) {
+		eventfd_ctx_put( sampler->eventfd );
+		sampler->eventfd = ( struct eventfd_ctx* ) 0;
+	}
+}
+
+static void gpio_sampler_configure( struct gpio_sampler* sampler, const struct gpio_sampler_config* config ) {
+	struct spectr_io_gpio_sample_header* const header = sampler->header;
+
+	sampler->eventfd = config->eventfd;
+	sampler->period_ns = config->period_ns;
+	sampler->rle = config->rle;
+	sampler->notify = config->notify ? config->notify : 1;
+
+	// A restarted sampler carries on from the words userspace already knows about
+	sampler->head = header->head;
+	sampler->notified = sampler->head;
+	sampler->overruns = header->overruns;
+	sampler->missed = header->missed;
+	sampler->pending = 0;
+
+	header->period_ns = config->period_ns;
+	header->flags = config->rle ? SPECTR_IO_GPIO_SAMPLE_RLE : 0;
+	header->start_head = sampler->head;
+}
+
+int gpio_sampler_start( struct gpio_sampler* sampler, const struct gpio_sampler_config* config ) {
+	struct task_struct* worker;
+
+	if ( sampler->worker || config->period_ns < GPIO_SAMPLER_MIN_PERIOD_NS ) {
+		const int err = sampler->worker ? -EBUSY : -EINVAL;
+		if ( config->eventfd ) {
+			eventfd_ctx_put( config->eventfd );
+		}
+		return err;
+	}
+
+	gpio_sampler_configure( sampler, config );
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "GPIO starting sampler every %u ns into %u words.", sampler->period_ns, sampler->words );
+#endif // DEBUG
+	worker = kthread_create( gpio_sampler_worker, sampler, "spectr-io-sample" );
+	if ( IS_ERR( worker ) ) {
+		LOG( KERN_ERR, "GPIO failed to start sampler thread." );
+		gpio_sampler_release_config( sampler );
+		return PTR_ERR( worker );
+	}
+
+	if ( gpio_sampler_cpu >= 0 ) {
+		if ( gpio_sampler_cpu < nr_cpu_ids && cpu_online( gpio_sampler_cpu ) ) {
+			kthread_bind( worker, gpio_sampler_cpu );
+		} else {
+			LOG( KERN_ERR, "GPIO sampler CPU %d is not online, sampler left unbound.", gpio_sampler_cpu );
+		}
+	}
+
+	if ( gpio_sampler_prio > 0 ) {
+		struct sched_param param = {
+			.sched_priority = min( gpio_sampler_prio, MAX_RT_PRIO - 1 ),
+		};
+		if ( sched_setscheduler_nocheck( worker, SCHED_FIFO, &param ) ) {
+			LOG( KERN_ERR, "GPIO failed to set sampler priority %d.", gpio_sampler_prio );
+		}
+	}
+
+	sampler->worker = worker;
+	wake_up_process( worker );
+
+	return 0;
+}
+
+void gpio_sampler_stop( struct gpio_sampler* sampler ) {
+	if ( !sampler->worker ) {
+		return;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "GPIO stopping sampler." );
+#endif // DEBUG
+	kthread_stop( sampler->worker );
+	sampler->worker = ( struct task_struct* ) 0;
+	gpio_sampler_release_config( sampler );
+
+	// Pollers still waiting for the next wake-up get to see the words left behind
+	wake_up_interruptible( &sampler->wait );
+}
+
+int gpio_sampler_running( const struct gpio_sampler* sampler ) {
+	return sampler->worker != ( struct task_struct* ) 0;
+}
+
+int gpio_sampler_mmap( struct gpio_sampler* sampler, struct vm_area_struct* vma ) {
+	if ( vma->vm_pgoff ) {
+		return -EINVAL;
+	}
+
+	// Sizes past the end of the ring are refused
+	return remap_vmalloc_range( vma, sampler->header, 0 );
+}
+
+__poll_t gpio_sampler_poll( struct gpio_sampler* sampler, struct file* file, poll_table* wait ) {
+	const struct spectr_io_gpio_sample_header* const header = sampler->header;
+
+	poll_wait( file, &sampler->wait, wait );
+
+	return smp_load_acquire( &header->head ) != READ_ONCE( header->tail ) ? EPOLLIN | EPOLLRDNORM : 0;
+}
@@ -0,0 +1,110 @@
+#ifndef _SPECTR_IO_GPIO_SAMPLER_H
+#define _SPECTR_IO_GPIO_SAMPLER_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+
+struct eventfd_ctx;
+struct gpio_sampler;
+
+// The settings of a started sampler.
+struct gpio_sampler_config {
+	u32 period_ns;			// The time from a sample to the next.
+	int rle;			// Whether only changes of the levels are recorded.
+	unsigned int notify;		// The number of words between wake-ups, zero for every word.
+	struct eventfd_ctx* eventfd;	// Signaled on every wake-up, or NULL.
+};
+
+/**
+ * Creates a stopped GPIO sampler along with its ring.
+ *
+ * The ring is zeroed vmalloc memory starting with a struct spectr_io_gpio_sample_header page,
+ * meant to be mapped into userspace with gpio_sampler_mmap().
+ *
+ * @param words The number of sample words in the ring, a power of two.
+ *
+ * @returns The sampler; an ERR_PTR() on failure.
+ *
+ */
+struct gpio_sampler* gpio_sampler_create( u32 words );
+
+/**
+ * Stops and frees a sampler. Mappings of its ring keep their pages until they are unmapped.
+ *
+ * @param sampler The sampler.
+ *
+ */
+void gpio_sampler_destroy( struct gpio_sampler* sampler );
+
+/**
+ * Checks whether the ring of a sampler has a size.
+ *
+ * @param sampler The sampler.
+ * @param words The number of sample words.
+ *
+ * @returns Nonzero if it has; zero otherwise.
+ *
+ */
+int gpio_sampler_fits( const struct gpio_sampler* sampler, u32 words );
+
+/**
+ * Starts a sampler on a thread of its own, bound to the CPU given by the gpio_sampler_cpu
+ * parameter, which reads both GPIO banks once per period for as long as the sampler runs.
+ *
+ * Samples are taken on a fixed schedule from the start, periods the thread falls behind over are
+ * folded into the run of the next sample instead of being caught up on. Short periods are spun
+ * out, so the sampler keeps its CPU busy. Words that find the ring full are dropped and counted
+ * as overruns.
+ *
+ * @param sampler The sampler, stopped.
+ * @param config The settings, copied. The eventfd reference is taken over, even on failure.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_sampler_start( struct gpio_sampler* sampler, const struct gpio_sampler_config* config );
+
+/**
+ * Stops a sampler. A run still being counted is written out before it returns.
+ *
+ * @param sampler The sampler.
+ *
+ */
+void gpio_sampler_stop( struct gpio_sampler* sampler );
+
+/**
+ * Checks whether a sampler runs.
+ *
+ * @param sampler The sampler.
+ *
+ * @returns Nonzero if it runs; zero otherwise.
+ *
+ */
+int gpio_sampler_running( const struct gpio_sampler* sampler );
+
+/**
+ * Maps the ring of a sampler into userspace, from the start of the ring.
+ *
+ * @param sampler The sampler.
+ * @param vma The area to map the ring into.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int gpio_sampler_mmap( struct gpio_sampler* sampler, struct vm_area_struct* vma );
+
+/**
+ * Polls a sampler for sample words.
+ *
+ * @param sampler The sampler.
+ * @param file The file polled.
+ * @param wait The poll table.
+ *
+ * @returns EPOLLIN if words wait to be consumed.
+ *
+ */
+__poll_t gpio_sampler_poll( struct gpio_sampler* sampler, struct file* file, poll_table* wait );
+
+#endif // _SPECTR_IO_GPIO_SAMPLER_H
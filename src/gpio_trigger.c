@@ -0,0 +1,419 @@
+#include "gpio_trigger.h"
+
+#include <asm/barrier.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "gpio.h"
+#include "gpio_event.h"
+#include "i2c.h"
+
+// The number of edges queued to the worker, a power of two.
+#define GPIO_TRIGGER_FIRES	64
+
+// The number of samples the ring holds, a power of two.
+#define GPIO_TRIGGER_RING	256
+
+struct gpio_trigger {
+	int active;
+	u32 gen;		// Bumped on every add, so edges queued for a removed trigger are dropped.
+	unsigned int pin;
+	unsigned int kind;
+	size_t len;
+	int spi_device;
+	unsigned int i2c_bus;
+	u8 i2c_addr;
+	u8 i2c_reg;
+	u8 tx[GPIO_TRIGGER_DATA_MAX];
+	int tx_zero;
+};
+
+// An edge queued by the interrupt.
+struct gpio_trigger_fire {
+	u64 timestamp_ns;
+	u32 seqno;
+	u32 gen;
+	unsigned int trigger;
+};
+
+// Both rings have a single producer and a single consumer. The interrupt hands edges to the
+// worker through the first one, the worker hands samples to the reader through the second one.
+struct gpio_trigger_state {
+	struct gpio_trigger triggers[GPIO_TRIGGERS];
+
+	struct gpio_trigger_fire fires[GPIO_TRIGGER_FIRES];
+	u32 fire_head;
+	u32 fire_tail;
+	u32 seqno;		// The sequence number of the next edge, owned by the interrupt.
+
+	struct spectr_io_trigger_sample ring[GPIO_TRIGGER_RING];
+	u32 head;
+	u32 tail;
+
+	struct mutex lock;	// Held by the worker around a transaction and around trigger changes.
+	struct mutex read_lock;	// Held by the reader, and around taking and giving back the ring.
+	wait_queue_head_t wait;	// Readers waiting for samples.
+	wait_queue_head_t work;	// The worker waiting for edges.
+	struct task_struct* worker;
+	int open;
+};
+
+static int gpio_trigger_cpu = -1;
+module_param( gpio_trigger_cpu, int, 0444 );
+MODULE_PARM_DESC( gpio_trigger_cpu, "CPU the GPIO trigger worker thread is bound to, unbound if negative" );
+
+static int gpio_trigger_prio = 0;
+module_param( gpio_trigger_prio, int, 0444 );
+MODULE_PARM_DESC( gpio_trigger_prio, "SCHED_FIFO priority of the GPIO trigger worker thread, SCHED_NORMAL if zero" );
+
+static struct gpio_trigger_state gpio_triggers;
+
+static void gpio_trigger_edge( unsigned int pin, u64 timestamp_ns, void* ctx ) {
+	const struct gpio_trigger* const trigger = ctx;
+	const u32 head = gpio_triggers.fire_head;
+
+	// A full queue drops the edge, the sequence number still counts it
+	const u32 seqno = gpio_triggers.seqno++;
+	if ( head - smp_load_acquire( &gpio_triggers.fire_tail ) >= GPIO_TRIGGER_FIRES ) {
+		return;
+	}
+
+	struct gpio_trigger_fire* const fire = &gpio_triggers.fires[head & ( GPIO_TRIGGER_FIRES - 1 )];
+	fire->timestamp_ns = timestamp_ns;
+	fire->seqno = seqno;
+	fire->gen = trigger->gen;
+	fire->trigger = trigger - gpio_triggers.triggers;
+	smp_store_release( &gpio_triggers.fire_head, head + 1 );
+
+	wake_up( &gpio_triggers.work );
+}
+
+static int gpio_trigger_run( const struct gpio_trigger* trigger, u8* data ) {
+	ssize_t ret = 0;
+
+	if ( trigger->kind == GPIO_TRIGGER_SPI ) {
+		spi_lock_bus();
+		ret = spi_use_device( trigger->spi_device );
+		if ( !ret ) {
+			spi_begin_transfer();
+			ret = spi_transfer( trigger->tx_zero ? ( u8* ) 0 : trigger->tx, data, trigger->len );
+			spi_end_transfer();
+		}
+		spi_unlock_bus();
+
+		return ret < 0 ? ret : 0;
+	}
+
+	u8 reg = trigger->i2c_reg;
+	struct i2c1_msg msgs[2] = {
+		{
+			.addr = trigger->i2c_addr,
+			.len = 1,
+			.buf = &reg,
+		},
+		{
+			.addr = trigger->i2c_addr,
+			.flags = I2C1_M_RD,
+			.len = trigger->len,
+			.buf = data,
+		},
+	};
+
+	return i2c_bus_transfer( trigger->i2c_bus, msgs, ARRAY_SIZE( msgs ) );
+}
+
+static void gpio_trigger_push( const struct spectr_io_trigger_sample* sample ) {
+	const u32 head = gpio_triggers.head;
+
+	// A full ring drops the sample, the reader sees the gap in the sequence numbers
+	if ( head - smp_load_acquire( &gpio_triggers.tail ) >= GPIO_TRIGGER_RING ) {
+		return;
+	}
+
+	gpio_triggers.ring[head & ( GPIO_TRIGGER_RING - 1 )] = *sample;
+	smp_store_release( &gpio_triggers.head, head + 1 );
+	wake_up_interruptible( &gpio_triggers.wait );
+}
+
+static int gpio_trigger_fire_pending( void ) {
+	return smp_load_acquire( &gpio_triggers.fire_head ) != READ_ONCE( gpio_triggers.fire_tail );
+}
+
+static void gpio_trigger_drain( void ) {
+	struct spectr_io_trigger_sample sample;
+	struct gpio_trigger_fire fire;
+
+	while ( gpio_trigger_fire_pending() ) {
+		const u32 tail = gpio_triggers.fire_tail;
+		fire = gpio_triggers.fires[tail & ( GPIO_TRIGGER_FIRES - 1 )];
+		smp_store_release( &gpio_triggers.fire_tail, tail + 1 );
+
+		mutex_lock( &gpio_triggers.lock );
+		const struct gpio_trigger* const trigger = &gpio_triggers.triggers[fire.trigger];
+		if ( trigger->active && trigger->gen == fire.gen ) {
+			memset( &sample, 0, sizeof( sample ) );
+			sample.result = gpio_trigger_run( trigger, sample.data );
+			sample.latency_ns = min_t( u64, ktime_get_ns() - fire.timestamp_ns, U32_MAX );
+			sample.timestamp_ns = fire.timestamp_ns;
+			sample.seqno = fire.seqno;
+			sample.trigger = fire.trigger;
+			sample.len = trigger->len;
+			gpio_trigger_push( &sample );
+		}
+		mutex_unlock( &gpio_triggers.lock );
+	}
+}
+
+static int gpio_trigger_worker( void* data ) {
+	while ( !kthread_should_stop() ) {
+		wait_event_interruptible( gpio_triggers.work, gpio_trigger_fire_pending() || kthread_should_stop() );
+		gpio_trigger_drain();
+	}
+
+	return 0;
+}
+
+int __init gpio_trigger_init( void ) {
+	struct task_struct* worker;
+
+	mutex_init( &gpio_triggers.lock );
+	mutex_init( &gpio_triggers.read_lock );
+	init_waitqueue_head( &gpio_triggers.wait );
+	init_waitqueue_head( &gpio_triggers.work );
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "GPIO starting trigger worker thread." );
+#endif // DEBUG
+	worker = kthread_create( gpio_trigger_worker, ( void* ) 0, "spectr-io-trigger" );
+	if ( IS_ERR( worker ) ) {
+		// Not fatal, triggers are just not available
+		LOG( KERN_ERR, "GPIO failed to start trigger worker thread, triggers are disabled." );
+		return 0;
+	}
+
+	if ( gpio_trigger_cpu >= 0 ) {
+		if ( gpio_trigger_cpu < nr_cpu_ids && cpu_online( gpio_trigger_cpu ) ) {
+			kthread_bind( worker, gpio_trigger_cpu );
+		} else {
+			LOG( KERN_ERR, "GPIO trigger worker CPU %d is not online, worker left unbound.", gpio_trigger_cpu );
+		}
+	}
+
+	if ( gpio_trigger_prio > 0 ) {
+		struct sched_param param = {
+			.sched_priority = min( gpio_trigger_prio, MAX_RT_PRIO - 1 ),
+		};
+		if ( sched_setscheduler_nocheck( worker, SCHED_FIFO, &param ) ) {
+			LOG( KERN_ERR, "GPIO failed to set trigger worker priority %d.", gpio_trigger_prio );
+		}
+	}
+
+	gpio_triggers.worker = worker;
+	wake_up_process( worker );
+
+	return 0;
+}
+
+void gpio_trigger_exit( void ) {
+	if ( gpio_triggers.worker ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "GPIO stopping trigger worker thread." );
+#endif // DEBUG
+		kthread_stop( gpio_triggers.worker );
+		gpio_triggers.worker = ( struct task_struct* ) 0;
+	}
+}
+
+int gpio_trigger_open( void ) {
+	int err = 0;
+
+	mutex_lock( &gpio_triggers.read_lock );
+	if ( gpio_triggers.open ) {
+		err = -EBUSY;
+	} else {
+		gpio_triggers.open = 1;
+		smp_store_release( &gpio_triggers.tail, smp_load_acquire( &gpio_triggers.head ) );
+	}
+	mutex_unlock( &gpio_triggers.read_lock );
+
+	return err;
+}
+
+void gpio_trigger_release( void ) {
+	int handle;
+
+	for ( handle = 0; handle < GPIO_TRIGGERS; handle++ ) {
+		gpio_trigger_remove( handle );
+	}
+
+	mutex_lock( &gpio_triggers.read_lock );
+	gpio_triggers.open = 0;
+	mutex_unlock( &gpio_triggers.read_lock );
+}
+
+static int gpio_trigger_check( const struct gpio_trigger_config* config ) {
+	if ( config->pin >= GPIO_PINS || !config->len || config->len > GPIO_TRIGGER_DATA_MAX ) {
+		return -EINVAL;
+	}
+
+	switch ( config->kind ) {
+	case GPIO_TRIGGER_SPI:
+		return 0;
+	case GPIO_TRIGGER_I2C:
+		return config->i2c_bus < I2C_BUSES && config->i2c_addr <= 0x7F ? 0 : -EINVAL;
+	}
+
+	return -EINVAL;
+}
+
+int gpio_trigger_add( const struct gpio_trigger_config* config ) {
+	struct gpio_trigger* trigger = ( struct gpio_trigger* ) 0;
+	int handle;
+	int err;
+
+	err = gpio_trigger_check( config );
+	if ( err ) {
+		return err;
+	}
+	if ( !gpio_triggers.worker ) {
+		return -ENODEV;
+	}
+
+	mutex_lock( &gpio_triggers.lock );
+	for ( handle = 0; handle < GPIO_TRIGGERS; handle++ ) {
+		if ( !gpio_triggers.triggers[handle].active ) {
+			trigger = &gpio_triggers.triggers[handle];
+			break;
+		}
+	}
+	if ( !trigger ) {
+		mutex_unlock( &gpio_triggers.lock );
+		return -ENOSPC;
+	}
+
+	trigger->pin = config->pin;
+	trigger->kind = config->kind;
+	trigger->len = config->len;
+	trigger->i2c_bus = config->i2c_bus;
+	trigger->i2c_addr = config->i2c_addr;
+	trigger->i2c_reg = config->i2c_reg;
+	trigger->tx_zero = !config->tx;
+	if ( config->tx ) {
+		memcpy( trigger->tx, config->tx, config->len );
+	}
+
+	// SPI triggers switch to a device of their own, so they do not depend on any file
+	if ( config->kind == GPIO_TRIGGER_SPI ) {
+		trigger->spi_device = spi_register_device( &config->spi );
+		if ( trigger->spi_device < 0 ) {
+			mutex_unlock( &gpio_triggers.lock );
+			return trigger->spi_device == SPI_ERR_BAD_CHIP ? -EINVAL : -ENOSPC;
+		}
+	}
+
+	trigger->gen++;
+	trigger->active = 1;
+	mutex_unlock( &gpio_triggers.lock );
+
+	// The pin is bound last, once the trigger can be run
+	err = gpio_event_bind( config->pin, config->edges, gpio_trigger_edge, trigger );
+	if ( err ) {
+		mutex_lock( &gpio_triggers.lock );
+		trigger->active = 0;
+		if ( trigger->kind == GPIO_TRIGGER_SPI ) {
+			spi_unregister_device( trigger->spi_device );
+		}
+		mutex_unlock( &gpio_triggers.lock );
+		return err;
+	}
+
+	return handle;
+}
+
+int gpio_trigger_remove( int handle ) {
+	if ( handle < 0 || handle >= GPIO_TRIGGERS ) {
+		return -EINVAL;
+	}
+
+	struct gpio_trigger* const trigger = &gpio_triggers.triggers[handle];
+	if ( !READ_ONCE( trigger->active ) ) {
+		return -EINVAL;
+	}
+
+	// No edge comes in for the pin once it is unbound, and none queued runs once the trigger is
+	// inactive, the lock waits for one that already runs
+	gpio_event_unbind( trigger->pin );
+	mutex_lock( &gpio_triggers.lock );
+	trigger->active = 0;
+	if ( trigger->kind == GPIO_TRIGGER_SPI ) {
+		spi_unregister_device( trigger->spi_device );
+	}
+	mutex_unlock( &gpio_triggers.lock );
+
+	return 0;
+}
+
+static inline int gpio_trigger_pending( void ) {
+	return smp_load_acquire( &gpio_triggers.head ) != READ_ONCE( gpio_triggers.tail );
+}
+
+ssize_t gpio_trigger_read( char __user* buf, size_t len, int nonblock ) {
+	const size_t size = sizeof( struct spectr_io_trigger_sample );
+	const size_t max = len / size;
+	u32 head;
+	u32 tail;
+
+	if ( !max ) {
+		return -EINVAL;
+	}
+
+	if ( mutex_lock_interruptible( &gpio_triggers.read_lock ) ) {
+		return -ERESTARTSYS;
+	}
+	while ( !gpio_trigger_pending() ) {
+		mutex_unlock( &gpio_triggers.read_lock );
+		if ( nonblock ) {
+			return -EAGAIN;
+		}
+		if ( wait_event_interruptible( gpio_triggers.wait, gpio_trigger_pending() ) ) {
+			return -ERESTARTSYS;
+		}
+		if ( mutex_lock_interruptible( &gpio_triggers.read_lock ) ) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	head = smp_load_acquire( &gpio_triggers.head );
+	tail = gpio_triggers.tail;
+	const size_t count = min_t( size_t, head - tail, max );
+
+	// The samples read wrap around the end of the ring at most once
+	const size_t first = min_t( size_t, count, GPIO_TRIGGER_RING - ( tail & ( GPIO_TRIGGER_RING - 1 ) ) );
+	if ( copy_to_user( buf, &gpio_triggers.ring[tail & ( GPIO_TRIGGER_RING - 1 )], first * size )
+			|| copy_to_user( buf + first * size, gpio_triggers.ring, ( count - first ) * size ) ) {
+		mutex_unlock( &gpio_triggers.read_lock );
+		return -EFAULT;
+	}
+
+	// The slots are only handed back once the samples are copied out of them
+	smp_store_release( &gpio_triggers.tail, tail + count );
+	mutex_unlock( &gpio_triggers.read_lock );
+
+	return count * size;
+}
+
+__poll_t gpio_trigger_poll( struct file* file, poll_table* wait ) {
+	poll_wait( file, &gpio_triggers.wait, wait );
+
+	return gpio_trigger_pending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
@@ -0,0 +1,111 @@
+#ifndef _SPECTR_IO_GPIO_TRIGGER_H
+#define _SPECTR_IO_GPIO_TRIGGER_H
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+
+#include "spi.h"
+#include "uapi/spectr_io.h"
+
+#define GPIO_TRIGGERS		8	// The max number of triggers.
+
+#define GPIO_TRIGGER_SPI	0	// The trigger runs a full-duplex transfer on SPI0.
+#define GPIO_TRIGGER_I2C	1	// The trigger reads a register over I2C.
+
+#define GPIO_TRIGGER_DATA_MAX	SPECTR_IO_TRIGGER_DATA_MAX
+
+// The settings of a trigger.
+struct gpio_trigger_config {
+	unsigned int pin;			// The pin.
+	unsigned int edges;			// The GPIO_EDGE* edges.
+	unsigned int kind;			// The GPIO_TRIGGER_* kind.
+	size_t len;				// The number of bytes transferred or read.
+	struct spi_device_profile spi;		// The bus settings of an SPI trigger.
+	const u8* tx;				// The data written by an SPI trigger, or NULL to write
+						// zeros.
+	unsigned int i2c_bus;			// The I2C_BUS* bus of an I2C trigger.
+	u8 i2c_addr;				// The 7-bit peripheral address of an I2C trigger.
+	u8 i2c_reg;				// The register read by an I2C trigger.
+};
+
+/**
+ * Initializes GPIO triggers and starts their worker thread.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init gpio_trigger_init( void );
+
+/**
+ * Stops the worker thread of GPIO triggers.
+ *
+ */
+void gpio_trigger_exit( void );
+
+/**
+ * Takes the reading end of the sample ring, there is only one.
+ *
+ * Samples left over from a previous reader are dropped.
+ *
+ * @returns Zero on success; -EBUSY if the ring already has a reader.
+ *
+ */
+int gpio_trigger_open( void );
+
+/**
+ * Gives back the reading end of the sample ring and removes every trigger.
+ *
+ */
+void gpio_trigger_release( void );
+
+/**
+ * Adds a trigger, which runs its transaction on every edge of its pin.
+ *
+ * The interrupt timestamps the edge and hands it to the worker thread, bound to the CPU given by
+ * the gpio_trigger_cpu parameter, which takes the bus and pushes the data read into the sample
+ * ring. Edges that find the worker too far behind, and samples that find the ring full, are
+ * dropped and show as gaps in the sequence numbers.
+ *
+ * @param config The settings, copied.
+ *
+ * @returns The trigger handle; a negative error code on failure.
+ *
+ */
+int gpio_trigger_add( const struct gpio_trigger_config* config );
+
+/**
+ * Removes a trigger, waiting for a transaction of it in progress to finish.
+ *
+ * @param handle The trigger handle.
+ *
+ * @returns Zero on success; -EINVAL if there is no such trigger.
+ *
+ */
+int gpio_trigger_remove( int handle );
+
+/**
+ * Reads whole struct spectr_io_trigger_sample samples from the ring, as many as are there and fit.
+ *
+ * @param buf The userspace buffer to read to.
+ * @param len The length of the buffer in bytes.
+ * @param nonblock Whether to fail with -EAGAIN instead of waiting for a sample.
+ *
+ * @returns The number of bytes read; a negative error code on failure.
+ *
+ */
+ssize_t gpio_trigger_read( char __user* buf, size_t len, int nonblock );
+
+/**
+ * Polls the sample ring for samples.
+ *
+ * @param file The file polled.
+ * @param wait The poll table.
+ *
+ * @returns EPOLLIN if samples wait to be read.
+ *
+ */
+__poll_t gpio_trigger_poll( struct file* file, poll_table* wait );
+
+#endif // _SPECTR_IO_GPIO_TRIGGER_H
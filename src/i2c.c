@@ -1,12 +1,25 @@
 #include "i2c.h"
 
 #include <asm/io.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include <log.h>
 
 #include "dma.h"
 #include "gpio.h"
+#include "io_trace.h"
+#include "io_wait.h"
+#include "stats.h"
 
+#define I2C0_OFFSET	0x00205000
 #define I2C1_OFFSET	0x00804000
 #define I2C_SIZE	0x20
 
@@ -42,228 +55,928 @@
 #define I2C_DEL_REDL_OFF	0
 #define I2C_DEL_FEDL_OFF	16
 
+#define I2C_DLEN_MAX	0xFFFF
+
+#define I2C_DIV_DEFAULT		0x05DC
+#define I2C_DEL_DEFAULT		0x00300030
+#define I2C_CLKT_DEFAULT	0x0040
+
+#define I2C_ADDRS	128
+
+#define I2C_FIFO_SIZE		16
+#define I2C_FIFO_SIZE_1_4	4
+#define I2C_FIFO_SIZE_3_4	12
+
+// Stuck buses are clocked free at about 100 kHz, with up to a byte and its acknowledge of pulses
+#define I2C_RECOVER_HALF_US	5
+#define I2C_RECOVER_PULSES	9
+
+// The longest a peripheral may stretch a recovery pulse.
+#define I2C_RECOVER_STRETCH_NS	100000
+
+struct i2c_ctrl;
+
+// The timing registers of a BSC, a zero divider marks an address without a profile.
+struct i2c_timing {
+	u32 div;
+	u32 del;
+	u32 clkt;
+};
+
+struct i2c_xfer_state {
+	struct i2c_ctrl* ctrl;
+	struct i2c1_msg* msgs;
+	size_t n;
+	size_t next;		// The first message of the next segment.
+	int irq;		// Whether the transfer is driven by interrupts.
+	int err;
+
+	// The segment currently being moved through the FIFO, split into chunks DLEN can hold
+	int read;
+	unsigned char addr;
+	size_t remaining;	// The bytes of the current chunk still to be moved.
+	size_t carry;		// The bytes of the segment after the current chunk.
+	size_t msg;
+	size_t off;
+
+	size_t moved;		// The bytes moved through the FIFO so far.
+	struct io_trace_phases phases;
+};
+
+struct i2c_irq_state {
+	spinlock_t lock;
+	int ready;
+	int active;
+
+	struct i2c_xfer_state* xfer;
+
+	struct completion done;
+};
+
+// A BSC controller, each one is locked and driven independently of the others.
+struct i2c_ctrl {
+	const char* name;
+	unsigned long offset;
+	unsigned int stats_bus;
+	const struct gpio_pin_config* pins_alt0;
+	const struct gpio_pin_config* pins_input;
+	size_t pin_count;
+	const int* enable;
+	const int* irq;
+	unsigned int sda;	// The SDA pin, in bank 0.
+	unsigned int scl;	// The SCL pin, in bank 0.
+
+	u8* mem;
+	unsigned char addr;
+	struct mutex lock;	// Held for the whole of a transfer and around timing changes.
+	struct i2c_irq_state irq_state;
+
+	struct i2c_timing timing;		// Used for peripherals without a profile.
+	struct i2c_timing hw;			// The values last written to the registers.
+	struct i2c_timing devices[I2C_ADDRS];	// The profiles, by peripheral address.
+};
+
 unsigned int i2c1_hw_timeout = 1000;
 
-static u8* i2c1_mem = ( u8* ) 0;
+static int i2c0_enable = 0;
+module_param( i2c0_enable, int, 0444 );
+MODULE_PARM_DESC( i2c0_enable, "Drive the BSC0 controller on GPIO 0 and 1, left to the board ID EEPROM if zero" );
+
+static int i2c0_irq = -1;
+module_param( i2c0_irq, int, 0444 );
+MODULE_PARM_DESC( i2c0_irq, "IRQ of the BSC0 controller, interrupt driven transfers are disabled if negative" );
+
+static int i2c1_enable = 1;
+
+static int i2c1_irq = -1;
+module_param( i2c1_irq, int, 0444 );
+MODULE_PARM_DESC( i2c1_irq, "IRQ of the BSC1 controller, interrupt driven transfers are disabled if negative" );
+
+static const struct gpio_pin_config i2c0_pins_alt0[] = {
+	{ 0, GPIO_PIN_MODE_ALT0 },
+	{ 1, GPIO_PIN_MODE_ALT0 },
+};
+
+static const struct gpio_pin_config i2c0_pins_input[] = {
+	{ 0, GPIO_PIN_MODE_INPUT },
+	{ 1, GPIO_PIN_MODE_INPUT },
+};
+
+static const struct gpio_pin_config i2c1_pins_alt0[] = {
+	{ 2, GPIO_PIN_MODE_ALT0 },
+	{ 3, GPIO_PIN_MODE_ALT0 },
+};
+
+static const struct gpio_pin_config i2c1_pins_input[] = {
+	{ 2, GPIO_PIN_MODE_INPUT },
+	{ 3, GPIO_PIN_MODE_INPUT },
+};
+
+static struct i2c_ctrl i2c_ctrls[I2C_BUSES] = {
+	[I2C_BUS0] = {
+		.name = "i2c0",
+		.offset = I2C0_OFFSET,
+		.stats_bus = STATS_BUS_I2C0,
+		.pins_alt0 = i2c0_pins_alt0,
+		.pins_input = i2c0_pins_input,
+		.pin_count = ARRAY_SIZE( i2c0_pins_alt0 ),
+		.enable = &i2c0_enable,
+		.irq = &i2c0_irq,
+		.sda = 0,
+		.scl = 1,
+	},
+	[I2C_BUS1] = {
+		.name = "i2c1",
+		.offset = I2C1_OFFSET,
+		.stats_bus = STATS_BUS_I2C1,
+		.pins_alt0 = i2c1_pins_alt0,
+		.pins_input = i2c1_pins_input,
+		.pin_count = ARRAY_SIZE( i2c1_pins_alt0 ),
+		.enable = &i2c1_enable,
+		.irq = &i2c1_irq,
+		.sda = 2,
+		.scl = 3,
+	},
+};
+
+static struct i2c_ctrl* i2c_get_ctrl( unsigned int bus ) {
+	if ( bus >= I2C_BUSES || !i2c_ctrls[bus].mem ) {
+		return ( struct i2c_ctrl* ) 0;
+	}
+
+	return &i2c_ctrls[bus];
+}
 
-static int i2c1_await_flags_or_timeout( int reg, u32 flags ) {
-	unsigned long timeout = jiffies + ( i2c1_hw_timeout * HZ ) / 1000;
-	while ( !dma_get_flags32( i2c1_mem + reg, flags ) ) {
-		if ( dma_get_flags32( i2c1_mem + I2C_S, I2C_S_ERR ) ) {
-			return I2C_ERR_NO_RESPONSE;
+static int i2c_await_flags_or_timeout( struct i2c_ctrl* ctrl, u32 flags ) {
+	const u64 begin = io_trace_stall_now();
+	u8* const mem = ctrl->mem;
+	struct io_wait wait;
+	int err = 0;
+
+	// A byte is due next, behind the address if a segment just started, unless the wait is for
+	// the FIFO to run empty
+	const size_t bytes = ( flags & ( I2C_S_RXD | I2C_S_TXD ) ) ? 2 : I2C_FIFO_SIZE + 1;
+	// A peripheral stretching the clock up to CLKT is still within spec, the wait must outlast
+	// it so the BSC gets to report the clock timeout itself
+	const u64 expected = io_wait_i2c_ns( bytes, ctrl->hw.div )
+		+ io_wait_i2c_stretch_ns( ctrl->hw.clkt, ctrl->hw.div );
+	// Only polled transfers wait here, they run under the controller mutex and may sleep
+	io_wait_begin( &wait, expected, i2c1_hw_timeout, 1 );
+	// The flags waited for and the error flags all live in the status, one read covers them
+	u32 status = dma_read32( mem + I2C_S );
+	while ( !( status & flags ) ) {
+		if ( status & I2C_S_ERR ) {
+			err = I2C_ERR_NO_RESPONSE;
+			break;
 		}
-		if ( dma_get_flags32( i2c1_mem + I2C_S, I2C_S_CLKT ) ) {
-			return I2C_ERR_CLK_TIMEOUT;
+		if ( status & I2C_S_CLKT ) {
+			err = I2C_ERR_CLK_TIMEOUT;
+			break;
 		}
-		if ( jiffies >= timeout ) {
-			return I2C_ERR_HW_TIMEOUT;
+		if ( io_wait_poll( &wait ) ) {
+			err = I2C_ERR_HW_TIMEOUT;
+			break;
 		}
+		status = dma_read32( mem + I2C_S );
 	}
-	return 0;
+
+	stats_add( ctrl->stats_bus, STATS_POLLS, wait.polls );
+	io_trace_stall( ctrl->stats_bus, flags, wait.polls, begin );
+	return err;
 }
 
-void i2c1_set_clk_div( unsigned short clk_div ) {
-	dma_write16( i2c1_mem + I2C_DIV, clk_div );
+static inline u32 i2c_del_for_div( u32 div ) {
+	// Data delays that follow the clock divider prevent strange behavior
+	return ( max_t( u32, div >> 4, 1 ) << I2C_DEL_FEDL_OFF )
+	     | ( max_t( u32, div >> 2, 1 ) << I2C_DEL_REDL_OFF );
+}
 
-	// Set the data delay values based on the new clock divider to prevent strange behavior
-	dma_write32( i2c1_mem + I2C_DEL,
-		( max( clk_div >> 4, 1 ) << I2C_DEL_FEDL_OFF )
-	      | ( max( clk_div >> 2, 1 ) << I2C_DEL_REDL_OFF ) );
+static void i2c_apply_timing( struct i2c_ctrl* ctrl, const struct i2c_timing* timing ) {
+	if ( timing->div != ctrl->hw.div ) {
+		dma_write32( ctrl->mem + I2C_DIV, timing->div );
+	}
+	if ( timing->del != ctrl->hw.del ) {
+		dma_write32( ctrl->mem + I2C_DEL, timing->del );
+	}
+	if ( timing->clkt != ctrl->hw.clkt ) {
+		dma_write32( ctrl->mem + I2C_CLKT, timing->clkt );
+	}
+	ctrl->hw = *timing;
 }
 
-void i2c1_set_addr( unsigned char addr ) {
-	dma_write8( i2c1_mem + I2C_A, addr & 0x7F );
+void i2c_bus_set_clk_div( unsigned int bus, unsigned short clk_div ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	mutex_lock( &ctrl->lock );
+	ctrl->timing.div = clk_div;
+	ctrl->timing.del = i2c_del_for_div( clk_div );
+	i2c_apply_timing( ctrl, &ctrl->timing );
+	mutex_unlock( &ctrl->lock );
 }
 
-size_t i2c1_read_register( unsigned char reg, ssize_t len, u8* data ) {
-	int err;
+int i2c_bus_add_device( unsigned int bus, const struct i2c_device_profile* profile ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
+
+	// The BSC divides by even numbers only, rounding down, so round up to stay under the max
+	u32 div = profile->max_hz ? DIV_ROUND_UP( BCM2836_CORE_CLK_HZ, profile->max_hz ) : ctrl->timing.div;
+	div = clamp_t( u32, round_up( div, 2 ), 2, 0xFFFE );
+
+	struct i2c_timing timing = {
+		.div = div,
+		.del = i2c_del_for_div( div ),
+		.clkt = profile->clkt ? profile->clkt : ctrl->timing.clkt,
+	};
+	if ( profile->fedl || profile->redl ) {
+		timing.del = ( profile->fedl << I2C_DEL_FEDL_OFF ) | ( profile->redl << I2C_DEL_REDL_OFF );
+	}
+
+	mutex_lock( &ctrl->lock );
+	ctrl->devices[profile->addr & 0x7F] = timing;
+	mutex_unlock( &ctrl->lock );
+
+	return 0;
+}
 
+void i2c_bus_remove_device( unsigned int bus, unsigned char addr ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	mutex_lock( &ctrl->lock );
+	memset( &ctrl->devices[addr & 0x7F], 0, sizeof( struct i2c_timing ) );
+	mutex_unlock( &ctrl->lock );
+}
+
+void i2c_bus_set_addr( unsigned int bus, unsigned char addr ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	// Every transfer programs A from the messages, so a transfer in progress keeps its address
+	mutex_lock( &ctrl->lock );
+	ctrl->addr = addr & 0x7F;
+	mutex_unlock( &ctrl->lock );
+}
+
+static void i2c_reset( struct i2c_ctrl* ctrl ) {
 	// Reset errors, clear the FIFO, and enable the BSC
-	dma_set_flags32( i2c1_mem + I2C_S, I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_CLEARL | I2C_C_CLEARH | I2C_C_EN );
+	dma_w1c32( ctrl->mem + I2C_S, I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT );
+	dma_set_flags32( ctrl->mem + I2C_C, I2C_C_CLEARL | I2C_C_CLEARH | I2C_C_EN );
+}
 
-	// Set up a write transfer of one byte to send the register ID
-	dma_write16( i2c1_mem + I2C_DLEN, 1 );
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_READ );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_ST );
+static void i2c_end( struct i2c_ctrl* ctrl ) {
+	// Disable the BSC and its interrupts, and reset the status for the next transfer
+	dma_write32( ctrl->mem + I2C_C, 0x00000000 );
+	dma_w1c32( ctrl->mem + I2C_S, I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT );
+}
 
-	// Wait for the transfer to start
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TA );
-	if ( err ) {
-		goto i2c_err;
+static inline int i2c_has_next( const struct i2c_xfer_state* st ) {
+	return st->carry || st->next < st->n;
+}
+
+static void i2c_seg_start( struct i2c_xfer_state* st ) {
+	if ( !st->carry ) {
+		const struct i2c1_msg* const first = &st->msgs[st->next];
+
+		// A segment is a message plus every following message continuing it without a start
+		st->read = ( first->flags & I2C1_M_RD ) != 0;
+		st->addr = first->addr & 0x7F;
+		st->carry = first->len;
+		st->msg = st->next;
+		st->off = 0;
+		st->next++;
+		while ( st->next < st->n && ( st->msgs[st->next].flags & I2C1_M_NOSTART ) ) {
+			st->carry += st->msgs[st->next].len;
+			st->next++;
+		}
 	}
 
-	// Wait for the TX FIFO to have space
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TXD );
-	if ( err ) {
-		goto i2c_err;
+	// Segments longer than DLEN can count are continued in further chunks
+	st->remaining = min_t( size_t, st->carry, I2C_DLEN_MAX );
+	st->carry -= st->remaining;
+
+	u32 flags = I2C_C_EN | I2C_C_ST;
+	if ( st->read ) {
+		flags |= I2C_C_READ;
+	}
+	if ( st->irq ) {
+		flags |= I2C_C_INTD | ( st->read ? I2C_C_INTR : I2C_C_INTT );
 	}
 
-	// Send the register ID
-	dma_write8( i2c1_mem + I2C_FIFO, reg );
+	// Set up a transfer of the chunk length and start it, if the previous chunk is still on the
+	// bus the BSC follows it with a repeated start instead of a stop
+	dma_write8( st->ctrl->mem + I2C_A, st->addr );
+	dma_write16( st->ctrl->mem + I2C_DLEN, st->remaining );
+	dma_write32( st->ctrl->mem + I2C_C, flags );
+	io_trace_mark( &st->phases.setup );
+}
 
-	// Await for the register ID transfer to finish
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_DONE );
-	if ( err ) {
-		goto i2c_err;
+static inline size_t i2c_fifo_level( int read, u32 status ) {
+	if ( read ) {
+		if ( status & I2C_S_RXF ) {
+			return I2C_FIFO_SIZE;
+		}
+		if ( status & I2C_S_RXR ) {
+			return I2C_FIFO_SIZE_3_4;
+		}
+		return ( status & I2C_S_RXD ) ? 1 : 0;
 	}
 
-	// Set up a read transfer of len number of bytes to receive the register data
-	dma_write16( i2c1_mem + I2C_DLEN, len );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_ST | I2C_C_READ );
+	if ( status & I2C_S_TXE ) {
+		return I2C_FIFO_SIZE;
+	}
+	if ( status & I2C_S_TXW ) {
+		return I2C_FIFO_SIZE - I2C_FIFO_SIZE_1_4;
+	}
+	return ( status & I2C_S_TXD ) ? 1 : 0;
+}
 
-	// Wait for the transfer to start
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TA );
-	if ( err ) {
-		goto i2c_err;
+static u32 i2c_seg_pump( struct i2c_xfer_state* st ) {
+	u8* const mem = st->ctrl->mem;
+	u32 status = dma_read32_relaxed( mem + I2C_S );
+
+	while ( st->remaining ) {
+		// Move as many bytes as the FIFO level flags promise per status read
+		size_t count = min( i2c_fifo_level( st->read, status ), st->remaining );
+		if ( !count ) {
+			break;
+		}
+		st->remaining -= count;
+		st->moved += count;
+
+		// The accesses are relaxed, one fence per fill or drain orders the burst against memory
+		if ( !st->read ) {
+			dma_write_fence();
+		}
+		for ( ; count; count-- ) {
+			// Walk the scatter list, skipping exhausted and empty messages
+			struct i2c1_msg* msg = &st->msgs[st->msg];
+			while ( st->off == msg->len ) {
+				msg = &st->msgs[++st->msg];
+				st->off = 0;
+			}
+
+			if ( st->read ) {
+				msg->buf[st->off] = dma_read8_relaxed( mem + I2C_FIFO );
+			} else {
+				dma_write8_relaxed( mem + I2C_FIFO, msg->buf[st->off] );
+			}
+			st->off++;
+		}
+		if ( st->read ) {
+			dma_read_fence();
+		}
+
+		status = dma_read32_relaxed( mem + I2C_S );
+	}
+
+	return status;
+}
+
+static int i2c_step( struct i2c_xfer_state* st ) {
+	u32 status = i2c_seg_pump( st );
+	if ( st->moved ) {
+		io_trace_mark( &st->phases.first );
+	}
+	if ( !st->remaining && !i2c_has_next( st ) ) {
+		io_trace_mark( &st->phases.last );
+	}
+	if ( status & I2C_S_ERR ) {
+		st->err = I2C_ERR_NO_RESPONSE;
+		return 1;
+	}
+	if ( status & I2C_S_CLKT ) {
+		st->err = I2C_ERR_CLK_TIMEOUT;
+		return 1;
+	}
+
+	// Once a write chunk has left the FIFO but is still on the bus the next chunk can be started
+	// behind it, so the BSC issues a repeated start rather than a stop. When polling, starting any
+	// earlier would let a following read mistake the unsent bytes in the shared FIFO for received
+	// ones, the pump looks at RXD. Interrupts only come back on RXR or DONE, which the BSC raises
+	// once the read is underway, so the handler starts the next chunk as soon as this one is queued
+	// instead of waiting for TXE, which no interrupt announces
+	if ( !st->read && !st->remaining && i2c_has_next( st )
+	  && ( status & I2C_S_TA ) && ( st->irq || ( status & I2C_S_TXE ) ) && !( status & I2C_S_DONE ) ) {
+		i2c_seg_start( st );
+		return 0;
+	}
+
+	if ( status & I2C_S_DONE ) {
+		// Collect whatever arrived after the last status read
+		if ( st->read ) {
+			i2c_seg_pump( st );
+		}
+
+		if ( !i2c_has_next( st ) ) {
+			return 1;
+		}
+
+		// A chunk after a read, or one that missed the repeated start, gets a new start
+		dma_w1c32( st->ctrl->mem + I2C_S, I2C_S_DONE );
+		i2c_seg_start( st );
+		return 0;
+	}
+
+	// Everything is queued, stop asking for more
+	if ( st->irq && !st->read && !st->remaining ) {
+		dma_clr_flags32( st->ctrl->mem + I2C_C, I2C_C_INTT );
+	}
+
+	return 0;
+}
+
+static u32 i2c_step_wait_flags( const struct i2c_xfer_state* st ) {
+	if ( st->read ) {
+		return I2C_S_RXD | I2C_S_DONE;
 	}
+	if ( st->remaining ) {
+		return I2C_S_TXD | I2C_S_DONE;
+	}
+	if ( i2c_has_next( st ) ) {
+		return I2C_S_TXE | I2C_S_DONE;
+	}
+	return I2C_S_DONE;
+}
 
-	// Read bytes until the specified number of bytes is read or the transfer finishes
-	size_t i = 0;
-	while ( i < len && !dma_get_flags32( i2c1_mem + I2C_S, I2C_S_DONE ) ) {
-		// Await the RX FIFO to have data
-		err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_RXD );
+static int i2c_run_poll( struct i2c_xfer_state* st ) {
+	int err;
+
+	i2c_reset( st->ctrl );
+	i2c_seg_start( st );
+
+	while ( !i2c_step( st ) ) {
+		// Await the FIFO, the bus, or the end of the transfer to need attention
+		err = i2c_await_flags_or_timeout( st->ctrl, i2c_step_wait_flags( st ) );
 		if ( err ) {
-			goto i2c_err;
+			st->err = err;
+			break;
 		}
+	}
 
-		// Read the next byte of register data
-		data[i] = dma_read8( i2c1_mem + I2C_FIFO );
+	i2c_end( st->ctrl );
 
-		i++;
+	return st->err;
+}
+
+static irqreturn_t i2c_irq_handler( int irq, void* dev ) {
+	struct i2c_ctrl* const ctrl = dev;
+	struct i2c_irq_state* const st = &ctrl->irq_state;
+
+	spin_lock( &st->lock );
+	if ( !st->active ) {
+		spin_unlock( &st->lock );
+		return IRQ_NONE;
 	}
 
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+	// RXR asks for the RX FIFO to be drained, TXW for the TX FIFO to be refilled
+	if ( i2c_step( st->xfer ) ) {
+		i2c_end( ctrl );
+		st->active = 0;
+		complete( &st->done );
+	}
+	spin_unlock( &st->lock );
 
-	return i;
+	return IRQ_HANDLED;
+}
 
-i2c_err:
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+static int i2c_run_irq( struct i2c_xfer_state* xfer ) {
+	struct i2c_ctrl* const ctrl = xfer->ctrl;
+	struct i2c_irq_state* const st = &ctrl->irq_state;
+	unsigned long flags;
+
+	spin_lock_irqsave( &st->lock, flags );
+	st->xfer = xfer;
+	reinit_completion( &st->done );
+	st->active = 1;
+
+	// The handler moves the data and finishes the transfer once DONE is raised
+	i2c_reset( ctrl );
+	i2c_seg_start( xfer );
+	spin_unlock_irqrestore( &st->lock, flags );
+
+	if ( !wait_for_completion_timeout( &st->done, msecs_to_jiffies( i2c1_hw_timeout ) ) ) {
+		spin_lock_irqsave( &st->lock, flags );
+		if ( st->active ) {
+			i2c_end( ctrl );
+			st->active = 0;
+			xfer->err = I2C_ERR_HW_TIMEOUT;
+		}
+		spin_unlock_irqrestore( &st->lock, flags );
+	}
 
-	return err;
+	return xfer->err;
 }
 
-size_t i2c1_read( ssize_t len, u8* data ) {
-	int err = 0;
+static inline int i2c_bus_idle( const struct i2c_ctrl* ctrl ) {
+	const u32 lines = BIT( ctrl->sda ) | BIT( ctrl->scl );
 
-	// Reset errors, clear the FIFO, and enable the BSC
-	dma_set_flags32( i2c1_mem + I2C_S, I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_CLEARL | I2C_C_CLEARH | I2C_C_EN );
+	// The levels read back whatever function the pins have, both lines are pulled up when idle
+	return ( gpio_read_bank( GPIO_BANK0 ) & lines ) == lines;
+}
 
-	// Set up a read transfer of len number of bytes to receive the data
-	dma_write16( i2c1_mem + I2C_DLEN, len );
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_ST | I2C_C_READ );
+// The bus owns its pins, so their modes are changed through the ownership table
+static inline void i2c_recover_set_mode( const struct i2c_ctrl* ctrl, unsigned int pin,
+		unsigned int mode ) {
+	const struct gpio_pin_config config = { pin, mode };
 
-	// Wait for the transfer to start
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TA );
-	if ( err ) {
-		goto i2c_err;
+	gpio_configure_pins( ctrl->name, &config, 1 );
+}
+
+static inline void i2c_recover_pull_low( const struct i2c_ctrl* ctrl, unsigned int pin ) {
+	gpio_set_pin_low( pin );
+	i2c_recover_set_mode( ctrl, pin, GPIO_PIN_MODE_OUTPUT );
+}
+
+static int i2c_recover_release_scl( const struct i2c_ctrl* ctrl ) {
+	const u64 deadline = ktime_get_ns() + I2C_RECOVER_STRETCH_NS;
+
+	i2c_recover_set_mode( ctrl, ctrl->scl, GPIO_PIN_MODE_INPUT );
+	while ( !gpio_get_pin_level( ctrl->scl ) ) {
+		if ( ktime_get_ns() >= deadline ) {
+			return 0;
+		}
+		cpu_relax();
 	}
 
-	// Read bytes until the specified number of bytes is read or the transfer finishes
-	size_t i = 0;
-	while ( i < len && !dma_get_flags32( i2c1_mem + I2C_S, I2C_S_DONE ) ) {
-		// Await the RX FIFO to have data
-		err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_RXD );
-		if ( err ) {
-			goto i2c_err;
+	return 1;
+}
+
+// Clocks a peripheral left mid-byte by a glitch out of holding the bus, its lock must be held
+static int i2c_recover( struct i2c_ctrl* ctrl ) {
+	unsigned int i;
+
+	stats_add( ctrl->stats_bus, STATS_RECOVERIES, 1 );
+
+	// The lines are bit banged open drain, pulled low as outputs and let go high as inputs
+	gpio_configure_pins( ctrl->name, ctrl->pins_input, ctrl->pin_count );
+
+	// A peripheral driving SDA lets go of it after the rest of its byte and the acknowledge bit
+	for ( i = 0; i < I2C_RECOVER_PULSES && !gpio_get_pin_level( ctrl->sda ); i++ ) {
+		i2c_recover_pull_low( ctrl, ctrl->scl );
+		udelay( I2C_RECOVER_HALF_US );
+		if ( !i2c_recover_release_scl( ctrl ) ) {
+			break;
 		}
+		udelay( I2C_RECOVER_HALF_US );
+	}
+
+	// A stop, SDA rising while SCL is high, leaves every peripheral waiting for a start
+	i2c_recover_pull_low( ctrl, ctrl->scl );
+	udelay( I2C_RECOVER_HALF_US );
+	i2c_recover_pull_low( ctrl, ctrl->sda );
+	udelay( I2C_RECOVER_HALF_US );
+	i2c_recover_release_scl( ctrl );
+	udelay( I2C_RECOVER_HALF_US );
+	i2c_recover_set_mode( ctrl, ctrl->sda, GPIO_PIN_MODE_INPUT );
+	udelay( I2C_RECOVER_HALF_US );
+
+	const int idle = i2c_bus_idle( ctrl );
+	gpio_configure_pins( ctrl->name, ctrl->pins_alt0, ctrl->pin_count );
+	if ( !idle ) {
+		LOG( KERN_ERR, "I2C %s bus still stuck after recovery.", ctrl->name );
+		return I2C_ERR_BUS_STUCK;
+	}
+
+	return 0;
+}
+
+static int i2c_ctrl_run( struct i2c_xfer_state* st ) {
+	st->next = 0;
+	st->err = 0;
+	st->carry = 0;
+	st->moved = 0;
+
+	return st->irq ? i2c_run_irq( st ) : i2c_run_poll( st );
+}
+
+static size_t i2c_transfer_len( const struct i2c1_msg* msgs, size_t n ) {
+	size_t len = 0;
+	size_t i;
+
+	for ( i = 0; i < n; i++ ) {
+		len += msgs[i].len;
+	}
+
+	return len;
+}
+
+static void i2c_transfer_stats( unsigned int bus, const struct i2c1_msg* msgs, size_t n, int err ) {
+	switch ( err ) {
+	case 0:
+		stats_add( bus, STATS_BYTES, i2c_transfer_len( msgs, n ) );
+		break;
+	case I2C_ERR_NO_RESPONSE:
+		stats_add( bus, STATS_NACKS, 1 );
+		break;
+	case I2C_ERR_CLK_TIMEOUT:
+		stats_add( bus, STATS_CLK_TIMEOUTS, 1 );
+		break;
+	case I2C_ERR_HW_TIMEOUT:
+		stats_add( bus, STATS_TIMEOUTS, 1 );
+		break;
+	}
+	stats_add( bus, STATS_TRANSFERS, 1 );
+}
+
+// Runs a combined transaction on a controller, its lock must be held
+static int i2c_ctrl_transfer( struct i2c_ctrl* ctrl, struct i2c1_msg* msgs, size_t n, u64 begin ) {
+	int err;
+
+	struct i2c_xfer_state st = {
+		.ctrl = ctrl,
+		.msgs = msgs,
+		.n = n,
+		.irq = ctrl->irq_state.ready,
+	};
+
+	io_trace_begin( &st.phases, begin );
+	trace_spectr_io_xfer_start( ctrl->stats_bus, STATS_OP_I2C_TRANSFER, i2c_transfer_len( msgs, n ) );
+
+	// Combined transactions run at the pace of the peripheral the first message addresses
+	const struct i2c_timing* const timing = &ctrl->devices[msgs[0].addr & 0x7F];
+	i2c_apply_timing( ctrl, timing->div ? timing : &ctrl->timing );
 
-		// Read the next byte of data
-		data[i] = dma_read8( i2c1_mem + I2C_FIFO );
+	// A bus held low would fail the transfer slowly, or read back zeros nobody acknowledged
+	err = i2c_bus_idle( ctrl ) ? 0 : i2c_recover( ctrl );
+	if ( !err ) {
+		err = i2c_ctrl_run( &st );
 
-		i++;
+		// A transfer cut short by a glitch can leave the peripheral holding the bus, it gets one retry
+		if ( ( err == I2C_ERR_HW_TIMEOUT || err == I2C_ERR_CLK_TIMEOUT ) && !i2c_bus_idle( ctrl ) && !i2c_recover( ctrl ) ) {
+			err = i2c_ctrl_run( &st );
+		}
 	}
 
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+	i2c_transfer_stats( ctrl->stats_bus, msgs, n, err );
+	stats_end( ctrl->stats_bus, STATS_OP_I2C_TRANSFER, begin );
+	if ( err ) {
+		trace_spectr_io_xfer_error( ctrl->stats_bus, STATS_OP_I2C_TRANSFER, err );
+	} else {
+		io_trace_done( ctrl->stats_bus, STATS_OP_I2C_TRANSFER, st.moved, &st.phases );
+	}
 
-	return i;
+	return err;
+}
 
-i2c_err:
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+int i2c_bus_transfer( unsigned int bus, struct i2c1_msg* msgs, size_t n ) {
+	const u64 begin = stats_begin();
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	int err;
+
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
+	if ( !n ) {
+		return 0;
+	}
+
+	mutex_lock( &ctrl->lock );
+	err = i2c_ctrl_transfer( ctrl, msgs, n, begin );
+	mutex_unlock( &ctrl->lock );
 
 	return err;
 }
 
-size_t i2c1_write( ssize_t len, const u8* data ) {
+int i2c_bus_run_session( unsigned int bus, struct i2c1_xfer* xfers, size_t n ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
 	int err = 0;
+	size_t i;
 
-	// Reset errors, clear the FIFO, and enable the BSC
-	dma_set_flags32( i2c1_mem + I2C_S, I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_CLEARL | I2C_C_CLEARH | I2C_C_EN );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
 
-	// Set up a write transfer of one len number of bytes to write the data
-	dma_write16( i2c1_mem + I2C_DLEN, len );
-	dma_set_flags32( i2c1_mem + I2C_C, I2C_C_ST );
+	mutex_lock( &ctrl->lock );
+	for ( i = 0; i < n; i++ ) {
+		xfers[i].result = xfers[i].n ? i2c_ctrl_transfer( ctrl, xfers[i].msgs, xfers[i].n, stats_begin() ) : 0;
+		if ( xfers[i].result && !err ) {
+			err = xfers[i].result;
+		}
+	}
+	mutex_unlock( &ctrl->lock );
 
-	// Wait for the transfer to start
-	err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TA );
-	if ( err ) {
-		goto i2c_err;
+	return err;
+}
+
+unsigned short i2c_bus_get_clk_div( unsigned int bus, unsigned char addr ) {
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return 0;
 	}
 
-	// Write bytes until the specified number of bytes is written or the transfer finishes
-	size_t i = 0;
-	while ( i < len && !dma_get_flags32( i2c1_mem + I2C_S, I2C_S_DONE ) ) {
-		// Await the TX FIFO to have space
-		err = i2c1_await_flags_or_timeout( I2C_S, I2C_S_TXD );
-		if ( err ) {
-			goto i2c_err;
-		}
+	mutex_lock( &ctrl->lock );
+	const u32 div = ctrl->devices[addr & 0x7F].div ? ctrl->devices[addr & 0x7F].div : ctrl->timing.div;
+	mutex_unlock( &ctrl->lock );
 
-		// Write the next byte of data
-		dma_write8( i2c1_mem + I2C_FIFO, data[i] );
+	return div;
+}
 
-		i++;
+size_t i2c_bus_read_register( unsigned int bus, unsigned char reg, ssize_t len, u8* data ) {
+	const u64 begin = stats_begin();
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
 	}
 
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+	struct i2c1_msg msgs[] = {
+		{ .addr = ctrl->addr, .flags = 0,          .len = 1,   .buf = &reg },
+		{ .addr = ctrl->addr, .flags = I2C1_M_RD, .len = len, .buf = data },
+	};
 
-	return i;
+	const int err = i2c_bus_transfer( bus, msgs, ARRAY_SIZE( msgs ) );
+	stats_end( ctrl->stats_bus, STATS_OP_I2C_READ_REGISTER, begin );
 
-i2c_err:
-	// Disable the BSC
-	dma_clr_flags32( i2c1_mem + I2C_C, I2C_C_EN );
+	return err ? err : len;
+}
 
-	return err;
+size_t i2c_bus_read_register16( unsigned int bus, u16 reg, ssize_t len, u8* data ) {
+	const u64 begin = stats_begin();
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
+
+	// Register addresses are sent most significant byte first
+	u8 addr[] = { reg >> 8, reg & 0xFF };
+	struct i2c1_msg msgs[] = {
+		{ .addr = ctrl->addr, .flags = 0,          .len = sizeof( addr ), .buf = addr },
+		{ .addr = ctrl->addr, .flags = I2C1_M_RD, .len = len,            .buf = data },
+	};
+
+	const int err = i2c_bus_transfer( bus, msgs, ARRAY_SIZE( msgs ) );
+	stats_end( ctrl->stats_bus, STATS_OP_I2C_READ_REGISTER, begin );
+
+	return err ? err : len;
+}
+
+size_t i2c_bus_read( unsigned int bus, ssize_t len, u8* data ) {
+	const u64 begin = stats_begin();
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
+
+	struct i2c1_msg msg = { .addr = ctrl->addr, .flags = I2C1_M_RD, .len = len, .buf = data };
+
+	const int err = i2c_bus_transfer( bus, &msg, 1 );
+	stats_end( ctrl->stats_bus, STATS_OP_I2C_READ, begin );
+
+	return err ? err : len;
+}
+
+size_t i2c_bus_write( unsigned int bus, ssize_t len, const u8* data ) {
+	const u64 begin = stats_begin();
+	struct i2c_ctrl* const ctrl = i2c_get_ctrl( bus );
+	if ( !ctrl ) {
+		return I2C_ERR_NO_BUS;
+	}
+
+	// The buffer is only ever read from for writes
+	struct i2c1_msg msg = { .addr = ctrl->addr, .flags = 0, .len = len, .buf = ( u8* ) data };
+
+	const int err = i2c_bus_transfer( bus, &msg, 1 );
+	stats_end( ctrl->stats_bus, STATS_OP_I2C_WRITE, begin );
+
+	return err ? err : len;
+}
+
+void i2c1_set_clk_div( unsigned short clk_div ) {
+	i2c_bus_set_clk_div( I2C_BUS1, clk_div );
+}
+
+void i2c1_set_addr( unsigned char addr ) {
+	i2c_bus_set_addr( I2C_BUS1, addr );
+}
+
+int i2c1_transfer( struct i2c1_msg* msgs, size_t n ) {
+	return i2c_bus_transfer( I2C_BUS1, msgs, n );
+}
+
+size_t i2c1_read_register( unsigned char reg, ssize_t len, u8* data ) {
+	return i2c_bus_read_register( I2C_BUS1, reg, len, data );
+}
+
+size_t i2c1_read_register16( u16 reg, ssize_t len, u8* data ) {
+	return i2c_bus_read_register16( I2C_BUS1, reg, len, data );
+}
+
+size_t i2c1_read( ssize_t len, u8* data ) {
+	return i2c_bus_read( I2C_BUS1, len, data );
+}
+
+size_t i2c1_write( ssize_t len, const u8* data ) {
+	return i2c_bus_write( I2C_BUS1, len, data );
 }
 
-int __init i2c1_init( void ) {
-	gpio_set_pin_mode( 2, GPIO_PIN_MODE_ALT0 );
-	gpio_set_pin_mode( 3, GPIO_PIN_MODE_ALT0 );
+static int __init i2c_ctrl_init( struct i2c_ctrl* ctrl ) {
+	int err;
+
+	mutex_init( &ctrl->lock );
+
+	err = gpio_configure_pins( ctrl->name, ctrl->pins_alt0, ctrl->pin_count );
+	if ( err ) {
+		return err;
+	}
 
-	i2c1_mem = ( u8* ) ioremap( BCM2836_IO_MEM_START + I2C1_OFFSET, I2C_SIZE );
-	if ( !i2c1_mem ) {
+	ctrl->mem = ( u8* ) dma_ioremap( BCM2836_IO_MEM_START + ctrl->offset, I2C_SIZE );
+	if ( !ctrl->mem ) {
+		gpio_release_pins( ctrl->name, ctrl->pins_input, ctrl->pin_count );
 		return I2C_ERR_IO_MAP_FAIL;
 	}
 
-	dma_write32( i2c1_mem + I2C_C,    0x00000000 );
-	dma_write32( i2c1_mem + I2C_DIV,  0x000005DC );
-	dma_write32( i2c1_mem + I2C_DEL,  0x00300030 );
-	dma_write32( i2c1_mem + I2C_CLKT, 0x00000040 );
+	ctrl->timing.div = I2C_DIV_DEFAULT;
+	ctrl->timing.del = I2C_DEL_DEFAULT;
+	ctrl->timing.clkt = I2C_CLKT_DEFAULT;
+	ctrl->hw = ctrl->timing;
+	memset( ctrl->devices, 0, sizeof( ctrl->devices ) );
+
+	dma_write32( ctrl->mem + I2C_C,    0x00000000 );
+	dma_write32( ctrl->mem + I2C_DIV,  ctrl->hw.div );
+	dma_write32( ctrl->mem + I2C_DEL,  ctrl->hw.del );
+	dma_write32( ctrl->mem + I2C_CLKT, ctrl->hw.clkt );
+
+	if ( *ctrl->irq >= 0 ) {
+		spin_lock_init( &ctrl->irq_state.lock );
+		init_completion( &ctrl->irq_state.done );
+
+		// Interrupts are optional, transfers fall back to polling without them
+		if ( !request_irq( *ctrl->irq, i2c_irq_handler, IRQF_SHARED, ctrl->name, ctrl ) ) {
+			ctrl->irq_state.ready = 1;
+		}
+	}
 
 	return 0;
 }
 
-void __exit i2c1_exit( void ) {
-	if ( i2c1_mem ) {
-		iounmap( i2c1_mem );
-		i2c1_mem = ( u8* ) 0;
+static void i2c_ctrl_exit( struct i2c_ctrl* ctrl ) {
+	if ( ctrl->irq_state.ready ) {
+		free_irq( *ctrl->irq, ctrl );
+		ctrl->irq_state.ready = 0;
 	}
 
-	gpio_set_pin_mode( 2, GPIO_PIN_MODE_INPUT );
-	gpio_set_pin_mode( 3, GPIO_PIN_MODE_INPUT );
+	if ( ctrl->mem ) {
+		dma_iounmap( ctrl->mem );
+		ctrl->mem = ( u8* ) 0;
+
+		gpio_release_pins( ctrl->name, ctrl->pins_input, ctrl->pin_count );
+	}
+}
+
+int __init i2c_init( void ) {
+	unsigned int i;
+	int err;
+
+	for ( i = 0; i < I2C_BUSES; i++ ) {
+		if ( !*i2c_ctrls[i].enable ) {
+			continue;
+		}
+
+		err = i2c_ctrl_init( &i2c_ctrls[i] );
+		if ( err ) {
+			LOG( KERN_ERR, "I2C failed to initialize %s.", i2c_ctrls[i].name );
+			while ( i-- ) {
+				i2c_ctrl_exit( &i2c_ctrls[i] );
+			}
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+void i2c_exit( void ) {
+	unsigned int i;
+
+	for ( i = 0; i < I2C_BUSES; i++ ) {
+		i2c_ctrl_exit( &i2c_ctrls[i] );
+	}
 }
 
 EXPORT_SYMBOL( i2c1_hw_timeout );
+EXPORT_SYMBOL( i2c_bus_set_clk_div );
+EXPORT_SYMBOL( i2c_bus_set_addr );
+EXPORT_SYMBOL( i2c_bus_add_device );
+EXPORT_SYMBOL( i2c_bus_remove_device );
+EXPORT_SYMBOL( i2c_bus_transfer );
+EXPORT_SYMBOL( i2c_bus_run_session );
+EXPORT_SYMBOL( i2c_bus_get_clk_div );
+EXPORT_SYMBOL( i2c_bus_read_register );
+EXPORT_SYMBOL( i2c_bus_read_register16 );
+EXPORT_SYMBOL( i2c_bus_read );
+EXPORT_SYMBOL( i2c_bus_write );
 EXPORT_SYMBOL( i2c1_set_clk_div );
 EXPORT_SYMBOL( i2c1_set_addr );
+EXPORT_SYMBOL( i2c1_transfer );
 EXPORT_SYMBOL( i2c1_read_register );
+EXPORT_SYMBOL( i2c1_read_register16 );
 EXPORT_SYMBOL( i2c1_read );
 EXPORT_SYMBOL( i2c1_write );
-
@@ -3,6 +3,7 @@
 
 #include <linux/bitops.h>
 #include <linux/init.h>
+#include <linux/types.h>
 
 #define I2C_ERR_IO_MAP_FAIL	-1	// Mapping IO memory into kernel virtual memory failed.
 #define I2C_ERR_HW_TIMEOUT	-2	// The configured hardware timeout was reached during and
@@ -10,23 +11,198 @@
 #define I2C_ERR_NO_RESPONSE	-3	// No I2C device acknowleged the address.
 #define I2C_ERR_CLK_TIMEOUT	-4	// The addressed I2C device held the clock signal low for
 					// longer than the configured clock timeout.
+#define I2C_ERR_NO_BUS		-5	// The bus does not exist or was not enabled.
+#define I2C_ERR_BUS_STUCK	-6	// A peripheral kept SDA or SCL low through a bus recovery.
 
-// The max number of milliseconds to wait for a hardware operation.
+#define I2C_BUS0	0	// BSC0 on GPIO 0 and 1, only driven with the i2c0_enable parameter set.
+#define I2C_BUS1	1	// BSC1 on GPIO 2 and 3.
+#define I2C_BUSES	2
+
+#define I2C1_M_RD	BIT( 0 )	// The message reads from the peripheral instead of writing to it.
+#define I2C1_M_NOSTART	BIT( 1 )	// The message continues the previous message without a start,
+					// used to scatter one transfer over several buffers. Its
+					// direction and address must match the previous message.
+
+// A message of a combined I2C transaction, on any of the buses.
+struct i2c1_msg {
+	unsigned char addr;	// The 7-bit peripheral address.
+	unsigned short flags;	// The I2C1_M_* flags.
+	size_t len;		// The length of the message data in bytes.
+	u8* buf;		// The message data.
+};
+
+// A combined transaction of a session, see i2c_bus_run_session().
+struct i2c1_xfer {
+	struct i2c1_msg* msgs;	// The messages.
+	size_t n;		// The number of messages.
+	int result;		// Set to zero; a negative I2C_ERR_* code.
+};
+
+// The bus timing of a peripheral, applied whenever a transfer addresses it.
+struct i2c_device_profile {
+	unsigned char addr;	// The 7-bit peripheral address.
+	unsigned int max_hz;	// The max clock rate of the peripheral, zero for the bus default.
+	u16 clkt;		// The clock stretch timeout in SCL cycles, zero for the bus default.
+	u16 fedl;		// The falling edge data delay in core clock cycles, both delays zero
+	u16 redl;		// to derive them from the clock rate.
+};
+
+// The max number of milliseconds to wait for a hardware operation, on any of the buses.
 extern unsigned int i2c1_hw_timeout;
 
 /**
- * Initializes the I2C1 subsystem.
+ * Initializes the I2C subsystem and every enabled bus.
  *
  * @returns Zero on success; a negative error code on failure.
  *
  */
-extern int __init i2c1_init( void );
+extern int __init i2c_init( void );
 
 /**
- * Destroys the I2C1 subsystem.
+ * Destroys the I2C subsystem.
  *
  */
-extern void __exit i2c1_exit( void );
+extern void i2c_exit( void );
+
+/**
+ * Sets the default clock divider of an I2C bus, used for peripherals without a profile.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param div The divider.
+ *
+ */
+void i2c_bus_set_clk_div( unsigned int bus, unsigned short clk_div );
+
+/**
+ * Sets the timing profile of a peripheral on an I2C bus, replacing any previous one.
+ *
+ * Transfers addressing the peripheral switch the bus to its timing first. The timing registers
+ * are only written when they differ from the last transfer, so peripherals with the same
+ * profile cost nothing to switch between.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param profile The profile, copied.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int i2c_bus_add_device( unsigned int bus, const struct i2c_device_profile* profile );
+
+/**
+ * Removes the timing profile of a peripheral, it falls back to the bus default.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param addr The 7-bit peripheral address.
+ *
+ */
+void i2c_bus_remove_device( unsigned int bus, unsigned char addr );
+
+/**
+ * Sets the peripheral address of an I2C bus.
+ *
+ * Waits for a transfer in progress, the address is used from the next transfer on.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param addr The address.
+ *
+ */
+void i2c_bus_set_addr( unsigned int bus, unsigned char addr );
+
+/**
+ * Runs a combined transaction of several messages on an I2C bus.
+ *
+ * Behaves like i2c1_transfer(). Each bus has its own lock, so transfers on different buses run in
+ * parallel while transfers on the same bus are serialized.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param msgs The messages.
+ * @param n The number of messages.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int i2c_bus_transfer( unsigned int bus, struct i2c1_msg* msgs, size_t n );
+
+/**
+ * Runs several combined transactions on an I2C bus in a single session.
+ *
+ * The bus is taken once for the whole session, so no other transfer gets in between. A
+ * transaction that fails does not stop the ones after it. Ordering the transactions by clock
+ * divider and address keeps the timing registers from being rewritten between them.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param xfers The transactions, their results are set.
+ * @param n The number of transactions.
+ *
+ * @returns Zero if every transaction succeeded; the first negative error code otherwise.
+ *
+ */
+int i2c_bus_run_session( unsigned int bus, struct i2c1_xfer* xfers, size_t n );
+
+/**
+ * Gets the clock divider transfers addressing a peripheral run at.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param addr The 7-bit peripheral address.
+ *
+ * @returns The divider of the peripheral profile or the bus default; zero if there is no bus.
+ *
+ */
+unsigned short i2c_bus_get_clk_div( unsigned int bus, unsigned char addr );
+
+/**
+ * Reads a register from an I2C bus.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param reg The register.
+ * @param len The length of the register data to read in bytes.
+ * @param data The buffer to read data into.
+ *
+ * @returns The number of bytes read.
+ *
+ */
+size_t i2c_bus_read_register( unsigned int bus, unsigned char reg, ssize_t len, u8* data );
+
+/**
+ * Reads a register with a 16-bit address from an I2C bus.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param reg The register.
+ * @param len The length of the register data to read in bytes.
+ * @param data The buffer to read data into.
+ *
+ * @returns The number of bytes read.
+ *
+ */
+size_t i2c_bus_read_register16( unsigned int bus, u16 reg, ssize_t len, u8* data );
+
+/**
+ * Reads data from an I2C bus.
+ *
+ * Reads of more than 65535 bytes are split into transfers separated by stops.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param len The length of the trasaction in bytes.
+ * @param data The buffer to read data into.
+ *
+ * @returns The number of bytes read.
+ *
+ */
+size_t i2c_bus_read( unsigned int bus, ssize_t len, u8* data );
+
+/**
+ * Writes data to an I2C bus.
+ *
+ * Writes of more than 65535 bytes are split into transfers joined by repeated starts.
+ *
+ * @param bus The I2C_BUS* bus.
+ * @param len The length of the trasaction in bytes.
+ * @param data The buffer to send data from.
+ *
+ * @returns The number of bytes written.
+ *
+ */
+size_t i2c_bus_write( unsigned int bus, ssize_t len, const u8* data );
 
 /**
  * Sets the clock divider of the I2C1 bus.
@@ -44,6 +220,26 @@ void i2c1_set_clk_div( unsigned short clk_div );
  */
 void i2c1_set_addr( unsigned char addr );
 
+/**
+ * Runs a combined transaction of several messages on the I2C1 bus.
+ *
+ * Each message starts a new segment with a repeated start unless it has I2C1_M_NOSTART set, in
+ * which case it continues the previous message in the same direction. A segment following a
+ * write is chained without a stop; a segment following a read is preceded by a stop.
+ *
+ * The BSC counts at most 65535 bytes per transfer, longer segments are split into chunks of that
+ * size. A write chunk is followed by the next one with a repeated start and the peripheral
+ * address again, a read chunk ends with a stop before the next one starts. Peripherals that
+ * expect one unbroken transfer must not be sent segments that long.
+ *
+ * @param msgs The messages.
+ * @param n The number of messages.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int i2c1_transfer( struct i2c1_msg* msgs, size_t n );
+
 /**
  * Reads a register from the I2C1 bus.
  *
@@ -56,9 +252,23 @@ void i2c1_set_addr( unsigned char addr );
  */
 size_t i2c1_read_register( unsigned char reg, ssize_t len, u8* data );
 
+/**
+ * Reads a register with a 16-bit address from the I2C1 bus.
+ *
+ * @param reg The register.
+ * @param len The length of the register data to read in bytes.
+ * @param data The buffer to read data into.
+ *
+ * @returns The number of bytes read.
+ *
+ */
+size_t i2c1_read_register16( u16 reg, ssize_t len, u8* data );
+
 /**
  * Reads data from the I2C1 bus.
  *
+ * Reads of more than 65535 bytes are split as i2c1_transfer() describes.
+ *
  * @param len The length of the trasaction in bytes.
  * @param data The buffer to read data into.
  *
@@ -70,6 +280,8 @@ size_t i2c1_read( ssize_t len, u8* data );
 /**
  * Writes data to the I2C1 bus.
  *
+ * Writes of more than 65535 bytes are split as i2c1_transfer() describes.
+ *
  * @param len The length of the trasaction in bytes.
  * @param data The buffer to send data from.
  *
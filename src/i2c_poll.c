@@ -0,0 +1,330 @@
+#include "i2c_poll.h"
+
+#include <asm/barrier.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include <log.h>
+
+#include "i2c.h"
+
+// Jobs due within this many ns of a session are run in it instead of in a session of their own.
+#define I2C_POLL_MERGE_NS	50000
+
+// The slack given to the timer the thread sleeps on.
+#define I2C_POLL_SLACK_NS	10000
+
+struct i2c_poll_job {
+	unsigned char addr;
+	u8 reg;
+	u8 len;
+	u16 div;		// The clock divider the peripheral runs at, a sort key.
+	u32 slot;
+	u64 period_ns;
+	u64 next_ns;		// The time the job is due at next.
+	u8 data[SPECTR_IO_I2C_POLL_DATA_MAX];
+	struct i2c1_msg msgs[2];
+};
+
+struct i2c_poller {
+	unsigned int bus;
+	struct spectr_io_i2c_poll_header* header;	// The start of the snapshot, shared with userspace.
+	struct spectr_io_i2c_poll_slot* slots;		// The first slot.
+	size_t size;					// The size of the snapshot in bytes, page aligned.
+
+	// The jobs in the order they run in a session, owned by the worker while the poller runs
+	struct i2c_poll_job jobs[SPECTR_IO_I2C_POLL_JOBS_MAX];
+	u32 count;
+	u32 sessions;
+	u32 late;
+
+	// The session being run
+	struct i2c_poll_job* due[SPECTR_IO_I2C_POLL_JOBS_MAX];
+	struct i2c1_xfer xfers[SPECTR_IO_I2C_POLL_JOBS_MAX];
+
+	struct task_struct* worker;
+};
+
+static int i2c_poll_cpu = -1;
+module_param( i2c_poll_cpu, int, 0444 );
+MODULE_PARM_DESC( i2c_poll_cpu, "CPU the I2C poller threads are bound to, unbound if negative" );
+
+static int i2c_poll_prio = 0;
+module_param( i2c_poll_prio, int, 0444 );
+MODULE_PARM_DESC( i2c_poll_prio, "SCHED_FIFO priority of the I2C poller threads, SCHED_NORMAL if zero" );
+
+static void i2c_poller_publish( struct i2c_poller* poller, const struct i2c_poll_job* job, int result, u64 timestamp_ns ) {
+	struct spectr_io_i2c_poll_slot* const slot = &poller->slots[job->slot];
+	const u32 seq = slot->seq;
+
+	// An odd sequence number tells readers the slot is being written
+	WRITE_ONCE( slot->seq, seq + 1 );
+	smp_wmb();
+
+	slot->result = result;
+	slot->timestamp_ns = timestamp_ns;
+	slot->reads++;
+	if ( result ) {
+		slot->errors++;
+	} else {
+		memcpy( slot->data, job->data, job->len );
+	}
+
+	smp_store_release( &slot->seq, seq + 2 );
+}
+
+static void i2c_poller_advance( struct i2c_poller* poller, struct i2c_poll_job* job, u64 now ) {
+	job->next_ns += job->period_ns;
+
+	// A job that fell a whole period behind skips ahead instead of running in a burst
+	if ( job->next_ns <= now ) {
+		const u64 late = div64_u64( now - job->next_ns, job->period_ns ) + 1;
+		job->next_ns += late * job->period_ns;
+		poller->late += late;
+	}
+}
+
+static void i2c_poller_session( struct i2c_poller* poller ) {
+	const u64 start = ktime_get_ns();
+	size_t n = 0;
+	size_t i;
+
+	// The jobs are kept sorted, so the ones picked run in the order that switches the bus least
+	for ( i = 0; i < poller->count; i++ ) {
+		struct i2c_poll_job* const job = &poller->jobs[i];
+		if ( job->next_ns > start + I2C_POLL_MERGE_NS ) {
+			continue;
+		}
+		poller->due[n] = job;
+		poller->xfers[n] = ( struct i2c1_xfer ) {
+			.msgs = job->msgs,
+			.n = ARRAY_SIZE( job->msgs ),
+		};
+		n++;
+	}
+
+	i2c_bus_run_session( poller->bus, poller->xfers, n );
+
+	const u64 end = ktime_get_ns();
+	for ( i = 0; i < n; i++ ) {
+		i2c_poller_publish( poller, poller->due[i], poller->xfers[i].result, end );
+		i2c_poller_advance( poller, poller->due[i], end );
+	}
+
+	WRITE_ONCE( poller->header->late, poller->late );
+	WRITE_ONCE( poller->header->session_ns, start );
+	smp_store_release( &poller->header->sessions, ++poller->sessions );
+}
+
+static u64 i2c_poller_next( const struct i2c_poller* poller ) {
+	u64 next = poller->jobs[0].next_ns;
+	u32 i;
+
+	for ( i = 1; i < poller->count; i++ ) {
+		next = min( next, poller->jobs[i].next_ns );
+	}
+
+	return next;
+}
+
+static int i2c_poller_worker( void* data ) {
+	struct i2c_poller* const poller = data;
+
+	while ( !kthread_should_stop() ) {
+		ktime_t next = ns_to_ktime( i2c_poller_next( poller ) );
+		if ( ktime_get_ns() < ktime_to_ns( next ) ) {
+			// The state is set before the stop check so a stop in between still wakes the sleep
+			set_current_state( TASK_INTERRUPTIBLE );
+			if ( kthread_should_stop() ) {
+				__set_current_state( TASK_RUNNING );
+				break;
+			}
+			schedule_hrtimeout_range( &next, I2C_POLL_SLACK_NS, HRTIMER_MODE_ABS );
+			continue;
+		}
+
+		i2c_poller_session( poller );
+	}
+
+	return 0;
+}
+
+struct i2c_poller* i2c_poller_create( unsigned int bus ) {
+	if ( bus >= I2C_BUSES ) {
+		return ERR_PTR( -EINVAL );
+	}
+
+	struct i2c_poller* const poller = kzalloc( sizeof( *poller ), GFP_KERNEL );
+	if ( !poller ) {
+		return ERR_PTR( -ENOMEM );
+	}
+
+	// vmalloc_user() zeroes the pages and marks them for remap_vmalloc_range()
+	poller->size = PAGE_ALIGN( PAGE_SIZE + SPECTR_IO_I2C_POLL_JOBS_MAX * sizeof( struct spectr_io_i2c_poll_slot ) );
+	poller->header = vmalloc_user( poller->size );
+	if ( !poller->header ) {
+		kfree( poller );
+		return ERR_PTR( -ENOMEM );
+	}
+
+	poller->slots = ( struct spectr_io_i2c_poll_slot* ) ( ( u8* ) poller->header + PAGE_SIZE );
+	poller->bus = bus;
+	poller->header->slot_offset = PAGE_SIZE;
+
+	return poller;
+}
+
+void i2c_poller_destroy( struct i2c_poller* poller ) {
+	i2c_poller_stop( poller );
+	vfree( poller->header );
+	kfree( poller );
+}
+
+static int i2c_poll_job_cmp( const void* a, const void* b ) {
+	const struct i2c_poll_job* const x = a;
+	const struct i2c_poll_job* const y = b;
+
+	if ( x->div != y->div ) {
+		return x->div < y->div ? -1 : 1;
+	}
+	if ( x->addr != y->addr ) {
+		return x->addr < y->addr ? -1 : 1;
+	}
+
+	return x->reg - y->reg;
+}
+
+static void i2c_poller_clear( struct i2c_poller* poller, u32 slot ) {
+	struct spectr_io_i2c_poll_slot* const s = &poller->slots[slot];
+	const u32 seq = s->seq;
+
+	WRITE_ONCE( s->seq, seq + 1 );
+	smp_wmb();
+	memset( ( u8* ) s + sizeof( s->seq ), 0, sizeof( *s ) - sizeof( s->seq ) );
+	smp_store_release( &s->seq, seq + 2 );
+}
+
+static int i2c_poller_load( struct i2c_poller* poller, const struct spectr_io_i2c_poll_job* jobs, u32 count ) {
+	u32 i;
+
+	if ( !count || count > SPECTR_IO_I2C_POLL_JOBS_MAX ) {
+		return -EINVAL;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		if ( jobs[i].addr > 0x7F || !jobs[i].len || jobs[i].len > SPECTR_IO_I2C_POLL_DATA_MAX
+				|| jobs[i].period_us < SPECTR_IO_I2C_POLL_PERIOD_MIN_US ) {
+			return -EINVAL;
+		}
+	}
+
+	const u64 now = ktime_get_ns();
+	for ( i = 0; i < count; i++ ) {
+		struct i2c_poll_job* const job = &poller->jobs[i];
+		*job = ( struct i2c_poll_job ) {
+			.addr = jobs[i].addr,
+			.reg = jobs[i].reg,
+			.len = jobs[i].len,
+			.div = i2c_bus_get_clk_div( poller->bus, jobs[i].addr ),
+			.slot = i,
+			.period_ns = ( u64 ) jobs[i].period_us * NSEC_PER_USEC,
+			.next_ns = now,
+		};
+	}
+	sort( poller->jobs, count, sizeof( poller->jobs[0] ), i2c_poll_job_cmp, NULL );
+
+	// The messages point into the jobs, so they are only set up once the jobs are in place
+	for ( i = 0; i < count; i++ ) {
+		struct i2c_poll_job* const job = &poller->jobs[i];
+		job->msgs[0] = ( struct i2c1_msg ) { .addr = job->addr, .flags = 0, .len = 1, .buf = &job->reg };
+		job->msgs[1] = ( struct i2c1_msg ) { .addr = job->addr, .flags = I2C1_M_RD, .len = job->len, .buf = job->data };
+	}
+
+	for ( i = 0; i < SPECTR_IO_I2C_POLL_JOBS_MAX; i++ ) {
+		i2c_poller_clear( poller, i );
+	}
+	poller->count = count;
+	poller->header->jobs = count;
+
+	return 0;
+}
+
+int i2c_poller_start( struct i2c_poller* poller, const struct spectr_io_i2c_poll_job* jobs, u32 count ) {
+	struct task_struct* worker;
+	int err;
+
+	if ( poller->worker ) {
+		return -EBUSY;
+	}
+
+	err = i2c_poller_load( poller, jobs, count );
+	if ( err ) {
+		return err;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "I2C starting poller of %u jobs.", poller->count );
+#endif // DEBUG
+	worker = kthread_create( i2c_poller_worker, poller, "spectr-io-i2c-poll" );
+	if ( IS_ERR( worker ) ) {
+		LOG( KERN_ERR, "I2C failed to start poller thread." );
+		return PTR_ERR( worker );
+	}
+
+	if ( i2c_poll_cpu >= 0 ) {
+		if ( i2c_poll_cpu < nr_cpu_ids && cpu_online( i2c_poll_cpu ) ) {
+			kthread_bind( worker, i2c_poll_cpu );
+		} else {
+			LOG( KERN_ERR, "I2C poller CPU %d is not online, poller left unbound.", i2c_poll_cpu );
+		}
+	}
+
+	if ( i2c_poll_prio > 0 ) {
+		struct sched_param param = {
+			.sched_priority = min( i2c_poll_prio, MAX_RT_PRIO - 1 ),
+		};
+		if ( sched_setscheduler_nocheck( worker, SCHED_FIFO, &param ) ) {
+			LOG( KERN_ERR, "I2C failed to set poller priority %d.", i2c_poll_prio );
+		}
+	}
+
+	poller->worker = worker;
+	wake_up_process( worker );
+
+	return 0;
+}
+
+void i2c_poller_stop( struct i2c_poller* poller ) {
+	if ( !poller->worker ) {
+		return;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "I2C stopping poller." );
+#endif // DEBUG
+	kthread_stop( poller->worker );
+	poller->worker = ( struct task_struct* ) 0;
+}
+
+int i2c_poller_running( const struct i2c_poller* poller ) {
+	return poller->worker != ( struct task_struct* ) 0;
+}
+
+int i2c_poller_mmap( struct i2c_poller* poller, struct vm_area_struct* vma ) {
+	if ( vma->vm_pgoff ) {
+		return -EINVAL;
+	}
+
+	// Sizes past the end of the snapshot are refused
+	return remap_vmalloc_range( vma, poller->header, 0 );
+}
@@ -0,0 +1,81 @@
+#ifndef _SPECTR_IO_I2C_POLL_H
+#define _SPECTR_IO_I2C_POLL_H
+
+#include <linux/mm.h>
+#include <linux/types.h>
+
+#include "uapi/spectr_io.h"
+
+struct i2c_poller;
+
+/**
+ * Creates a stopped I2C poller along with its snapshot.
+ *
+ * The snapshot is zeroed vmalloc memory starting with a struct spectr_io_i2c_poll_header page,
+ * followed by a slot for each of the SPECTR_IO_I2C_POLL_JOBS_MAX jobs a table can have, meant to be
+ * mapped into userspace with i2c_poller_mmap().
+ *
+ * @param bus The I2C_BUS* bus the poller reads from.
+ *
+ * @returns The poller; an ERR_PTR() on failure.
+ *
+ */
+struct i2c_poller* i2c_poller_create( unsigned int bus );
+
+/**
+ * Stops and frees a poller. Mappings of its snapshot keep their pages until they are unmapped.
+ *
+ * @param poller The poller.
+ *
+ */
+void i2c_poller_destroy( struct i2c_poller* poller );
+
+/**
+ * Starts a poller on a thread of its own, bound to the CPU given by the i2c_poll_cpu parameter,
+ * which reads the registers of a table of jobs, each at its own rate.
+ *
+ * The thread sleeps on a high resolution timer until the next job is due, then runs every job due
+ * by then or shortly after in a single bus session, ordered by clock divider, address and register
+ * so the bus timing changes as little as possible. Each job keeps its schedule from the start,
+ * periods a job falls behind over are skipped and counted as late. The results are written into
+ * the slots of the snapshot, which starts out cleared.
+ *
+ * @param poller The poller, stopped.
+ * @param jobs The jobs, copied.
+ * @param count The number of jobs.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int i2c_poller_start( struct i2c_poller* poller, const struct spectr_io_i2c_poll_job* jobs, u32 count );
+
+/**
+ * Stops a poller, waiting for a session in progress to finish.
+ *
+ * @param poller The poller.
+ *
+ */
+void i2c_poller_stop( struct i2c_poller* poller );
+
+/**
+ * Checks whether a poller runs.
+ *
+ * @param poller The poller.
+ *
+ * @returns Nonzero if it runs; zero otherwise.
+ *
+ */
+int i2c_poller_running( const struct i2c_poller* poller );
+
+/**
+ * Maps the snapshot of a poller into userspace, from the start of the snapshot.
+ *
+ * @param poller The poller.
+ * @param vma The area to map the snapshot into.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int i2c_poller_mmap( struct i2c_poller* poller, struct vm_area_struct* vma );
+
+#endif // _SPECTR_IO_I2C_POLL_H
@@ -0,0 +1,246 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM spectr_io
+
+#if !defined( _SPECTR_IO_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define _SPECTR_IO_TRACE_H
+
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+#include "stats.h"
+
+#define io_trace_show_bus( bus )					\
+	__print_symbolic( bus,						\
+		{ STATS_BUS_SPI0, "spi0" },				\
+		{ STATS_BUS_I2C1, "i2c1" },				\
+		{ STATS_BUS_SPI1, "spi1" },				\
+		{ STATS_BUS_SPI2, "spi2" },				\
+		{ STATS_BUS_I2C0, "i2c0" } )
+
+#define io_trace_show_op( op )						\
+	__print_symbolic( op,						\
+		{ STATS_OP_SPI_READ,		"spi_read" },		\
+		{ STATS_OP_SPI_WRITE,		"spi_write" },		\
+		{ STATS_OP_SPI_TRANSFER,	"spi_transfer" },	\
+		{ STATS_OP_SPI_AWAIT,		"spi_await_transfer" },	\
+		{ STATS_OP_I2C_TRANSFER,	"i2c_transfer" } )
+
+TRACE_EVENT( spectr_io_xfer_start,
+
+	TP_PROTO( unsigned int bus, unsigned int op, size_t len ),
+
+	TP_ARGS( bus, op, len ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bus )
+		__field( unsigned int, op )
+		__field( size_t, len )
+	),
+
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->op = op;
+		__entry->len = len;
+	),
+
+	TP_printk( "bus=%s op=%s len=%zu", io_trace_show_bus( __entry->bus ),
+		io_trace_show_op( __entry->op ), __entry->len )
+);
+
+TRACE_EVENT( spectr_io_fifo_stall,
+
+	TP_PROTO( unsigned int bus, u32 flags, u64 polls, u64 ns ),
+
+	TP_ARGS( bus, flags, polls, ns ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bus )
+		__field( u32, flags )
+		__field( u64, polls )
+		__field( u64, ns )
+	),
+
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->flags = flags;
+		__entry->polls = polls;
+		__entry->ns = ns;
+	),
+
+	TP_printk( "bus=%s flags=0x%08x polls=%llu ns=%llu", io_trace_show_bus( __entry->bus ),
+		__entry->flags, __entry->polls, __entry->ns )
+);
+
+TRACE_EVENT( spectr_io_xfer_done,
+
+	TP_PROTO( unsigned int bus, unsigned int op, size_t len, u64 begin, u64 setup, u64 first,
+		u64 last ),
+
+	TP_ARGS( bus, op, len, begin, setup, first, last ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bus )
+		__field( unsigned int, op )
+		__field( size_t, len )
+		__field( u64, setup_ns )
+		__field( u64, first_ns )
+		__field( u64, last_ns )
+		__field( u64, done_ns )
+	),
+
+	// Phases are relative to the start of the transfer, zero if the transfer never reached them
+	TP_fast_assign(
+		const u64 now = ktime_get_ns();
+		__entry->bus = bus;
+		__entry->op = op;
+		__entry->len = len;
+		__entry->setup_ns = setup ? setup - begin : 0;
+		__entry->first_ns = first ? first - begin : 0;
+		__entry->last_ns = last ? last - begin : 0;
+		__entry->done_ns = now - begin;
+	),
+
+	TP_printk( "bus=%s op=%s len=%zu setup=%llu first=%llu last=%llu done=%llu",
+		io_trace_show_bus( __entry->bus ), io_trace_show_op( __entry->op ), __entry->len,
+		__entry->setup_ns, __entry->first_ns, __entry->last_ns, __entry->done_ns )
+);
+
+TRACE_EVENT( spectr_io_xfer_error,
+
+	TP_PROTO( unsigned int bus, unsigned int op, int err ),
+
+	TP_ARGS( bus, op, err ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bus )
+		__field( unsigned int, op )
+		__field( int, err )
+	),
+
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->op = op;
+		__entry->err = err;
+	),
+
+	TP_printk( "bus=%s op=%s err=%d", io_trace_show_bus( __entry->bus ),
+		io_trace_show_op( __entry->op ), __entry->err )
+);
+
+TRACE_EVENT( spectr_io_gpio_write,
+
+	TP_PROTO( unsigned int bank, u32 set, u32 clr ),
+
+	TP_ARGS( bank, set, clr ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bank )
+		__field( u32, set )
+		__field( u32, clr )
+	),
+
+	TP_fast_assign(
+		__entry->bank = bank;
+		__entry->set = set;
+		__entry->clr = clr;
+	),
+
+	TP_printk( "bank=%u set=0x%08x clr=0x%08x", __entry->bank, __entry->set, __entry->clr )
+);
+
+TRACE_EVENT( spectr_io_gpio_read,
+
+	TP_PROTO( unsigned int bank, u32 levels ),
+
+	TP_ARGS( bank, levels ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bank )
+		__field( u32, levels )
+	),
+
+	TP_fast_assign(
+		__entry->bank = bank;
+		__entry->levels = levels;
+	),
+
+	TP_printk( "bank=%u levels=0x%08x", __entry->bank, __entry->levels )
+);
+
+TRACE_EVENT( spectr_io_gpio_mode,
+
+	TP_PROTO( unsigned int bank, u32 pins, unsigned int mode ),
+
+	TP_ARGS( bank, pins, mode ),
+
+	TP_STRUCT__entry(
+		__field( unsigned int, bank )
+		__field( u32, pins )
+		__field( unsigned int, mode )
+	),
+
+	TP_fast_assign(
+		__entry->bank = bank;
+		__entry->pins = pins;
+		__entry->mode = mode;
+	),
+
+	TP_printk( "bank=%u pins=0x%08x mode=%u", __entry->bank, __entry->pins, __entry->mode )
+);
+
+#endif // _SPECTR_IO_TRACE_H
+
+#ifndef _SPECTR_IO_TRACE_PHASES_H
+#define _SPECTR_IO_TRACE_PHASES_H
+
+// The phase timestamps of a transfer, only taken while the done tracepoint is enabled.
+struct io_trace_phases {
+	u64 begin;	// The transfer was entered.
+	u64 setup;	// The controller was set up and the first FIFO access is next.
+	u64 first;	// The first byte was moved through the FIFO.
+	u64 last;	// The last byte was moved through the FIFO.
+};
+
+static inline u64 io_trace_now( void ) {
+	return trace_spectr_io_xfer_done_enabled() ? ktime_get_ns() : 0;
+}
+
+static inline u64 io_trace_stall_now( void ) {
+	return trace_spectr_io_fifo_stall_enabled() ? ktime_get_ns() : 0;
+}
+
+static inline void io_trace_begin( struct io_trace_phases* phases, u64 begin ) {
+	phases->begin = begin;
+	phases->setup = 0;
+	phases->first = 0;
+	phases->last = 0;
+}
+
+static inline void io_trace_mark( u64* phase ) {
+	if ( trace_spectr_io_xfer_done_enabled() && !*phase ) {
+		*phase = ktime_get_ns();
+	}
+}
+
+static inline void io_trace_done( unsigned int bus, unsigned int op, size_t len,
+		const struct io_trace_phases* phases ) {
+	trace_spectr_io_xfer_done( bus, op, len, phases->begin, phases->setup, phases->first,
+		phases->last );
+}
+
+// Reports a wait on the FIFO flags, a wait satisfied by the first status read is no stall.
+static inline void io_trace_stall( unsigned int bus, u32 flags, u64 polls, u64 begin ) {
+	if ( polls > 1 && trace_spectr_io_fifo_stall_enabled() ) {
+		trace_spectr_io_fifo_stall( bus, flags, polls, begin ? ktime_get_ns() - begin : 0 );
+	}
+}
+
+#endif // _SPECTR_IO_TRACE_PHASES_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE io_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,61 @@
+#include "io_wait.h"
+
+#include <linux/delay.h>
+#include <linux/module.h>
+
+static unsigned int io_wait_spin_ns = 20000;
+module_param( io_wait_spin_ns, uint, 0644 );
+MODULE_PARM_DESC( io_wait_spin_ns, "Waits expected to end within this many ns spin instead of sleeping" );
+
+static unsigned int io_wait_slack = 4;
+module_param( io_wait_slack, uint, 0644 );
+MODULE_PARM_DESC( io_wait_slack, "Multiple of the expected time after which a wait on the bus fails" );
+
+static unsigned int io_wait_min_ns = 200000;
+module_param( io_wait_min_ns, uint, 0644 );
+MODULE_PARM_DESC( io_wait_min_ns, "Shortest time in ns before a wait on the bus fails" );
+
+static void io_wait_sleep_ns( u64 ns ) {
+	const unsigned long us = div_u64( ns, NSEC_PER_USEC );
+
+	// Let the timer fire anywhere in the first half of the spin window to allow it to coalesce
+	usleep_range( us, us + io_wait_spin_ns / ( 2 * NSEC_PER_USEC ) );
+}
+
+void io_wait_begin( struct io_wait* wait, u64 expected, unsigned int timeout_ms, int can_sleep ) {
+	const u64 now = ktime_get_ns();
+	const u64 limit = ( u64 ) timeout_ms * NSEC_PER_MSEC;
+
+	wait->expected = expected;
+	wait->due = now + expected;
+	wait->deadline = now + min( max( expected * io_wait_slack, ( u64 ) io_wait_min_ns ), limit );
+	wait->polls = 1;
+	wait->can_sleep = can_sleep;
+}
+
+int io_wait_poll( struct io_wait* wait ) {
+	const u64 now = ktime_get_ns();
+
+	wait->polls++;
+	if ( now >= wait->deadline ) {
+		return 1;
+	}
+
+	if ( wait->can_sleep ) {
+		// Sleep through a long wait up to the spin window before it is due, the window is spun
+		// so the wake-up latency does not add to the wait
+		if ( wait->due > now + io_wait_spin_ns ) {
+			io_wait_sleep_ns( wait->due - now - io_wait_spin_ns );
+			return 0;
+		}
+
+		// An overdue long wait backs off instead of spinning all the way to the deadline
+		if ( now > wait->due && wait->expected > io_wait_spin_ns ) {
+			io_wait_sleep_ns( min( wait->expected >> 2, wait->deadline - now ) );
+			return 0;
+		}
+	}
+
+	cpu_relax();
+	return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef _SPECTR_IO_IO_WAIT_H
+#define _SPECTR_IO_IO_WAIT_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+
+#include <dma.h>
+
+// A wait on bus hardware, paced by how long the hardware is expected to take.
+struct io_wait {
+	u64 due;	// The time the hardware is expected to be done.
+	u64 deadline;	// The time the wait fails at.
+	u64 expected;	// The time the hardware is expected to take in nanoseconds.
+	u64 polls;	// The status reads made, counting the first one.
+	int can_sleep;	// Whether the waiting context may sleep.
+};
+
+/**
+ * Gets the time an SPI bus takes to shift bytes.
+ *
+ * @param bytes The number of bytes.
+ * @param div The system clock divider, zero for the largest one.
+ *
+ * @returns The time in nanoseconds.
+ *
+ */
+static inline u64 io_wait_spi_ns( size_t bytes, u32 div ) {
+	const u64 cycles = ( u64 ) bytes * 8 * ( div ? div : 65536 );
+	return div_u64( cycles * 1000, BCM2836_CORE_CLK_HZ / 1000000 );
+}
+
+/**
+ * Gets the time an I2C bus takes to move bytes, each with its acknowledge bit.
+ *
+ * @param bytes The number of bytes.
+ * @param div The BSC clock divider, zero for the largest one.
+ *
+ * @returns The time in nanoseconds.
+ *
+ */
+static inline u64 io_wait_i2c_ns( size_t bytes, u32 div ) {
+	const u64 cycles = ( u64 ) bytes * 9 * ( div ? div : 32768 );
+	return div_u64( cycles * 1000, BCM2836_CORE_CLK_HZ / 1000000 );
+}
+
+/**
+ * Gets the time a peripheral may stretch an I2C clock before the BSC reports a clock timeout.
+ *
+ * @param clkt The CLKT timeout in bus clock cycles.
+ * @param div The BSC clock divider, zero for the largest one.
+ *
+ * @returns The time in nanoseconds.
+ *
+ */
+static inline u64 io_wait_i2c_stretch_ns( u32 clkt, u32 div ) {
+	const u64 cycles = ( u64 ) clkt * ( div ? div : 32768 );
+	return div_u64( cycles * 1000, BCM2836_CORE_CLK_HZ / 1000000 );
+}
+
+/**
+ * Starts a wait on bus hardware.
+ *
+ * The wait fails once a small multiple of the expected time has passed, but never sooner than
+ * io_wait_min_ns and never later than the hardware timeout.
+ *
+ * @param wait The wait.
+ * @param expected The time the hardware is expected to take in nanoseconds.
+ * @param timeout_ms The hardware timeout in milliseconds.
+ * @param can_sleep Nonzero if the caller may sleep; zero from interrupt handlers and under spinlocks.
+ *
+ */
+void io_wait_begin( struct io_wait* wait, u64 expected, unsigned int timeout_ms, int can_sleep );
+
+/**
+ * Waits a little longer for bus hardware, called every time a status read comes up empty.
+ *
+ * Spins while the hardware is about to be done. Long waits sleep through the bulk of the
+ * expected time on a high resolution timer instead, if the wait was started as one that may sleep.
+ *
+ * @param wait The wait.
+ *
+ * @returns Zero to keep polling; nonzero once the wait failed.
+ *
+ */
+int io_wait_poll( struct io_wait* wait );
+
+#endif // _SPECTR_IO_IO_WAIT_H
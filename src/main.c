@@ -1,33 +1,104 @@
 #include <linux/init.h>
 #include <linux/module.h>
 
+#include "chardev.h"
+#include "dmac.h"
 #include "gpio.h"
+#include "gpio_event.h"
+#include "gpio_pattern.h"
+#include "gpio_trigger.h"
 #include "i2c.h"
 #include "spi.h"
+#include "spi_aux.h"
+#include "spi_queue.h"
+#include "stats.h"
 
 static int __init spectre_io_init( void ) {
 	int err;
 
-	err = gpio_init();
+	err = stats_init();
 	if ( err ) {
 		return err;
 	}
+	err = gpio_init();
+	if ( err ) {
+		goto spectre_io_init_stats;
+	}
+	err = gpio_event_init();
+	if ( err ) {
+		goto spectre_io_init_gpio;
+	}
+	err = gpio_pattern_init();
+	if ( err ) {
+		goto spectre_io_init_gpio_event;
+	}
+	err = dmac_init();
+	if ( err ) {
+		goto spectre_io_init_gpio_pattern;
+	}
 	err = spi_init();
 	if ( err ) {
-		return err;
+		goto spectre_io_init_dmac;
 	}
-	err = i2c1_init();
+	err = spi_queue_init();
 	if ( err ) {
-		return err;
+		goto spectre_io_init_spi;
+	}
+	err = spi_aux_init();
+	if ( err ) {
+		goto spectre_io_init_spi_queue;
+	}
+	err = i2c_init();
+	if ( err ) {
+		goto spectre_io_init_spi_aux;
+	}
+	err = gpio_trigger_init();
+	if ( err ) {
+		goto spectre_io_init_i2c;
+	}
+	err = chardev_init();
+	if ( err ) {
+		goto spectre_io_init_gpio_trigger;
 	}
 
 	return 0;
+
+spectre_io_init_gpio_trigger:
+	gpio_trigger_exit();
+spectre_io_init_i2c:
+	i2c_exit();
+spectre_io_init_spi_aux:
+	spi_aux_exit();
+spectre_io_init_spi_queue:
+	spi_queue_exit();
+spectre_io_init_spi:
+	spi_exit();
+spectre_io_init_dmac:
+	dmac_exit();
+spectre_io_init_gpio_pattern:
+	gpio_pattern_exit();
+spectre_io_init_gpio_event:
+	gpio_event_exit();
+spectre_io_init_gpio:
+	gpio_exit();
+spectre_io_init_stats:
+	stats_exit();
+
+	return err;
 }
 
 static void __exit spectre_io_exit( void ) {
-	i2c1_exit();
+	chardev_exit();
+	gpio_trigger_exit();
+	i2c_exit();
+	spi_aux_exit();
+	spi_queue_exit();
 	spi_exit();
+	dmac_exit();
+	gpio_pattern_exit();
+	gpio_event_exit();
 	gpio_exit();
+	stats_exit();
 }
 
 MODULE_LICENSE( "GPL" );
@@ -2,13 +2,23 @@
 
 #include <asm/io.h>
 #include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/interrupt.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 
 #include <dma.h>
 #include <log.h>
 
+#include "dmac.h"
 #include "gpio.h"
+#include "io_trace.h"
+#include "io_wait.h"
+#include "stats.h"
 
 #define SPI_OFFSET	0x00204000
 #define SPI_SIZE	0x18
@@ -16,6 +26,7 @@
 #define SPI_CS		0x00
 #define SPI_FIFO	0x04
 #define SPI_CLK		0x08
+#define SPI_DLEN	0x0C
 
 #define SPI_CS_CSL	BIT(  0 )
 #define SPI_CS_CSH	BIT(  1 )
@@ -44,132 +55,750 @@
 
 #define SPI_CS_CS_MASK		( SPI_CS_CSL | SPI_CS_CSH )
 #define SPI_CS_MODE_MASK	( SPI_CS_CPHA | SPI_CS_CPOL )
+#define SPI_CS_CSPOL_MASK	( SPI_CS_CSPOL | SPI_CS_CSPOL0 | SPI_CS_CSPOL1 | SPI_CS_CSPOL2 )
+#define SPI_CS_PROFILE_MASK	( SPI_CS_CS_MASK | SPI_CS_MODE_MASK | SPI_CS_CSPOL | SPI_CS_REN )
+
+#define SPI_FIFO_SIZE		64
+#define SPI_FIFO_SIZE_3_4	48
+
+// The size of each DMA bounce buffer, longer transfers are split into chunks of this size.
+#define SPI_DMA_BUF_SIZE	16384
+
+struct spi_dma_state {
+	spinlock_t lock;
+	int ready;
+	int active;
+
+	struct dmac_cb* cbs;
+	u32 cbs_bus;
+	u8* tx_buf;
+	u32 tx_bus;
+	u8* rx_buf;
+	u32 rx_bus;
+
+	const u8* tx;
+	u8* rx;
+	size_t len;
+	size_t pos;
+	size_t chunk;
+
+	spi_complete_fn complete;
+	void* ctx;
+};
+
+struct spi_irq_state {
+	spinlock_t lock;
+	int ready;
+	int active;
+	int await_done;
+
+	const u8* tx;
+	u8* rx;
+	size_t len;
+	size_t tx_count;
+	size_t rx_count;
+
+	struct completion done;
+	u64 done_time;
+};
+
+struct spi_dma_sync {
+	struct completion done;
+	u64 done_time;
+	int err;
+};
+
+// A registered device profile, with its register values worked out up front.
+struct spi_device {
+	int used;
+	u8 chip;
+	u8 cs_high;
+	u32 cs;		// The SPI_CS_PROFILE_MASK bits of the CS register.
+	u32 clk;
+};
 
 static u8* spi_mem = ( u8* ) 0;
 
+// Shadows of the CS configuration bits and TA, and of CLK, the registers are only written when
+// they differ. The interrupt and DMA enables are left out, they are only set during a transfer
+static u32 spi_cs = 0x00000000;
+static u32 spi_clk = 0x00000000;
+
+static struct spi_device spi_devices[SPI_DEVICES];
+
+static DEFINE_MUTEX( spi_devices_mutex );
+
 unsigned int spi_hw_timeout = 1000;
 
-static int spi_await_cs_flags_with_timeout( u32 flags ) {
-	const unsigned long timeout = jiffies + ( spi_hw_timeout * HZ ) / 1000;
+unsigned int spi_dma_threshold = 128;
+
+static int spi_dma_irq = -1;
+module_param( spi_dma_irq, int, 0444 );
+MODULE_PARM_DESC( spi_dma_irq, "IRQ of the SPI RX DMA channel, DMA transfers are disabled if negative" );
+
+static int spi_dma_tx_chan = 4;
+module_param( spi_dma_tx_chan, int, 0444 );
+MODULE_PARM_DESC( spi_dma_tx_chan, "DMA channel used for SPI TX, must not be used by any other driver" );
+
+static int spi_dma_rx_chan = 5;
+module_param( spi_dma_rx_chan, int, 0444 );
+MODULE_PARM_DESC( spi_dma_rx_chan, "DMA channel used for SPI RX, must not be used by any other driver" );
+
+unsigned int spi_irq_threshold = 32;
+
+static int spi_irq = -1;
+module_param( spi_irq, int, 0444 );
+MODULE_PARM_DESC( spi_irq, "IRQ of the SPI0 controller, interrupt driven transfers are disabled if negative" );
+
+static const struct gpio_pin_config spi_pins_alt0[] = {
+	{  7, GPIO_PIN_MODE_ALT0 },
+	{  8, GPIO_PIN_MODE_ALT0 },
+	{  9, GPIO_PIN_MODE_ALT0 },
+	{ 10, GPIO_PIN_MODE_ALT0 },
+	{ 11, GPIO_PIN_MODE_ALT0 },
+};
+
+static const struct gpio_pin_config spi_pins_input[] = {
+	{  7, GPIO_PIN_MODE_INPUT },
+	{  8, GPIO_PIN_MODE_INPUT },
+	{  9, GPIO_PIN_MODE_INPUT },
+	{ 10, GPIO_PIN_MODE_INPUT },
+	{ 11, GPIO_PIN_MODE_INPUT },
+};
+
+static struct spi_dma_state spi_dma;
+
+static DEFINE_MUTEX( spi_bus_mutex );
+
+static struct spi_irq_state spi_irq_state;
+
+static int spi_await_cs_flags_with_timeout( u32 flags, size_t bytes ) {
+	const u64 begin = io_trace_stall_now();
+	struct io_wait wait;
+	int err = 0;
+
+	// Synchronous transfers run under the bus mutex and may sleep
+	io_wait_begin( &wait, io_wait_spi_ns( bytes, spi_clk ), spi_hw_timeout, 1 );
 	while ( !( dma_get_flags32( spi_mem + SPI_CS, flags ) ) ) {
-		if ( jiffies >= timeout ) {
-			return SPI_ERR_HW_TIMEOUT;
+		if ( io_wait_poll( &wait ) ) {
+			stats_add( STATS_BUS_SPI0, STATS_TIMEOUTS, 1 );
+			err = SPI_ERR_HW_TIMEOUT;
+			break;
 		}
 	}
 
-	return 0;
+	stats_add( STATS_BUS_SPI0, STATS_POLLS, wait.polls );
+	io_trace_stall( STATS_BUS_SPI0, flags, wait.polls, begin );
+	return err;
+}
+
+static inline size_t spi_fifo_rx_level( u32 cs ) {
+	if ( cs & SPI_CS_RXF ) {
+		return SPI_FIFO_SIZE;
+	}
+	if ( cs & SPI_CS_RXR ) {
+		return SPI_FIFO_SIZE_3_4;
+	}
+	return ( cs & SPI_CS_RXD ) ? 1 : 0;
+}
+
+static inline void spi_pio_stats( unsigned int op, u64 begin, size_t bytes, u64 polls ) {
+	stats_add( STATS_BUS_SPI0, STATS_TRANSFERS, 1 );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, bytes );
+	stats_add( STATS_BUS_SPI0, STATS_POLLS, polls );
+	stats_add( STATS_BUS_SPI0, STATS_CPU_NS, stats_end( STATS_BUS_SPI0, op, begin ) );
+}
+
+static inline void spi_wake_stats( u64 done_time ) {
+	stats_add( STATS_BUS_SPI0, STATS_WAKES, 1 );
+	stats_add( STATS_BUS_SPI0, STATS_WAKE_NS, ktime_get_ns() - done_time );
+}
+
+static size_t spi_fifo_burst( const u8* tx, u8* rx, size_t len, size_t* tx_count, size_t* rx_count ) {
+	const u32 cs = dma_read32_relaxed( spi_mem + SPI_CS );
+	const size_t in_flight = *tx_count - *rx_count;
+	size_t i;
+
+	// Drain as much as the FIFO level flags promise, once DONE is set everything in flight has
+	// been shifted into the RX FIFO. The accesses are relaxed, one fence per drain and per fill
+	// orders the burst against memory
+	size_t received = ( cs & SPI_CS_DONE ) ? in_flight : min( spi_fifo_rx_level( cs ), in_flight );
+	for ( i = 0; i < received; i++ ) {
+		const u8 byte = dma_read8_relaxed( spi_mem + SPI_FIFO );
+		if ( rx ) {
+			rx[*rx_count] = byte;
+		}
+		( *rx_count )++;
+	}
+	if ( received ) {
+		dma_read_fence();
+	}
+
+	// With at most a FIFO worth of bytes in flight the TX FIFO always has room for the
+	// difference, so it can be filled without checking TXD
+	const size_t count = min( len - *tx_count, SPI_FIFO_SIZE - ( *tx_count - *rx_count ) );
+	if ( count ) {
+		dma_write_fence();
+	}
+	for ( i = 0; i < count; i++ ) {
+		dma_write8_relaxed( spi_mem + SPI_FIFO, tx ? tx[*tx_count] : 0x00 );
+		( *tx_count )++;
+	}
+
+	return received;
+}
+
+static void spi_irq_pump( void ) {
+	struct spi_irq_state* const st = &spi_irq_state;
+
+	spi_fifo_burst( st->tx, st->rx, st->len, &st->tx_count, &st->rx_count );
+}
+
+static irqreturn_t spi_irq_handler( int irq, void* dev ) {
+	struct spi_irq_state* const st = &spi_irq_state;
+
+	spin_lock( &st->lock );
+	if ( !st->active ) {
+		spin_unlock( &st->lock );
+		return IRQ_NONE;
+	}
+
+	const u64 start = ktime_get_ns();
+	if ( st->await_done ) {
+		if ( !dma_get_flags32( spi_mem + SPI_CS, SPI_CS_DONE ) ) {
+			spin_unlock( &st->lock );
+			return IRQ_NONE;
+		}
+	} else {
+		// RXR means the RX FIFO needs draining, DONE means the TX FIFO ran dry
+		spi_irq_pump();
+		if ( st->rx_count < st->len ) {
+			stats_add( STATS_BUS_SPI0, STATS_CPU_NS, ktime_get_ns() - start );
+			spin_unlock( &st->lock );
+			return IRQ_HANDLED;
+		}
+	}
+
+	// DONE stays set while TA is, so the interrupts have to be disabled to stop them refiring
+	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_INTD | SPI_CS_INTR );
+	st->active = 0;
+	st->done_time = ktime_get_ns();
+	stats_add( STATS_BUS_SPI0, STATS_CPU_NS, st->done_time - start );
+	complete( &st->done );
+	spin_unlock( &st->lock );
+
+	return IRQ_HANDLED;
+}
+
+static int spi_irq_wait( void ) {
+	struct spi_irq_state* const st = &spi_irq_state;
+	unsigned long flags;
+	int err = 0;
+
+	if ( !wait_for_completion_timeout( &st->done, msecs_to_jiffies( spi_hw_timeout ) ) ) {
+		spin_lock_irqsave( &st->lock, flags );
+		if ( st->active ) {
+			dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_INTD | SPI_CS_INTR );
+			st->active = 0;
+			err = SPI_ERR_HW_TIMEOUT;
+		}
+		spin_unlock_irqrestore( &st->lock, flags );
+	}
+	if ( err ) {
+		stats_add( STATS_BUS_SPI0, STATS_TIMEOUTS, 1 );
+	} else {
+		spi_wake_stats( st->done_time );
+	}
+
+	return err;
+}
+
+static ssize_t spi_transfer_irq( const u8* tx, u8* rx, size_t len ) {
+	struct spi_irq_state* const st = &spi_irq_state;
+	unsigned long flags;
+	int err;
+
+	spin_lock_irqsave( &st->lock, flags );
+	st->tx = tx;
+	st->rx = rx;
+	st->len = len;
+	st->tx_count = 0;
+	st->rx_count = 0;
+	st->await_done = 0;
+	reinit_completion( &st->done );
+	st->active = 1;
+
+	// Prime the FIFO, from here on the handler keeps it going
+	spi_irq_pump();
+	dma_set_flags32( spi_mem + SPI_CS, SPI_CS_INTR | SPI_CS_INTD );
+	spin_unlock_irqrestore( &st->lock, flags );
+
+	err = spi_irq_wait();
+	stats_add( STATS_BUS_SPI0, STATS_TRANSFERS, 1 );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, st->rx_count );
+	if ( err ) {
+		LOG( KERN_ERR, "SPI hardware timout on interrupt transfer." );
+		return err;
+	}
+
+	return st->rx_count;
+}
+
+static void spi_irq_init( void ) {
+	if ( spi_irq < 0 ) {
+		return;
+	}
+
+	spin_lock_init( &spi_irq_state.lock );
+	init_completion( &spi_irq_state.done );
+
+	if ( request_irq( spi_irq, spi_irq_handler, IRQF_SHARED, "spectr-io-spi", &spi_irq_state ) ) {
+		LOG( KERN_ERR, "SPI failed to request IRQ %d, interrupt transfers disabled.", spi_irq );
+		return;
+	}
+
+	spi_irq_state.ready = 1;
+}
+
+static void spi_irq_exit( void ) {
+	if ( !spi_irq_state.ready ) {
+		return;
+	}
+
+	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_INTD | SPI_CS_INTR );
+	free_irq( spi_irq, &spi_irq_state );
+	spi_irq_state.ready = 0;
+}
+
+static void spi_dma_start_chunk( void ) {
+	struct dmac_cb* const tx_cb = &spi_dma.cbs[0];
+	struct dmac_cb* const rx_cb = &spi_dma.cbs[1];
+
+	spi_dma.chunk = min_t( size_t, spi_dma.len - spi_dma.pos, SPI_DMA_BUF_SIZE );
+	if ( spi_dma.tx ) {
+		memcpy( spi_dma.tx_buf, spi_dma.tx + spi_dma.pos, spi_dma.chunk );
+	} else {
+		memset( spi_dma.tx_buf, 0x00, spi_dma.chunk );
+	}
+
+	// TX writes the bounce buffer into the FIFO, paced by the SPI TX DREQ
+	tx_cb->ti = DMAC_TI_DEST_DREQ | DMAC_TI_PERMAP( DMAC_PERMAP_SPI_TX ) | DMAC_TI_SRC_INC
+		| DMAC_TI_WAIT_RESP;
+	tx_cb->source_ad = spi_dma.tx_bus;
+	tx_cb->dest_ad = dmac_io_bus_addr( SPI_OFFSET + SPI_FIFO );
+	tx_cb->txfr_len = spi_dma.chunk;
+	tx_cb->stride = 0;
+	tx_cb->nextconbk = 0;
+
+	// RX reads the FIFO into the bounce buffer, paced by the SPI RX DREQ, and interrupts once the
+	// whole chunk has arrived
+	rx_cb->ti = DMAC_TI_SRC_DREQ | DMAC_TI_PERMAP( DMAC_PERMAP_SPI_RX ) | DMAC_TI_DEST_INC
+		| DMAC_TI_WAIT_RESP | DMAC_TI_INTEN;
+	rx_cb->source_ad = dmac_io_bus_addr( SPI_OFFSET + SPI_FIFO );
+	rx_cb->dest_ad = spi_dma.rx_bus;
+	rx_cb->txfr_len = spi_dma.chunk;
+	rx_cb->stride = 0;
+	rx_cb->nextconbk = 0;
+
+	dma_write32( spi_mem + SPI_DLEN, spi_dma.chunk );
+	dma_set_flags32( spi_mem + SPI_CS, SPI_CS_DMAEN );
+
+	// Start RX first so no received word is missed once TX starts clocking
+	dmac_start( spi_dma_rx_chan, spi_dma.cbs_bus + sizeof( struct dmac_cb ) );
+	dmac_start( spi_dma_tx_chan, spi_dma.cbs_bus );
+}
+
+static void spi_dma_stop( void ) {
+	dmac_reset( spi_dma_tx_chan );
+	dmac_reset( spi_dma_rx_chan );
+	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_DMAEN );
+}
+
+static irqreturn_t spi_dma_irq_handler( int irq, void* dev ) {
+	spi_complete_fn callback;
+	void* ctx;
+	int err = 0;
+
+	const int status = dmac_ack_irq( spi_dma_rx_chan );
+	if ( !status ) {
+		return IRQ_NONE;
+	}
+
+	const u64 start = ktime_get_ns();
+	spin_lock( &spi_dma.lock );
+	if ( !spi_dma.active ) {
+		// The transfer was aborted before the interrupt was handled
+		spin_unlock( &spi_dma.lock );
+		return IRQ_HANDLED;
+	}
+
+	if ( status & DMAC_IRQ_ERROR ) {
+		err = SPI_ERR_DMA_FAIL;
+		goto spi_dma_finish;
+	}
+
+	if ( spi_dma.rx ) {
+		memcpy( spi_dma.rx + spi_dma.pos, spi_dma.rx_buf, spi_dma.chunk );
+	}
+	spi_dma.pos += spi_dma.chunk;
+
+	// Chain the next chunk straight from the interrupt so the bus only idles for the refill
+	if ( spi_dma.pos < spi_dma.len ) {
+		spi_dma_start_chunk();
+		spin_unlock( &spi_dma.lock );
+		stats_add( STATS_BUS_SPI0, STATS_CPU_NS, ktime_get_ns() - start );
+		return IRQ_HANDLED;
+	}
+
+spi_dma_finish:
+	spi_dma_stop();
+	spi_dma.active = 0;
+	callback = spi_dma.complete;
+	ctx = spi_dma.ctx;
+	spin_unlock( &spi_dma.lock );
+
+	// The callback belongs to the caller, only the copying and chaining count as the driver's time
+	stats_add( STATS_BUS_SPI0, STATS_CPU_NS, ktime_get_ns() - start );
+	callback( ctx, err );
+
+	return IRQ_HANDLED;
+}
+
+static void spi_dma_abort( void ) {
+	spi_complete_fn callback;
+	void* ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave( &spi_dma.lock, flags );
+	if ( !spi_dma.active ) {
+		spin_unlock_irqrestore( &spi_dma.lock, flags );
+		return;
+	}
+
+	spi_dma_stop();
+	spi_dma.active = 0;
+	callback = spi_dma.complete;
+	ctx = spi_dma.ctx;
+	spin_unlock_irqrestore( &spi_dma.lock, flags );
+
+	callback( ctx, SPI_ERR_HW_TIMEOUT );
+}
+
+static void spi_dma_complete_sync( void* ctx, int err ) {
+	struct spi_dma_sync* const sync = ctx;
+
+	sync->err = err;
+	sync->done_time = ktime_get_ns();
+	complete( &sync->done );
+}
+
+static ssize_t spi_transfer_dma( const u8* tx, u8* rx, size_t len ) {
+	struct spi_dma_sync sync;
+	int err;
+
+	init_completion( &sync.done );
+	sync.err = 0;
+
+	err = spi_transfer_async( tx, rx, len, spi_dma_complete_sync, &sync );
+	if ( err ) {
+		return err;
+	}
+
+	if ( !wait_for_completion_timeout( &sync.done, msecs_to_jiffies( spi_hw_timeout ) ) ) {
+		LOG( KERN_ERR, "SPI hardware timout on DMA transfer." );
+		stats_add( STATS_BUS_SPI0, STATS_TIMEOUTS, 1 );
+		// Aborting reports the timeout through the completion unless the transfer just finished
+		spi_dma_abort();
+		wait_for_completion( &sync.done );
+	} else {
+		spi_wake_stats( sync.done_time );
+	}
+
+	return sync.err ? sync.err : ( ssize_t ) len;
+}
+
+static void spi_dma_init( void ) {
+	if ( spi_dma_irq < 0 ) {
+		return;
+	}
+	if ( spi_dma_tx_chan < 0 || spi_dma_tx_chan >= DMAC_CHANNELS
+	  || spi_dma_rx_chan < 0 || spi_dma_rx_chan >= DMAC_CHANNELS
+	  || spi_dma_tx_chan == spi_dma_rx_chan ) {
+		LOG( KERN_ERR, "SPI invalid DMA channels, DMA transfers disabled." );
+		return;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "SPI allocating DMA control blocks and bounce buffers." );
+#endif // DEBUG
+	spin_lock_init( &spi_dma.lock );
+	spi_dma.cbs = dmac_alloc( 2 * sizeof( struct dmac_cb ), &spi_dma.cbs_bus );
+	spi_dma.tx_buf = dmac_alloc( SPI_DMA_BUF_SIZE, &spi_dma.tx_bus );
+	spi_dma.rx_buf = dmac_alloc( SPI_DMA_BUF_SIZE, &spi_dma.rx_bus );
+	if ( !spi_dma.cbs || !spi_dma.tx_buf || !spi_dma.rx_buf ) {
+		LOG( KERN_ERR, "SPI failed to allocate DMA memory, DMA transfers disabled." );
+		goto spi_dma_init_err;
+	}
+
+	dmac_reset( spi_dma_tx_chan );
+	dmac_reset( spi_dma_rx_chan );
+
+	if ( request_irq( spi_dma_irq, spi_dma_irq_handler, IRQF_SHARED, "spectr-io-spi-dma", &spi_dma ) ) {
+		LOG( KERN_ERR, "SPI failed to request DMA IRQ %d, DMA transfers disabled.", spi_dma_irq );
+		goto spi_dma_init_err;
+	}
+
+	spi_dma.ready = 1;
+
+	return;
+
+spi_dma_init_err:
+	if ( spi_dma.cbs ) {
+		dmac_free( 2 * sizeof( struct dmac_cb ), spi_dma.cbs, spi_dma.cbs_bus );
+		spi_dma.cbs = ( struct dmac_cb* ) 0;
+	}
+	if ( spi_dma.tx_buf ) {
+		dmac_free( SPI_DMA_BUF_SIZE, spi_dma.tx_buf, spi_dma.tx_bus );
+		spi_dma.tx_buf = ( u8* ) 0;
+	}
+	if ( spi_dma.rx_buf ) {
+		dmac_free( SPI_DMA_BUF_SIZE, spi_dma.rx_buf, spi_dma.rx_bus );
+		spi_dma.rx_buf = ( u8* ) 0;
+	}
+}
+
+static void spi_dma_exit( void ) {
+	if ( !spi_dma.ready ) {
+		return;
+	}
+
+	spi_dma_abort();
+	free_irq( spi_dma_irq, &spi_dma );
+	spi_dma.ready = 0;
+
+	dmac_free( 2 * sizeof( struct dmac_cb ), spi_dma.cbs, spi_dma.cbs_bus );
+	dmac_free( SPI_DMA_BUF_SIZE, spi_dma.tx_buf, spi_dma.tx_bus );
+	dmac_free( SPI_DMA_BUF_SIZE, spi_dma.rx_buf, spi_dma.rx_bus );
+	spi_dma.cbs = ( struct dmac_cb* ) 0;
+	spi_dma.tx_buf = ( u8* ) 0;
+	spi_dma.rx_buf = ( u8* ) 0;
 }
 
 int __init spi_init( void ) {
+	int err;
+
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI setting GPIO modes for pins 7-11 to ALT0." );
 #endif // DEBUG
-	gpio_set_pin_mode(  7, GPIO_PIN_MODE_ALT0 );
-	gpio_set_pin_mode(  8, GPIO_PIN_MODE_ALT0 );
-	gpio_set_pin_mode(  9, GPIO_PIN_MODE_ALT0 );
-	gpio_set_pin_mode( 10, GPIO_PIN_MODE_ALT0 );
-	gpio_set_pin_mode( 11, GPIO_PIN_MODE_ALT0 );
+	err = gpio_configure_pins( "spi0", spi_pins_alt0, ARRAY_SIZE( spi_pins_alt0 ) );
+	if ( err ) {
+		return err;
+	}
 
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI mapping IO memory into kernel virtual address space." );
 #endif // DEBUG
-	spi_mem = ( u8* ) ioremap( BCM2836_IO_MEM_START + SPI_OFFSET, SPI_SIZE );
+	spi_mem = ( u8* ) dma_ioremap( BCM2836_IO_MEM_START + SPI_OFFSET, SPI_SIZE );
 	if ( !spi_mem ) {
 		LOG( KERN_ERR, "SPI failed to map IO memory." );
+		gpio_release_pins( "spi0", spi_pins_input, ARRAY_SIZE( spi_pins_input ) );
 		return SPI_ERR_IO_MAP_FAIL;
 	}
 
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI clearing CS register." );
 #endif // DEBUG
-	dma_write32( spi_mem + SPI_CS,  0x00000000 );
+	spi_cs = 0x00000000;
+	dma_write32( spi_mem + SPI_CS,  spi_cs );
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI reseting CLK register." );
 #endif // DEBUG
-	dma_write32( spi_mem + SPI_CLK, 0x00000000 );
+	spi_clk = 0x00000000;
+	dma_write32( spi_mem + SPI_CLK, spi_clk );
+
+	spi_irq_init();
+	spi_dma_init();
 
 	return 0;
 }
 
-void __exit spi_exit( void ) {
+void spi_exit( void ) {
+	spi_dma_exit();
+	spi_irq_exit();
+
 	if ( spi_mem ) {
 #if defined( DEBUG )
 		LOG( KERN_DEBUG, "SPI unmapping IO memory from kernel virtual address space." );
 #endif // DEBUG
-		iounmap( spi_mem );
+		dma_iounmap( spi_mem );
 		spi_mem = ( u8* ) 0;
 	}
 
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI setting GPIO modes for pins 7-11 to INPUT." );
 #endif // DEBUG
-	gpio_set_pin_mode(  7, GPIO_PIN_MODE_INPUT );
-	gpio_set_pin_mode(  8, GPIO_PIN_MODE_INPUT );
-	gpio_set_pin_mode(  9, GPIO_PIN_MODE_INPUT );
-	gpio_set_pin_mode( 10, GPIO_PIN_MODE_INPUT );
-	gpio_set_pin_mode( 11, GPIO_PIN_MODE_INPUT );
+	gpio_release_pins( "spi0", spi_pins_input, ARRAY_SIZE( spi_pins_input ) );
+}
+
+static inline u32 spi_cs_mode_bits( u8 mode ) {
+	return ( ( mode & SPI_MODE1 ) ? SPI_CS_CPHA : 0 ) | ( ( mode & SPI_MODE2 ) ? SPI_CS_CPOL : 0 );
+}
+
+static void spi_update_cs( u32 mask, u32 bits ) {
+	const u32 cs = ( spi_cs & ~mask ) | ( bits & mask );
+	if ( cs != spi_cs ) {
+		spi_cs = cs;
+		dma_write32( spi_mem + SPI_CS, cs );
+	}
+}
+
+static void spi_update_clk( u32 clk ) {
+	if ( clk != spi_clk ) {
+		spi_clk = clk;
+		dma_write32( spi_mem + SPI_CLK, clk );
+	}
+}
+
+static u32 spi_device_cspol_lines( void ) {
+	u32 lines = 0;
+	unsigned int i;
+
+	// The per-line polarities hold for every device, so the idle lines never glitch active
+	for ( i = 0; i < SPI_DEVICES; i++ ) {
+		if ( spi_devices[i].used && spi_devices[i].cs_high ) {
+			lines |= SPI_CS_CSPOL0 << spi_devices[i].chip;
+		}
+	}
+
+	return lines;
 }
 
 void spi_set_clk_div( u16 div ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI setting clock divider to 0x%04X.", div );
 #endif // DEBUG
-	dma_write16( spi_mem + SPI_CLK, div );
+	spi_update_clk( div );
 }
 
 void spi_select_chip( u8 chip ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI setting chip select to 0x%02X.", chip );
 #endif // DEBUG
-	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_CS_MASK );
-	dma_set_flags32( spi_mem + SPI_CS, chip & SPI_CS_CS_MASK );
+	spi_update_cs( SPI_CS_CS_MASK, chip );
 }
 
 void spi_set_mode( u8 mode ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI setting mode to 0x%02X.", mode );
 #endif // DEBUG
-	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_MODE_MASK );
-	dma_set_flags32( spi_mem + SPI_CS, mode & SPI_CS_MODE_MASK );
+	spi_update_cs( SPI_CS_MODE_MASK, spi_cs_mode_bits( mode ) );
 }
 
 void spi_enable_reads( void ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI enabling bus reads." );
 #endif // DEBUG
-	dma_set_flags32( spi_mem + SPI_CS, SPI_CS_REN );
+	spi_update_cs( SPI_CS_REN, SPI_CS_REN );
 }
 
 void spi_disable_reads( void ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI disabling bus reads." );
 #endif // DEBUG
-	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_REN );
+	spi_update_cs( SPI_CS_REN, 0 );
+}
+
+int spi_register_device( const struct spi_device_profile* profile ) {
+	int dev;
+
+	// The chip also picks the CSPOLn bit, past CS2 that would set DMA_LEN and the bits above it
+	if ( profile->chip > SPI_CHIP2 ) {
+		return SPI_ERR_BAD_CHIP;
+	}
+
+	mutex_lock( &spi_devices_mutex );
+	for ( dev = 0; dev < SPI_DEVICES; dev++ ) {
+		struct spi_device* const device = &spi_devices[dev];
+		if ( device->used ) {
+			continue;
+		}
+
+		device->chip = profile->chip;
+		device->cs_high = profile->cs_high ? 1 : 0;
+		device->cs = device->chip | spi_cs_mode_bits( profile->mode )
+			| ( device->cs_high ? SPI_CS_CSPOL : 0 ) | ( profile->reads ? SPI_CS_REN : 0 );
+		device->clk = profile->clk_div;
+		device->used = 1;
+		break;
+	}
+	mutex_unlock( &spi_devices_mutex );
+
+	return dev < SPI_DEVICES ? dev : SPI_ERR_NO_DEVICE;
+}
+
+void spi_unregister_device( int dev ) {
+	if ( dev < 0 || dev >= SPI_DEVICES ) {
+		return;
+	}
+
+	mutex_lock( &spi_devices_mutex );
+	spi_devices[dev].used = 0;
+	mutex_unlock( &spi_devices_mutex );
+}
+
+int spi_use_device( int dev ) {
+	u32 cs;
+	u32 clk;
+
+	// The shadows belong to whoever holds the bus, the device table to its own lock
+	lockdep_assert_held( &spi_bus_mutex );
+
+	if ( dev < 0 || dev >= SPI_DEVICES ) {
+		return SPI_ERR_NO_DEVICE;
+	}
+
+	mutex_lock( &spi_devices_mutex );
+	if ( !spi_devices[dev].used ) {
+		mutex_unlock( &spi_devices_mutex );
+		return SPI_ERR_NO_DEVICE;
+	}
+	cs = spi_devices[dev].cs | spi_device_cspol_lines();
+	clk = spi_devices[dev].clk;
+	mutex_unlock( &spi_devices_mutex );
+
+	spi_update_cs( SPI_CS_PROFILE_MASK | SPI_CS_CSPOL_MASK, cs );
+	spi_update_clk( clk );
+
+	return 0;
 }
 
 void spi_begin_transfer( void ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI beginning transfer." );
 #endif // DEBUG
-	dma_set_flags32( spi_mem + SPI_CS, SPI_CS_CLEAR_TX | SPI_CS_CLEAR_RX | SPI_CS_TA );
+	spi_cs |= SPI_CS_TA;
+	dma_write32( spi_mem + SPI_CS, spi_cs | SPI_CS_CLEAR_TX | SPI_CS_CLEAR_RX );
 }
 
 int spi_read_byte( u8* byte ) {
+	struct io_trace_phases phases;
 	int err;
 
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "SPI reading byte from bus." );
-#endif // DEBUG
-	err = spi_await_cs_flags_with_timeout( SPI_CS_RXD );
+	io_trace_begin( &phases, io_trace_now() );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_READ, 1 );
+	err = spi_await_cs_flags_with_timeout( SPI_CS_RXD, 1 );
 	if ( err ) {
 		goto spi_read_err;
 	}
 
 	*byte = dma_read8( spi_mem + SPI_FIFO );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, 1 );
+	io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_READ, 1, &phases );
 
 	return 0;
 
 spi_read_err:
+	trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_READ, err );
 	switch ( err ) {
 	case SPI_ERR_HW_TIMEOUT:
 		LOG( KERN_ERR, "SPI hardware timout on RXD." );
@@ -179,24 +808,42 @@ spi_read_err:
 }
 
 size_t spi_read( ssize_t len, u8* data ) {
+	const u64 begin = stats_begin();
+	struct io_trace_phases phases;
+	u64 polls = 0;
 	int err;
 
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "SPI reading %d bytes from bus.", len );
-#endif // DEBUG
+	io_trace_begin( &phases, begin );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_READ, len );
+	io_trace_mark( &phases.setup );
 	size_t i = 0;
-	for ( ; i < len; i++ ) {
-		err = spi_await_cs_flags_with_timeout( SPI_CS_RXD );
-		if ( err ) {
-			goto spi_read_err;
+	while ( i < len ) {
+		// Read as many bytes as the FIFO level flags promise per status read
+		size_t count = spi_fifo_rx_level( dma_read32_relaxed( spi_mem + SPI_CS ) );
+		polls++;
+		if ( !count ) {
+			err = spi_await_cs_flags_with_timeout( SPI_CS_RXD, 1 );
+			if ( err ) {
+				goto spi_read_err;
+			}
+			continue;
 		}
 
-		data[i] = dma_read8( spi_mem + SPI_FIFO );
+		for ( count = min( count, len - i ); count; count-- ) {
+			data[i++] = dma_read8_relaxed( spi_mem + SPI_FIFO );
+		}
+		dma_read_fence();
+		io_trace_mark( &phases.first );
 	}
+	io_trace_mark( &phases.last );
 
+	spi_pio_stats( STATS_OP_SPI_READ, begin, i, polls );
+	io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_READ, i, &phases );
 	return i;
 
 spi_read_err:
+	spi_pio_stats( STATS_OP_SPI_READ, begin, i, polls );
+	trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_READ, err );
 	switch ( err ) {
 	case SPI_ERR_HW_TIMEOUT:
 		LOG( KERN_ERR, "SPI hardware timout on RXD." );
@@ -206,21 +853,24 @@ spi_read_err:
 }
 
 int spi_write_byte( u8 byte ) {
+	struct io_trace_phases phases;
 	int err;
 
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "SPI writing byte 0x%02X to bus.", byte );
-#endif // DEBUG
-	err = spi_await_cs_flags_with_timeout( SPI_CS_TXD );
+	io_trace_begin( &phases, io_trace_now() );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, 1 );
+	err = spi_await_cs_flags_with_timeout( SPI_CS_TXD, 1 );
 	if ( err ) {
 		goto spi_write_err;
 	}
 
 	dma_write8( spi_mem + SPI_FIFO, byte );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, 1 );
+	io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, 1, &phases );
 
 	return 0;
 
 spi_write_err:
+	trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, err );
 	switch ( err ) {
 	case SPI_ERR_HW_TIMEOUT:
 		LOG( KERN_ERR, "SPI hardware timout on TXD." );
@@ -230,24 +880,43 @@ spi_write_err:
 }
 
 size_t spi_write( ssize_t len, const u8* data ) {
+	const u64 begin = stats_begin();
+	struct io_trace_phases phases;
+	u64 polls = 0;
 	int err;
 
-#if defined( DEBUG )
-	LOG( KERN_DEBUG, "SPI writing %d bytes to bus.", len );
-#endif // DEBUG
+	io_trace_begin( &phases, begin );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, len );
+	io_trace_mark( &phases.setup );
 	size_t i = 0;
-	for ( ; i < len; i++ ) {
-		err = spi_await_cs_flags_with_timeout( SPI_CS_TXD );
-		if ( err ) {
-			goto spi_write_err;
+	while ( i < len ) {
+		// DONE means the TX FIFO has drained completely, otherwise TXD only promises one byte
+		const u32 cs = dma_read32_relaxed( spi_mem + SPI_CS );
+		polls++;
+		size_t count = ( cs & SPI_CS_DONE ) ? SPI_FIFO_SIZE : ( cs & SPI_CS_TXD ) ? 1 : 0;
+		if ( !count ) {
+			err = spi_await_cs_flags_with_timeout( SPI_CS_TXD, 1 );
+			if ( err ) {
+				goto spi_write_err;
+			}
+			continue;
 		}
 
-		dma_write8( spi_mem + SPI_FIFO, data[i] );
+		dma_write_fence();
+		for ( count = min( count, len - i ); count; count-- ) {
+			dma_write8_relaxed( spi_mem + SPI_FIFO, data[i++] );
+		}
+		io_trace_mark( &phases.first );
 	}
+	io_trace_mark( &phases.last );
 
+	spi_pio_stats( STATS_OP_SPI_WRITE, begin, i, polls );
+	io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, i, &phases );
 	return i;
 
 spi_write_err:
+	spi_pio_stats( STATS_OP_SPI_WRITE, begin, i, polls );
+	trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_WRITE, err );
 	switch ( err ) {
 	case SPI_ERR_HW_TIMEOUT:
 		LOG( KERN_ERR, "SPI hardware timout on TXD." );
@@ -256,20 +925,155 @@ spi_write_err:
 	return SPI_ERR_HW_TIMEOUT;
 }
 
-int spi_await_transfer( void ) {
-	int err;
+static inline void spi_pio_wait_begin( struct io_wait* wait, size_t in_flight ) {
+	// Wake up once half of the bytes in flight are due, so the TX FIFO is refilled before the
+	// bus runs dry. Synchronous transfers run under the bus mutex and may sleep
+	io_wait_begin( wait, io_wait_spi_ns( DIV_ROUND_UP( in_flight, 2 ), spi_clk ), spi_hw_timeout, 1 );
+}
+
+static ssize_t spi_transfer_pio( const u8* tx, u8* rx, size_t len, struct io_trace_phases* phases ) {
+	size_t tx_count = 0;
+	size_t rx_count = 0;
+	struct io_wait wait;
+	u64 polls = 0;
+
+	io_trace_mark( &phases->setup );
+	spi_pio_wait_begin( &wait, min_t( size_t, len, SPI_FIFO_SIZE ) );
+	while ( rx_count < len ) {
+		// Drain the RX FIFO and refill the TX FIFO, never putting more bytes in flight than the
+		// RX FIFO can hold or the bus will stall
+		const size_t received = spi_fifo_burst( tx, rx, len, &tx_count, &rx_count );
+		polls++;
+
+		// The timeout is for the bus making no progress, not for the whole transfer
+		if ( received ) {
+			io_trace_mark( &phases->first );
+			spi_pio_wait_begin( &wait, tx_count - rx_count );
+		} else if ( io_wait_poll( &wait ) ) {
+			LOG( KERN_ERR, "SPI hardware timout on transfer." );
+			stats_add( STATS_BUS_SPI0, STATS_TIMEOUTS, 1 );
+			break;
+		}
+	}
+	if ( rx_count == len ) {
+		io_trace_mark( &phases->last );
+	}
+
+	stats_add( STATS_BUS_SPI0, STATS_TRANSFERS, 1 );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, rx_count );
+	stats_add( STATS_BUS_SPI0, STATS_POLLS, polls );
+
+	return rx_count < len ? SPI_ERR_HW_TIMEOUT : ( ssize_t ) rx_count;
+}
+
+ssize_t spi_transfer( const u8* tx, u8* rx, size_t len ) {
+	const u64 begin = stats_begin();
+	struct io_trace_phases phases;
+	ssize_t ret;
+	int pio = 0;
+
+	io_trace_begin( &phases, begin );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_TRANSFER, len );
+
+	// Long transfers go through DMA to free the CPU, short ones are cheaper to move by hand.
+	// Medium transfers sleep while the interrupt handler keeps the FIFO going, very short ones
+	// finish sooner than the wake-up would take
+	if ( spi_dma.ready && len >= spi_dma_threshold ) {
+		ret = spi_transfer_dma( tx, rx, len );
+	} else if ( spi_irq_state.ready && len >= spi_irq_threshold ) {
+		ret = spi_transfer_irq( tx, rx, len );
+	} else {
+		ret = spi_transfer_pio( tx, rx, len, &phases );
+		pio = 1;
+	}
+
+	// Polling keeps the CPU busy for the whole transfer, the other modes count their handlers
+	const u64 ns = stats_end( STATS_BUS_SPI0, STATS_OP_SPI_TRANSFER, begin );
+	if ( pio ) {
+		stats_add( STATS_BUS_SPI0, STATS_CPU_NS, ns );
+	}
+	if ( ret < 0 ) {
+		trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_TRANSFER, ret );
+	} else {
+		io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_TRANSFER, ret, &phases );
+	}
+	return ret;
+}
+
+int spi_transfer_async( const u8* tx, u8* rx, size_t len, spi_complete_fn complete, void* ctx ) {
+	unsigned long flags;
+
+	if ( !spi_dma.ready ) {
+		return SPI_ERR_DMA_FAIL;
+	}
+
+	spin_lock_irqsave( &spi_dma.lock, flags );
+	if ( spi_dma.active ) {
+		spin_unlock_irqrestore( &spi_dma.lock, flags );
+		return SPI_ERR_BUSY;
+	}
 
 #if defined( DEBUG )
-	LOG( KERN_DEBUG, "SPI current thread synchronizing with SPI bus." );
+	LOG( KERN_DEBUG, "SPI starting asynchronous DMA transfer of %d bytes.", len );
 #endif // DEBUG
-	err = spi_await_cs_flags_with_timeout( SPI_CS_DONE );
+	spi_dma.tx = tx;
+	spi_dma.rx = rx;
+	spi_dma.len = len;
+	spi_dma.pos = 0;
+	spi_dma.complete = complete;
+	spi_dma.ctx = ctx;
+	spi_dma.active = 1;
+	spi_dma_start_chunk();
+	spin_unlock_irqrestore( &spi_dma.lock, flags );
+
+	stats_add( STATS_BUS_SPI0, STATS_TRANSFERS, 1 );
+	stats_add( STATS_BUS_SPI0, STATS_BYTES, len );
+
+	return 0;
+}
+
+int spi_await_transfer( void ) {
+	const u64 begin = stats_begin();
+	struct io_trace_phases phases;
+	int err;
+
+	io_trace_begin( &phases, begin );
+	trace_spectr_io_xfer_start( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, 0 );
+	if ( spi_irq_state.ready ) {
+		struct spi_irq_state* const st = &spi_irq_state;
+		unsigned long flags;
+
+		spin_lock_irqsave( &st->lock, flags );
+		if ( dma_get_flags32( spi_mem + SPI_CS, SPI_CS_DONE ) ) {
+			spin_unlock_irqrestore( &st->lock, flags );
+			stats_end( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, begin );
+			io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, 0, &phases );
+			return 0;
+		}
+
+		// Sleep until the DONE interrupt instead of spinning on the flag
+		st->len = 0;
+		st->await_done = 1;
+		reinit_completion( &st->done );
+		st->active = 1;
+		dma_set_flags32( spi_mem + SPI_CS, SPI_CS_INTD );
+		spin_unlock_irqrestore( &st->lock, flags );
+
+		err = spi_irq_wait();
+	} else {
+		err = spi_await_cs_flags_with_timeout( SPI_CS_DONE, SPI_FIFO_SIZE );
+		stats_add( STATS_BUS_SPI0, STATS_CPU_NS, ktime_get_ns() - begin );
+	}
+	stats_end( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, begin );
 	if ( err ) {
 		goto spi_done_err;
 	}
 
+	io_trace_done( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, 0, &phases );
 	return 0;
 
 spi_done_err:
+	trace_spectr_io_xfer_error( STATS_BUS_SPI0, STATS_OP_SPI_AWAIT, err );
 	switch ( err ) {
 	case SPI_ERR_HW_TIMEOUT:
 		LOG( KERN_ERR, "SPI hardware timout on DONE." );
@@ -282,20 +1086,37 @@ void spi_end_transfer( void ) {
 #if defined( DEBUG )
 	LOG( KERN_DEBUG, "SPI ending transfer." );
 #endif // DEBUG
-	dma_clr_flags32( spi_mem + SPI_CS, SPI_CS_TA );
+	spi_update_cs( SPI_CS_TA, 0 );
+}
+
+void spi_lock_bus( void ) {
+	mutex_lock( &spi_bus_mutex );
+}
+
+void spi_unlock_bus( void ) {
+	mutex_unlock( &spi_bus_mutex );
 }
 
 EXPORT_SYMBOL( spi_hw_timeout );
+EXPORT_SYMBOL( spi_dma_threshold );
+EXPORT_SYMBOL( spi_irq_threshold );
 EXPORT_SYMBOL( spi_set_clk_div );
 EXPORT_SYMBOL( spi_select_chip );
 EXPORT_SYMBOL( spi_set_mode );
 EXPORT_SYMBOL( spi_enable_reads );
 EXPORT_SYMBOL( spi_disable_reads );
+EXPORT_SYMBOL( spi_register_device );
+EXPORT_SYMBOL( spi_unregister_device );
+EXPORT_SYMBOL( spi_use_device );
 EXPORT_SYMBOL( spi_begin_transfer );
 EXPORT_SYMBOL( spi_read_byte );
 EXPORT_SYMBOL( spi_read );
 EXPORT_SYMBOL( spi_write_byte );
 EXPORT_SYMBOL( spi_write );
+EXPORT_SYMBOL( spi_transfer );
+EXPORT_SYMBOL( spi_transfer_async );
 EXPORT_SYMBOL( spi_await_transfer );
 EXPORT_SYMBOL( spi_end_transfer );
+EXPORT_SYMBOL( spi_lock_bus );
+EXPORT_SYMBOL( spi_unlock_bus );
 
@@ -6,9 +6,18 @@
 
 #define SPI_ERR_IO_MAP_FAIL	-1
 #define SPI_ERR_HW_TIMEOUT	-2
+#define SPI_ERR_BUSY		-3
+#define SPI_ERR_DMA_FAIL	-4
+#define SPI_ERR_CANCELED	-5
+#define SPI_ERR_NO_DEVICE	-6
+#define SPI_ERR_BAD_CHIP	-7
+
+// The max number of device profiles registered at the same time.
+#define SPI_DEVICES	8
 
 #define SPI_CHIP0	0x00
 #define SPI_CHIP1	0x01
+#define SPI_CHIP2	0x02
 
 // CLK rest low, CLK transition at middle of data bit
 #define SPI_MODE0	0x00
@@ -19,9 +28,33 @@
 // CLK rest high, CLK transition at beginning of data bit
 #define SPI_MODE3	0x11
 
+// The bus settings of a device, registered once and switched to with spi_use_device().
+struct spi_device_profile {
+	u8 chip;		// The SPI_CHIP* chip select line.
+	u8 mode;		// The SPI_MODE* clock phase and polarity.
+	u8 cs_high;		// Whether the chip select line is active high.
+	u8 reads;		// Whether reads are enabled, see spi_enable_reads().
+	u16 clk_div;		// The system clock divider.
+};
+
 // The timeout for the SPI hardware in milliseconds.
 extern unsigned int spi_hw_timeout;
 
+// The minimum length in bytes of a transfer for it to be done with DMA instead of PIO.
+extern unsigned int spi_dma_threshold;
+
+// The minimum length in bytes of a PIO transfer for it to sleep on interrupts instead of polling.
+extern unsigned int spi_irq_threshold;
+
+/**
+ * Called when an asynchronous SPI transfer finishes, from interrupt context.
+ *
+ * @param ctx The context given when the transfer was started.
+ * @param err Zero on success; a negative error code on failure.
+ *
+ */
+typedef void ( *spi_complete_fn )( void* ctx, int err );
+
 /**
  * Initializes the SPI subsystem.
  * 
@@ -34,7 +67,7 @@ int __init spi_init( void );
  * Destorys the SPI subsystem.
  * 
  */
-void __exit spi_exit( void );
+void spi_exit( void );
 
 /**
  * Sets the system clock divider the SPI bus will use.
@@ -72,6 +105,39 @@ void spi_enable_reads( void );
  */
 void spi_disable_reads( void );
 
+/**
+ * Registers the bus settings of a device.
+ *
+ * @param profile The settings, copied.
+ *
+ * @returns The device handle; SPI_ERR_BAD_CHIP if the chip is not one of SPI_CHIP*;
+ * SPI_ERR_NO_DEVICE if all SPI_DEVICES are registered.
+ *
+ */
+int spi_register_device( const struct spi_device_profile* profile );
+
+/**
+ * Unregisters a device registered with spi_register_device().
+ *
+ * @param dev The device handle.
+ *
+ */
+void spi_unregister_device( int dev );
+
+/**
+ * Switches the SPI bus to the settings of a device.
+ *
+ * The driver keeps a copy of the CS and CLK registers, so only the registers whose value changes
+ * are written and none are read. Must be called outside of a transfer, with the bus held through
+ * spi_lock_bus().
+ *
+ * @param dev The device handle.
+ *
+ * @returns Zero on success; SPI_ERR_NO_DEVICE if the device is not registered.
+ *
+ */
+int spi_use_device( int dev );
+
 /**
  * Begins an SPI bus data transfer.
  * 
@@ -112,6 +178,40 @@ int spi_write_byte( u8 byte );
  */
 size_t spi_write( ssize_t len, const u8* data );
 
+/**
+ * Transfers data on the SPI bus in full-duplex.
+ *
+ * The TX FIFO is kept filled while the RX FIFO is drained so the bus does not idle between
+ * bytes. Transfers of at least spi_dma_threshold bytes are done with DMA when it is available,
+ * transfers of at least spi_irq_threshold bytes are driven by interrupts when they are available.
+ * Must be called between spi_begin_transfer() and spi_end_transfer().
+ *
+ * @param tx The data buffer to write from, or NULL to write zeros.
+ * @param rx The data buffer to read to, or NULL to discard the read data.
+ * @param len The number of bytes to transfer.
+ *
+ * @returns The number of bytes transferred; a negative error code on failure.
+ *
+ */
+ssize_t spi_transfer( const u8* tx, u8* rx, size_t len );
+
+/**
+ * Starts a full-duplex DMA transfer on the SPI bus and returns without waiting for it.
+ *
+ * Must be called between spi_begin_transfer() and spi_end_transfer(), and the buffers must stay
+ * valid until the completion callback runs.
+ *
+ * @param tx The data buffer to write from, or NULL to write zeros.
+ * @param rx The data buffer to read to, or NULL to discard the read data.
+ * @param len The number of bytes to transfer.
+ * @param complete The function called when the transfer finishes.
+ * @param ctx The context passed to the completion function.
+ *
+ * @returns Zero if the transfer was started; a negative error code on failure.
+ *
+ */
+int spi_transfer_async( const u8* tx, u8* rx, size_t len, spi_complete_fn complete, void* ctx );
+
 /**
  * Synchronizes the program with the SPI bus.
  *
@@ -124,5 +224,19 @@ int spi_await_transfer( void );
  */
 void spi_end_transfer( void );
 
+/**
+ * Takes exclusive use of the SPI bus, sleeping until it is free.
+ *
+ * Direct transfers only need the lock when the transfer queue may be in use at the same time.
+ *
+ */
+void spi_lock_bus( void );
+
+/**
+ * Releases the SPI bus taken with spi_lock_bus().
+ *
+ */
+void spi_unlock_bus( void );
+
 #endif // _SPECTR_IO_SPI_H
 
@@ -0,0 +1,436 @@
+#include "spi_aux.h"
+
+#include <asm/io.h>
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+
+#include <dma.h>
+#include <log.h>
+
+#include "gpio.h"
+#include "io_trace.h"
+#include "io_wait.h"
+#include "spi.h"
+#include "stats.h"
+
+#define AUX_OFFSET	0x00215000
+#define AUX_SIZE	0x100
+
+#define AUX_ENABLES	0x04
+#define AUX_SPI1	0x80
+#define AUX_SPI2	0xC0
+
+#define AUX_ENABLES_SPI1	BIT( 1 )
+#define AUX_ENABLES_SPI2	BIT( 2 )
+
+#define SPI_AUX_CNTL0	0x00
+#define SPI_AUX_CNTL1	0x04
+#define SPI_AUX_STAT	0x08
+#define SPI_AUX_PEEK	0x0C
+#define SPI_AUX_IO	0x20	// Writes end the transfer with the chip released behind them.
+#define SPI_AUX_TXHOLD	0x30	// Writes keep the chip selected behind them.
+
+#define SPI_AUX_CNTL0_MSB_OUT	BIT(  6 )
+#define SPI_AUX_CNTL0_CPOL	BIT(  7 )
+#define SPI_AUX_CNTL0_OUT_RISING	BIT(  8 )
+#define SPI_AUX_CNTL0_CLEAR_FIFO	BIT(  9 )
+#define SPI_AUX_CNTL0_IN_RISING	BIT( 10 )
+#define SPI_AUX_CNTL0_ENABLE	BIT( 11 )
+#define SPI_AUX_CNTL0_VAR_WIDTH	BIT( 14 )
+
+#define SPI_AUX_CNTL0_CS_OFF	17
+#define SPI_AUX_CNTL0_CS_MASK	( 0x7 << SPI_AUX_CNTL0_CS_OFF )
+#define SPI_AUX_CNTL0_SPEED_OFF	20
+#define SPI_AUX_CNTL0_SPEED_MAX	0xFFF
+#define SPI_AUX_CNTL0_MODE_MASK	( SPI_AUX_CNTL0_CPOL | SPI_AUX_CNTL0_OUT_RISING | SPI_AUX_CNTL0_IN_RISING )
+
+#define SPI_AUX_CNTL1_MSB_IN	BIT(  1 )
+
+#define SPI_AUX_STAT_BUSY	BIT(  6 )
+#define SPI_AUX_STAT_RX_EMPTY	BIT(  7 )
+#define SPI_AUX_STAT_TX_FULL	BIT( 10 )
+
+// In variable width mode each FIFO entry carries its own bit count above the data
+#define SPI_AUX_FIFO_WIDTH_OFF	24
+#define SPI_AUX_FIFO_DEPTH	4
+#define SPI_AUX_WORD_BYTES	3
+
+// A mini SPI controller, each one is locked and driven independently of the others.
+struct spi_aux_ctrl {
+	const char* name;
+	unsigned long offset;
+	u32 enable_bit;
+	unsigned int stats_bus;
+	const struct gpio_pin_config* pins_alt4;
+	const struct gpio_pin_config* pins_input;
+	size_t pin_count;
+	const int* enable;
+
+	u8* mem;
+	u32 cntl0;		// The configuration written to CNTL0 at the start of every transfer.
+	struct mutex lock;	// Held for the whole of a transfer and around configuration changes.
+};
+
+static int spi1_enable = 0;
+module_param( spi1_enable, int, 0444 );
+MODULE_PARM_DESC( spi1_enable, "Drive the SPI1 mini SPI controller on GPIO 16-21" );
+
+static int spi2_enable = 0;
+module_param( spi2_enable, int, 0444 );
+MODULE_PARM_DESC( spi2_enable, "Drive the SPI2 mini SPI controller on GPIO 40-45" );
+
+static u8* aux_mem = ( u8* ) 0;
+
+static const struct gpio_pin_config spi1_pins_alt4[] = {
+	{ 16, GPIO_PIN_MODE_ALT4 },
+	{ 17, GPIO_PIN_MODE_ALT4 },
+	{ 18, GPIO_PIN_MODE_ALT4 },
+	{ 19, GPIO_PIN_MODE_ALT4 },
+	{ 20, GPIO_PIN_MODE_ALT4 },
+	{ 21, GPIO_PIN_MODE_ALT4 },
+};
+
+static const struct gpio_pin_config spi1_pins_input[] = {
+	{ 16, GPIO_PIN_MODE_INPUT },
+	{ 17, GPIO_PIN_MODE_INPUT },
+	{ 18, GPIO_PIN_MODE_INPUT },
+	{ 19, GPIO_PIN_MODE_INPUT },
+	{ 20, GPIO_PIN_MODE_INPUT },
+	{ 21, GPIO_PIN_MODE_INPUT },
+};
+
+static const struct gpio_pin_config spi2_pins_alt4[] = {
+	{ 40, GPIO_PIN_MODE_ALT4 },
+	{ 41, GPIO_PIN_MODE_ALT4 },
+	{ 42, GPIO_PIN_MODE_ALT4 },
+	{ 43, GPIO_PIN_MODE_ALT4 },
+	{ 44, GPIO_PIN_MODE_ALT4 },
+	{ 45, GPIO_PIN_MODE_ALT4 },
+};
+
+static const struct gpio_pin_config spi2_pins_input[] = {
+	{ 40, GPIO_PIN_MODE_INPUT },
+	{ 41, GPIO_PIN_MODE_INPUT },
+	{ 42, GPIO_PIN_MODE_INPUT },
+	{ 43, GPIO_PIN_MODE_INPUT },
+	{ 44, GPIO_PIN_MODE_INPUT },
+	{ 45, GPIO_PIN_MODE_INPUT },
+};
+
+static struct spi_aux_ctrl spi_aux_ctrls[SPI_AUX_BUSES] = {
+	[SPI_AUX_BUS1] = {
+		.name = "spi1",
+		.offset = AUX_SPI1,
+		.enable_bit = AUX_ENABLES_SPI1,
+		.stats_bus = STATS_BUS_SPI1,
+		.pins_alt4 = spi1_pins_alt4,
+		.pins_input = spi1_pins_input,
+		.pin_count = ARRAY_SIZE( spi1_pins_alt4 ),
+		.enable = &spi1_enable,
+	},
+	[SPI_AUX_BUS2] = {
+		.name = "spi2",
+		.offset = AUX_SPI2,
+		.enable_bit = AUX_ENABLES_SPI2,
+		.stats_bus = STATS_BUS_SPI2,
+		.pins_alt4 = spi2_pins_alt4,
+		.pins_input = spi2_pins_input,
+		.pin_count = ARRAY_SIZE( spi2_pins_alt4 ),
+		.enable = &spi2_enable,
+	},
+};
+
+static struct spi_aux_ctrl* spi_aux_get_ctrl( unsigned int bus ) {
+	if ( bus >= SPI_AUX_BUSES || !spi_aux_ctrls[bus].mem ) {
+		return ( struct spi_aux_ctrl* ) 0;
+	}
+
+	return &spi_aux_ctrls[bus];
+}
+
+static inline u32 spi_aux_cs_bits( u8 chip ) {
+	// The chip select lines are active low, every line but the selected one stays high
+	return SPI_AUX_CNTL0_CS_MASK & ~BIT( SPI_AUX_CNTL0_CS_OFF + ( chip % 3 ) );
+}
+
+static inline u32 spi_aux_mode_bits( u8 mode ) {
+	u32 bits = ( mode & SPI_MODE2 ) ? SPI_AUX_CNTL0_CPOL : 0;
+
+	// The mini SPI has no phase setting, the edges data is shifted out and sampled on are picked
+	// to match the phase instead
+	if ( !( mode & SPI_MODE1 ) == !( mode & SPI_MODE2 ) ) {
+		bits |= SPI_AUX_CNTL0_IN_RISING;
+	} else {
+		bits |= SPI_AUX_CNTL0_OUT_RISING;
+	}
+
+	return bits;
+}
+
+static void spi_aux_update( struct spi_aux_ctrl* ctrl, u32 mask, u32 bits ) {
+	mutex_lock( &ctrl->lock );
+	ctrl->cntl0 = ( ctrl->cntl0 & ~mask ) | bits;
+	mutex_unlock( &ctrl->lock );
+}
+
+void spi_aux_set_clk_div( unsigned int bus, u16 div ) {
+	struct spi_aux_ctrl* const ctrl = spi_aux_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	// The bus runs at the system clock over 2 * (speed + 1), a zero divider is the slowest
+	const u32 speed = div ? min_t( u32, DIV_ROUND_UP( max_t( u32, div, 2 ), 2 ) - 1,
+		SPI_AUX_CNTL0_SPEED_MAX ) : SPI_AUX_CNTL0_SPEED_MAX;
+	spi_aux_update( ctrl, SPI_AUX_CNTL0_SPEED_MAX << SPI_AUX_CNTL0_SPEED_OFF,
+		speed << SPI_AUX_CNTL0_SPEED_OFF );
+}
+
+void spi_aux_select_chip( unsigned int bus, u8 chip ) {
+	struct spi_aux_ctrl* const ctrl = spi_aux_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	spi_aux_update( ctrl, SPI_AUX_CNTL0_CS_MASK, spi_aux_cs_bits( chip ) );
+}
+
+void spi_aux_set_mode( unsigned int bus, u8 mode ) {
+	struct spi_aux_ctrl* const ctrl = spi_aux_get_ctrl( bus );
+	if ( !ctrl ) {
+		return;
+	}
+
+	spi_aux_update( ctrl, SPI_AUX_CNTL0_MODE_MASK, spi_aux_mode_bits( mode ) );
+}
+
+static inline u32 spi_aux_pack( const u8* tx, size_t count ) {
+	u32 word = ( count * 8 ) << SPI_AUX_FIFO_WIDTH_OFF;
+	size_t i;
+
+	// Data is shifted out from bit 23 down, received data is shifted in from bit 0 up
+	for ( i = 0; i < count; i++ ) {
+		word |= ( tx ? tx[i] : 0x00 ) << ( 8 * ( SPI_AUX_WORD_BYTES - 1 - i ) );
+	}
+
+	return word;
+}
+
+static inline void spi_aux_unpack( u8* rx, u32 word, size_t count ) {
+	size_t i;
+
+	for ( i = 0; i < count; i++ ) {
+		rx[i] = ( word >> ( 8 * ( count - 1 - i ) ) ) & 0xFF;
+	}
+}
+
+static inline void spi_aux_wait_begin( struct spi_aux_ctrl* ctrl, struct io_wait* wait,
+		unsigned int in_flight ) {
+	const u32 speed = ( ctrl->cntl0 >> SPI_AUX_CNTL0_SPEED_OFF ) & SPI_AUX_CNTL0_SPEED_MAX;
+
+	// Wake up once half of the words in flight are due, so the TX FIFO is refilled before the
+	// bus runs dry. Transfers run under the controller mutex and may sleep
+	io_wait_begin( wait, io_wait_spi_ns( DIV_ROUND_UP( in_flight, 2 ) * SPI_AUX_WORD_BYTES,
+		2 * ( speed + 1 ) ), spi_hw_timeout, 1 );
+}
+
+static ssize_t spi_aux_transfer_pio( struct spi_aux_ctrl* ctrl, const u8* tx, u8* rx, size_t len,
+		struct io_trace_phases* phases ) {
+	u8* const mem = ctrl->mem;
+	size_t tx_count = 0;
+	size_t rx_count = 0;
+	unsigned int in_flight = 0;
+	struct io_wait wait;
+	u64 polls = 0;
+
+	io_trace_mark( &phases->setup );
+	spi_aux_wait_begin( ctrl, &wait, min_t( size_t, DIV_ROUND_UP( len, SPI_AUX_WORD_BYTES ),
+		SPI_AUX_FIFO_DEPTH ) );
+	while ( rx_count < len ) {
+		size_t received = 0;
+
+		// Drain the RX FIFO, one word per entry sent. The accesses are relaxed, one fence per
+		// drain and per fill orders the burst against memory
+		u32 stat = dma_read32_relaxed( mem + SPI_AUX_STAT );
+		polls++;
+		while ( in_flight && !( stat & SPI_AUX_STAT_RX_EMPTY ) ) {
+			const size_t count = min_t( size_t, len - rx_count, SPI_AUX_WORD_BYTES );
+			const u32 word = dma_read32_relaxed( mem + SPI_AUX_IO );
+			if ( rx ) {
+				spi_aux_unpack( rx + rx_count, word, count );
+			}
+			rx_count += count;
+			received += count;
+			in_flight--;
+
+			stat = dma_read32_relaxed( mem + SPI_AUX_STAT );
+		}
+		if ( received ) {
+			dma_read_fence();
+		}
+
+		// Refill the TX FIFO, never putting more words in flight than the RX FIFO can hold
+		if ( tx_count < len && in_flight < SPI_AUX_FIFO_DEPTH ) {
+			dma_write_fence();
+		}
+		while ( tx_count < len && in_flight < SPI_AUX_FIFO_DEPTH ) {
+			const size_t count = min_t( size_t, len - tx_count, SPI_AUX_WORD_BYTES );
+			const u32 word = spi_aux_pack( tx ? tx + tx_count : ( const u8* ) 0, count );
+			tx_count += count;
+			in_flight++;
+
+			dma_write32_relaxed( mem + ( tx_count < len ? SPI_AUX_TXHOLD : SPI_AUX_IO ), word );
+		}
+
+		// The timeout is for the bus making no progress, not for the whole transfer
+		if ( received ) {
+			io_trace_mark( &phases->first );
+			spi_aux_wait_begin( ctrl, &wait, in_flight );
+		} else if ( io_wait_poll( &wait ) ) {
+			LOG( KERN_ERR, "SPI hardware timout on %s transfer.", ctrl->name );
+			stats_add( ctrl->stats_bus, STATS_TIMEOUTS, 1 );
+			break;
+		}
+	}
+	if ( rx_count == len ) {
+		io_trace_mark( &phases->last );
+	}
+
+	stats_add( ctrl->stats_bus, STATS_TRANSFERS, 1 );
+	stats_add( ctrl->stats_bus, STATS_BYTES, rx_count );
+	stats_add( ctrl->stats_bus, STATS_POLLS, polls );
+
+	return rx_count < len ? SPI_AUX_ERR_HW_TIMEOUT : ( ssize_t ) rx_count;
+}
+
+ssize_t spi_aux_transfer( unsigned int bus, const u8* tx, u8* rx, size_t len ) {
+	const u64 begin = stats_begin();
+	struct spi_aux_ctrl* const ctrl = spi_aux_get_ctrl( bus );
+	struct io_trace_phases phases;
+	ssize_t ret;
+
+	if ( !ctrl ) {
+		return SPI_AUX_ERR_NO_BUS;
+	}
+	if ( !len ) {
+		return 0;
+	}
+
+	io_trace_begin( &phases, begin );
+	trace_spectr_io_xfer_start( ctrl->stats_bus, STATS_OP_SPI_TRANSFER, len );
+
+	mutex_lock( &ctrl->lock );
+	dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 | SPI_AUX_CNTL0_CLEAR_FIFO );
+	dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 );
+	ret = spi_aux_transfer_pio( ctrl, tx, rx, len, &phases );
+	if ( ret < 0 ) {
+		// Drop whatever is left so the chip is not held into the next transfer
+		dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 | SPI_AUX_CNTL0_CLEAR_FIFO );
+		dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 );
+	}
+	mutex_unlock( &ctrl->lock );
+
+	stats_end( ctrl->stats_bus, STATS_OP_SPI_TRANSFER, begin );
+	if ( ret < 0 ) {
+		trace_spectr_io_xfer_error( ctrl->stats_bus, STATS_OP_SPI_TRANSFER, ret );
+	} else {
+		io_trace_done( ctrl->stats_bus, STATS_OP_SPI_TRANSFER, ret, &phases );
+	}
+	return ret;
+}
+
+static int __init spi_aux_ctrl_init( struct spi_aux_ctrl* ctrl ) {
+	int err;
+
+	mutex_init( &ctrl->lock );
+
+	err = gpio_configure_pins( ctrl->name, ctrl->pins_alt4, ctrl->pin_count );
+	if ( err ) {
+		return err;
+	}
+
+	// The enable bits are shared with the mini UART, which may well be in use
+	dma_set_flags32( aux_mem + AUX_ENABLES, ctrl->enable_bit );
+	ctrl->mem = aux_mem + ctrl->offset;
+
+	ctrl->cntl0 = SPI_AUX_CNTL0_ENABLE | SPI_AUX_CNTL0_VAR_WIDTH | SPI_AUX_CNTL0_MSB_OUT
+		| ( SPI_AUX_CNTL0_SPEED_MAX << SPI_AUX_CNTL0_SPEED_OFF )
+		| spi_aux_cs_bits( SPI_AUX_CHIP0 ) | spi_aux_mode_bits( SPI_MODE0 );
+	dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 | SPI_AUX_CNTL0_CLEAR_FIFO );
+	dma_write32( ctrl->mem + SPI_AUX_CNTL0, ctrl->cntl0 );
+	dma_write32( ctrl->mem + SPI_AUX_CNTL1, SPI_AUX_CNTL1_MSB_IN );
+
+	return 0;
+}
+
+static void spi_aux_ctrl_exit( struct spi_aux_ctrl* ctrl ) {
+	if ( !ctrl->mem ) {
+		return;
+	}
+
+	dma_write32( ctrl->mem + SPI_AUX_CNTL0, 0x00000000 );
+	dma_clr_flags32( aux_mem + AUX_ENABLES, ctrl->enable_bit );
+	ctrl->mem = ( u8* ) 0;
+
+	gpio_release_pins( ctrl->name, ctrl->pins_input, ctrl->pin_count );
+}
+
+int __init spi_aux_init( void ) {
+	unsigned int i;
+	int err;
+
+	if ( !spi1_enable && !spi2_enable ) {
+		return 0;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "SPI mapping AUX IO memory into kernel virtual address space." );
+#endif // DEBUG
+	aux_mem = ( u8* ) dma_ioremap( BCM2836_IO_MEM_START + AUX_OFFSET, AUX_SIZE );
+	if ( !aux_mem ) {
+		LOG( KERN_ERR, "SPI failed to map AUX IO memory." );
+		return SPI_AUX_ERR_IO_MAP_FAIL;
+	}
+
+	for ( i = 0; i < SPI_AUX_BUSES; i++ ) {
+		if ( !*spi_aux_ctrls[i].enable ) {
+			continue;
+		}
+
+		err = spi_aux_ctrl_init( &spi_aux_ctrls[i] );
+		if ( err ) {
+			LOG( KERN_ERR, "SPI failed to initialize %s.", spi_aux_ctrls[i].name );
+			while ( i-- ) {
+				spi_aux_ctrl_exit( &spi_aux_ctrls[i] );
+			}
+			dma_iounmap( aux_mem );
+			aux_mem = ( u8* ) 0;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+void spi_aux_exit( void ) {
+	unsigned int i;
+
+	for ( i = 0; i < SPI_AUX_BUSES; i++ ) {
+		spi_aux_ctrl_exit( &spi_aux_ctrls[i] );
+	}
+
+	if ( aux_mem ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "SPI unmapping AUX IO memory from kernel virtual address space." );
+#endif // DEBUG
+		dma_iounmap( aux_mem );
+		aux_mem = ( u8* ) 0;
+	}
+}
+
+EXPORT_SYMBOL( spi_aux_set_clk_div );
+EXPORT_SYMBOL( spi_aux_select_chip );
+EXPORT_SYMBOL( spi_aux_set_mode );
+EXPORT_SYMBOL( spi_aux_transfer );
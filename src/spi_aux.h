@@ -0,0 +1,78 @@
+#ifndef _SPECTR_IO_SPI_AUX_H
+#define _SPECTR_IO_SPI_AUX_H
+
+#include <linux/init.h>
+#include <linux/types.h>
+
+#define SPI_AUX_ERR_IO_MAP_FAIL	-1
+#define SPI_AUX_ERR_HW_TIMEOUT	-2
+#define SPI_AUX_ERR_NO_BUS	-3	// The bus does not exist or was not enabled.
+
+#define SPI_AUX_BUS1	0	// SPI1 on GPIO 16-21, only driven with the spi1_enable parameter set.
+#define SPI_AUX_BUS2	1	// SPI2 on GPIO 40-45, only driven with the spi2_enable parameter set.
+#define SPI_AUX_BUSES	2
+
+#define SPI_AUX_CHIP0	0x00
+#define SPI_AUX_CHIP1	0x01
+#define SPI_AUX_CHIP2	0x02
+
+/**
+ * Initializes the auxiliary SPI subsystem and every enabled bus.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init spi_aux_init( void );
+
+/**
+ * Destroys the auxiliary SPI subsystem.
+ *
+ */
+void spi_aux_exit( void );
+
+/**
+ * Sets the system clock divider an auxiliary SPI bus will use.
+ *
+ * The mini SPI only divides by even numbers, odd dividers are rounded up.
+ *
+ * @param bus The SPI_AUX_BUS* bus.
+ * @param div The divider.
+ *
+ */
+void spi_aux_set_clk_div( unsigned int bus, u16 div );
+
+/**
+ * Sets the chip select line of an auxiliary SPI bus.
+ *
+ * @param bus The SPI_AUX_BUS* bus.
+ * @param chip The chip.
+ *
+ */
+void spi_aux_select_chip( unsigned int bus, u8 chip );
+
+/**
+ * Sets the clock phase and polarity of an auxiliary SPI bus.
+ *
+ * @param bus The SPI_AUX_BUS* bus.
+ * @param mode The SPI_MODE* mode defining the clock phase and polarity to use.
+ *
+ */
+void spi_aux_set_mode( unsigned int bus, u8 mode );
+
+/**
+ * Transfers data on an auxiliary SPI bus in full-duplex.
+ *
+ * The selected chip is held for the whole transfer and released at its end. Each bus has its own
+ * lock, so transfers on different buses, SPI0 included, run in parallel.
+ *
+ * @param bus The SPI_AUX_BUS* bus.
+ * @param tx The data buffer to write from, or NULL to write zeros.
+ * @param rx The data buffer to read to, or NULL to discard the read data.
+ * @param len The number of bytes to transfer.
+ *
+ * @returns The number of bytes transferred; a negative error code on failure.
+ *
+ */
+ssize_t spi_aux_transfer( unsigned int bus, const u8* tx, u8* rx, size_t len );
+
+#endif // _SPECTR_IO_SPI_AUX_H
@@ -0,0 +1,225 @@
+#include "spi_queue.h"
+
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "spi.h"
+
+// The selection a transfer left held for the next one.
+struct spi_queue_sel {
+	int held;
+	int device;
+	u8 chip;
+};
+
+struct spi_queue_state {
+	spinlock_t lock;
+	struct list_head pending;
+	wait_queue_head_t wait;
+
+	struct task_struct* worker;
+};
+
+static int spi_worker_cpu = -1;
+module_param( spi_worker_cpu, int, 0444 );
+MODULE_PARM_DESC( spi_worker_cpu, "CPU the SPI bus worker thread is bound to, unbound if negative" );
+
+static int spi_worker_prio = 0;
+module_param( spi_worker_prio, int, 0444 );
+MODULE_PARM_DESC( spi_worker_prio, "SCHED_FIFO priority of the SPI bus worker thread, SCHED_NORMAL if zero" );
+
+static struct spi_queue_state spi_queue;
+
+static struct spi_xfer* spi_queue_pop( void ) {
+	struct spi_xfer* xfer = ( struct spi_xfer* ) 0;
+	unsigned long flags;
+
+	spin_lock_irqsave( &spi_queue.lock, flags );
+	if ( !list_empty( &spi_queue.pending ) ) {
+		xfer = list_first_entry( &spi_queue.pending, struct spi_xfer, node );
+		list_del_init( &xfer->node );
+	}
+	spin_unlock_irqrestore( &spi_queue.lock, flags );
+
+	return xfer;
+}
+
+static int spi_queue_has_pending( void ) {
+	unsigned long flags;
+
+	spin_lock_irqsave( &spi_queue.lock, flags );
+	const int pending = !list_empty( &spi_queue.pending );
+	spin_unlock_irqrestore( &spi_queue.lock, flags );
+
+	return pending;
+}
+
+static void spi_queue_finish( struct spi_xfer* xfer, ssize_t result ) {
+	xfer->result = result;
+
+	// The submitter may free the transfer as soon as it learns it finished, so it is not touched
+	// after either of these
+	if ( xfer->complete ) {
+		xfer->complete( xfer );
+	} else {
+		complete( &xfer->done );
+	}
+}
+
+static void spi_queue_run( struct spi_xfer* xfer, struct spi_queue_sel* sel ) {
+	// A held selection only carries over to a transfer with the same settings on the same chip
+	if ( sel->held && ( sel->device != xfer->device
+	  || ( xfer->device == SPI_XFER_KEEP_DEVICE && sel->chip != xfer->chip ) ) ) {
+		spi_end_transfer();
+		sel->held = 0;
+	}
+	if ( !sel->held ) {
+		// Whoever held the bus last may have left another device's mode and clock behind
+		if ( xfer->device != SPI_XFER_KEEP_DEVICE ) {
+			const int err = spi_use_device( xfer->device );
+			if ( err ) {
+				spi_queue_finish( xfer, err );
+				return;
+			}
+		} else {
+			spi_select_chip( xfer->chip );
+		}
+		spi_begin_transfer();
+		sel->held = 1;
+		sel->device = xfer->device;
+		sel->chip = xfer->chip;
+	}
+
+	const ssize_t result = spi_transfer( xfer->tx, xfer->rx, xfer->len );
+
+	// The chip only stays selected if another transfer is already waiting to use it
+	if ( result < 0 || !( xfer->flags & SPI_XFER_CS_KEEP ) || !spi_queue_has_pending() ) {
+		spi_end_transfer();
+		sel->held = 0;
+	}
+
+	spi_queue_finish( xfer, result );
+}
+
+static int spi_queue_worker( void* data ) {
+	struct spi_xfer* xfer;
+	struct spi_queue_sel sel = { 0 };
+
+	while ( !kthread_should_stop() ) {
+		wait_event_interruptible( spi_queue.wait, spi_queue_has_pending() || kthread_should_stop() );
+
+		// Keep the bus until the queue runs dry so consecutive transfers go out back to back
+		spi_lock_bus();
+		while ( ( xfer = spi_queue_pop() ) ) {
+			spi_queue_run( xfer, &sel );
+		}
+		spi_unlock_bus();
+	}
+
+	return 0;
+}
+
+int __init spi_queue_init( void ) {
+	struct task_struct* worker;
+
+	spin_lock_init( &spi_queue.lock );
+	INIT_LIST_HEAD( &spi_queue.pending );
+	init_waitqueue_head( &spi_queue.wait );
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "SPI starting bus worker thread." );
+#endif // DEBUG
+	worker = kthread_create( spi_queue_worker, ( void* ) 0, "spectr-io-spi" );
+	if ( IS_ERR( worker ) ) {
+		// Not fatal, spi_submit() runs transfers on the submitting thread instead
+		LOG( KERN_ERR, "SPI failed to start bus worker thread, queued transfers run synchronously." );
+		return 0;
+	}
+
+	if ( spi_worker_cpu >= 0 ) {
+		if ( spi_worker_cpu < nr_cpu_ids && cpu_online( spi_worker_cpu ) ) {
+			kthread_bind( worker, spi_worker_cpu );
+		} else {
+			LOG( KERN_ERR, "SPI bus worker CPU %d is not online, worker left unbound.", spi_worker_cpu );
+		}
+	}
+
+	if ( spi_worker_prio > 0 ) {
+		struct sched_param param = {
+			.sched_priority = min( spi_worker_prio, MAX_RT_PRIO - 1 ),
+		};
+		if ( sched_setscheduler_nocheck( worker, SCHED_FIFO, &param ) ) {
+			LOG( KERN_ERR, "SPI failed to set bus worker priority %d.", spi_worker_prio );
+		}
+	}
+
+	spi_queue.worker = worker;
+	wake_up_process( worker );
+
+	return 0;
+}
+
+void spi_queue_exit( void ) {
+	struct spi_xfer* xfer;
+
+	if ( spi_queue.worker ) {
+#if defined( DEBUG )
+		LOG( KERN_DEBUG, "SPI stopping bus worker thread." );
+#endif // DEBUG
+		kthread_stop( spi_queue.worker );
+		spi_queue.worker = ( struct task_struct* ) 0;
+	}
+
+	while ( ( xfer = spi_queue_pop() ) ) {
+		spi_queue_finish( xfer, SPI_ERR_CANCELED );
+	}
+}
+
+void spi_xfer_init( struct spi_xfer* xfer ) {
+	INIT_LIST_HEAD( &xfer->node );
+	init_completion( &xfer->done );
+	xfer->device = SPI_XFER_KEEP_DEVICE;
+	xfer->result = 0;
+}
+
+int spi_submit( struct spi_xfer* xfer ) {
+	unsigned long flags;
+
+	reinit_completion( &xfer->done );
+	xfer->result = 0;
+
+	if ( !spi_queue.worker ) {
+		struct spi_queue_sel sel = { 0 };
+
+		spi_lock_bus();
+		spi_queue_run( xfer, &sel );
+		spi_unlock_bus();
+
+		return 0;
+	}
+
+	spin_lock_irqsave( &spi_queue.lock, flags );
+	list_add_tail( &xfer->node, &spi_queue.pending );
+	spin_unlock_irqrestore( &spi_queue.lock, flags );
+
+	wake_up( &spi_queue.wait );
+
+	return 0;
+}
+
+ssize_t spi_xfer_wait( struct spi_xfer* xfer ) {
+	wait_for_completion( &xfer->done );
+
+	return xfer->result;
+}
+
+EXPORT_SYMBOL( spi_xfer_init );
+EXPORT_SYMBOL( spi_submit );
+EXPORT_SYMBOL( spi_xfer_wait );
@@ -0,0 +1,90 @@
+#ifndef _SPECTR_IO_SPI_QUEUE_H
+#define _SPECTR_IO_SPI_QUEUE_H
+
+#include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/types.h>
+
+#define SPI_XFER_CS_KEEP	BIT( 0 )	// Keep the chip selected into the next queued transfer.
+
+#define SPI_XFER_KEEP_DEVICE	-1	// Run the transfer with the bus settings left as they are.
+
+struct spi_xfer;
+
+/**
+ * Called when a queued SPI transfer finishes, from the bus worker thread or, if it failed to
+ * start, from the submitting thread.
+ *
+ * @param xfer The finished transfer, which may be freed or resubmitted from here on.
+ *
+ */
+typedef void ( *spi_xfer_fn )( struct spi_xfer* xfer );
+
+// A transfer queued with spi_submit(), initialized with spi_xfer_init().
+struct spi_xfer {
+	const u8* tx;		// The data buffer to write from, or NULL to write zeros.
+	u8* rx;			// The data buffer to read to, or NULL to discard the read data.
+	size_t len;		// The number of bytes to transfer.
+	int device;		// The spi_register_device() handle to switch to, or SPI_XFER_KEEP_DEVICE.
+	u8 chip;		// The chip to select for the transfer, if it keeps the device.
+	unsigned int flags;	// The SPI_XFER_* flags.
+
+	spi_xfer_fn complete;	// Called when the transfer finishes, or NULL to use spi_xfer_wait().
+	void* ctx;		// Left to the submitter.
+
+	ssize_t result;		// The number of bytes transferred; a negative error code on failure.
+
+	struct list_head node;
+	struct completion done;
+};
+
+/**
+ * Initializes the SPI transfer queue and starts its bus worker thread.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init spi_queue_init( void );
+
+/**
+ * Stops the bus worker thread, canceling every transfer still queued.
+ *
+ */
+void spi_queue_exit( void );
+
+/**
+ * Initializes a transfer before its first submission, keeping the device until one is set.
+ *
+ * @param xfer The transfer.
+ *
+ */
+void spi_xfer_init( struct spi_xfer* xfer );
+
+/**
+ * Queues a transfer to the bus worker thread.
+ *
+ * Transfers run in submission order, back to back while the queue is not empty. Each one switches
+ * to its device, or selects its chip if it keeps the device, and runs between spi_begin_transfer()
+ * and spi_end_transfer(), unless SPI_XFER_CS_KEEP lets it share the selection with the transfer
+ * queued after it for the same device. The buffers must stay valid until the transfer finishes.
+ *
+ * @param xfer The transfer.
+ *
+ * @returns Zero if the transfer was queued; a negative error code on failure.
+ *
+ */
+int spi_submit( struct spi_xfer* xfer );
+
+/**
+ * Waits for a transfer queued without a completion function to finish.
+ *
+ * @param xfer The transfer.
+ *
+ * @returns The number of bytes transferred; a negative error code on failure.
+ *
+ */
+ssize_t spi_xfer_wait( struct spi_xfer* xfer );
+
+#endif // _SPECTR_IO_SPI_QUEUE_H
@@ -0,0 +1,287 @@
+#include "spi_stream.h"
+
+#include <asm/barrier.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/eventfd.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include <log.h>
+
+#include "spi.h"
+#include "uapi/spectr_io.h"
+
+struct spi_stream {
+	struct spectr_io_stream_header* header;	// The start of the ring, shared with userspace.
+	u8* data;				// The first frame slot.
+	size_t size;				// The size of the ring in bytes, page aligned.
+	u32 frame_len;
+	u32 frames;
+
+	// Owned by the worker while the stream runs, the header only gets copies of these so nothing
+	// userspace writes to it can throw the driver off
+	u32 head;
+	u32 notified;		// The head at the last wake-up.
+	u32 overruns;
+
+	u8* tx;
+	int device;
+	unsigned int period_us;
+	unsigned int notify;
+	struct eventfd_ctx* eventfd;
+
+	struct task_struct* worker;
+	wait_queue_head_t wait;
+};
+
+static void spi_stream_wake( struct spi_stream* stream ) {
+	stream->notified = stream->head;
+	wake_up_interruptible( &stream->wait );
+	if ( stream->eventfd ) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 8, 0 )
+		eventfd_signal( stream->eventfd );
+#else
+		eventfd_signal( stream->eventfd, 1 );
+#endif
+	}
+}
+
+static int spi_stream_fill( struct spi_stream* stream ) {
+	struct spectr_io_stream_header* const header = stream->header;
+	u8* rx = ( u8* ) 0;
+	ssize_t ret = 0;
+
+	// The tail is only ever read here, a consumer that moved it past the head just sees a full ring
+	if ( stream->head - smp_load_acquire( &header->tail ) < stream->frames ) {
+		rx = stream->data + ( size_t ) ( stream->head & ( stream->frames - 1 ) ) * stream->frame_len;
+	}
+
+	spi_lock_bus();
+	if ( stream->device >= 0 ) {
+		ret = spi_use_device( stream->device );
+	}
+	if ( !ret ) {
+		spi_begin_transfer();
+		ret = spi_transfer( stream->tx, rx, stream->frame_len );
+		spi_end_transfer();
+	}
+	spi_unlock_bus();
+
+	if ( ret < 0 ) {
+		WRITE_ONCE( header->error, ret );
+		spi_stream_wake( stream );
+		return ret;
+	}
+
+	// The frame is clocked even without room for it, so the device keeps its sampling pace
+	if ( !rx ) {
+		WRITE_ONCE( header->overruns, ++stream->overruns );
+		return 0;
+	}
+
+	// The data has to be visible before the head that publishes it
+	smp_store_release( &header->head, ++stream->head );
+	if ( stream->head - stream->notified >= stream->notify ) {
+		spi_stream_wake( stream );
+	}
+
+	return 0;
+}
+
+static void spi_stream_pace( struct spi_stream* stream, u64* next ) {
+	if ( !stream->period_us ) {
+		// Back to back frames never sleep, nothing else gets the CPU otherwise on kernels without
+		// preemption
+		cond_resched();
+		return;
+	}
+
+	*next += ( u64 ) stream->period_us * NSEC_PER_USEC;
+	const u64 now = ktime_get_ns();
+	if ( *next <= now ) {
+		// A stream that fell behind starts over from now instead of catching up in a burst, and
+		// does not sleep either
+		*next = now;
+		cond_resched();
+		return;
+	}
+
+	const unsigned long us = div_u64( *next - now, NSEC_PER_USEC );
+	usleep_range( us, us + 1 );
+}
+
+static int spi_stream_worker( void* data ) {
+	struct spi_stream* const stream = data;
+	u64 next = ktime_get_ns();
+
+	while ( !kthread_should_stop() ) {
+		if ( spi_stream_fill( stream ) ) {
+			LOG( KERN_ERR, "SPI stream stopped on error %d.", READ_ONCE( stream->header->error ) );
+			break;
+		}
+		spi_stream_pace( stream, &next );
+	}
+
+	// The thread has to stay around until it is stopped
+	wait_event_interruptible( stream->wait, kthread_should_stop() );
+
+	return 0;
+}
+
+struct spi_stream* spi_stream_create( u32 frame_len, u32 frames ) {
+	if ( !frame_len || !is_power_of_2( frames ) || frame_len > SPECTR_IO_STREAM_DATA_MAX / frames ) {
+		return ERR_PTR( -EINVAL );
+	}
+
+	struct spi_stream* const stream = kzalloc( sizeof( *stream ), GFP_KERNEL );
+	if ( !stream ) {
+		return ERR_PTR( -ENOMEM );
+	}
+
+	// vmalloc_user() zeroes the pages and marks them for remap_vmalloc_range()
+	stream->size = PAGE_ALIGN( PAGE_SIZE + ( size_t ) frame_len * frames );
+	stream->header = vmalloc_user( stream->size );
+	if ( !stream->header ) {
+		kfree( stream );
+		return ERR_PTR( -ENOMEM );
+	}
+
+	stream->data = ( u8* ) stream->header + PAGE_SIZE;
+	stream->frame_len = frame_len;
+	stream->frames = frames;
+	stream->device = -1;
+	init_waitqueue_head( &stream->wait );
+
+	stream->header->frames = frames;
+	stream->header->frame_len = frame_len;
+	stream->header->data_offset = PAGE_SIZE;
+
+	return stream;
+}
+
+void spi_stream_destroy( struct spi_stream* stream ) {
+	spi_stream_stop( stream );
+	vfree( stream->header );
+	kfree( stream );
+}
+
+int spi_stream_fits( const struct spi_stream* stream, u32 frame_len, u32 frames ) {
+	return stream->frame_len == frame_len && stream->frames == frames;
+}
+
+static void spi_stream_release_config( struct spi_stream* stream ) {
+	kfree( stream->tx );
+	stream->tx = ( u8* ) 0;
+	if ( stream->eventfd ) {
+		eventfd_ctx_put( stream->eventfd );
+		stream->eventfd = ( struct eventfd_ctx* ) 0;
+	}
+}
+
+static int spi_stream_configure( struct spi_stream* stream, const struct spi_stream_config* config ) {
+	stream->eventfd = config->eventfd;
+	stream->device = config->device;
+	stream->period_us = config->period_us;
+	stream->notify = config->notify ? config->notify : 1;
+
+	if ( config->tx ) {
+		stream->tx = kmemdup( config->tx, stream->frame_len, GFP_KERNEL );
+		if ( !stream->tx ) {
+			spi_stream_release_config( stream );
+			return -ENOMEM;
+		}
+	}
+
+	// A restarted stream carries on from the frames userspace already knows about
+	stream->head = stream->header->head;
+	stream->notified = stream->head;
+	stream->overruns = stream->header->overruns;
+	WRITE_ONCE( stream->header->error, 0 );
+
+	return 0;
+}
+
+int spi_stream_start( struct spi_stream* stream, const struct spi_stream_config* config ) {
+	struct task_struct* worker;
+	int err;
+
+	if ( stream->worker ) {
+		if ( config->eventfd ) {
+			eventfd_ctx_put( config->eventfd );
+		}
+		return -EBUSY;
+	}
+
+	err = spi_stream_configure( stream, config );
+	if ( err ) {
+		return err;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "SPI starting stream of %u frames of %u bytes.", stream->frames, stream->frame_len );
+#endif // DEBUG
+	worker = kthread_create( spi_stream_worker, stream, "spectr-io-stream" );
+	if ( IS_ERR( worker ) ) {
+		LOG( KERN_ERR, "SPI failed to start stream thread." );
+		spi_stream_release_config( stream );
+		return PTR_ERR( worker );
+	}
+
+	stream->worker = worker;
+	wake_up_process( worker );
+
+	return 0;
+}
+
+void spi_stream_stop( struct spi_stream* stream ) {
+	if ( !stream->worker ) {
+		return;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "SPI stopping stream." );
+#endif // DEBUG
+	kthread_stop( stream->worker );
+	stream->worker = ( struct task_struct* ) 0;
+	spi_stream_release_config( stream );
+
+	// Pollers still waiting for the next wake-up get to see the frames left behind
+	wake_up_interruptible( &stream->wait );
+}
+
+int spi_stream_running( const struct spi_stream* stream ) {
+	return stream->worker != ( struct task_struct* ) 0;
+}
+
+int spi_stream_mmap( struct spi_stream* stream, struct vm_area_struct* vma ) {
+	if ( vma->vm_pgoff ) {
+		return -EINVAL;
+	}
+
+	// Sizes past the end of the ring are refused
+	return remap_vmalloc_range( vma, stream->header, 0 );
+}
+
+__poll_t spi_stream_poll( struct spi_stream* stream, struct file* file, poll_table* wait ) {
+	const struct spectr_io_stream_header* const header = stream->header;
+	__poll_t mask = 0;
+
+	poll_wait( file, &stream->wait, wait );
+	if ( smp_load_acquire( &header->head ) != READ_ONCE( header->tail ) ) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+	if ( READ_ONCE( header->error ) ) {
+		mask |= EPOLLERR;
+	}
+
+	return mask;
+}
@@ -0,0 +1,114 @@
+#ifndef _SPECTR_IO_SPI_STREAM_H
+#define _SPECTR_IO_SPI_STREAM_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+
+struct eventfd_ctx;
+struct spi_stream;
+
+// The settings of a started stream.
+struct spi_stream_config {
+	const u8* tx;			// The data written for every frame, or NULL to write zeros.
+	int device;			// The device handle to switch to for every frame, negative to leave
+					// the bus settings as they are.
+	unsigned int period_us;		// The time from the start of a frame to the next, zero to run back
+					// to back.
+	unsigned int notify;		// The number of frames between wake-ups, zero for every frame.
+	struct eventfd_ctx* eventfd;	// Signaled on every wake-up, or NULL.
+};
+
+/**
+ * Creates a stopped stream along with its ring.
+ *
+ * The ring is zeroed vmalloc memory starting with a struct spectr_io_stream_header page, meant to
+ * be mapped into userspace with spi_stream_mmap().
+ *
+ * @param frame_len The length of a frame in bytes.
+ * @param frames The number of frame slots, a power of two.
+ *
+ * @returns The stream; an ERR_PTR() on failure.
+ *
+ */
+struct spi_stream* spi_stream_create( u32 frame_len, u32 frames );
+
+/**
+ * Stops and frees a stream. Mappings of its ring keep their pages until they are unmapped.
+ *
+ * @param stream The stream.
+ *
+ */
+void spi_stream_destroy( struct spi_stream* stream );
+
+/**
+ * Checks whether the ring of a stream has a geometry.
+ *
+ * @param stream The stream.
+ * @param frame_len The length of a frame in bytes.
+ * @param frames The number of frame slots.
+ *
+ * @returns Nonzero if it has; zero otherwise.
+ *
+ */
+int spi_stream_fits( const struct spi_stream* stream, u32 frame_len, u32 frames );
+
+/**
+ * Starts a stream on a thread of its own, which runs one transfer per frame straight into the
+ * ring for as long as the stream runs.
+ *
+ * Every frame takes the bus with spi_lock_bus() and gives it back, so other users of the bus get
+ * their turn in between. Frames that find the ring full are still clocked, their data is dropped
+ * and counted as an overrun. A failing transfer stops the stream with its error in the header.
+ *
+ * @param stream The stream, stopped.
+ * @param config The settings, copied. The eventfd reference is taken over, even on failure.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int spi_stream_start( struct spi_stream* stream, const struct spi_stream_config* config );
+
+/**
+ * Stops a stream, waiting for the frame in progress to finish. The ring keeps its contents.
+ *
+ * @param stream The stream.
+ *
+ */
+void spi_stream_stop( struct spi_stream* stream );
+
+/**
+ * Checks whether a stream runs.
+ *
+ * @param stream The stream.
+ *
+ * @returns Nonzero if it runs; zero otherwise.
+ *
+ */
+int spi_stream_running( const struct spi_stream* stream );
+
+/**
+ * Maps the ring of a stream into userspace, from the start of the ring.
+ *
+ * @param stream The stream.
+ * @param vma The area to map the ring into.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int spi_stream_mmap( struct spi_stream* stream, struct vm_area_struct* vma );
+
+/**
+ * Polls a stream for frames.
+ *
+ * @param stream The stream.
+ * @param file The file polled.
+ * @param wait The poll table.
+ *
+ * @returns EPOLLIN if frames wait to be consumed, EPOLLERR if the stream stopped on a failure.
+ *
+ */
+__poll_t spi_stream_poll( struct spi_stream* stream, struct file* file, poll_table* wait );
+
+#endif // _SPECTR_IO_SPI_STREAM_H
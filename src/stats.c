@@ -0,0 +1,200 @@
+#include "stats.h"
+
+// The tracepoints live with the rest of the instrumentation
+#define CREATE_TRACE_POINTS
+#include "io_trace.h"
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#include <log.h>
+
+#define STATS_KIND_SPI	0
+#define STATS_KIND_I2C	1
+
+struct stats_bus_info {
+	unsigned int kind;
+	const char* name;
+};
+
+struct stats_op_info {
+	unsigned int kind;
+	const char* name;
+};
+
+struct stats_cpu __percpu* stats_cpu = ( struct stats_cpu __percpu* ) 0;
+
+static struct dentry* stats_dir = ( struct dentry* ) 0;
+
+static const char* const stats_counter_names[STATS_COUNTERS] = {
+	"bytes",
+	"transfers",
+	"timeouts",
+	"nacks",
+	"clk_timeouts",
+	"polls",
+	"recoveries",
+	"cpu_ns",
+	"wakes",
+	"wake_ns",
+};
+
+static const struct stats_bus_info stats_buses[STATS_BUSES] = {
+	{ STATS_KIND_SPI, "spi0" },
+	{ STATS_KIND_I2C, "i2c1" },
+	{ STATS_KIND_SPI, "spi1" },
+	{ STATS_KIND_SPI, "spi2" },
+	{ STATS_KIND_I2C, "i2c0" },
+};
+
+static const struct stats_op_info stats_ops[STATS_OPS] = {
+	{ STATS_KIND_SPI, "spi_read" },
+	{ STATS_KIND_SPI, "spi_write" },
+	{ STATS_KIND_SPI, "spi_transfer" },
+	{ STATS_KIND_SPI, "spi_await_transfer" },
+	{ STATS_KIND_I2C, "i2c_transfer" },
+	{ STATS_KIND_I2C, "i2c_read" },
+	{ STATS_KIND_I2C, "i2c_write" },
+	{ STATS_KIND_I2C, "i2c_read_register" },
+};
+
+u64 stats_read( unsigned int bus, unsigned int counter ) {
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu( cpu ) {
+		sum += per_cpu_ptr( stats_cpu, cpu )->counters[bus][counter];
+	}
+
+	return sum;
+}
+
+u64 stats_read_latency( unsigned int bus, unsigned int op, unsigned int bucket ) {
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu( cpu ) {
+		sum += per_cpu_ptr( stats_cpu, cpu )->latency[bus][op][bucket];
+	}
+
+	return sum;
+}
+
+void stats_reset( void ) {
+	int cpu;
+
+	// Counters updated concurrently may survive the reset, good enough for statistics
+	for_each_possible_cpu( cpu ) {
+		memset( per_cpu_ptr( stats_cpu, cpu ), 0, sizeof( struct stats_cpu ) );
+	}
+}
+
+static int stats_bus_show( struct seq_file* m, void* v ) {
+	const unsigned int bus = ( unsigned long ) m->private;
+	unsigned int i;
+	unsigned int j;
+
+	for ( i = 0; i < STATS_COUNTERS; i++ ) {
+		seq_printf( m, "%-16s %llu\n", stats_counter_names[i], stats_read( bus, i ) );
+	}
+
+	// Hundredths are enough to tell a FIFO burst from a byte-by-byte poll
+	const u64 bytes = stats_read( bus, STATS_BYTES );
+	const u64 polls = bytes ? stats_read( bus, STATS_POLLS ) * 100 / bytes : 0;
+	seq_printf( m, "%-16s %llu.%02llu\n", "polls_per_byte", polls / 100, polls % 100 );
+
+	const u64 wakes = stats_read( bus, STATS_WAKES );
+	seq_printf( m, "%-16s %llu\n", "wake_ns_avg", wakes ? stats_read( bus, STATS_WAKE_NS ) / wakes : 0 );
+
+	for ( i = 0; i < STATS_OPS; i++ ) {
+		if ( stats_ops[i].kind != stats_buses[bus].kind ) {
+			continue;
+		}
+
+		seq_printf( m, "\n%s latency (ns):\n", stats_ops[i].name );
+		for ( j = 0; j < STATS_BUCKETS; j++ ) {
+			const u64 count = stats_read_latency( bus, i, j );
+			if ( !count ) {
+				continue;
+			}
+
+			if ( j == STATS_BUCKETS - 1 ) {
+				seq_printf( m, "  %10llu -            %llu\n", 1ULL << ( j - 1 ), count );
+			} else {
+				seq_printf( m, "  %10llu - %10llu %llu\n", j ? 1ULL << ( j - 1 ) : 0, ( 1ULL << j ) - 1,
+					count );
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int stats_bus_open( struct inode* inode, struct file* file ) {
+	return single_open( file, stats_bus_show, inode->i_private );
+}
+
+static ssize_t stats_reset_write( struct file* file, const char __user* buf, size_t len, loff_t* pos ) {
+	stats_reset();
+	return len;
+}
+
+static const struct file_operations stats_bus_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_bus_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+int __init stats_init( void ) {
+	unsigned long i;
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "Stats allocating per-CPU counters." );
+#endif // DEBUG
+	stats_cpu = alloc_percpu( struct stats_cpu );
+	if ( !stats_cpu ) {
+		LOG( KERN_ERR, "Stats failed to allocate per-CPU counters." );
+		return -ENOMEM;
+	}
+
+#if defined( DEBUG )
+	LOG( KERN_DEBUG, "Stats creating debugfs files." );
+#endif // DEBUG
+	stats_dir = debugfs_create_dir( "spectr-io", ( struct dentry* ) 0 );
+	if ( IS_ERR_OR_NULL( stats_dir ) ) {
+		// Counting goes on regardless, the files are only a view on it
+		LOG( KERN_WARNING, "Stats failed to create debugfs directory, counters are not exposed." );
+		stats_dir = ( struct dentry* ) 0;
+		return 0;
+	}
+
+	for ( i = 0; i < STATS_BUSES; i++ ) {
+		debugfs_create_file( stats_buses[i].name, 0444, stats_dir, ( void* ) i, &stats_bus_fops );
+	}
+	debugfs_create_file( "reset", 0200, stats_dir, ( void* ) 0, &stats_reset_fops );
+
+	return 0;
+}
+
+void stats_exit( void ) {
+	debugfs_remove_recursive( stats_dir );
+	stats_dir = ( struct dentry* ) 0;
+
+	free_percpu( stats_cpu );
+	stats_cpu = ( struct stats_cpu __percpu* ) 0;
+}
+
+EXPORT_SYMBOL( stats_read );
+EXPORT_SYMBOL( stats_read_latency );
+EXPORT_SYMBOL( stats_reset );
@@ -0,0 +1,132 @@
+#ifndef _SPECTR_IO_STATS_H
+#define _SPECTR_IO_STATS_H
+
+#include <linux/bitops.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+#define STATS_BUS_SPI0	0
+#define STATS_BUS_I2C1	1
+#define STATS_BUS_SPI1	2
+#define STATS_BUS_SPI2	3
+#define STATS_BUS_I2C0	4
+#define STATS_BUSES	5
+
+#define STATS_BYTES		0	// Bytes moved over the bus.
+#define STATS_TRANSFERS		1	// Transfers started on the bus.
+#define STATS_TIMEOUTS		2	// Transfers aborted by the hardware timeout.
+#define STATS_NACKS		3	// Transfers no peripheral acknowledged.
+#define STATS_CLK_TIMEOUTS	4	// Transfers aborted by a peripheral stretching the clock.
+#define STATS_POLLS		5	// Status register reads spent waiting on the bus.
+#define STATS_RECOVERIES	6	// Stuck buses clocked free.
+#define STATS_CPU_NS		7	// Nanoseconds the CPU spent moving data, in the handlers unless polling.
+#define STATS_WAKES		8	// Sleeping waits ended by an interrupt handler.
+#define STATS_WAKE_NS		9	// Nanoseconds from the handlers completing waits to the waiters running.
+#define STATS_COUNTERS		10
+
+#define STATS_OP_SPI_READ		0
+#define STATS_OP_SPI_WRITE		1
+#define STATS_OP_SPI_TRANSFER		2
+#define STATS_OP_SPI_AWAIT		3
+#define STATS_OP_I2C_TRANSFER		4
+#define STATS_OP_I2C_READ		5
+#define STATS_OP_I2C_WRITE		6
+#define STATS_OP_I2C_READ_REGISTER	7
+#define STATS_OPS			8
+
+// Latency bucket n counts calls taking [2^(n-1), 2^n) ns, the last one everything longer.
+#define STATS_BUCKETS	32
+
+struct stats_cpu {
+	u64 counters[STATS_BUSES][STATS_COUNTERS];
+	u64 latency[STATS_BUSES][STATS_OPS][STATS_BUCKETS];
+};
+
+// Allocated at init, the histograms are too large for the static per-CPU area modules get
+extern struct stats_cpu __percpu* stats_cpu;
+
+/**
+ * Initializes the statistics subsystem and its debugfs files.
+ *
+ * @returns Zero on success; a negative error code on failure.
+ *
+ */
+int __init stats_init( void );
+
+/**
+ * Destroys the statistics subsystem.
+ *
+ */
+void stats_exit( void );
+
+/**
+ * Adds to a bus counter on the current CPU.
+ *
+ * @param bus The STATS_BUS_* bus.
+ * @param counter The STATS_* counter.
+ * @param n The amount to add.
+ *
+ */
+static inline void stats_add( unsigned int bus, unsigned int counter, u64 n ) {
+	this_cpu_add( stats_cpu->counters[bus][counter], n );
+}
+
+/**
+ * Gets the start time of an operation whose latency is to be recorded.
+ *
+ * @returns The start time in nanoseconds.
+ *
+ */
+static inline u64 stats_begin( void ) {
+	return ktime_get_ns();
+}
+
+/**
+ * Records the latency of an operation on the current CPU.
+ *
+ * @param bus The STATS_BUS_* bus.
+ * @param op The STATS_OP_* operation.
+ * @param begin The start time returned by stats_begin().
+ *
+ * @returns The latency in nanoseconds.
+ *
+ */
+static inline u64 stats_end( unsigned int bus, unsigned int op, u64 begin ) {
+	const u64 ns = ktime_get_ns() - begin;
+	this_cpu_inc( stats_cpu->latency[bus][op][min_t( unsigned int, fls64( ns ), STATS_BUCKETS - 1 )] );
+	return ns;
+}
+
+/**
+ * Gets a bus counter summed over all CPUs.
+ *
+ * @param bus The STATS_BUS_* bus.
+ * @param counter The STATS_* counter.
+ *
+ * @returns The counter value.
+ *
+ */
+u64 stats_read( unsigned int bus, unsigned int counter );
+
+/**
+ * Gets a latency histogram bucket summed over all CPUs.
+ *
+ * @param bus The STATS_BUS_* bus.
+ * @param op The STATS_OP_* operation.
+ * @param bucket The bucket.
+ *
+ * @returns The number of calls in the bucket.
+ *
+ */
+u64 stats_read_latency( unsigned int bus, unsigned int op, unsigned int bucket );
+
+/**
+ * Resets all counters and histograms.
+ *
+ */
+void stats_reset( void );
+
+#endif // _SPECTR_IO_STATS_H
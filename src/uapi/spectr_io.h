@@ -0,0 +1,318 @@
+#ifndef _SPECTR_IO_UAPI_SPECTR_IO_H
+#define _SPECTR_IO_UAPI_SPECTR_IO_H
+
+// The interface of the /dev/spectr-* character devices, shared with userspace.
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define SPECTR_IO_IOC_MAGIC	0xE5
+
+// The max number of transfers in a batch.
+#define SPECTR_IO_BATCH_MAX		64
+// The max number of bytes a batch moves, counting both directions.
+#define SPECTR_IO_BATCH_DATA_MAX	65536
+// The max number of I2C messages over all the transfers of a batch.
+#define SPECTR_IO_I2C_MSGS_MAX		128
+
+// The max size of the frame slots of a stream ring.
+#define SPECTR_IO_STREAM_DATA_MAX	( 16 << 20 )
+
+// A batch of transfers, run in order in a single call until one of them fails.
+struct spectr_io_batch {
+	__u64 xfers;		// The array of spectr_io_spi_xfer or spectr_io_i2c_xfer transfers.
+	__u32 count;		// The number of transfers.
+	__u32 reserved;		// Must be zero.
+};
+
+#define SPECTR_IO_SPI_KEEP_DEVICE	-1	// Runs the transfer with the bus settings left as they are.
+
+#define SPECTR_IO_SPI_CS_KEEP	( 1 << 0 )	// The chip stays selected into the next transfer of the
+						// batch, which must keep the device.
+
+// The bus settings of an SPI device, see struct spi_device_profile.
+struct spectr_io_spi_device {
+	__u8 chip;		// The chip select line, 0 to 2.
+	__u8 mode;		// The SPI_MODE* clock phase and polarity.
+	__u8 cs_high;		// Whether the chip select line is active high.
+	__u8 reads;		// Whether reads are enabled.
+	__u16 clk_div;		// The system clock divider.
+	__u16 reserved;		// Must be zero.
+	__s32 handle;		// Set to the device handle.
+};
+
+// A full-duplex SPI transfer of a batch.
+struct spectr_io_spi_xfer {
+	__u64 tx;		// The data buffer to write from, or zero to write zeros.
+	__u64 rx;		// The data buffer to read to, or zero to discard the read data.
+	__u32 len;		// The number of bytes to transfer.
+	__s32 device;		// The device handle to switch to, or SPECTR_IO_SPI_KEEP_DEVICE.
+	__u32 flags;		// The SPECTR_IO_SPI_* flags.
+	__s32 result;		// Set to the number of bytes transferred; a negative SPI_ERR_* code.
+};
+
+// The settings of an SPI capture stream, which runs the same transfer over and over into a ring
+// userspace maps with mmap().
+struct spectr_io_stream_config {
+	__u64 tx;		// The data written for every frame, frame_len bytes, or zero to write zeros.
+	__s32 device;		// The device handle to switch to for every frame, or SPECTR_IO_SPI_KEEP_DEVICE.
+	__u32 frame_len;	// The length of a frame in bytes.
+	__u32 frames;		// The number of frame slots in the ring, a power of two.
+	__u32 period_us;	// The time from the start of a frame to the next, zero to run back to back.
+	__u32 notify;		// The number of frames between wake-ups, zero to wake up for every frame.
+	__s32 eventfd;		// The eventfd signaled on every wake-up besides poll(), or negative for none.
+};
+
+// The first page of a stream mapping. Frame n is in the slot at data_offset + (n % frames) *
+// frame_len. head and tail count frames from the start and wrap around at 2^32, each sits on its
+// own cache line so the producer and the consumer do not contend.
+struct spectr_io_stream_header {
+	__u32 frames;		// The number of frame slots in the ring.
+	__u32 frame_len;	// The length of a frame in bytes.
+	__u32 data_offset;	// The offset of the first slot from the start of the mapping.
+	__u32 overruns;		// The number of frames dropped because the ring was full.
+	__s32 error;		// Set to the negative SPI_ERR_* code if the stream stopped on a failure.
+	__u32 reserved0[11];
+	__u32 head;		// The frames written, stored by the driver with release semantics.
+	__u32 reserved1[15];
+	__u32 tail;		// The frames consumed, stored by userspace with release semantics.
+	__u32 reserved2[15];
+};
+
+#define SPECTR_IO_I2C_M_RD		( 1 << 0 )	// See I2C1_M_RD.
+#define SPECTR_IO_I2C_M_NOSTART		( 1 << 1 )	// See I2C1_M_NOSTART.
+
+// The bus timing of an I2C peripheral, see struct i2c_device_profile.
+struct spectr_io_i2c_device {
+	__u16 addr;		// The 7-bit peripheral address.
+	__u16 clkt;		// The clock stretch timeout in SCL cycles, zero for the bus default.
+	__u32 max_hz;		// The max clock rate, zero for the bus default.
+	__u16 fedl;		// The falling edge data delay in core clock cycles.
+	__u16 redl;		// The rising edge data delay in core clock cycles.
+};
+
+// A message of a combined I2C transaction.
+struct spectr_io_i2c_msg {
+	__u64 buf;		// The message data.
+	__u32 len;		// The length of the message data in bytes.
+	__u16 addr;		// The 7-bit peripheral address.
+	__u16 flags;		// The SPECTR_IO_I2C_M_* flags.
+};
+
+// A combined I2C transaction of a batch.
+struct spectr_io_i2c_xfer {
+	__u64 msgs;		// The array of messages.
+	__u32 count;		// The number of messages.
+	__s32 result;		// Set to zero; a negative I2C_ERR_* code.
+};
+
+// The max number of jobs in an I2C poll table.
+#define SPECTR_IO_I2C_POLL_JOBS_MAX		64
+// The max number of bytes an I2C poll job reads.
+#define SPECTR_IO_I2C_POLL_DATA_MAX		32
+// The shortest period of an I2C poll job.
+#define SPECTR_IO_I2C_POLL_PERIOD_MIN_US	100
+
+// A register the I2C poller reads at a fixed rate.
+struct spectr_io_i2c_poll_job {
+	__u16 addr;		// The 7-bit peripheral address.
+	__u8 reg;		// The register.
+	__u8 len;		// The number of bytes read.
+	__u32 period_us;	// The time from a read to the next.
+};
+
+// A table of I2C poll jobs, job n has slot n of the snapshot.
+struct spectr_io_i2c_poll_table {
+	__u64 jobs;		// The array of jobs.
+	__u32 count;		// The number of jobs.
+	__u32 reserved;		// Must be zero.
+};
+
+// The last result of an I2C poll job. seq is odd while the driver writes the slot, a copy of it is
+// consistent if seq was even and the same before and after the copy.
+struct spectr_io_i2c_poll_slot {
+	__u32 seq;		// Bumped before and after every write of the slot.
+	__s32 result;		// Zero; the negative I2C_ERR_* code of the last read.
+	__u64 timestamp_ns;	// The CLOCK_MONOTONIC time the last read finished at.
+	__u32 reads;		// The number of reads of the job since the start.
+	__u32 errors;		// The number of those that failed.
+	__u8 data[SPECTR_IO_I2C_POLL_DATA_MAX];	// The data of the last read that succeeded.
+	__u32 reserved[2];
+};
+
+// The first page of an I2C poll mapping. Slot n is at slot_offset + n * sizeof( struct
+// spectr_io_i2c_poll_slot ).
+struct spectr_io_i2c_poll_header {
+	__u32 jobs;		// The number of jobs of the table last started.
+	__u32 slot_offset;	// The offset of the first slot from the start of the mapping.
+	__u32 sessions;		// The number of bus sessions run, stored with release semantics.
+	__u32 late;		// The number of periods jobs were skipped over by a poller behind.
+	__u64 session_ns;	// The CLOCK_MONOTONIC time the last session started at.
+	__u32 reserved[10];
+};
+
+#define SPECTR_IO_GPIO_EDGE_RISING	( 1 << 0 )	// See GPIO_EDGE_RISING.
+#define SPECTR_IO_GPIO_EDGE_FALLING	( 1 << 1 )	// See GPIO_EDGE_FALLING.
+#define SPECTR_IO_GPIO_EDGE_ASYNC	( 1 << 2 )	// See GPIO_EDGE_ASYNC.
+
+// The edges a GPIO pin raises events on.
+struct spectr_io_gpio_watch {
+	__u32 pin;		// The pin.
+	__u32 edges;		// The SPECTR_IO_GPIO_EDGE_* edges, zero to stop watching the pin.
+};
+
+// An edge on a watched GPIO pin, read from /dev/spectr-gpio.
+struct spectr_io_gpio_event {
+	__u64 timestamp_ns;	// The CLOCK_MONOTONIC time the interrupt was taken at.
+	__u32 seqno;		// Counts every event, dropped ones included, so a gap shows a drop.
+	__u8 pin;		// The pin.
+	__u8 edge;		// SPECTR_IO_GPIO_EDGE_RISING or SPECTR_IO_GPIO_EDGE_FALLING. Pins
+				// watching both edges get the one matching the level in the handler.
+	__u16 reserved;
+};
+
+#define SPECTR_IO_GPIO_SAMPLE_RLE	( 1 << 0 )	// Only changes of the levels are recorded.
+
+// A sample word holds the levels of pins 0 to 53 in its low bits, bit n for pin n, and in its top
+// bits the number of sample periods after it the levels held for, so the word stands for one more
+// sample than its run. Without SPECTR_IO_GPIO_SAMPLE_RLE the run is only nonzero over the periods
+// the sampler missed, which take the levels of the sample that came after them.
+#define SPECTR_IO_GPIO_SAMPLE_LEVELS(word)	( ( word ) & ( ( 1ULL << 54 ) - 1 ) )
+#define SPECTR_IO_GPIO_SAMPLE_RUN(word)		( ( __u32 ) ( ( word ) >> 54 ) )
+#define SPECTR_IO_GPIO_SAMPLE_RUN_MAX		1023
+
+// The max number of words in a GPIO sample ring.
+#define SPECTR_IO_GPIO_SAMPLE_WORDS_MAX	( SPECTR_IO_STREAM_DATA_MAX / 8 )
+
+// The settings of a GPIO sampler, which snapshots the levels of both banks at a fixed rate into a
+// ring userspace maps with mmap().
+struct spectr_io_gpio_sample_config {
+	__u32 words;		// The number of words in the ring, a power of two.
+	__u32 period_ns;	// The time from a sample to the next.
+	__u32 flags;		// The SPECTR_IO_GPIO_SAMPLE_* flags.
+	__u32 notify;		// The number of words between wake-ups, zero to wake up for every word.
+	__s32 eventfd;		// The eventfd signaled on every wake-up besides poll(), or negative for none.
+	__u32 reserved;		// Must be zero.
+};
+
+// The first page of a GPIO sampler mapping. Word n is at data_offset + (n % words) * 8, head and
+// tail count words the same way as in struct spectr_io_stream_header.
+struct spectr_io_gpio_sample_header {
+	__u32 words;		// The number of words in the ring.
+	__u32 data_offset;	// The offset of the first word from the start of the mapping.
+	__u32 period_ns;	// The time from a sample to the next.
+	__u32 flags;		// The SPECTR_IO_GPIO_SAMPLE_* flags.
+	__u64 start_ns;		// The CLOCK_MONOTONIC time of the first sample of the last start.
+	__u32 start_head;	// The head at the last start, the word of the first sample.
+	__u32 overruns;		// The number of words dropped because the ring was full.
+	__u32 missed;		// The number of sample periods the sampler fell behind over.
+	__u32 reserved0[7];
+	__u32 head;		// The words written, stored by the driver with release semantics.
+	__u32 reserved1[15];
+	__u32 tail;		// The words consumed, stored by userspace with release semantics.
+	__u32 reserved2[15];
+};
+
+// The max number of steps in a GPIO pattern table.
+#define SPECTR_IO_GPIO_PATTERN_STEPS_MAX	4096
+// The shortest nonzero delay of a GPIO pattern step.
+#define SPECTR_IO_GPIO_PATTERN_DELAY_MIN	1000
+
+// A step of a GPIO pattern, which drives pins 0 to 31.
+struct spectr_io_gpio_step {
+	__u32 set_mask;		// The pins set high.
+	__u32 clr_mask;		// The pins set low.
+	__u32 delay_ns;		// The time to the next step, zero to run it right away.
+	__u32 reserved;		// Must be zero.
+};
+
+// A GPIO pattern table, played from the first step to the last and over again.
+struct spectr_io_gpio_pattern {
+	__u64 steps;		// The array of steps.
+	__u32 count;		// The number of steps.
+	__u32 loops;		// The number of passes before the engine stops, zero to play until stopped.
+};
+
+// The state of the GPIO pattern engine.
+struct spectr_io_gpio_pattern_status {
+	__u32 running;		// Whether a table plays.
+	__u32 step;		// The next step of the table playing.
+	__u32 passes;		// The passes the table playing finished.
+	__u32 pending;		// Whether a loaded table waits for the end of the pass to be swapped in.
+	__u32 swaps;		// The number of tables swapped in at the end of a pass.
+	__u32 late;		// The number of steps that ran a whole step late.
+};
+
+#define SPECTR_IO_TRIGGER_SPI	0	// The trigger runs a transfer on SPI0.
+#define SPECTR_IO_TRIGGER_I2C	1	// The trigger reads a register over I2C.
+
+// The max number of bytes a trigger moves.
+#define SPECTR_IO_TRIGGER_DATA_MAX	40
+
+// A transaction run on every edge of a GPIO pin, without a round trip to userspace.
+struct spectr_io_trigger {
+	__u32 pin;		// The pin.
+	__u32 edges;		// The SPECTR_IO_GPIO_EDGE_* edges.
+	__u32 kind;		// The SPECTR_IO_TRIGGER_* kind.
+	__u32 len;		// The number of bytes transferred over SPI or read over I2C.
+	struct spectr_io_spi_device spi;	// The bus settings of an SPI trigger, the handle is unused.
+	__u8 i2c_bus;		// The I2C bus of an I2C trigger.
+	__u8 i2c_addr;		// The 7-bit peripheral address of an I2C trigger.
+	__u8 i2c_reg;		// The register read by an I2C trigger.
+	__u8 reserved0;		// Must be zero.
+	__u8 tx[SPECTR_IO_TRIGGER_DATA_MAX];	// The data written by an SPI trigger.
+	__s32 handle;		// Set to the trigger handle.
+	__u32 reserved1;	// Must be zero.
+};
+
+// The result of a trigger, read from /dev/spectr-gpio-trigger.
+struct spectr_io_trigger_sample {
+	__u64 timestamp_ns;	// The CLOCK_MONOTONIC time the edge interrupt was taken at.
+	__u32 latency_ns;	// The time from the interrupt to the end of the transaction.
+	__u32 seqno;		// Counts every edge of every trigger, dropped ones included.
+	__s32 result;		// Zero; a negative SPI_ERR_* or I2C_ERR_* code.
+	__u8 trigger;		// The trigger handle.
+	__u8 len;		// The number of bytes in data.
+	__u16 reserved;
+	__u8 data[SPECTR_IO_TRIGGER_DATA_MAX];	// The data read.
+};
+
+// Each batch returns the number of transfers that succeeded, the results of those and of the one
+// that failed are written back.
+#define SPECTR_IO_SPI_IOC_ADD_DEVICE	_IOWR( SPECTR_IO_IOC_MAGIC, 0x01, struct spectr_io_spi_device )
+#define SPECTR_IO_SPI_IOC_REMOVE_DEVICE	_IO( SPECTR_IO_IOC_MAGIC, 0x02 )
+#define SPECTR_IO_SPI_IOC_BATCH		_IOW( SPECTR_IO_IOC_MAGIC, 0x03, struct spectr_io_batch )
+
+// The ring is created by the first start and keeps its geometry until the file is closed, it is
+// mapped with mmap() at offset zero and read through poll() or the eventfd.
+#define SPECTR_IO_SPI_IOC_STREAM_START	_IOW( SPECTR_IO_IOC_MAGIC, 0x04, struct spectr_io_stream_config )
+#define SPECTR_IO_SPI_IOC_STREAM_STOP	_IO( SPECTR_IO_IOC_MAGIC, 0x05 )
+
+#define SPECTR_IO_I2C_IOC_ADD_DEVICE	_IOW( SPECTR_IO_IOC_MAGIC, 0x11, struct spectr_io_i2c_device )
+#define SPECTR_IO_I2C_IOC_REMOVE_DEVICE	_IO( SPECTR_IO_IOC_MAGIC, 0x12 )
+#define SPECTR_IO_I2C_IOC_BATCH		_IOW( SPECTR_IO_IOC_MAGIC, 0x13, struct spectr_io_batch )
+
+// The snapshot is created by the first start and mapped with mmap() at offset zero, it stays valid
+// until the file is closed. Jobs due together run in a single bus session.
+#define SPECTR_IO_I2C_IOC_POLL_START	_IOW( SPECTR_IO_IOC_MAGIC, 0x14, struct spectr_io_i2c_poll_table )
+#define SPECTR_IO_I2C_IOC_POLL_STOP	_IO( SPECTR_IO_IOC_MAGIC, 0x15 )
+
+// Watches are dropped when the file is closed, events are read in whole structs with read().
+#define SPECTR_IO_GPIO_IOC_WATCH	_IOW( SPECTR_IO_IOC_MAGIC, 0x21, struct spectr_io_gpio_watch )
+
+// The ring of /dev/spectr-gpio-sample follows the same rules as the SPI stream ring.
+#define SPECTR_IO_GPIO_IOC_SAMPLE_START	_IOW( SPECTR_IO_IOC_MAGIC, 0x22, struct spectr_io_gpio_sample_config )
+#define SPECTR_IO_GPIO_IOC_SAMPLE_STOP	_IO( SPECTR_IO_IOC_MAGIC, 0x23 )
+
+// A table loaded into /dev/spectr-gpio-pattern while another one plays is swapped in at the end of
+// the pass, poll() reports EPOLLOUT once the next table can be loaded.
+#define SPECTR_IO_GPIO_IOC_PATTERN_LOAD		_IOW( SPECTR_IO_IOC_MAGIC, 0x24, struct spectr_io_gpio_pattern )
+#define SPECTR_IO_GPIO_IOC_PATTERN_START	_IO( SPECTR_IO_IOC_MAGIC, 0x25 )
+#define SPECTR_IO_GPIO_IOC_PATTERN_STOP		_IO( SPECTR_IO_IOC_MAGIC, 0x26 )
+#define SPECTR_IO_GPIO_IOC_PATTERN_STATUS	_IOR( SPECTR_IO_IOC_MAGIC, 0x27, struct spectr_io_gpio_pattern_status )
+
+// Triggers are removed when the file is closed, samples are read in whole structs with read().
+#define SPECTR_IO_TRIGGER_IOC_ADD	_IOWR( SPECTR_IO_IOC_MAGIC, 0x31, struct spectr_io_trigger )
+#define SPECTR_IO_TRIGGER_IOC_REMOVE	_IO( SPECTR_IO_IOC_MAGIC, 0x32 )
+
+#endif // _SPECTR_IO_UAPI_SPECTR_IO_H